@@ -0,0 +1,1646 @@
+/**
+ * @file archivio.c
+ * @brief File per la gestione dell'archivio su disco delle history, che sopravvive al riavvio del server
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * L'archivio è diviso in ARCHIVIO_PARTI parti, a cui gli utenti sono assegnati tramite l'impronta del nome, e ogni
+ * parte è una sequenza di file di segmento (<parte>-<numero>.seg) a cui i record vengono solo aggiunti. Chi memorizza
+ * un messaggio lo copia nel buffer della parte; un thread scrittore scrive i buffer di tutte le parti ogni
+ * ARCHIVIO_INTERVALLO millisecondi, o prima se un buffer supera ARCHIVIO_LOTTO byte, con una scrittura per parte
+ * seguita da fdatasync se la politica lo richiede. Il body di un messaggio inviato a più utenti viene scritto una
+ * sola volta, gli altri destinatari salvano un riferimento alla sua posizione.
+ * Lo scrittore tiene per ogni utente le posizioni degli ultimi messaggi scritti e le salva in un file indice della
+ * parte (<parte>-<numero>.ind) quando chiude un segmento e quando il server termina. All'avvio ogni parte carica il suo
+ * ultimo indice e rilegge solo i record successivi, in parallelo, un thread per parte; i segmenti vengono mappati in
+ * memoria e i body vengono letti dalla mappatura, senza copiarli, quando l'utente si registra. Dopo ogni indice i
+ * segmenti che non contengono più messaggi recuperabili vengono eliminati e quelli quasi vuoti vengono compattati,
+ * copiando i body ancora usati in fondo alla parte: da quel momento le history che puntano alle copie si trovano solo
+ * negli indici, che per questo vengono scritti in un file temporaneo, resi persistenti e poi rinominati.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+//realpath fa parte delle estensioni X/Open
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <config.h>
+#include <chiave.h>
+#include <archivio.h>
+
+//macro per allocazioni dinamiche
+#define SYSCALL_D(r,c,e) \
+    if((r=c)==NULL) { perror(e); exit(-1); }
+
+#if ARCHIVIO_PARTI>254
+#error "la parte viene salvata nell'ottavo byte della posizione di un record, ARCHIVIO_PARTI deve essere minore di 255"
+#endif
+
+//tipi dei record: un messaggio con il body, un riferimento al body salvato da un altro destinatario, l'eliminazione
+//di un utente, la fine di un segmento, che resta nel buffer e indica allo scrittore di passare al segmento successivo,
+//e la copia di un body spostato da un segmento compattato, che non aggiunge un messaggio alla history del destinatario
+#define REC_MESSAGGIO     1
+#define REC_RIFERIMENTO   2
+#define REC_ELIMINAZIONE  3
+#define REC_FINE          4
+#define REC_COPIA         5
+
+//la posizione di un record è formata dalla parte, dal numero del segmento e dallo scostamento nel segmento
+#define POSIZIONE(p,n,o)  (((uint64_t)(p)<<56)|((uint64_t)(n)<<32)|(uint64_t)(o))
+#define PARTE(pos)        ((int)((pos)>>56))
+#define NUMERO(pos)       ((uint32_t)(((pos)>>32)&0xFFFFFF))
+#define SCOSTAMENTO(pos)  ((size_t)((pos)&0xFFFFFFFF))
+
+/**
+ * @struct Record
+ * @brief è l'intestazione di un record dell'archivio, seguita dal body e da zeri fino ad un multiplo di 8 byte
+ * @var somma è il checksum dei byte del record che la seguono
+ * @var len indica la lunghezza del record
+ * @var tipo indica il tipo del record
+ * @var op indica il tipo del messaggio
+ * @var seq indica il numero di sequenza del messaggio nella history del destinatario
+ * @var posizione indica la posizione del record che contiene il body, per un riferimento
+ * @var dim indica la lunghezza del body
+ * @var destinatario indica il nome dell'utente a cui appartiene il record
+ * @var mittente indica il nome di chi ha inviato il messaggio
+ */
+typedef struct Record1{
+  uint32_t somma;
+  uint32_t len;
+  uint32_t tipo;
+  uint32_t op;
+  uint64_t seq;
+  uint64_t posizione;
+  uint32_t dim;
+  Chiave destinatario;
+  char mittente[MAX_NAME_LENGTH+1];
+}Record;
+
+/**
+ * @struct Segmento
+ * @brief è un file di segmento trovato all'avvio
+ * @var numero indica il numero del segmento nella sua parte
+ * @var mappa è la mappatura del file, NULL se il file è vuoto o è stato eliminato
+ * @var mappato indica la lunghezza della mappatura
+ * @var fine indica la lunghezza della parte valida, dopo l'ultimo record integro
+ * @var record indica il numero di record del segmento
+ * @var vivo vale 1 se il segmento contiene un messaggio recuperabile
+ * @var eliminazioni vale 1 se il segmento contiene l'eliminazione di un utente
+ * @var cancellato vale 1 se il file del segmento è stato eliminato
+ */
+typedef struct Segmento1{
+  uint32_t numero;
+  char *mappa;
+  size_t mappato;
+  size_t fine;
+  uint32_t record;
+  int vivo;
+  int eliminazioni;
+  int cancellato;
+}Segmento;
+
+/**
+ * @struct Voce
+ * @brief è la history salvata di un utente, ricostruita all'avvio
+ * @var nome indica il nome dell'utente, vuoto se il posto è libero
+ * @var pos è l'array circolare delle posizioni degli ultimi record dell'utente
+ * @var start indica la posizione del record più vecchio
+ * @var cont indica il numero dei record
+ * @var seq indica il numero di sequenza del prossimo messaggio, 0 se l'utente non ha una history da recuperare
+ */
+typedef struct Voce1{
+  Chiave nome;
+  uint64_t *pos;
+  int start;
+  int cont;
+  size_t seq;
+}Voce;
+
+/**
+ * @struct Tabella
+ * @brief è una tabella delle history salvate degli utenti di una parte, con indirizzamento aperto
+ * @var voci è l'array dei posti
+ * @var cap indica il numero di posti, una potenza di due
+ * @var n indica il numero di posti occupati
+ */
+typedef struct Tabella1{
+  Voce *voci;
+  size_t cap;
+  size_t n;
+}Tabella;
+
+/**
+ * @struct Traccia
+ * @brief è un segmento noto allo scrittore
+ * @var numero indica il numero del segmento
+ * @var record indica il numero di record scritti nel segmento
+ * @var vivi indica il numero di posizioni delle history che puntano al segmento, calcolato da Riordina
+ * @var scelto vale 1 se il segmento sta venendo compattato
+ */
+typedef struct Traccia1{
+  uint32_t numero;
+  uint32_t record;
+  uint32_t vivi;
+  uint32_t scelto;
+}Traccia;
+
+/**
+ * @struct Intestazione
+ * @brief è l'intestazione di un file indice, seguita dai segmenti della parte e dalle history degli utenti
+ * @var somma è il checksum dei byte del file che la seguono
+ * @var numero indica il segmento fino a cui arriva l'indice
+ * @var scostamento indica la lunghezza del segmento già compresa nell'indice, i record successivi vengono riletti
+ * @var ntracce indica il numero dei segmenti
+ * @var nvoci indica il numero delle history
+ */
+typedef struct Intestazione1{
+  uint32_t somma;
+  uint32_t numero;
+  uint64_t scostamento;
+  uint64_t ntracce;
+  uint64_t nvoci;
+}Intestazione;
+
+/**
+ * @struct Riga
+ * @brief è la history di un utente in un file indice, seguita dalle posizioni dei messaggi dal più vecchio
+ * @var nome indica il nome dell'utente
+ * @var cont indica il numero delle posizioni
+ * @var seq indica il numero di sequenza del prossimo messaggio dell'utente
+ */
+typedef struct Riga1{
+  Chiave nome;
+  uint32_t cont;
+  uint64_t seq;
+}Riga;
+
+/**
+ * @struct Settore
+ * @brief è una parte dell'archivio
+ * @var mutex è la variabile di mutua-esclusione sul buffer e sulle voci
+ * @var buf contiene i record in attesa di essere scritti
+ * @var nbuf indica il numero di byte nel buffer
+ * @var capbuf indica la dimensione del buffer
+ * @var riserva è il secondo buffer, che lo scrittore scambia con il primo per scriverlo senza mutua-esclusione
+ * @var capriserva indica la dimensione del secondo buffer
+ * @var numero indica il segmento in cui vanno i nuovi record
+ * @var dim indica il numero di byte del segmento già assegnati
+ * @var accodati indica il numero di byte aggiunti al buffer dall'avvio
+ * @var scritti indica il numero di byte già scritti dallo scrittore, in mutua-esclusione su mutex_archivio
+ * @var perso indica fin dove arriva l'ultima scrittura fallita, in mutua-esclusione su mutex_archivio
+ * @var fd indica il descrittore del segmento aperto dallo scrittore, -1 se non è aperto
+ * @var aperto indica il numero del segmento in cui scrive lo scrittore
+ * @var sano indica la lunghezza del segmento aperto fino all'ultimo record scritto senza errori
+ * @var guasto vale 1 se una scrittura nel segmento aperto è fallita, i record successivi dello stesso segmento vengono scartati
+ * @var seg è l'array dei segmenti trovati all'avvio, in ordine di numero
+ * @var nseg indica il numero dei segmenti
+ * @var capseg indica la dimensione dell'array dei segmenti
+ * @var trovati è l'array dei numeri dei file indice trovati all'avvio
+ * @var ntrovati indica il numero dei file indice trovati
+ * @var captrovati indica la dimensione dell'array dei file indice trovati
+ * @var voci è la tabella delle history ricostruite all'avvio, da cui gli utenti recuperano i messaggi
+ * @var recenti è la tabella delle history aggiornata dallo scrittore, che viene salvata negli indici
+ * @var tracce è l'array dei segmenti noti allo scrittore, in ordine di numero, l'ultimo è quello aperto
+ * @var ntracce indica il numero dei segmenti noti allo scrittore
+ * @var captracce indica la dimensione dell'array dei segmenti noti allo scrittore
+ * @var indici contiene i numeri degli ultimi due indici salvati, dal più vecchio
+ * @var nindici indica il numero degli indici salvati
+ */
+typedef struct Settore1{
+  pthread_mutex_t mutex;
+  char *buf;
+  size_t nbuf;
+  size_t capbuf;
+  char *riserva;
+  size_t capriserva;
+  uint32_t numero;
+  size_t dim;
+  uint64_t accodati;
+  uint64_t scritti;
+  uint64_t perso;
+  int fd;
+  uint32_t aperto;
+  size_t sano;
+  int guasto;
+  Segmento *seg;
+  int nseg;
+  int capseg;
+  uint32_t *trovati;
+  int ntrovati;
+  int captrovati;
+  Tabella voci;
+  Tabella recenti;
+  Traccia *tracce;
+  int ntracce;
+  int captracce;
+  uint32_t indici[2];
+  int nindici;
+}Settore;
+
+/**
+ * @var settore sono le parti dell'archivio
+ * @var cartella indica la directory dell'archivio
+ * @var attivo vale 1 se l'archivio è aperto
+ * @var politica_a indica quando i dati vengono resi persistenti
+ * @var maxhist_a indica il numero massimo di messaggi recuperati per ogni utente
+ */
+static Settore settore[ARCHIVIO_PARTI];
+static char *cartella=NULL;
+static int attivo=0, politica_a=1, maxhist_a=1;
+
+/**
+ * @var fermo vale 1 quando lo scrittore deve terminare
+ * @var anticipa vale 1 se lo scrittore deve scrivere senza aspettare la fine dell'intervallo
+ * @var mutex_archivio è la variabile di mutua-esclusione sullo stato dello scrittore
+ * @var sveglia_a è la variabile di condizione su cui aspetta lo scrittore
+ * @var scritto è la variabile di condizione su cui aspetta chi vuole che i propri messaggi siano persistenti
+ * @var scrittore è il thread che scrive i buffer
+ * @var chiusi vale 1 se lo scrittore ha chiuso un segmento dall'ultima volta che ha eliminato i segmenti inutili
+ */
+static int fermo=0, anticipa=0, chiusi=0;
+static pthread_mutex_t mutex_archivio=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sveglia_a=PTHREAD_COND_INITIALIZER, scritto=PTHREAD_COND_INITIALIZER;
+static pthread_t scrittore;
+
+/**
+ * @function Fnv
+ * @brief Calcola il checksum di una sequenza di byte
+ * @param p indica i byte
+ * @param n indica il numero di byte
+ * @return il checksum
+ */
+static uint32_t Fnv(const unsigned char *p, size_t n){
+  uint32_t h=2166136261u;
+  for(size_t i=0;i<n;i++)
+    h=(h^p[i])*16777619u;
+  return h;
+}
+
+/**
+ * @function Somma
+ * @brief Calcola il checksum di un record, con cui all'avvio si riconosce un record scritto solo in parte
+ * @param r indica il record
+ * @return il checksum dei byte del record successivi al campo somma
+ */
+static uint32_t Somma(Record *r){
+  return Fnv((const unsigned char*)r+sizeof(uint32_t),r->len-sizeof(uint32_t));
+}
+
+/**
+ * @function Percorso
+ * @brief Costruisce il percorso di un file di segmento o di un file indice
+ * @param p indica la parte
+ * @param n indica il numero del segmento
+ * @param tipo indica l'estensione del file
+ * @return il percorso, da liberare con free
+ */
+static char * Percorso(int p, uint32_t n, const char *tipo){
+  size_t dim=strlen(cartella)+strlen(tipo)+32;
+  char *nome;
+  SYSCALL_D(nome,malloc(dim),"malloc");
+  snprintf(nome,dim,"%s/%d-%u.%s",cartella,p,n,tipo);
+  return nome;
+}
+
+/**
+ * @function SincronizzaCartella
+ * @brief Rende persistenti le creazioni, i cambi di nome e le eliminazioni dei file dell'archivio
+ */
+static void SincronizzaCartella(){
+  int fd=open(cartella,O_RDONLY);
+  if(fd<0) return;
+  if(fsync(fd)<0 && errno!=EINVAL)
+    perror("fsync");
+  close(fd);
+}
+
+/**
+ * @function ParteDi
+ * @brief Restituisce la parte dell'archivio a cui è assegnato un utente
+ * @param k indica il nome dell'utente
+ * @return l'indice della parte
+ */
+static int ParteDi(Chiave *k){
+  return (int)(ImprontaChiave(k)%ARCHIVIO_PARTI);
+}
+
+/**
+ * @function AllargaVoci
+ * @brief Raddoppia una tabella delle history salvate
+ * @param t indica la tabella
+ */
+static void AllargaVoci(Tabella *t){
+  size_t cap=(t->cap==0) ? 1024 : 2*t->cap;
+  Voce *voci;
+  SYSCALL_D(voci,calloc(cap,sizeof(Voce)),"calloc");
+  for(size_t i=0;i<t->cap;i++){
+    if(t->voci[i].nome.nome[0]=='\0') continue;
+    size_t j=(ImprontaChiave(&(t->voci[i].nome))/ARCHIVIO_PARTI)&(cap-1);
+    while(voci[j].nome.nome[0]!='\0')
+      j=(j+1)&(cap-1);
+    voci[j]=t->voci[i];
+  }
+  free(t->voci);
+  t->voci=voci;
+  t->cap=cap;
+}
+
+/**
+ * @function CercaVoce
+ * @brief Cerca la history salvata di un utente
+ * @param t indica la tabella della parte a cui è assegnato l'utente
+ * @param k indica il nome dell'utente
+ * @param crea se vale 1 la voce viene creata se non esiste
+ * @return la voce, NULL se non esiste e crea vale 0
+ */
+static Voce * CercaVoce(Tabella *t, Chiave *k, int crea){
+  if(crea && (t->n+1)*4>t->cap*3)
+    AllargaVoci(t);
+  if(t->cap==0) return NULL;
+  size_t i=(ImprontaChiave(k)/ARCHIVIO_PARTI)&(t->cap-1);
+  while(t->voci[i].nome.nome[0]!='\0'){
+    if(UgualeChiave(&(t->voci[i].nome),k))
+      return &(t->voci[i]);
+    i=(i+1)&(t->cap-1);
+  }
+  if(!crea) return NULL;
+  Voce *v=&(t->voci[i]);
+  v->nome=*k;
+  SYSCALL_D(v->pos,malloc(sizeof(uint64_t)*maxhist_a),"malloc");
+  v->start=0;
+  v->cont=0;
+  v->seq=0;
+  t->n++;
+  return v;
+}
+
+/**
+ * @function LiberaVoci
+ * @brief Libera una tabella delle history salvate
+ * @param t indica la tabella
+ */
+static void LiberaVoci(Tabella *t){
+  for(size_t i=0;i<t->cap;i++)
+    if(t->voci[i].nome.nome[0]!='\0')
+      free(t->voci[i].pos);
+  free(t->voci);
+  memset(t,0,sizeof(Tabella));
+}
+
+/**
+ * @function Indicizza
+ * @brief Aggiorna la history salvata del destinatario di un record
+ * @param t indica la tabella della parte che contiene il record
+ * @param r indica il record
+ * @param pos indica la posizione del record
+ *
+ * Per un riferimento viene salvata la posizione del body, così la history punta solo ai record da leggere.
+ */
+static void Indicizza(Tabella *t, Record *r, uint64_t pos){
+  if(r->tipo==REC_ELIMINAZIONE){
+    //i messaggi precedenti all'eliminazione non vanno recuperati se l'utente si registra di nuovo
+    Voce *v=CercaVoce(t,&(r->destinatario),0);
+    if(v!=NULL){
+      v->start=0;
+      v->cont=0;
+      v->seq=0;
+    }
+    return;
+  }
+  if(r->tipo!=REC_MESSAGGIO && r->tipo!=REC_RIFERIMENTO) return;
+  if(r->tipo==REC_RIFERIMENTO)
+    pos=r->posizione;
+  Voce *v=CercaVoce(t,&(r->destinatario),1);
+  //tengo solo gli ultimi maxhist_a messaggi, come la history in memoria
+  if(v->cont==maxhist_a){
+    v->start=(v->start+1)%maxhist_a;
+    v->cont--;
+  }
+  v->pos[(v->start+v->cont)%maxhist_a]=pos;
+  v->cont++;
+  v->seq=r->seq+1;
+}
+
+/**
+ * @function TrovaSegmento
+ * @brief Cerca un segmento trovato all'avvio
+ * @param s indica la parte
+ * @param numero indica il numero del segmento
+ * @return il segmento, NULL se non esiste
+ */
+static Segmento * TrovaSegmento(Settore *s, uint32_t numero){
+  int a=0, b=s->nseg-1;
+  while(a<=b){
+    int m=(a+b)/2;
+    if(s->seg[m].numero==numero) return &(s->seg[m]);
+    if(s->seg[m].numero<numero) a=m+1;
+    else b=m-1;
+  }
+  return NULL;
+}
+
+/**
+ * @function LeggiIndice
+ * @brief Carica le history dall'indice integro più recente di una parte
+ * @param p indica la parte
+ * @param numero conterrà il segmento fino a cui arriva l'indice
+ * @param scostamento conterrà la lunghezza del segmento già compresa nell'indice
+ * @return 1 se un indice è stato caricato, 0 se la parte va riletta dall'inizio
+ */
+static int LeggiIndice(int p, uint32_t *numero, size_t *scostamento){
+  Settore *s=&settore[p];
+  //provo gli indici dal più recente, uno che non è integro viene saltato
+  for(int i=s->ntrovati-1;i>=0;i--){
+    char *nome=Percorso(p,s->trovati[i],"ind");
+    int fd=open(nome,O_RDONLY);
+    free(nome);
+    if(fd<0) continue;
+    struct stat st;
+    char *buf=NULL;
+    size_t dim=0;
+    if(fstat(fd,&st)==0 && (size_t)st.st_size>=sizeof(Intestazione)){
+      dim=(size_t)st.st_size;
+      SYSCALL_D(buf,malloc(dim),"malloc");
+      if(read(fd,buf,dim)!=(ssize_t)dim){
+        free(buf);
+        buf=NULL;
+      }
+    }
+    close(fd);
+    if(buf==NULL) continue;
+    Intestazione *h=(Intestazione*)buf;
+    size_t off=sizeof(Intestazione);
+    int integro=(h->somma==Fnv((unsigned char*)buf+sizeof(uint32_t),dim-sizeof(uint32_t)) &&
+                 h->ntracce<=(dim-off)/sizeof(Traccia));
+    //il numero di record dei segmenti serve allo scrittore per decidere quali compattare
+    for(uint64_t j=0;integro && j<h->ntracce;j++){
+      Traccia t;
+      memcpy(&t,buf+off,sizeof(Traccia));
+      off+=sizeof(Traccia);
+      Segmento *g=TrovaSegmento(s,t.numero);
+      if(g!=NULL)
+        g->record=t.record;
+    }
+    for(uint64_t j=0;integro && j<h->nvoci;j++){
+      Riga r;
+      if(dim-off<sizeof(Riga)){
+        integro=0;
+        break;
+      }
+      memcpy(&r,buf+off,sizeof(Riga));
+      off+=sizeof(Riga);
+      if(r.cont>(dim-off)/sizeof(uint64_t)){
+        integro=0;
+        break;
+      }
+      Voce *v=CercaVoce(&(s->voci),&(r.nome),1);
+      //se MaxHistMsgs è diminuito tengo solo le posizioni più recenti
+      uint32_t salta=(r.cont>(uint32_t)maxhist_a) ? r.cont-(uint32_t)maxhist_a : 0;
+      v->start=0;
+      v->cont=(int)(r.cont-salta);
+      memcpy(v->pos,buf+off+salta*sizeof(uint64_t),sizeof(uint64_t)*v->cont);
+      v->seq=r.seq;
+      off+=sizeof(uint64_t)*r.cont;
+    }
+    if(integro){
+      *numero=h->numero;
+      *scostamento=h->scostamento;
+      s->indici[0]=s->trovati[i];
+      s->nindici=1;
+      free(buf);
+      return 1;
+    }
+    //le history caricate da un indice non integro vengono scartate
+    free(buf);
+    LiberaVoci(&(s->voci));
+    for(int j=0;j<s->nseg;j++)
+      s->seg[j].record=0;
+  }
+  return 0;
+}
+
+/**
+ * @function Carica
+ * @brief Mappa i segmenti di una parte e ricostruisce le history salvate, eseguita da un thread per ogni parte
+ * @param arg indica l'indice della parte
+ *
+ * I segmenti che precedono il punto a cui arriva l'ultimo indice vengono solo mappati, senza leggerli.
+ */
+static void * Carica(void *arg){
+  int p=(int)(long)arg;
+  Settore *s=&settore[p];
+  uint32_t numero=0;
+  size_t scostamento=0;
+  int indice=LeggiIndice(p,&numero,&scostamento);
+  for(int j=0;j<s->nseg;j++){
+    Segmento *g=&(s->seg[j]);
+    int ultimo=(j==s->nseg-1);
+    char *nome=Percorso(p,g->numero,"seg");
+    int fd=open(nome,O_RDWR);
+    free(nome);
+    if(fd<0){
+      perror("open");
+      continue;
+    }
+    struct stat st;
+    memset(&st,0,sizeof(st));
+    if(fstat(fd,&st)==0 && st.st_size>0){
+      g->mappato=(size_t)st.st_size;
+      if((g->mappa=mmap(NULL,g->mappato,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED){
+        perror("mmap");
+        g->mappa=NULL;
+        g->mappato=0;
+      }
+    }
+    size_t off=0;
+    if(indice && g->numero<numero){
+      g->fine=g->mappato;
+      close(fd);
+      continue;
+    }
+    if(indice && g->numero==numero)
+      off=(scostamento<g->mappato) ? scostamento : g->mappato;
+    //scorro le intestazioni dei record, senza leggere i body
+    while(g->mappa!=NULL && off+sizeof(Record)<=g->mappato){
+      Record *r=(Record*)(g->mappa+off);
+      if(r->len<sizeof(Record) || r->len%8!=0 || r->len>g->mappato-off) break;
+      //solo l'ultimo segmento può contenere un record scritto a metà, gli altri sono stati resi persistenti prima di passare al successivo
+      if(ultimo && Somma(r)!=r->somma) break;
+      if(r->tipo==REC_ELIMINAZIONE)
+        g->eliminazioni=1;
+      Indicizza(&(s->voci),r,POSIZIONE(p,g->numero,off));
+      g->record++;
+      off+=r->len;
+    }
+    g->fine=off;
+    //tolgo dall'ultimo segmento il record scritto a metà, i nuovi record verranno aggiunti dopo l'ultimo integro
+    if(ultimo && off<(size_t)st.st_size && ftruncate(fd,(off_t)off)<0)
+      perror("ftruncate");
+    close(fd);
+  }
+  //i nuovi record non possono andare in un segmento che precede il punto a cui arriva l'indice
+  if(indice && (s->nseg==0 || s->seg[s->nseg-1].numero<numero)){
+    s->numero=numero;
+    s->dim=0;
+  }
+  else if(s->nseg>0){
+    s->numero=s->seg[s->nseg-1].numero;
+    s->dim=s->seg[s->nseg-1].fine;
+  }
+  return NULL;
+}
+
+/**
+ * @function Leggi
+ * @brief Restituisce un record letto all'avvio tramite la sua posizione
+ * @param pos indica la posizione del record
+ * @return il record nella mappatura, NULL se non è integro o il suo segmento è stato eliminato
+ */
+static Record * Leggi(uint64_t pos){
+  if(PARTE(pos)>=ARCHIVIO_PARTI) return NULL;
+  Segmento *g=TrovaSegmento(&settore[PARTE(pos)],NUMERO(pos));
+  size_t off=SCOSTAMENTO(pos);
+  if(g==NULL || g->mappa==NULL || off+sizeof(Record)>g->fine) return NULL;
+  Record *r=(Record*)(g->mappa+off);
+  if(r->len<sizeof(Record) || r->len>g->fine-off) return NULL;
+  return r;
+}
+
+/**
+ * @function Body
+ * @brief Restituisce il record che contiene il body di un messaggio, seguendo l'eventuale riferimento
+ * @param pos indica la posizione del record del messaggio
+ * @return il record con il body, NULL se non è leggibile
+ */
+static Record * Body(uint64_t pos){
+  Record *r=Leggi(pos);
+  if(r!=NULL && r->tipo==REC_RIFERIMENTO)
+    r=Leggi(r->posizione);
+  if(r==NULL || (r->tipo!=REC_MESSAGGIO && r->tipo!=REC_COPIA) || r->dim>r->len-sizeof(Record)) return NULL;
+  return r;
+}
+
+/**
+ * @function Segna
+ * @brief Segna come vivo il segmento che contiene un record
+ * @param pos indica la posizione del record
+ */
+static void Segna(uint64_t pos){
+  Segmento *g=TrovaSegmento(&settore[PARTE(pos)],NUMERO(pos));
+  if(g!=NULL)
+    g->vivo=1;
+}
+
+/**
+ * @function Pulisci
+ * @brief Elimina i segmenti che non contengono messaggi recuperabili, dopo che tutte le parti sono state caricate
+ *
+ * Un segmento con l'eliminazione di un utente viene tenuto se resta un segmento più vecchio della stessa parte,
+ * che potrebbe contenere messaggi dell'utente da non recuperare. L'ultimo segmento di ogni parte non viene mai eliminato.
+ */
+static void Pulisci(){
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    Settore *s=&settore[p];
+    for(size_t i=0;i<s->voci.cap;i++){
+      Voce *v=&(s->voci.voci[i]);
+      if(v->nome.nome[0]=='\0') continue;
+      //le history contengono già le posizioni dei body, non dei riferimenti
+      for(int j=0;j<v->cont;j++)
+        Segna(v->pos[(v->start+j)%maxhist_a]);
+    }
+  }
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    Settore *s=&settore[p];
+    int vecchi=0;
+    for(int j=0;j<s->nseg-1;j++){
+      Segmento *g=&(s->seg[j]);
+      if(g->vivo || (g->eliminazioni && vecchi)){
+        vecchi=1;
+        continue;
+      }
+      if(g->mappa!=NULL)
+        munmap(g->mappa,g->mappato);
+      g->mappa=NULL;
+      g->mappato=0;
+      g->fine=0;
+      g->cancellato=1;
+      char *nome=Percorso(p,g->numero,"seg");
+      if(unlink(nome)<0)
+        perror(nome);
+      free(nome);
+    }
+  }
+}
+
+/**
+ * @function Confronta
+ * @brief Confronta due segmenti in base al numero, per ordinarli con qsort
+ * @param a indica il primo segmento
+ * @param b indica il secondo segmento
+ * @return un valore negativo, nullo o positivo se il primo segmento precede, è uguale o segue il secondo
+ */
+static int Confronta(const void *a, const void *b){
+  uint32_t x=((const Segmento*)a)->numero, y=((const Segmento*)b)->numero;
+  return (x>y)-(x<y);
+}
+
+/**
+ * @function ConfrontaNumeri
+ * @brief Confronta i numeri di due file indice, per ordinarli con qsort
+ * @param a indica il primo numero
+ * @param b indica il secondo numero
+ * @return un valore negativo, nullo o positivo se il primo numero è minore, uguale o maggiore del secondo
+ */
+static int ConfrontaNumeri(const void *a, const void *b){
+  uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b;
+  return (x>y)-(x<y);
+}
+
+/**
+ * @function ConfrontaPosizioni
+ * @brief Confronta due posizioni di record, per ordinarle con qsort
+ * @param a indica la prima posizione
+ * @param b indica la seconda posizione
+ * @return un valore negativo, nullo o positivo se la prima posizione è minore, uguale o maggiore della seconda
+ */
+static int ConfrontaPosizioni(const void *a, const void *b){
+  uint64_t x=*(const uint64_t*)a, y=*(const uint64_t*)b;
+  return (x>y)-(x<y);
+}
+
+/**
+ * @function TrovaTraccia
+ * @brief Cerca il segmento noto allo scrittore che contiene un record
+ * @param pos indica la posizione del record
+ * @return il segmento, NULL se è stato eliminato
+ */
+static Traccia * TrovaTraccia(uint64_t pos){
+  if(PARTE(pos)>=ARCHIVIO_PARTI) return NULL;
+  Settore *s=&settore[PARTE(pos)];
+  uint32_t numero=NUMERO(pos);
+  int a=0, b=s->ntracce-1;
+  while(a<=b){
+    int m=(a+b)/2;
+    if(s->tracce[m].numero==numero) return &(s->tracce[m]);
+    if(s->tracce[m].numero<numero) a=m+1;
+    else b=m-1;
+  }
+  return NULL;
+}
+
+/**
+ * @function AggiungiTraccia
+ * @brief Aggiunge un segmento a quelli noti allo scrittore, dopo tutti gli altri
+ * @param s indica la parte
+ * @param numero indica il numero del segmento
+ * @param record indica il numero di record del segmento
+ */
+static void AggiungiTraccia(Settore *s, uint32_t numero, uint32_t record){
+  if(s->ntracce==s->captracce){
+    s->captracce=(s->captracce==0) ? 16 : 2*s->captracce;
+    Traccia *tmp;
+    SYSCALL_D(tmp,realloc(s->tracce,sizeof(Traccia)*s->captracce),"realloc");
+    s->tracce=tmp;
+  }
+  Traccia *t=&(s->tracce[s->ntracce++]);
+  memset(t,0,sizeof(Traccia));
+  t->numero=numero;
+  t->record=record;
+}
+
+/**
+ * @function TogliTraccia
+ * @brief Elimina il file di un segmento noto allo scrittore
+ * @param p indica la parte
+ * @param i indica la posizione del segmento nell'array dei segmenti noti
+ *
+ * Un segmento mappato all'avvio resta mappato: i messaggi recuperati possono puntare ancora ai suoi body.
+ */
+static void TogliTraccia(int p, int i){
+  Settore *s=&settore[p];
+  char *nome=Percorso(p,s->tracce[i].numero,"seg");
+  if(unlink(nome)<0 && errno!=ENOENT)
+    perror(nome);
+  free(nome);
+  memmove(&(s->tracce[i]),&(s->tracce[i+1]),sizeof(Traccia)*(s->ntracce-i-1));
+  s->ntracce--;
+}
+
+/**
+ * @function Copia
+ * @brief Copia un record nel buffer di una parte, da chiamare in mutua-esclusione sulla parte
+ * @param s indica la parte
+ * @param r indica l'intestazione del record
+ * @param body indica il body del record, NULL se non c'è
+ */
+static void Copia(Settore *s, Record *r, const char *body){
+  if(s->nbuf+r->len>s->capbuf){
+    size_t cap=(s->capbuf==0) ? ARCHIVIO_LOTTO : 2*s->capbuf;
+    while(cap<s->nbuf+r->len) cap*=2;
+    char *tmp;
+    SYSCALL_D(tmp,realloc(s->buf,cap),"realloc");
+    s->buf=tmp;
+    s->capbuf=cap;
+  }
+  Record *d=(Record*)(s->buf+s->nbuf);
+  memcpy(d,r,sizeof(Record));
+  size_t dim=(body!=NULL) ? r->dim : 0;
+  if(dim>0)
+    memcpy(d+1,body,dim);
+  memset((char*)(d+1)+dim,0,r->len-sizeof(Record)-dim);
+  d->somma=Somma(d);
+  s->nbuf+=r->len;
+}
+
+/**
+ * @function Guasto
+ * @brief Chiude il segmento aperto dopo una scrittura fallita, i nuovi record vanno nel segmento successivo
+ * @param p indica la parte
+ *
+ * Il segmento viene accorciato fino all'ultimo record scritto senza errori, così nessun record segue un record
+ * scritto a metà, e i record già assegnati allo stesso segmento vengono scartati fino al record di fine.
+ */
+static void Guasto(int p){
+  Settore *s=&settore[p];
+  if(s->fd>=0){
+    if(ftruncate(s->fd,(off_t)s->sano)<0 || fsync(s->fd)<0)
+      perror("ftruncate");
+    close(s->fd);
+    s->fd=-1;
+  }
+  s->guasto=1;
+  //se non l'ha già fatto chi aggiunge i record, faccio passare la parte al segmento successivo
+  pthread_mutex_lock(&(s->mutex));
+  if(s->numero==s->aperto){
+    Record fine;
+    memset(&fine,0,sizeof(fine));
+    fine.len=sizeof(Record);
+    fine.tipo=REC_FINE;
+    Copia(s,&fine,NULL);
+    s->numero++;
+    s->dim=0;
+  }
+  pthread_mutex_unlock(&(s->mutex));
+}
+
+/**
+ * @function Scrivi
+ * @brief Scrive dei record nel segmento aperto dallo scrittore, aprendolo se necessario, e li aggiunge alle history
+ * @param p indica la parte
+ * @param dati indica i record
+ * @param n indica il numero di byte
+ * @return 0 se i record sono stati scritti e resi persistenti come richiesto dalla politica, -1 se la scrittura è fallita
+ *         o i record sono stati scartati
+ */
+static int Scrivi(int p, char *dati, size_t n){
+  Settore *s=&settore[p];
+  if(n==0) return 0;
+  if(s->guasto) return -1;
+  if(s->fd<0){
+    char *nome=Percorso(p,s->aperto,"seg");
+    s->fd=open(nome,O_WRONLY|O_CREAT|O_APPEND,0600);
+    if(s->fd<0)
+      perror(nome);
+    free(nome);
+    off_t fine;
+    if(s->fd<0 || (fine=lseek(s->fd,0,SEEK_END))<0){
+      Guasto(p);
+      return -1;
+    }
+    s->sano=(size_t)fine;
+  }
+  size_t fatti=0;
+  while(fatti<n){
+    ssize_t r=write(s->fd,dati+fatti,n-fatti);
+    if(r<0){
+      if(errno==EINTR) continue;
+      perror("write");
+      Guasto(p);
+      return -1;
+    }
+    fatti+=(size_t)r;
+  }
+  if(politica_a>0 && fdatasync(s->fd)<0){
+    perror("fdatasync");
+    Guasto(p);
+    return -1;
+  }
+  //solo i record scritti senza errori entrano nelle history salvate negli indici
+  Traccia *t=&(s->tracce[s->ntracce-1]);
+  for(size_t off=0;off<n;off+=((Record*)(dati+off))->len){
+    Indicizza(&(s->recenti),(Record*)(dati+off),POSIZIONE(p,s->aperto,s->sano+off));
+    t->record++;
+  }
+  s->sano+=n;
+  return 0;
+}
+
+/**
+ * @function ScriviIndice
+ * @brief Salva le history aggiornate dallo scrittore nel file indice di una parte, eseguita dallo scrittore
+ * @param p indica la parte
+ * @return 0 se l'indice è stato salvato, -1 altrimenti
+ *
+ * L'indice arriva fino all'ultimo record scritto nella parte, che viene prima reso persistente. Un indice completo
+ * prende il posto del file precedente con lo stesso numero; restano gli ultimi due, se il più recente non è integro
+ * all'avvio viene usato l'altro.
+ */
+static int ScriviIndice(int p){
+  Settore *s=&settore[p];
+  if(s->fd>=0 && fdatasync(s->fd)<0){
+    perror("fdatasync");
+    return -1;
+  }
+  size_t dim=sizeof(Intestazione)+sizeof(Traccia)*s->ntracce, nvoci=0;
+  for(size_t i=0;i<s->recenti.cap;i++){
+    Voce *v=&(s->recenti.voci[i]);
+    if(v->nome.nome[0]=='\0' || v->seq==0) continue;
+    dim+=sizeof(Riga)+sizeof(uint64_t)*v->cont;
+    nvoci++;
+  }
+  char *buf;
+  SYSCALL_D(buf,calloc(1,dim),"calloc");
+  Intestazione *h=(Intestazione*)buf;
+  h->numero=s->aperto;
+  h->scostamento=s->sano;
+  h->ntracce=s->ntracce;
+  h->nvoci=nvoci;
+  size_t off=sizeof(Intestazione);
+  memcpy(buf+off,s->tracce,sizeof(Traccia)*s->ntracce);
+  off+=sizeof(Traccia)*s->ntracce;
+  for(size_t i=0;i<s->recenti.cap;i++){
+    Voce *v=&(s->recenti.voci[i]);
+    if(v->nome.nome[0]=='\0' || v->seq==0) continue;
+    Riga r;
+    memset(&r,0,sizeof(r));
+    r.nome=v->nome;
+    r.cont=(uint32_t)v->cont;
+    r.seq=v->seq;
+    memcpy(buf+off,&r,sizeof(r));
+    off+=sizeof(r);
+    for(int j=0;j<v->cont;j++){
+      memcpy(buf+off,&(v->pos[(v->start+j)%maxhist_a]),sizeof(uint64_t));
+      off+=sizeof(uint64_t);
+    }
+  }
+  h->somma=Fnv((unsigned char*)buf+sizeof(uint32_t),dim-sizeof(uint32_t));
+  //scrivo un file temporaneo, che diventa l'indice solo quando è completo e persistente
+  char *tmp=Percorso(p,s->aperto,"ind.tmp"), *nome=Percorso(p,s->aperto,"ind");
+  int esito=-1, fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+  if(fd<0)
+    perror(tmp);
+  else{
+    size_t fatti=0;
+    while(fatti<dim){
+      ssize_t r=write(fd,buf+fatti,dim-fatti);
+      if(r<0){
+        if(errno==EINTR) continue;
+        break;
+      }
+      fatti+=(size_t)r;
+    }
+    if(fatti<dim)
+      perror("write");
+    else if(fsync(fd)<0)
+      perror("fsync");
+    else if(rename(tmp,nome)<0)
+      perror(nome);
+    else
+      esito=0;
+    close(fd);
+    if(esito<0)
+      unlink(tmp);
+  }
+  free(buf);
+  free(tmp);
+  free(nome);
+  if(esito<0) return -1;
+  SincronizzaCartella();
+  //tengo gli ultimi due indici, il più vecchio viene eliminato
+  if(s->nindici==0 || s->indici[s->nindici-1]!=s->aperto){
+    if(s->nindici==2){
+      nome=Percorso(p,s->indici[0],"ind");
+      unlink(nome);
+      free(nome);
+      s->indici[0]=s->indici[1];
+      s->nindici=1;
+    }
+    s->indici[s->nindici++]=s->aperto;
+  }
+  return 0;
+}
+
+/**
+ * @function ChiudiSegmento
+ * @brief Rende persistente e chiude il segmento aperto dallo scrittore, i record successivi vanno nel segmento seguente
+ * @param p indica la parte
+ * @return 0 se il segmento è persistente, -1 altrimenti
+ *
+ * Se il segmento è persistente viene salvato un indice, così all'avvio il segmento non viene riletto.
+ */
+static int ChiudiSegmento(int p){
+  Settore *s=&settore[p];
+  int esito=0;
+  if(s->fd>=0){
+    if(fsync(s->fd)<0){
+      perror("fsync");
+      esito=-1;
+    }
+    close(s->fd);
+    s->fd=-1;
+  }
+  s->aperto++;
+  s->sano=0;
+  s->guasto=0;
+  AggiungiTraccia(s,s->aperto,0);
+  if(esito==0 && ScriviIndice(p)==0)
+    chiusi=1;
+  return esito;
+}
+
+/**
+ * @function Svuota
+ * @brief Scrive i record in attesa in una parte, eseguita dallo scrittore
+ * @param p indica la parte
+ * @param fino conterrà il numero di byte aggiunti alla parte che sono stati elaborati
+ * @return 0 se i record sono persistenti come richiesto dalla politica, -1 se almeno uno è andato perso
+ */
+static int Svuota(int p, uint64_t *fino){
+  Settore *s=&settore[p];
+  //scambio i buffer, così i record possono essere aggiunti mentre scrivo quelli già presenti
+  pthread_mutex_lock(&(s->mutex));
+  char *buf=s->buf;
+  size_t n=s->nbuf, cap=s->capbuf;
+  s->buf=s->riserva;
+  s->capbuf=s->capriserva;
+  s->nbuf=0;
+  *fino=s->accodati;
+  pthread_mutex_unlock(&(s->mutex));
+  size_t inizio=0, off=0;
+  int esito=0;
+  while(off<n){
+    Record *r=(Record*)(buf+off);
+    if(r->tipo==REC_FINE){
+      if(Scrivi(p,buf+inizio,off-inizio)<0)
+        esito=-1;
+      if(ChiudiSegmento(p)<0)
+        esito=-1;
+      inizio=off+r->len;
+    }
+    off+=r->len;
+  }
+  if(Scrivi(p,buf+inizio,n-inizio)<0)
+    esito=-1;
+  s->riserva=buf;
+  s->capriserva=cap;
+  return esito;
+}
+
+/**
+ * @function Sveglia
+ * @brief Fa iniziare subito una scrittura di gruppo
+ */
+static void Sveglia(){
+  pthread_mutex_lock(&mutex_archivio);
+  anticipa=1;
+  pthread_cond_signal(&sveglia_a);
+  pthread_mutex_unlock(&mutex_archivio);
+}
+
+/**
+ * @function Aggiungi
+ * @brief Aggiunge un record ad una parte, passando al segmento successivo se quello attuale è pieno
+ * @param p indica la parte
+ * @param r indica l'intestazione del record
+ * @param body indica il body del record, NULL se non c'è
+ * @return la posizione del record
+ */
+static uint64_t Aggiungi(int p, Record *r, const char *body){
+  Settore *s=&settore[p];
+  pthread_mutex_lock(&(s->mutex));
+  if(s->dim>0 && s->dim+r->len>ARCHIVIO_SEGMENTO){
+    Record fine;
+    memset(&fine,0,sizeof(fine));
+    fine.len=sizeof(Record);
+    fine.tipo=REC_FINE;
+    Copia(s,&fine,NULL);
+    s->numero++;
+    s->dim=0;
+  }
+  uint64_t pos=POSIZIONE(p,s->numero,s->dim);
+  Copia(s,r,body);
+  s->dim+=r->len;
+  __atomic_store_n(&(s->accodati),s->accodati+r->len,__ATOMIC_RELEASE);
+  int pieno=(s->nbuf>=ARCHIVIO_LOTTO);
+  pthread_mutex_unlock(&(s->mutex));
+  if(pieno)
+    Sveglia();
+  return pos;
+}
+
+/**
+ * @function Trasferisci
+ * @brief Copia in fondo alla sua parte il body di un messaggio che si trova in un segmento da compattare
+ * @param fd indica il descrittore del segmento
+ * @param pos indica la posizione del record con il body
+ * @return la posizione della copia, ARCHIVIO_NESSUNA se il record non è leggibile
+ */
+static uint64_t Trasferisci(int fd, uint64_t pos){
+  Record r;
+  off_t off=(off_t)SCOSTAMENTO(pos);
+  if(pread(fd,&r,sizeof(r),off)!=(ssize_t)sizeof(r) || (r.tipo!=REC_MESSAGGIO && r.tipo!=REC_COPIA) ||
+     r.len<sizeof(Record) || r.dim>r.len-sizeof(Record))
+    return ARCHIVIO_NESSUNA;
+  char *body=NULL;
+  if(r.dim>0){
+    SYSCALL_D(body,malloc(r.dim),"malloc");
+    if(pread(fd,body,r.dim,off+(off_t)sizeof(Record))!=(ssize_t)r.dim){
+      free(body);
+      return ARCHIVIO_NESSUNA;
+    }
+  }
+  r.tipo=REC_COPIA;
+  uint64_t nuova=Aggiungi(PARTE(pos),&r,body);
+  free(body);
+  return nuova;
+}
+
+/**
+ * @function Compatta
+ * @brief Sposta in fondo alle loro parti i body ancora usati dei segmenti scelti, poi elimina i segmenti, eseguita dallo scrittore
+ * @param fino contiene, per ogni parte, il numero di byte elaborati, aggiornato se vengono scritte delle copie
+ * @param esito contiene, per ogni parte, l'esito della scrittura, aggiornato se vengono scritte delle copie
+ *
+ * Le copie vengono rese persistenti prima di aggiornare le history che le usano, e un segmento viene eliminato solo
+ * dopo che tutte le parti con una history che puntava al segmento hanno salvato un nuovo indice.
+ */
+static void Compatta(uint64_t *fino, int *esito){
+  //raccolgo le posizioni che puntano ai segmenti scelti, ognuna una sola volta
+  uint64_t *pos=NULL, *nuova;
+  size_t n=0, cap=0;
+  for(int q=0;q<ARCHIVIO_PARTI;q++){
+    Tabella *t=&(settore[q].recenti);
+    for(size_t i=0;i<t->cap;i++){
+      Voce *v=&(t->voci[i]);
+      for(int j=0;v->nome.nome[0]!='\0' && j<v->cont;j++){
+        uint64_t x=v->pos[(v->start+j)%maxhist_a];
+        Traccia *g=TrovaTraccia(x);
+        if(g==NULL || !g->scelto) continue;
+        if(n==cap){
+          cap=(cap==0) ? 1024 : 2*cap;
+          uint64_t *tmp;
+          SYSCALL_D(tmp,realloc(pos,sizeof(uint64_t)*cap),"realloc");
+          pos=tmp;
+        }
+        pos[n++]=x;
+      }
+    }
+  }
+  if(n>0)
+    qsort(pos,n,sizeof(uint64_t),ConfrontaPosizioni);
+  size_t m=0;
+  for(size_t i=0;i<n;i++)
+    if(m==0 || pos[m-1]!=pos[i])
+      pos[m++]=pos[i];
+  n=m;
+  SYSCALL_D(nuova,malloc(sizeof(uint64_t)*((n>0) ? n : 1)),"malloc");
+  //copio i body nell'ordine in cui si trovano nei segmenti, un segmento con un body non leggibile non viene eliminato
+  int copie[ARCHIVIO_PARTI], toccate[ARCHIVIO_PARTI];
+  memset(copie,0,sizeof(copie));
+  memset(toccate,0,sizeof(toccate));
+  int fd=-1;
+  for(size_t i=0;i<n;i++){
+    if(i==0 || PARTE(pos[i])!=PARTE(pos[i-1]) || NUMERO(pos[i])!=NUMERO(pos[i-1])){
+      if(fd>=0)
+        close(fd);
+      char *nome=Percorso(PARTE(pos[i]),NUMERO(pos[i]),"seg");
+      fd=open(nome,O_RDONLY);
+      free(nome);
+    }
+    nuova[i]=(fd>=0) ? Trasferisci(fd,pos[i]) : ARCHIVIO_NESSUNA;
+    if(nuova[i]==ARCHIVIO_NESSUNA)
+      TrovaTraccia(pos[i])->scelto=0;
+    else
+      copie[PARTE(pos[i])]=1;
+  }
+  if(fd>=0)
+    close(fd);
+  //scrivo le copie, una parte in cui la scrittura fallisce tiene i suoi segmenti
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    if(!copie[p]) continue;
+    if(Svuota(p,&fino[p])<0){
+      esito[p]=-1;
+      copie[p]=0;
+      for(int i=0;i<settore[p].ntracce;i++)
+        settore[p].tracce[i].scelto=0;
+    }
+  }
+  //le history puntano alle copie
+  for(int q=0;q<ARCHIVIO_PARTI;q++){
+    Tabella *t=&(settore[q].recenti);
+    for(size_t i=0;i<t->cap;i++){
+      Voce *v=&(t->voci[i]);
+      for(int j=0;v->nome.nome[0]!='\0' && j<v->cont;j++){
+        uint64_t *x=&(v->pos[(v->start+j)%maxhist_a]);
+        Traccia *g=TrovaTraccia(*x);
+        if(g==NULL || !g->scelto) continue;
+        uint64_t *k=bsearch(x,pos,n,sizeof(uint64_t),ConfrontaPosizioni);
+        *x=nuova[k-pos];
+        toccate[q]=1;
+      }
+    }
+  }
+  //prima gli indici delle parti con le copie, che rendono persistenti le copie, poi quelli delle altre parti;
+  //i segmenti vengono eliminati solo se tutti gli indici che li usavano sono stati sostituiti
+  int salvati=1;
+  for(int q=0;q<ARCHIVIO_PARTI;q++)
+    if(copie[q] && ScriviIndice(q)<0)
+      salvati=0;
+  for(int q=0;q<ARCHIVIO_PARTI;q++)
+    if(toccate[q] && !copie[q] && ScriviIndice(q)<0)
+      salvati=0;
+  for(int p=0;salvati && p<ARCHIVIO_PARTI;p++){
+    Settore *s=&settore[p];
+    for(int i=0;i<s->ntracce;){
+      if(s->tracce[i].scelto)
+        TogliTraccia(p,i);
+      else
+        i++;
+    }
+  }
+  if(salvati)
+    SincronizzaCartella();
+  free(pos);
+  free(nuova);
+}
+
+/**
+ * @function Riordina
+ * @brief Elimina i segmenti che non contengono più messaggi recuperabili e compatta quelli quasi vuoti, eseguita dallo scrittore
+ * @param fino contiene, per ogni parte, il numero di byte elaborati, aggiornato se vengono scritte delle copie
+ * @param esito contiene, per ogni parte, l'esito della scrittura, aggiornato se vengono scritte delle copie
+ *
+ * Vengono considerati solo i segmenti che precedono entrambi gli indici salvati della loro parte, che all'avvio non
+ * vengono riletti neanche se l'indice più recente non è integro, e tra questi vengono compattati solo quelli che
+ * precedono anche gli ultimi due segmenti chiusi: un body appena scritto può ancora ricevere dei riferimenti da un
+ * invio a più utenti in corso.
+ */
+static void Riordina(uint64_t *fino, int *esito){
+  //conto le posizioni delle history che puntano ad ogni segmento
+  for(int p=0;p<ARCHIVIO_PARTI;p++)
+    for(int i=0;i<settore[p].ntracce;i++){
+      settore[p].tracce[i].vivi=0;
+      settore[p].tracce[i].scelto=0;
+    }
+  for(int q=0;q<ARCHIVIO_PARTI;q++){
+    Tabella *t=&(settore[q].recenti);
+    for(size_t i=0;i<t->cap;i++){
+      Voce *v=&(t->voci[i]);
+      for(int j=0;v->nome.nome[0]!='\0' && j<v->cont;j++){
+        Traccia *g=TrovaTraccia(v->pos[(v->start+j)%maxhist_a]);
+        if(g!=NULL)
+          g->vivi++;
+      }
+    }
+  }
+  int scelti=0, tolti=0;
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    Settore *s=&settore[p];
+    if(s->nindici==0) continue;
+    uint32_t limite=s->indici[0];
+    for(int i=0;i<s->ntracce;){
+      Traccia *g=&(s->tracce[i]);
+      if(g->numero>=limite || g->numero==s->aperto){
+        i++;
+        continue;
+      }
+      if(g->vivi==0){
+        TogliTraccia(p,i);
+        tolti=1;
+        continue;
+      }
+      if(g->numero+2<s->aperto && (uint64_t)g->vivi*ARCHIVIO_RIUSO<g->record){
+        g->scelto=1;
+        scelti=1;
+      }
+      i++;
+    }
+  }
+  if(tolti)
+    SincronizzaCartella();
+  if(scelti)
+    Compatta(fino,esito);
+}
+
+/**
+ * @function Scrittore
+ * @brief Funzione eseguita dal thread che scrive i record delle parti, una scrittura di gruppo alla volta
+ * @param arg non utilizzato
+ */
+static void * Scrittore(void *arg){
+  pthread_mutex_lock(&mutex_archivio);
+  while(1){
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME,&t);
+    t.tv_nsec+=ARCHIVIO_INTERVALLO*1000000L;
+    t.tv_sec+=t.tv_nsec/1000000000L;
+    t.tv_nsec%=1000000000L;
+    while(!fermo && !anticipa)
+      if(pthread_cond_timedwait(&sveglia_a,&mutex_archivio,&t)==ETIMEDOUT) break;
+    int ultimo=fermo;
+    anticipa=0;
+    pthread_mutex_unlock(&mutex_archivio);
+    uint64_t fino[ARCHIVIO_PARTI];
+    int esito[ARCHIVIO_PARTI];
+    for(int p=0;p<ARCHIVIO_PARTI;p++)
+      esito[p]=Svuota(p,&fino[p]);
+    //dopo un nuovo indice i segmenti che non servono più vengono eliminati
+    if(chiusi && !ultimo){
+      chiusi=0;
+      Riordina(fino,esito);
+    }
+    pthread_mutex_lock(&mutex_archivio);
+    //i byte di una scrittura fallita non risultano scritti, chi li aspetta viene svegliato e riceve l'errore
+    for(int p=0;p<ARCHIVIO_PARTI;p++){
+      if(esito[p]<0)
+        settore[p].perso=fino[p];
+      else
+        settore[p].scritti=fino[p];
+    }
+    pthread_cond_broadcast(&scritto);
+    if(ultimo) break;
+  }
+  pthread_mutex_unlock(&mutex_archivio);
+  return NULL;
+}
+
+/**
+ * @function Contenuta
+ * @brief Controlla se una directory coincide con un'altra o si trova al suo interno, dopo aver risolto i collegamenti
+ * @param dir indica la directory da controllare, che deve esistere
+ * @param base indica la directory che non deve contenerla
+ * @return 1 se dir coincide con base o si trova al suo interno, 0 altrimenti
+ */
+int Contenuta(const char *dir, const char *base){
+  if(dir==NULL || base==NULL || base[0]=='\0') return 0;
+  char *d=realpath(dir,NULL);
+  //se base non esiste ancora confronto il percorso così come è scritto
+  char *b=realpath(base,NULL);
+  const char *r=(d!=NULL) ? d : dir;
+  const char *c=(b!=NULL) ? b : base;
+  size_t n=strlen(c);
+  while(n>1 && c[n-1]=='/') n--;
+  int dentro=!strncmp(r,c,n) && (r[n]=='\0' || r[n]=='/' || (n==1 && c[0]=='/'));
+  free(d);
+  free(b);
+  return dentro;
+}
+
+/**
+ * @function ApriArchivio
+ * @brief Apre l'archivio e recupera le history salvate, caricando le parti in parallelo
+ * @param dir indica la directory dell'archivio, NULL lo disattiva
+ * @param file indica la directory dei file inviati dai client, che non può contenere l'archivio
+ * @param politica indica quando i dati vengono resi persistenti: 0 li affida al sistema operativo, 1 dopo ogni scrittura
+ *        di gruppo, 2 come 1 e chi aggiunge un messaggio aspetta che sia persistente
+ * @param maxhist indica il numero massimo di messaggi recuperati per ogni utente
+ */
+void ApriArchivio(char *dir, char *file, int politica, int maxhist){
+  if(dir==NULL) return;
+  politica_a=politica;
+  maxhist_a=(maxhist>0) ? maxhist : 1;
+  SYSCALL_D(cartella,strdup(dir),"strdup");
+  if(mkdir(cartella,0700)<0 && errno!=EEXIST){
+    perror(cartella);
+    exit(-1);
+  }
+  //i client potrebbero leggere e sovrascrivere i segmenti con GETFILE_OP e POSTFILE_OP
+  if(Contenuta(cartella,file)){
+    fprintf(stderr,"HistoryDir %s non può trovarsi dentro DirName %s\n",cartella,file);
+    exit(-1);
+  }
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    memset(&settore[p],0,sizeof(Settore));
+    pthread_mutex_init(&(settore[p].mutex),NULL);
+    settore[p].fd=-1;
+  }
+  //cerco i segmenti delle parti
+  DIR *d;
+  SYSCALL_D(d,opendir(cartella),cartella);
+  struct dirent *e;
+  while((e=readdir(d))!=NULL){
+    int p, fine=0;
+    unsigned int n;
+    //un indice temporaneo è rimasto da una scrittura interrotta
+    if(sscanf(e->d_name,"%d-%u.ind.tmp%n",&p,&n,&fine)>=2 && fine>0 && e->d_name[fine]=='\0'){
+      char *nome;
+      SYSCALL_D(nome,malloc(strlen(cartella)+strlen(e->d_name)+2),"malloc");
+      sprintf(nome,"%s/%s",cartella,e->d_name);
+      unlink(nome);
+      free(nome);
+      continue;
+    }
+    fine=0;
+    if(sscanf(e->d_name,"%d-%u.ind%n",&p,&n,&fine)>=2 && fine>0 && e->d_name[fine]=='\0' && p>=0 && p<ARCHIVIO_PARTI){
+      Settore *s=&settore[p];
+      if(s->ntrovati==s->captrovati){
+        s->captrovati=(s->captrovati==0) ? 4 : 2*s->captrovati;
+        uint32_t *tmp;
+        SYSCALL_D(tmp,realloc(s->trovati,sizeof(uint32_t)*s->captrovati),"realloc");
+        s->trovati=tmp;
+      }
+      s->trovati[s->ntrovati++]=n;
+      continue;
+    }
+    fine=0;
+    if(sscanf(e->d_name,"%d-%u.seg%n",&p,&n,&fine)<2 || fine==0 || e->d_name[fine]!='\0' || p<0 || p>=ARCHIVIO_PARTI)
+      continue;
+    Settore *s=&settore[p];
+    if(s->nseg==s->capseg){
+      s->capseg=(s->capseg==0) ? 16 : 2*s->capseg;
+      Segmento *tmp;
+      SYSCALL_D(tmp,realloc(s->seg,sizeof(Segmento)*s->capseg),"realloc");
+      s->seg=tmp;
+    }
+    memset(&(s->seg[s->nseg]),0,sizeof(Segmento));
+    s->seg[s->nseg++].numero=n;
+  }
+  closedir(d);
+  //carico le parti in parallelo, ogni utente è in una sola parte quindi i thread non condividono le voci
+  pthread_t th[ARCHIVIO_PARTI];
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    if(settore[p].nseg>0)
+      qsort(settore[p].seg,settore[p].nseg,sizeof(Segmento),Confronta);
+    if(settore[p].ntrovati>0)
+      qsort(settore[p].trovati,settore[p].ntrovati,sizeof(uint32_t),ConfrontaNumeri);
+    pthread_create(&th[p],NULL,Carica,(void*)(long)p);
+  }
+  for(int p=0;p<ARCHIVIO_PARTI;p++)
+    pthread_join(th[p],NULL);
+  Pulisci();
+  //lo scrittore riparte dai segmenti rimasti e dalle history ricostruite, i nuovi record vanno dopo l'ultimo integro
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    Settore *s=&settore[p];
+    s->aperto=s->numero;
+    s->sano=s->dim;
+    for(int j=0;j<s->nseg;j++)
+      if(!s->seg[j].cancellato && s->seg[j].numero<s->aperto)
+        AggiungiTraccia(s,s->seg[j].numero,s->seg[j].record);
+    Segmento *g=TrovaSegmento(s,s->aperto);
+    AggiungiTraccia(s,s->aperto,(g!=NULL) ? g->record : 0);
+    for(size_t i=0;i<s->voci.cap;i++){
+      Voce *v=&(s->voci.voci[i]);
+      if(v->nome.nome[0]=='\0' || v->seq==0) continue;
+      Voce *w=CercaVoce(&(s->recenti),&(v->nome),1);
+      memcpy(w->pos,v->pos,sizeof(uint64_t)*maxhist_a);
+      w->start=v->start;
+      w->cont=v->cont;
+      w->seq=v->seq;
+    }
+    //degli indici trovati tengo solo quello caricato
+    for(int i=0;i<s->ntrovati;i++){
+      if(s->nindici>0 && s->trovati[i]==s->indici[0]) continue;
+      char *nome=Percorso(p,s->trovati[i],"ind");
+      unlink(nome);
+      free(nome);
+    }
+    free(s->trovati);
+    s->trovati=NULL;
+    s->ntrovati=0;
+    s->captrovati=0;
+  }
+  attivo=1;
+  pthread_create(&scrittore,NULL,Scrittore,NULL);
+}
+
+/**
+ * @function Archivia
+ * @brief Aggiunge un messaggio della history di un utente all'archivio, da chiamare in mutua-esclusione sulla history dell'utente
+ * @param nome indica il nome del destinatario
+ * @param seq indica il numero di sequenza del messaggio nella history del destinatario
+ * @param msg indica il messaggio
+ * @param posizione indica dove il primo destinatario scrive la posizione del body, gli altri salvano solo un riferimento
+ */
+void Archivia(const char *nome, size_t seq, message_t *msg, uint64_t *posizione){
+  if(!attivo) return;
+  Record r;
+  memset(&r,0,sizeof(r));
+  FaiChiave(&(r.destinatario),nome);
+  r.seq=seq;
+  int p=ParteDi(&(r.destinatario));
+  uint64_t pos=ARCHIVIO_NESSUNA;
+  if(__atomic_compare_exchange_n(posizione,&pos,ARCHIVIO_IN_CORSO,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+    //sono il primo destinatario, salvo il body
+    r.tipo=REC_MESSAGGIO;
+    r.op=msg->hdr.op;
+    strncpy(r.mittente,msg->hdr.sender,MAX_NAME_LENGTH);
+    r.dim=msg->data.hdr.len;
+    r.len=(sizeof(Record)+r.dim+7)&~(size_t)7;
+    pos=Aggiungi(p,&r,msg->data.buf);
+    __atomic_store_n(posizione,pos,__ATOMIC_RELEASE);
+    return;
+  }
+  //un altro destinatario sta salvando il body, aspetto che ne pubblichi la posizione
+  while(pos==ARCHIVIO_IN_CORSO){
+    sched_yield();
+    pos=__atomic_load_n(posizione,__ATOMIC_ACQUIRE);
+  }
+  r.tipo=REC_RIFERIMENTO;
+  r.posizione=pos;
+  r.len=sizeof(Record);
+  Aggiungi(p,&r,NULL);
+}
+
+/**
+ * @function ArchiviaEliminazione
+ * @brief Segna nell'archivio che un utente è stato eliminato, per non recuperarne la history se si registra di nuovo
+ * @param nome indica il nome dell'utente
+ */
+void ArchiviaEliminazione(const char *nome){
+  if(!attivo) return;
+  Record r;
+  memset(&r,0,sizeof(r));
+  FaiChiave(&(r.destinatario),nome);
+  r.tipo=REC_ELIMINAZIONE;
+  r.len=sizeof(Record);
+  Aggiungi(ParteDi(&(r.destinatario)),&r,NULL);
+}
+
+/**
+ * @function SegnaArchivio
+ * @brief Salva fin dove arriva ogni parte dell'archivio, prima di aggiungere i messaggi di una richiesta
+ * @param inizio conterrà, per ogni parte, il numero di byte aggiunti finora
+ */
+void SegnaArchivio(uint64_t *inizio){
+  for(int p=0;p<ARCHIVIO_PARTI;p++)
+    inizio[p]=__atomic_load_n(&(settore[p].accodati),__ATOMIC_ACQUIRE);
+}
+
+/**
+ * @function AttendiArchivio
+ * @brief Aspetta che i messaggi archiviati finora siano persistenti, se la politica lo richiede
+ * @param inizio indica fin dove arrivavano le parti prima dei messaggi della richiesta, salvato da SegnaArchivio
+ * @return 0 se i messaggi sono persistenti o la politica non lo richiede, -1 se la scrittura di almeno uno è fallita
+ *
+ * Chi aspetta non fa scrivere nulla: si aggiunge alla prossima scrittura di gruppo, che rende persistenti con
+ * un solo fdatasync per parte i messaggi di tutti i thread in attesa. Un fallimento successivo a inizio viene
+ * attribuito anche a questa richiesta, anche se i suoi messaggi sono stati scritti in una scrittura riuscita.
+ */
+int AttendiArchivio(const uint64_t *inizio){
+  if(!attivo || politica_a<2) return 0;
+  uint64_t fino[ARCHIVIO_PARTI];
+  SegnaArchivio(fino);
+  int esito=0;
+  pthread_mutex_lock(&mutex_archivio);
+  anticipa=1;
+  pthread_cond_signal(&sveglia_a);
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    while(settore[p].scritti<fino[p] && settore[p].perso<fino[p])
+      pthread_cond_wait(&scritto,&mutex_archivio);
+    if(settore[p].perso>inizio[p])
+      esito=-1;
+  }
+  pthread_mutex_unlock(&mutex_archivio);
+  return esito;
+}
+
+/**
+ * @function Recupera
+ * @brief Restituisce la history salvata di un utente, che non viene più restituita alle chiamate successive
+ * @param nome indica il nome dell'utente
+ * @param n conterrà il numero dei messaggi
+ * @param seq conterrà il numero di sequenza del prossimo messaggio dell'utente
+ * @return l'array dei messaggi dal più vecchio, da liberare con free, NULL se l'utente non ha una history salvata
+ *
+ * Il body dei messaggi punta alla mappatura dell'archivio, che resta valida fino a ChiudiArchivio.
+ */
+message_t * Recupera(const char *nome, int *n, size_t *seq){
+  *n=0;
+  *seq=0;
+  if(!attivo) return NULL;
+  Chiave k;
+  FaiChiave(&k,nome);
+  Settore *s=&settore[ParteDi(&k)];
+  pthread_mutex_lock(&(s->mutex));
+  Voce *v=CercaVoce(&(s->voci),&k,0);
+  if(v==NULL || v->seq==0){
+    pthread_mutex_unlock(&(s->mutex));
+    return NULL;
+  }
+  message_t *msg;
+  SYSCALL_D(msg,calloc((v->cont>0) ? v->cont : 1,sizeof(message_t)),"calloc");
+  //parto dal più recente e mi fermo al primo body non leggibile, i messaggi restituiti devono avere numeri di sequenza consecutivi
+  int i=v->cont;
+  while(i>0){
+    Record *r=Body(v->pos[(v->start+i-1)%maxhist_a]);
+    if(r==NULL) break;
+    message_t *m=&msg[i-1];
+    m->hdr.op=r->op;
+    strncpy(m->hdr.sender,r->mittente,MAX_NAME_LENGTH);
+    m->data.hdr.len=r->dim;
+    m->data.buf=(char*)(r+1);
+    i--;
+  }
+  *n=v->cont-i;
+  memmove(msg,msg+i,sizeof(message_t)*(*n));
+  *seq=v->seq;
+  v->start=0;
+  v->cont=0;
+  v->seq=0;
+  pthread_mutex_unlock(&(s->mutex));
+  return msg;
+}
+
+/**
+ * @function ChiudiArchivio
+ * @brief Scrive i messaggi ancora in attesa e chiude l'archivio
+ */
+void ChiudiArchivio(){
+  if(!attivo) return;
+  //lo scrittore esegue un'ultima scrittura di gruppo prima di terminare
+  pthread_mutex_lock(&mutex_archivio);
+  fermo=1;
+  pthread_cond_signal(&sveglia_a);
+  pthread_mutex_unlock(&mutex_archivio);
+  pthread_join(scrittore,NULL);
+  for(int p=0;p<ARCHIVIO_PARTI;p++){
+    Settore *s=&settore[p];
+    //l'indice finale evita di rileggere all'avvio i record scritti dopo l'ultimo segmento chiuso
+    if(s->nindici>0 || s->ntracce>1 || s->sano>0)
+      ScriviIndice(p);
+    if(s->fd>=0){
+      if(fsync(s->fd)<0)
+        perror("fsync");
+      close(s->fd);
+    }
+    free(s->buf);
+    free(s->riserva);
+    for(int j=0;j<s->nseg;j++)
+      if(s->seg[j].mappa!=NULL)
+        munmap(s->seg[j].mappa,s->seg[j].mappato);
+    free(s->seg);
+    LiberaVoci(&(s->voci));
+    LiberaVoci(&(s->recenti));
+    free(s->tracce);
+    free(s->trovati);
+    pthread_mutex_destroy(&(s->mutex));
+  }
+  free(cartella);
+  cartella=NULL;
+  attivo=0;
+  fermo=0;
+  chiusi=0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file archivio.h
+ * @brief File per la gestione dell'archivio su disco delle history, che sopravvive al riavvio del server
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef ARCHIVIO_H_
+#define ARCHIVIO_H_
+
+#include <stdint.h>
+#include <config.h>
+#include <message.h>
+
+/**
+ * @var ARCHIVIO_NESSUNA indica un messaggio il cui body non è ancora stato archiviato
+ * @var ARCHIVIO_IN_CORSO indica un messaggio il cui body sta venendo archiviato da un altro thread
+ */
+#define ARCHIVIO_NESSUNA   UINT64_MAX
+#define ARCHIVIO_IN_CORSO  (UINT64_MAX-1)
+
+/**
+ * @function ApriArchivio
+ * @brief Apre l'archivio e recupera le history salvate, caricando le parti in parallelo
+ * @param dir indica la directory dell'archivio, NULL lo disattiva
+ * @param file indica la directory dei file inviati dai client, che non può contenere l'archivio
+ * @param politica indica quando i dati vengono resi persistenti: 0 li affida al sistema operativo, 1 dopo ogni scrittura
+ *        di gruppo, 2 come 1 e chi aggiunge un messaggio aspetta che sia persistente
+ * @param maxhist indica il numero massimo di messaggi recuperati per ogni utente
+ */
+void ApriArchivio(char *dir, char *file, int politica, int maxhist);
+
+/**
+ * @function Contenuta
+ * @brief Controlla se una directory coincide con un'altra o si trova al suo interno, dopo aver risolto i collegamenti
+ * @param dir indica la directory da controllare, che deve esistere
+ * @param base indica la directory che non deve contenerla
+ * @return 1 se dir coincide con base o si trova al suo interno, 0 altrimenti
+ */
+int Contenuta(const char *dir, const char *base);
+
+/**
+ * @function Archivia
+ * @brief Aggiunge un messaggio della history di un utente all'archivio, da chiamare in mutua-esclusione sulla history dell'utente
+ * @param nome indica il nome del destinatario
+ * @param seq indica il numero di sequenza del messaggio nella history del destinatario
+ * @param msg indica il messaggio
+ * @param posizione indica dove il primo destinatario scrive la posizione del body, gli altri salvano solo un riferimento
+ */
+void Archivia(const char *nome, size_t seq, message_t *msg, uint64_t *posizione);
+
+/**
+ * @function ArchiviaEliminazione
+ * @brief Segna nell'archivio che un utente è stato eliminato, per non recuperarne la history se si registra di nuovo
+ * @param nome indica il nome dell'utente
+ */
+void ArchiviaEliminazione(const char *nome);
+
+/**
+ * @function SegnaArchivio
+ * @brief Salva fin dove arriva ogni parte dell'archivio, prima di aggiungere i messaggi di una richiesta
+ * @param inizio conterrà, per ogni parte, il numero di byte aggiunti finora
+ */
+void SegnaArchivio(uint64_t *inizio);
+
+/**
+ * @function AttendiArchivio
+ * @brief Aspetta che i messaggi archiviati finora siano persistenti, se la politica lo richiede
+ * @param inizio indica fin dove arrivavano le parti prima dei messaggi della richiesta, salvato da SegnaArchivio
+ * @return 0 se i messaggi sono persistenti o la politica non lo richiede, -1 se la scrittura di almeno uno è fallita
+ */
+int AttendiArchivio(const uint64_t *inizio);
+
+/**
+ * @function Recupera
+ * @brief Restituisce la history salvata di un utente, che non viene più restituita alle chiamate successive
+ * @param nome indica il nome dell'utente
+ * @param n conterrà il numero dei messaggi
+ * @param seq conterrà il numero di sequenza del prossimo messaggio dell'utente
+ * @return l'array dei messaggi dal più vecchio, da liberare con free, NULL se l'utente non ha una history salvata
+ *
+ * Il body dei messaggi punta alla mappatura dell'archivio, che resta valida fino a ChiudiArchivio.
+ */
+message_t * Recupera(const char *nome, int *n, size_t *seq);
+
+/**
+ * @function ChiudiArchivio
+ * @brief Scrive i messaggi ancora in attesa e chiude l'archivio
+ */
+void ChiudiArchivio();
+
+#endif /* ARCHIVIO_H_ */
@@ -0,0 +1,157 @@
+/**
+ * @file bench_chiave.c
+ * @brief Confronta il costo di hash e confronto dei nomi come chiavi di 32 byte con la vecchia hash_pjw seguita da strcmp
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Per ogni lunghezza dei nomi viene misurato il costo di una ricerca: il calcolo dell'hash del nome cercato e il
+ * confronto con il nome trovato nella tabella, uguale per metà delle ricerche e diverso solo nell'ultimo carattere
+ * per l'altra metà. Le chiavi vengono costruite dal nome ad ogni ricerca, come avviene per i nomi ricevuti dai client;
+ * l'ultima colonna riporta il costo di hash e confronto con la chiave già costruita.
+ * Uso: ./bench_chiave [ricerche per lunghezza]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <chiave.h>
+
+//numero di ricerche per ogni lunghezza se non specificato
+#define RICERCHE 10000000
+
+//numero di nomi diversi usati a rotazione
+#define NOMI 1024
+
+#define BITS_IN_int     ( sizeof(int) * CHAR_BIT )
+#define THREE_QUARTERS  ((int) ((BITS_IN_int * 3) / 4))
+#define ONE_EIGHTH      ((int) (BITS_IN_int / 8))
+#define HIGH_BITS       ( ~((unsigned int)(~0) >> ONE_EIGHTH ))
+
+/**
+ * @function hash_pjw
+ * @brief Calcola la funzione hash come faceva la vecchia tabella degli utenti
+ * @param key indica la chiave su cui calcolare la funzione hash
+ * @return ritorna un intero che rappresenta il valore della funzione hash calcolata
+ */
+static unsigned int hash_pjw(void* key){
+  char *datum = (char *)key;
+  unsigned int hash_value, i;
+  if(!datum) return 0;
+  for(hash_value = 0; *datum; ++datum) {
+    hash_value = (hash_value << ONE_EIGHTH) + *datum;
+    if ((i = hash_value & HIGH_BITS) != 0)
+      hash_value = (hash_value ^ (i >> THREE_QUARTERS)) & ~HIGH_BITS;
+    }
+  return (hash_value)%1024;
+}
+
+/**
+ * @var cercati sono i nomi cercati, come arrivano dai client
+ * @var trovati sono i nomi presenti nella tabella, come stringhe e come chiavi
+ * @var ricerche indica il numero di ricerche per ogni lunghezza
+ */
+static char cercati[NOMI][MAX_NAME_LENGTH+1];
+static char trovati[NOMI][MAX_NAME_LENGTH+1];
+static Chiave chiavi[NOMI];
+static long ricerche=RICERCHE;
+
+/**
+ * @function Prepara
+ * @brief Genera i nomi di una certa lunghezza
+ * @param len indica la lunghezza dei nomi
+ */
+static void Prepara(int len){
+  for(int i=0;i<NOMI;i++){
+    for(int j=0;j<len;j++)
+      cercati[i][j]='a'+(i*7+j*13)%26;
+    cercati[i][len]='\0';
+    memcpy(trovati[i],cercati[i],MAX_NAME_LENGTH+1);
+    //metà dei nomi trovati differisce solo nell'ultimo carattere
+    if(i%2) trovati[i][len-1]^=1;
+    FaiChiave(&chiavi[i],trovati[i]);
+  }
+}
+
+/**
+ * @function Adesso
+ * @brief Restituisce l'istante attuale
+ * @return l'istante attuale in nanosecondi
+ */
+static double Adesso(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec*1e9+t.tv_nsec;
+}
+
+/**
+ * @function Vecchia
+ * @brief Esegue le ricerche con hash_pjw e strcmp
+ * @return il tempo medio di una ricerca in nanosecondi
+ */
+static double Vecchia(){
+  unsigned long somma=0;
+  double inizio=Adesso();
+  for(long i=0;i<ricerche;i++){
+    int n=i%NOMI;
+    somma+=hash_pjw(cercati[n]);
+    somma+=!strcmp(trovati[n],cercati[n]);
+  }
+  double t=(Adesso()-inizio)/ricerche;
+  //la somma viene usata perchè il compilatore non elimini il ciclo
+  if(somma==1) printf("\n");
+  return t;
+}
+
+/**
+ * @function Nuova
+ * @brief Esegue le ricerche usando ImprontaChiave e UgualeChiave
+ * @param costruisci se vale 1 la chiave viene costruita dal nome cercato ad ogni ricerca
+ * @return il tempo medio di una ricerca in nanosecondi
+ */
+static double Nuova(int costruisci){
+  unsigned long somma=0;
+  Chiave pronte[NOMI];
+  for(int i=0;i<NOMI;i++)
+    FaiChiave(&pronte[i],cercati[i]);
+  double inizio=Adesso();
+  for(long i=0;i<ricerche;i++){
+    int n=i%NOMI;
+    Chiave k;
+    if(costruisci)
+      FaiChiave(&k,cercati[n]);
+    else
+      k=pronte[n];
+    somma+=ImprontaChiave(&k);
+    somma+=UgualeChiave(&chiavi[n],&k);
+  }
+  double t=(Adesso()-inizio)/ricerche;
+  if(somma==1) printf("\n");
+  return t;
+}
+
+int main(int argc, char **argv){
+  if(argc>1)
+    ricerche=atol(argv[1]);
+#if defined(__AVX2__)
+  printf("confronto: AVX2\n");
+#elif defined(__SSE2__)
+  printf("confronto: SSE2\n");
+#else
+  printf("confronto: parole di 64 bit\n");
+#endif
+  printf("%10s %16s %16s %16s\n","lunghezza","hash_pjw ns","chiave ns","costruita ns");
+  for(int len=4;len<=MAX_NAME_LENGTH;len*=2){
+    Prepara(len);
+    double v=Vecchia();
+    double n=Nuova(1);
+    double c=Nuova(0);
+    printf("%10d %16.2f %16.2f %16.2f\n",len,v,n,c);
+  }
+  return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * @file bench_coda.c
+ * @brief Confronta il throughput delle code delle richieste (buffer circolari senza lock, uno per worker) con la vecchia lista protetta da mutex
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Con n che va da 1 a 32, n produttori inseriscono OPERAZIONI descrittori ciascuno e n consumatori li estraggono, come
+ * il listener e i worker del server: i produttori non hanno una coda propria, quindi ogni inserimento finisce nella coda
+ * di un consumatore, e i consumatori rimasti senza richieste rubano dalle code degli altri.
+ * Una seconda misura, riportata a parte, esegue con n thread OPERAZIONI coppie Push/Pop in cui ogni thread inserisce
+ * un descrittore affidato a sé stesso, come un worker che rimette in coda il proprio client: è il caso più favorevole
+ * all'affinità e non va confrontato con la lista.
+ * Uso: ./bench_coda [operazioni per thread]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <coda.h>
+
+//numero di descrittori inseriti da ogni produttore, o di coppie Push/Pop eseguite da ogni thread, se non specificato
+#define OPERAZIONI 200000
+
+//numero massimo di produttori e di consumatori
+#define MAX_THREAD 32
+
+//numero di descrittori diversi inseriti dai produttori
+#define DESCRITTORI 1024
+
+/**
+ * @struct Lista
+ * @brief è l'elemento della vecchia coda delle richieste, una lista protetta da una mutex
+ * @var fd indica il descrittore
+ * @var next è un puntatore all'elemento successivo
+ */
+typedef struct Lista1{
+  long fd;
+  struct Lista1 *next;
+}Lista;
+
+/**
+ * @var lista è il puntatore al primo elemento della lista
+ * @var ultimo_l è il puntatore all'ultimo elemento della lista
+ * @var mutex_l variabile per la gestione della mutua-esclusione
+ * @var cond_l variabile di condizione
+ */
+Lista *lista=NULL, *ultimo_l=NULL;
+pthread_mutex_t mutex_l=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_l=PTHREAD_COND_INITIALIZER;
+
+/**
+ * @function PushLista
+ * @brief Inserisce un descrittore nella lista, come faceva la vecchia Push
+ * @param fd indica il descrittore da inserire
+ */
+static void PushLista(long fd){
+  pthread_mutex_lock(&mutex_l);
+  Lista *new=malloc(sizeof(Lista));
+  if(new!=NULL){
+    new->fd=fd;
+    new->next=NULL;
+    if(lista==NULL)
+      lista=new;
+    else
+      ultimo_l->next=new;
+    ultimo_l=new;
+    pthread_cond_signal(&cond_l);
+  }
+  pthread_mutex_unlock(&mutex_l);
+}
+
+/**
+ * @function PopLista
+ * @brief Estrae un descrittore dalla lista, come faceva la vecchia Pop
+ * @return il valore del descrittore
+ */
+static long PopLista(){
+  pthread_mutex_lock(&mutex_l);
+  while(lista==NULL)
+    pthread_cond_wait(&cond_l,&mutex_l);
+  Lista *com=lista;
+  long ele=com->fd;
+  lista=lista->next;
+  free(com);
+  pthread_mutex_unlock(&mutex_l);
+  return ele;
+}
+
+/**
+ * @var operazioni indica il numero di descrittori inseriti da ogni produttore o di coppie Push/Pop eseguite da ogni thread
+ * @var usa_lista se vale 1 i thread usano la vecchia lista, altrimenti le code per worker
+ * @var nproduttori indica il numero di produttori della misura in corso
+ * @var estratti indica il numero di descrittori estratti dai consumatori nella misura in corso
+ */
+static long operazioni=OPERAZIONI;
+static int usa_lista=0;
+static int nproduttori=0;
+static long estratti=0;
+
+/**
+ * @function Produttore
+ * @brief Thread che inserisce descrittori nella coda scelta, senza estrarli
+ * @param arg indica l'indice del produttore
+ */
+static void* Produttore(void *arg){
+  long id=(long)arg;
+  for(long i=0;i<operazioni;i++){
+    //i produttori si alternano sui descrittori, che sono affidati ai consumatori in base al loro valore
+    long fd=(id+i*nproduttori)%DESCRITTORI;
+    if(usa_lista)
+      PushLista(fd);
+    else
+      Push(fd);
+  }
+  return NULL;
+}
+
+/**
+ * @function Consumatore
+ * @brief Thread che estrae descrittori dalla coda scelta finchè non riceve -1
+ * @param arg indica l'indice del consumatore, che è anche l'indice della sua coda
+ */
+static void* Consumatore(void *arg){
+  long id=(long)arg, somma=0, fd;
+  while((fd=usa_lista ? PopLista() : Pop((int)id))>=0){
+    somma+=fd;
+    __atomic_fetch_add(&estratti,1,__ATOMIC_RELEASE);
+  }
+  return (void*)somma;
+}
+
+/**
+ * @function Misura
+ * @brief Misura il throughput con n produttori e n consumatori
+ * @param n indica il numero di produttori e di consumatori
+ * @return il numero di milioni di operazioni (Push o Pop) al secondo
+ */
+static double Misura(int n){
+  pthread_t p[MAX_THREAD], c[MAX_THREAD];
+  struct timespec inizio, fine;
+  nproduttori=n;
+  estratti=0;
+  if(!usa_lista)
+    CreaCode(n, DESCRITTORI);
+  clock_gettime(CLOCK_MONOTONIC,&inizio);
+  for(long i=0;i<n;i++)
+    pthread_create(&c[i],NULL,Consumatore,(void*)i);
+  for(long i=0;i<n;i++)
+    pthread_create(&p[i],NULL,Produttore,(void*)i);
+  for(int i=0;i<n;i++)
+    pthread_join(p[i],NULL);
+  //aspetto che i consumatori abbiano estratto tutto prima di farli terminare
+  while(__atomic_load_n(&estratti,__ATOMIC_ACQUIRE)<operazioni*n)
+    sched_yield();
+  clock_gettime(CLOCK_MONOTONIC,&fine);
+  if(usa_lista)
+    for(int i=0;i<n;i++)
+      PushLista(-1);
+  else
+    Push(-1);
+  for(int i=0;i<n;i++)
+    pthread_join(c[i],NULL);
+  if(!usa_lista)
+    DestroyCode();
+  double sec=(fine.tv_sec-inizio.tv_sec)+(fine.tv_nsec-inizio.tv_nsec)/1e9;
+  return 2.0*operazioni*n/sec/1e6;
+}
+
+/**
+ * @function Affine
+ * @brief Thread che esegue coppie Push/Pop su un descrittore affidato a sé stesso
+ * @param arg indica l'indice del thread, che è anche il descrittore inserito
+ */
+static void* Affine(void *arg){
+  long id=(long)arg, somma=0;
+  for(long i=0;i<operazioni;i++){
+    Push(id);
+    somma+=Pop((int)id);
+  }
+  return (void*)somma;
+}
+
+/**
+ * @function MisuraAffine
+ * @brief Misura il throughput delle code per worker quando ogni thread rimette in coda il proprio descrittore
+ * @param n indica il numero di thread
+ * @return il numero di milioni di operazioni (Push o Pop) al secondo
+ */
+static double MisuraAffine(int n){
+  pthread_t t[MAX_THREAD];
+  struct timespec inizio, fine;
+  CreaCode(n, DESCRITTORI);
+  clock_gettime(CLOCK_MONOTONIC,&inizio);
+  for(long i=0;i<n;i++)
+    pthread_create(&t[i],NULL,Affine,(void*)i);
+  for(int i=0;i<n;i++)
+    pthread_join(t[i],NULL);
+  clock_gettime(CLOCK_MONOTONIC,&fine);
+  DestroyCode();
+  double sec=(fine.tv_sec-inizio.tv_sec)+(fine.tv_nsec-inizio.tv_nsec)/1e9;
+  return 2.0*operazioni*n/sec/1e6;
+}
+
+int main(int argc, char **argv){
+  if(argc>1)
+    operazioni=atol(argv[1]);
+  printf("produttori e consumatori\n");
+  printf("%8s %14s %14s\n","n","lista Mops/s","code Mops/s");
+  for(int n=1;n<=MAX_THREAD;n*=2){
+    usa_lista=1;
+    double l=Misura(n);
+    usa_lista=0;
+    double a=Misura(n);
+    printf("%8d %14.2f %14.2f\n",n,l,a);
+  }
+  printf("\naffinità: ogni thread rimette in coda il proprio descrittore\n");
+  printf("%8s %14s\n","thread","code Mops/s");
+  for(int n=1;n<=MAX_THREAD;n*=2)
+    printf("%8d %14.2f\n",n,MisuraAffine(n));
+  return 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file bench_ripristino.c
+ * @brief Misura il ripristino degli utenti registrati all'avvio, da mille a un milione di utenti
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Per ogni dimensione gli utenti vengono inseriti nella tabella uno alla volta con Insert e tutti insieme con
+ * InsertAll, il caricamento usato all'avvio; poi vengono registrati con il registro attivo e viene misurato
+ * ApriRegistro, che rilegge il registro da disco e ricostruisce la tabella.
+ * Uso: ./bench_ripristino [numero massimo di utenti]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <hash_history.h>
+#include <hash_gruppi.h>
+#include <registro.h>
+#include <slab.h>
+#include <epoca.h>
+
+//numero massimo di utenti se non specificato
+#define UTENTI 1000000
+
+//dimensione dei messaggi della history
+#define DIM_MSG 16
+
+/**
+ * @var cartella è la directory temporanea del registro
+ */
+static char cartella[]="/tmp/bench_ripristinoXXXXXX";
+
+/**
+ * @function Adesso
+ * @brief Restituisce l'istante attuale
+ * @return l'istante attuale in nanosecondi
+ */
+static double Adesso(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec*1e9+t.tv_nsec;
+}
+
+/**
+ * @function Svuota
+ * @brief Elimina i file del registro dalla directory temporanea
+ */
+static void Svuota(){
+  DIR *d=opendir(cartella);
+  if(d==NULL) return;
+  struct dirent *e;
+  char nome[512];
+  while((e=readdir(d))!=NULL){
+    if(strcmp(e->d_name,".")==0 || strcmp(e->d_name,"..")==0) continue;
+    snprintf(nome,sizeof(nome),"%s/%s",cartella,e->d_name);
+    unlink(nome);
+  }
+  closedir(d);
+}
+
+/**
+ * @function Misura
+ * @brief Misura il ripristino con un certo numero di utenti
+ * @param n indica il numero di utenti
+ */
+static void Misura(long n){
+  Chiave *nomi;
+  if((nomi=malloc(sizeof(Chiave)*n))==NULL){
+    perror("malloc");
+    exit(-1);
+  }
+  for(long i=0;i<n;i++){
+    char nome[MAX_NAME_LENGTH+1];
+    snprintf(nome,sizeof(nome),"utente%ld",i);
+    FaiChiave(&nomi[i],nome);
+  }
+  //inserimento uno alla volta
+  CreateHash(32,1,DIM_MSG);
+  double inizio=Adesso();
+  for(long i=0;i<n;i++)
+    Insert(nomi[i].nome);
+  double uno=(Adesso()-inizio)/n;
+  DestroyHash();
+  //caricamento di tutti gli utenti insieme
+  CreateHash(32,1,DIM_MSG);
+  inizio=Adesso();
+  InsertAll(nomi,n);
+  double tutti=(Adesso()-inizio)/n;
+  DestroyHash();
+  //ripristino completo dal registro su disco
+  Svuota();
+  CreateHash(32,1,DIM_MSG);
+  ApriRegistro(cartella,NULL,0);
+  for(long i=0;i<n;i++)
+    Insert(nomi[i].nome);
+  ChiudiRegistro();
+  DestroyHash();
+  CreateHash(32,1,DIM_MSG);
+  inizio=Adesso();
+  size_t trovati=ApriRegistro(cartella,NULL,0);
+  double apri=(Adesso()-inizio)/1e6;
+  ChiudiRegistro();
+  DestroyHash();
+  if(trovati!=(size_t)n)
+    fprintf(stderr,"errore: ripristinati %zu utenti su %ld\n",trovati,n);
+  printf("%10ld %12.1f %12.1f %16.1f\n",n,uno,tutti,apri);
+  free(nomi);
+}
+
+int main(int argc, char **argv){
+  long max=UTENTI;
+  if(argc>1)
+    max=atol(argv[1]);
+  if(mkdtemp(cartella)==NULL){
+    perror("mkdtemp");
+    return -1;
+  }
+  CreaSlab(DIM_MSG);
+  CreaEpoche();
+  CreateHash_G(32);
+  printf("%10s %12s %12s %16s\n","utenti","Insert ns","InsertAll ns","ApriRegistro ms");
+  for(long n=1000;n<=max;n*=10)
+    Misura(n);
+  DestroyHash_G();
+  DestroyEpoche();
+  Svuota();
+  rmdir(cartella);
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file bench_utenti.c
+ * @brief Misura il costo di Insert, Search e Delete sulla tabella degli utenti registrati, da mille a dieci milioni di utenti
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Per ogni dimensione vengono inseriti gli utenti, cercati tutti una volta (e altrettanti nomi non registrati) ed
+ * eliminati tutti. Oltre al tempo medio viene riportato l'inserimento più lento, che mostra se i ridimensionamenti
+ * della tabella fermano le altre operazioni. Gli utenti non ricevono messaggi, quindi la loro history non viene allocata.
+ * Uso: ./bench_utenti [numero massimo di utenti]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <hash_history.h>
+#include <slab.h>
+#include <epoca.h>
+
+//numero massimo di utenti se non specificato
+#define UTENTI 10000000
+
+//dimensione dei messaggi della history
+#define DIM_MSG 16
+
+/**
+ * @function Adesso
+ * @brief Restituisce l'istante attuale
+ * @return l'istante attuale in nanosecondi
+ */
+static double Adesso(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec*1e9+t.tv_nsec;
+}
+
+/**
+ * @function Nome
+ * @brief Scrive il nome dell'i-esimo utente
+ * @param buf indica dove scrivere il nome
+ * @param i indica l'indice dell'utente
+ * @param registrato vale 1 per un utente registrato, 0 per uno che non lo è
+ */
+static void Nome(char *buf, long i, int registrato){
+  snprintf(buf,MAX_NAME_LENGTH+1,"%s%ld",registrato ? "utente" : "assente",i);
+}
+
+/**
+ * @function Misura
+ * @brief Misura le operazioni sulla tabella con un certo numero di utenti
+ * @param n indica il numero di utenti
+ */
+static void Misura(long n){
+  char nome[MAX_NAME_LENGTH+1];
+  double peggiore=0, inizio, t;
+  CreateHash(32,1,DIM_MSG);
+  inizio=Adesso();
+  for(long i=0;i<n;i++){
+    Nome(nome,i,1);
+    t=Adesso();
+    Insert(nome);
+    t=Adesso()-t;
+    if(t>peggiore) peggiore=t;
+  }
+  double ins=(Adesso()-inizio)/n;
+  long trovati=0;
+  inizio=Adesso();
+  for(long i=0;i<n;i++){
+    Nome(nome,i,1);
+    trovati+=(Search(nome)!=NULL);
+  }
+  double hit=(Adesso()-inizio)/n;
+  inizio=Adesso();
+  for(long i=0;i<n;i++){
+    Nome(nome,i,0);
+    trovati-=(Search(nome)!=NULL);
+  }
+  double miss=(Adesso()-inizio)/n;
+  inizio=Adesso();
+  for(long i=0;i<n;i++){
+    Nome(nome,i,1);
+    Delete(nome);
+  }
+  double del=(Adesso()-inizio)/n;
+  DestroyHash();
+  if(trovati!=n)
+    fprintf(stderr,"errore: trovati %ld utenti su %ld\n",trovati,n);
+  printf("%10ld %12.1f %12.1f %12.1f %12.1f %14.1f\n",n,ins,hit,miss,del,peggiore/1e3);
+}
+
+int main(int argc, char **argv){
+  long max=UTENTI;
+  if(argc>1)
+    max=atol(argv[1]);
+  CreaSlab(DIM_MSG);
+  CreaEpoche();
+  printf("%10s %12s %12s %12s %12s %14s\n","utenti","Insert ns","Search ns","assenti ns","Delete ns","Insert max us");
+  for(long n=1000;n<=max;n*=10)
+    Misura(n);
+  DestroyEpoche();
+  return 0;
+}
@@ -0,0 +1,306 @@
+/**
+ * @file cachefile.c
+ * @brief File per la gestione della cache dei file richiesti con GETFILE_OP, mappati in memoria ed eliminati in ordine LRU
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Un file richiesto viene mappato in memoria e resta nella cache finchè la somma delle dimensioni dei file presenti
+ * non supera il budget, oltre il quale vengono tolti i file usati meno di recente. Ogni voce ha un contatore di
+ * riferimenti: chi la ottiene con PrendiFile la rilascia con RilasciaFile quando ha finito di inviarla, e la mappatura
+ * viene eliminata solo quando la voce non fa più parte della cache e nessuno la sta inviando.
+ * Un file non presente viene aperto e mappato fuori dalla mutua-esclusione: se nel frattempo un file è stato sostituito
+ * (il contatore delle invalidazioni è cambiato) la mappatura potrebbe essere quella vecchia, quindi non viene inserita
+ * nella cache e il contenuto viene inviato dal descrittore già aperto.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <config.h>
+#include <cachefile.h>
+
+//macro per allocazioni dinamiche
+#define SYSCALL_D(r,c,e) \
+    if((r=c)==NULL) { perror(e); exit(-1); }
+
+/**
+ * @var tabella è la tabella hash delle voci, indicizzata tramite il percorso del file
+ */
+static Voce **tabella=NULL;
+
+/**
+ * @var primo è la voce usata più di recente
+ * @var ultimo è la voce usata meno di recente, la prima ad essere tolta
+ */
+static Voce *primo=NULL, *ultimo=NULL;
+
+/**
+ * @var budget_c indica il numero massimo di byte mappati dalla cache
+ * @var usati indica il numero di byte dei file presenti nella cache
+ */
+static size_t budget_c=0, usati=0;
+
+/**
+ * @var hit indica il numero di richieste servite dalla memoria
+ * @var miss indica il numero di richieste che hanno aperto il file
+ */
+static unsigned long hit=0, miss=0;
+
+/**
+ * @var invalidazioni indica il numero di chiamate ad InvalidaFile, incrementato in mutua-esclusione sulla cache
+ */
+static unsigned long invalidazioni=0;
+
+/**
+ * @var mutex_cache è la variabile di mutua-esclusione sulla cache
+ */
+static pthread_mutex_t mutex_cache=PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @function Chiave
+ * @brief Calcola la posizione di un percorso nella tabella
+ * @param nome indica il percorso del file
+ * @return la posizione nella tabella
+ */
+static unsigned int Chiave(char *nome){
+  unsigned int h=0;
+  for(;*nome;nome++)
+    h=h*31+(unsigned char)*nome;
+  return h%CACHE_FILE_BUCKET;
+}
+
+/**
+ * @function Cerca
+ * @brief Cerca la voce associata ad un percorso, da chiamare in mutua-esclusione sulla cache
+ * @param nome indica il percorso del file
+ * @return la voce, NULL se il file non è nella cache
+ */
+static Voce * Cerca(char *nome){
+  for(Voce *v=tabella[Chiave(nome)];v!=NULL;v=v->succ)
+    if(!strcmp(v->nome,nome))
+      return v;
+  return NULL;
+}
+
+/**
+ * @function Stacca
+ * @brief Toglie una voce dalla lista LRU, da chiamare in mutua-esclusione sulla cache
+ * @param v indica la voce
+ */
+static void Stacca(Voce *v){
+  if(v->prev!=NULL) v->prev->next=v->next;
+  else primo=v->next;
+  if(v->next!=NULL) v->next->prev=v->prev;
+  else ultimo=v->prev;
+  v->prev=v->next=NULL;
+}
+
+/**
+ * @function InTesta
+ * @brief Mette una voce in testa alla lista LRU, da chiamare in mutua-esclusione sulla cache
+ * @param v indica la voce
+ */
+static void InTesta(Voce *v){
+  v->prev=NULL;
+  v->next=primo;
+  if(primo!=NULL) primo->prev=v;
+  primo=v;
+  if(ultimo==NULL) ultimo=v;
+}
+
+/**
+ * @function Elimina
+ * @brief Elimina la mappatura di una voce e la voce stessa
+ * @param v indica la voce
+ */
+static void Elimina(Voce *v){
+  munmap(v->mappa,v->len);
+  free(v->nome);
+  free(v);
+}
+
+/**
+ * @function Togli
+ * @brief Toglie una voce dalla cache e rilascia il riferimento della cache, da chiamare in mutua-esclusione sulla cache
+ * @param v indica la voce
+ * @return 1 se non ci sono altri riferimenti e la voce va eliminata, 0 altrimenti
+ */
+static int Togli(Voce *v){
+  Voce **p=&tabella[Chiave(v->nome)];
+  while(*p!=v)
+    p=&((*p)->succ);
+  *p=v->succ;
+  Stacca(v);
+  usati-=v->len;
+  return --v->rif==0;
+}
+
+/**
+ * @function CreaCacheFile
+ * @brief Crea la cache dei file
+ * @param budget indica il numero massimo di byte dei file mappati dalla cache, 0 disattiva la cache
+ */
+void CreaCacheFile(size_t budget){
+  budget_c=budget;
+  SYSCALL_D(tabella, calloc(CACHE_FILE_BUCKET,sizeof(Voce*)), "calloc");
+}
+
+/**
+ * @function PrendiFile
+ * @brief Restituisce la voce della cache associata ad un file, mappandolo in memoria se non è già presente
+ * @param pathname indica il percorso del file
+ * @param file indica dove restituire il descrittore del file aperto in lettura quando non viene restituita una voce, -1 se il file non esiste
+ * @param len indica dove restituire la dimensione del file
+ * @return la voce, da rilasciare con RilasciaFile, NULL se il file non è nella cache e non può esservi inserito
+ */
+Voce * PrendiFile(char *pathname, int *file, size_t *len){
+  pthread_mutex_lock(&mutex_cache);
+  Voce *v=Cerca(pathname);
+  if(v!=NULL){
+    //il file è già mappato, lo invio senza aprirlo
+    hit++;
+    v->rif++;
+    Stacca(v);
+    InTesta(v);
+    *len=v->len;
+    pthread_mutex_unlock(&mutex_cache);
+    return v;
+  }
+  miss++;
+  unsigned long inv=invalidazioni;
+  pthread_mutex_unlock(&mutex_cache);
+  //il file viene aperto e mappato fuori dalla mutua-esclusione
+  *file=open(pathname,O_RDONLY);
+  if(*file<0)
+    return NULL;
+  struct stat filestat;
+  if(fstat(*file,&filestat)==-1 || !S_ISREG(filestat.st_mode)){
+    close(*file);
+    *file=-1;
+    return NULL;
+  }
+  *len=filestat.st_size;
+  //i file vuoti o più grandi del budget vengono inviati direttamente dal file
+  if(*len==0 || *len>budget_c)
+    return NULL;
+  char *mappa=mmap(NULL,*len,PROT_READ,MAP_SHARED,*file,0);
+  if(mappa==MAP_FAILED)
+    return NULL;
+  SYSCALL_D(v, malloc(sizeof(Voce)), "malloc");
+  SYSCALL_D(v->nome, strdup(pathname), "strdup");
+  v->mappa=mappa;
+  v->len=*len;
+  //un riferimento è della cache, l'altro del chiamante
+  v->rif=2;
+  v->prev=v->next=NULL;
+  Voce *elimina=NULL;
+  pthread_mutex_lock(&mutex_cache);
+  if(invalidazioni!=inv){
+    //un file è stato sostituito dopo l'apertura, non inserisco una mappatura che potrebbe essere vecchia
+    pthread_mutex_unlock(&mutex_cache);
+    Elimina(v);
+    return NULL;
+  }
+  close(*file);
+  *file=-1;
+  Voce *altra=Cerca(pathname);
+  if(altra!=NULL){
+    //un altro thread ha mappato lo stesso file nel frattempo, uso la sua voce
+    altra->rif++;
+    *len=altra->len;
+    pthread_mutex_unlock(&mutex_cache);
+    Elimina(v);
+    return altra;
+  }
+  unsigned int k=Chiave(pathname);
+  v->succ=tabella[k];
+  tabella[k]=v;
+  InTesta(v);
+  usati+=v->len;
+  //tolgo i file usati meno di recente finchè la cache non rientra nel budget
+  while(usati>budget_c && ultimo!=v){
+    Voce *u=ultimo;
+    if(Togli(u)){
+      u->succ=elimina;
+      elimina=u;
+    }
+  }
+  pthread_mutex_unlock(&mutex_cache);
+  //le mappature vengono eliminate fuori dalla mutua-esclusione
+  while(elimina!=NULL){
+    Voce *u=elimina;
+    elimina=u->succ;
+    Elimina(u);
+  }
+  return v;
+}
+
+/**
+ * @function RilasciaFile
+ * @brief Rilascia un riferimento ad una voce, eliminando la mappatura quando non ci sono più riferimenti
+ * @param v indica la voce
+ */
+void RilasciaFile(Voce *v){
+  if(v==NULL) return;
+  pthread_mutex_lock(&mutex_cache);
+  int fine=(--v->rif==0);
+  pthread_mutex_unlock(&mutex_cache);
+  if(fine)
+    Elimina(v);
+}
+
+/**
+ * @function InvalidaFile
+ * @brief Toglie un file dalla cache, da chiamare dopo averne sostituito il contenuto
+ * @param pathname indica il percorso del file
+ *
+ * Chi sta ancora inviando il vecchio contenuto continua ad usare la propria mappatura, che viene eliminata con l'ultimo riferimento.
+ * Una PrendiFile che ha aperto il file prima dell'invalidazione non inserisce la sua mappatura nella cache.
+ */
+void InvalidaFile(char *pathname){
+  if(tabella==NULL) return;
+  pthread_mutex_lock(&mutex_cache);
+  invalidazioni++;
+  Voce *v=Cerca(pathname);
+  int fine=(v!=NULL && Togli(v));
+  pthread_mutex_unlock(&mutex_cache);
+  if(fine)
+    Elimina(v);
+}
+
+/**
+ * @function StampaCacheFile
+ * @brief Stampa su file i contatori della cache (richieste servite dalla memoria e richieste che hanno aperto il file)
+ * @param fp indica il file su cui stampare
+ */
+void StampaCacheFile(FILE *fp){
+  pthread_mutex_lock(&mutex_cache);
+  unsigned long h=hit, m=miss, tot=hit+miss;
+  size_t u=usati;
+  pthread_mutex_unlock(&mutex_cache);
+  fprintf(fp,"# filecache %lu %lu %.1f%% %zu\n",h,m,tot ? 100.0*h/tot : 0.0,u);
+}
+
+/**
+ * @function DestroyCacheFile
+ * @brief Elimina la cache dei file, da chiamare dopo la terminazione degli altri thread
+ */
+void DestroyCacheFile(){
+  if(tabella==NULL) return;
+  while(ultimo!=NULL){
+    Voce *v=ultimo;
+    if(Togli(v))
+      Elimina(v);
+  }
+  free(tabella);
+  tabella=NULL;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file cachefile.h
+ * @brief File per la gestione della cache dei file richiesti con GETFILE_OP, mappati in memoria ed eliminati in ordine LRU
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef CACHEFILE_H_
+#define CACHEFILE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * @struct Voce
+ * @brief è la struttura che rappresenta un file mappato in memoria
+ * @var nome indica il percorso del file
+ * @var mappa indica l'inizio della zona di memoria in cui è mappato il file
+ * @var len indica la dimensione del file
+ * @var rif indica il numero di riferimenti alla voce, compreso quello della cache finchè la voce ne fa parte
+ * @var prev puntatore alla voce usata più di recente nella lista LRU
+ * @var next puntatore alla voce usata meno di recente nella lista LRU
+ * @var succ puntatore alla voce successiva nella stessa lista di trabocco della tabella
+ */
+typedef struct Voce1{
+  char *nome;
+  char *mappa;
+  size_t len;
+  int rif;
+  struct Voce1 *prev;
+  struct Voce1 *next;
+  struct Voce1 *succ;
+}Voce;
+
+/**
+ * @function CreaCacheFile
+ * @brief Crea la cache dei file
+ * @param budget indica il numero massimo di byte dei file mappati dalla cache, 0 disattiva la cache
+ */
+void CreaCacheFile(size_t budget);
+
+/**
+ * @function PrendiFile
+ * @brief Restituisce la voce della cache associata ad un file, mappandolo in memoria se non è già presente
+ * @param pathname indica il percorso del file
+ * @param file indica dove restituire il descrittore del file aperto in lettura quando non viene restituita una voce, -1 se il file non esiste
+ * @param len indica dove restituire la dimensione del file
+ * @return la voce, da rilasciare con RilasciaFile, NULL se il file non è nella cache e non può esservi inserito
+ */
+Voce * PrendiFile(char *pathname, int *file, size_t *len);
+
+/**
+ * @function RilasciaFile
+ * @brief Rilascia un riferimento ad una voce, eliminando la mappatura quando non ci sono più riferimenti
+ * @param v indica la voce
+ */
+void RilasciaFile(Voce *v);
+
+/**
+ * @function InvalidaFile
+ * @brief Toglie un file dalla cache, da chiamare dopo averne sostituito il contenuto
+ * @param pathname indica il percorso del file
+ *
+ * Chi sta ancora inviando il vecchio contenuto continua ad usare la propria mappatura, che viene eliminata con l'ultimo riferimento.
+ * Una PrendiFile che ha aperto il file prima dell'invalidazione non inserisce la sua mappatura nella cache.
+ */
+void InvalidaFile(char *pathname);
+
+/**
+ * @function StampaCacheFile
+ * @brief Stampa su file i contatori della cache (richieste servite dalla memoria e richieste che hanno aperto il file)
+ * @param fp indica il file su cui stampare
+ */
+void StampaCacheFile(FILE *fp);
+
+/**
+ * @function DestroyCacheFile
+ * @brief Elimina la cache dei file, da chiamare dopo la terminazione degli altri thread
+ */
+void DestroyCacheFile();
+
+#endif /* CACHEFILE_H_ */
@@ -26,12 +26,15 @@
 #include <pthread.h>
 
 #define UNIX_PATH_MAX 108
+//prefisso dei file temporanei in cui viene ricevuto il contenuto di una POSTFILE_OP
+#define PREFISSO_CARICAMENTO ".caricamento-"
 
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <config.h>
 #include <stats.h>
 #include <fcntl.h>
@@ -44,8 +47,14 @@
 #include <coda.h>
 #include <stats.h>
 #include <online.h>
+#include <sessione.h>
+#include <slab.h>
+#include <cachefile.h>
+#include <epoca.h>
 #include <hash_history.h>
 #include <hash_gruppi.h>
+#include <archivio.h>
+#include <registro.h>
 
 //macro per chiamate di sistema
 #define SYSCALL(r,c) \
@@ -65,15 +74,10 @@
 struct statistics  chattyStats = { 0,0,0,0,0,0,0 };
 
 /**
-* @var fine variabile usata per la gestione dei segnali 
-*/
-volatile sig_atomic_t fine=0;
-
-/**
-* @var pfd usata per la gestione della pipe
+* @var epfd descrittore dell'epoll, usato dai worker per riarmare le connessioni
   @var notused usata come variabile di ritorno dalle funzioni passate come argomento alle MACRO
 */
-int pfd[2], notused;
+int epfd, notused;
 
 /**
  * @function IncrError
@@ -106,10 +110,10 @@ int DeRegistra(long fd, message_t *msg){
     IncrError(); //incremento il numero di errori
   }
   else{
-    //se esiste invece invio un messaggio di ok
-    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-    //elimino l'utente dalla hash
+    //se esiste invece elimino l'utente dalla hash
     Delete(msg->hdr.sender);
+    //e invio un messaggio di ok, dopo che l'eliminazione è stata salvata
+    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
     //elimino l'utente dalla lista degli online
     DeleteOnline(fd);
     pthread_mutex_lock(&mutex_stat);
@@ -139,10 +143,8 @@ int Connetti(long fd, message_t *msg){
       //rilascio la mutua-esclusione sulle statistiche
       pthread_mutex_unlock(&mutex_stat); 
     }
-    //invio un messaggio di ok al client
-    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-    //mando la lista degli online al client
-    ListaOnline(fd, msg);
+    //invio al client un messaggio di ok seguito dalla lista degli online
+    ListaOnline(fd, msg, OP_OK);
   }
   else{
     //se non esiste allora invio un messaggio di errore
@@ -169,12 +171,10 @@ int Registra(long fd, message_t *msg){
   else{
     //se non esiste allora lo aggiungo agli online
     PushOnline(fd, msg);
-    //invio un messaggio di ok al client
-    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
     //inserisco l'utente nell'hash
     Insert(msg->hdr.sender);
-    //invio la lista degli utenti online al client
-    ListaOnline(fd, msg);
+    //invio al client un messaggio di ok seguito dalla lista degli utenti online
+    ListaOnline(fd, msg, OP_OK);
     //elimino l'utente dalla lista degli utenti online
     DeleteOnline(fd);
     pthread_mutex_lock(&mutex_stat);
@@ -201,11 +201,18 @@ int PostTxt(long fd, message_t *msg){
     return 1;
   }
    //controllo se l'operazione richiesta è l'invio di un messaggio testuale ad un gruppo
-  if(FindGroup(fd,msg,TXT_MESSAGE)){
+  int gruppo=FindGroup(fd,msg,TXT_MESSAGE);
+  if(gruppo>0){
     //invio un messaggio di ok al client
     SendHdr_mutex(fd, &(msg->hdr), OP_OK);
     return 1;
   }
+  if(gruppo<0){
+    //il messaggio non è stato reso persistente come richiesto dalla politica
+    SendHdr_mutex(fd, &(msg->hdr), OP_FAIL);
+    IncrError();
+    return 1;
+  }
   //cerco se l'utente a cui inviare il messaggio esiste
   if(Search(msg->data.hdr.receiver)==NULL){
     //se non esiste allora invio un messaggio di errore al client
@@ -214,7 +221,7 @@ int PostTxt(long fd, message_t *msg){
     return 1;
   }
   //aggiungo il messaggio alla history del destinatario
-  Add_H(msg,TXT_MESSAGE);
+  int esito=Add_H(msg,TXT_MESSAGE);
   //ottengo il descrittore del destinatario
   long fd2=GetFd(msg->data.hdr.receiver);
   //se è online gli invio il messaggio e incremento il numero di messaggi testuali consegnati
@@ -229,32 +236,27 @@ int PostTxt(long fd, message_t *msg){
     chattyStats.nnotdelivered++;
     pthread_mutex_unlock(&mutex_stat);
   }
-  //invio un messaggio di ok al client
-  SendHdr_mutex(fd, &(msg->hdr), OP_OK);
+  //invio un messaggio di ok al client, o di errore se il messaggio non è stato reso persistente come richiesto
+  if(esito<0){
+    SendHdr_mutex(fd, &(msg->hdr), OP_FAIL);
+    IncrError();
+  }
+  else
+    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
   return 1;
 }
 
 /**
- * @function CreaLista
- * @brief Crea un array di stringhe
- * @return un puntatore che rappresenta l'array di stringhe
- */
-char ** CreaLista(){
-  char **lista=malloc(sizeof(char*)*maxhistmsgs);
-  if(lista!=NULL)
-    for(int j=0;j<maxhistmsgs;j++)
-     lista[j]=malloc(sizeof(char)*(MAX_NAME_LENGTH+1));
-  return lista;
-}
-
-/**
- * @function CancellaLista
- * @brief Elimina la memoria allocata per l'allocazione dell'array di stringhe
+ * @function ContaConsegne
+ * @brief Aggiorna le statistiche dei messaggi testuali con l'esito di una parte di un invio a tutti
+ * @param consegnati indica il numero di messaggi consegnati
+ * @param non_consegnati indica il numero di messaggi non ancora consegnati
  */
-void CancellaLista(char **lista){
-  for(int j=0;j<maxhistmsgs;j++)
-    free(lista[j]);
-  free(lista);
+static void ContaConsegne(int consegnati, int non_consegnati){
+  pthread_mutex_lock(&mutex_stat);
+  chattyStats.ndelivered+=consegnati;
+  chattyStats.nnotdelivered+=non_consegnati;
+  pthread_mutex_unlock(&mutex_stat);
 }
 
 /**
@@ -272,29 +274,13 @@ int PostAll(long fd, message_t *msg){
     IncrError();
     return 1;
   }
-  //creo un array di stringhe per contenere la lista degli utenti a cui inviare il messaggio
-  char **lista=CreaLista();
-  //aggiungo il messaggio nella history di tutti gli utenti e mi faccio restituire il numero di utenti a cui è stato inviato il messaggio
-  int cont=AddtoAll_H(msg,lista);
-  for(int i=0;i<cont;++i){
-    //ottengo il descrittore dell'utente a cui inviare il messaggio
-    long fd=GetFd(lista[i]);
-    //se l'utente è online allora invia il messaggio
-    if(SendMsg_mutex(fd,msg,TXT_MESSAGE)){
-      pthread_mutex_lock(&mutex_stat);
-      //incrementa il numero di messaggi testuali consegnati
-      chattyStats.ndelivered++;
-      pthread_mutex_unlock(&mutex_stat);
-    }
-    else{
-      pthread_mutex_lock(&mutex_stat);
-      //incrementa il numero di messaggi testuali non ancora consegnati
-      chattyStats.nnotdelivered++;
-      pthread_mutex_unlock(&mutex_stat);
-    }  
+  //aggiungo il messaggio nella history di tutti gli utenti, la consegna a quelli online prosegue sui worker
+  if(AddtoAll_H(msg,ContaConsegne)<0){
+    //il messaggio non è stato reso persistente come richiesto dalla politica
+    SendHdr_mutex(fd, &(msg->hdr), OP_FAIL);
+    IncrError();
+    return 1;
   }
-  //cancella l'array di stringhe precedentemente allocato
-  CancellaLista(lista);
   //invio un messaggio di ok al client che ha fatto richiesta
   SendHdr_mutex(fd, &(msg->hdr), OP_OK);
   return 1;
@@ -306,6 +292,9 @@ int PostAll(long fd, message_t *msg){
  * @param fd indica il descrittore del client che vuole ricevere i messaggi ricevuti
  * @param msg puntatore per l'accesso ai campi della struttura message_t
  * @return 1
+ *
+ * Con GETNEWMSGS_OP il body della richiesta contiene il numero di sequenza da cui partire, e vengono inviati solo i
+ * messaggi successivi insieme al numero di sequenza da chiedere la volta successiva.
  */
 int GetMessage(long fd, message_t *msg){
   //cerco se l'utente esiste
@@ -315,11 +304,16 @@ int GetMessage(long fd, message_t *msg){
     IncrError();
   }
   else{
-    //se esiste invio un messaggio di ok
-    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
     int mex_inviati=0, file_inviati=0;  
-    //ottengo e invio i messaggi ricevuti dal client che me l'ha richiesti, e mi faccio restituire il numero di file e messaggi testuali consegnati
-    mex_inviati=GetHistory(fd,msg,&file_inviati);
+    size_t dopo=0, *nuovi=NULL;
+    //un numero di sequenza mancante equivale a chiedere tutta la history
+    if(msg->hdr.op==GETNEWMSGS_OP){
+      if(msg->data.buf!=NULL && msg->data.hdr.len>=sizeof(size_t))
+        memcpy(&dopo,msg->data.buf,sizeof(size_t));
+      nuovi=&dopo;
+    }
+    //invio un messaggio di ok seguito dai messaggi ricevuti dal client che me l'ha richiesti, e mi faccio restituire il numero di file e messaggi testuali consegnati
+    mex_inviati=GetHistory(fd,msg,&file_inviati,nuovi);
     pthread_mutex_lock(&mutex_stat);
     //incrmento il numero di messaggi testuali consegnati
     chattyStats.ndelivered+=mex_inviati;
@@ -338,75 +332,139 @@ int GetMessage(long fd, message_t *msg){
  * @return 1
  */
 int UserList(long fd, message_t *msg){
-  //invio un messaggio di ok
-  SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-  //invio la lista degli utenti online al client che ne ha fatto richiesta
-  ListaOnline(fd, msg);
+  //invio un messaggio di ok seguito dalla lista degli utenti online al client che ne ha fatto richiesta
+  ListaOnline(fd, msg, OP_OK);
   return 1;
 }
 
 /**
- * @function CreaFile
- * @brief Crea un file
- * @param fd indica il descrittore del client che vuole inviare il file
- * @param msg puntatore per l'accesso ai campi della struttura message_t
- * @return <=0 in caso di errori, 1 altrimenti
+ * @function Percorso
+ * @brief Costruisce il percorso di un file nella directory DirName
+ * @param msg puntatore per l'accesso ai campi della struttura message_t, data.buf contiene il nome del file
+ * @return il percorso del file, da liberare con Libera, NULL se il nome è quello di un file temporaneo
  */
-int CreaFile(long fd, message_t *msg){
+char * Percorso(message_t *msg){
   //estraggo il nome del file dal messaggio ricevuto
   char *str=basename(msg->data.buf);
+  //i file temporanei dei caricamenti in corso non possono essere letti nè sovrascritti dai client
+  if(!strncmp(str,PREFISSO_CARICAMENTO,strlen(PREFISSO_CARICAMENTO)))
+    return NULL;
   int dim=(strlen(dirName)+strlen(str)+2);
-  char *pathname;
-  SYSCALL_D(pathname,malloc(sizeof(char)*dim),"malloc");
+  char *pathname=Alloca(sizeof(char)*dim);
   strncpy(pathname,dirName,dim);
   strncat(pathname,str,msg->data.hdr.len);
-  free(msg->data.buf);
-  //leggo il contenuto del messaggio
-  if(readData(fd,&(msg->data))<0)
-    return -1;
-  //controllo che la lunghezza del file non sia maggiore di quella consentita dal file di configurazione
-  if(msg->data.hdr.len>(maxfilesize*1024))
-    return 0;
-  //apro il file in scrittura
-  int fd2=open(pathname,O_CREAT|O_WRONLY|O_TRUNC,0777);
-  free(pathname);
-  if(fd2<0)
+  return pathname;
+}
+
+/**
+ * @function CreaFile
+ * @brief Crea il file temporaneo in cui verrà scritto il contenuto ricevuto dal client
+ * @param msg puntatore per l'accesso ai campi della struttura message_t
+ * @param pathname indica dove restituire il percorso definitivo del file, da liberare con Libera
+ * @param temporaneo indica dove restituire il percorso del file temporaneo, da liberare con Libera
+ * @return il descrittore del file temporaneo aperto in scrittura, -1 in caso di errore
+ *
+ * Il file con il nome definitivo resta quello vecchio finchè il contenuto nuovo non è stato ricevuto per intero.
+ */
+int CreaFile(message_t *msg, char **pathname, char **temporaneo){
+  *temporaneo=NULL;
+  if((*pathname=Percorso(msg))==NULL)
     return -1;
-  //scrivo nel file il contenuto ricevuto
-  SYSCALL(notused, writen(fd2,msg->data.buf,msg->data.hdr.len));
-  //chiudo il file
-  SYSCALL(notused, close(fd2)); 
+  int dim=strlen(dirName)+sizeof(PREFISSO_CARICAMENTO "XXXXXX");
+  *temporaneo=Alloca(dim);
+  snprintf(*temporaneo,dim,"%s" PREFISSO_CARICAMENTO "XXXXXX",dirName);
+  int fd2=mkstemp(*temporaneo);
+  if(fd2<0){
+    Libera(*pathname);
+    Libera(*temporaneo);
+    *pathname=*temporaneo=NULL;
+  }
+  return fd2;
+}
+
+/**
+ * @function Scarta
+ * @brief Invia un messaggio di errore al client e fa sì che il contenuto del file che segue la richiesta venga ignorato
+ * @param fd indica il descrittore del client
+ * @param s indica la sessione del client
+ * @param msg puntatore per l'accesso ai campi della struttura message_t
+ * @param file indica l'header del file
+ * @param op indica il codice di errore da inviare
+ * @return 1
+ */
+int Scarta(long fd, Sessione *s, message_t *msg, message_data_t *file, op_t op){
+  SendHdr_mutex(fd, &(msg->hdr), op);
+  IncrError();
+  IniziaCaricamento(s, -1, NULL, NULL, file->hdr.len, msg);
   return 1;
 }
 
 /**
  * @function PostFile
- * @brief Invia un file
+ * @brief Controlla una richiesta di invio di un file e avvia la ricezione del contenuto, che viene scritto su disco a blocchi man mano che arriva
  * @param fd indica il descrittore del client che vuole inviare il file ad un utente o a tutti gli utenti di un gruppo
  * @param msg puntatore per l'accesso ai campi della struttura message_t
+ * @param file indica l'header del file ricevuto dal client
  * @return 1
  */
-int PostFile(long fd, message_t *msg){
+int PostFile(long fd, message_t *msg, message_data_t *file){
+  Sessione *s=GetSessione(fd);
   //controllo se la lunghezza del messaggio è maggiore di quella prevista nel file di configurazione
-  if(msg->data.hdr.len>maxmsgsize){
-    //se lo è allora invio un messaggio di errore al client
-    SendHdr_mutex(fd, &(msg->hdr), OP_MSG_TOOLONG);
-    readData(fd,&(msg->data));
-    free(msg->data.buf); 
+  if(msg->data.hdr.len>maxmsgsize)
+    return Scarta(fd, s, msg, file, OP_MSG_TOOLONG);
+  //controllo che la lunghezza del file non sia maggiore di quella consentita, prima di riceverne il contenuto
+  if(file->hdr.len>(maxfilesize*1024))
+    return Scarta(fd, s, msg, file, OP_MSG_TOOLONG);
+  //controllo che il destinatario esista, i destinatari verranno avvisati solo quando il file sarà stato ricevuto
+  if(!SearchUser(msg->hdr.sender,Search_G(msg->data.hdr.receiver)) && Search(msg->data.hdr.receiver)==NULL)
+    return Scarta(fd, s, msg, file, OP_NICK_UNKNOWN);
+  //creo il file in cui scrivere il contenuto
+  char *pathname, *temporaneo;
+  int fd2=CreaFile(msg, &pathname, &temporaneo);
+  if(fd2<0)
+    return Scarta(fd, s, msg, file, OP_FAIL);
+  IniziaCaricamento(s, fd2, temporaneo, pathname, file->hdr.len, msg);
+  return 1;
+}
+
+/**
+ * @function FineCaricamento
+ * @brief Avvisa i destinatari di un file il cui contenuto è stato ricevuto per intero e risponde al client
+ * @param fd indica il descrittore del client che ha inviato il file
+ * @param s indica la sessione del client
+ */
+void FineCaricamento(long fd, Sessione *s){
+  Caricamento *c=&(s->car);
+  message_t *msg=&(c->msg);
+  //se il contenuto era da scartare la risposta è già stata inviata
+  if(c->file<0){
+    TerminaCaricamento(s);
+    return;
+  }
+  //il file completo prende il posto di quello vecchio, che chi lo sta già inviando continua a vedere
+  if(!c->errore && rename(c->percorso,c->destinazione)<0)
+    c->errore=1;
+  if(c->errore){
+    //la scrittura del file è fallita, il file temporaneo viene cancellato e resta la versione precedente
+    SendHdr_mutex(fd, &(msg->hdr), OP_FAIL);
     IncrError();
-    return 1;
+    TerminaCaricamento(s);
+    return;
   }
+  //tolgo dalla cache il contenuto precedente
+  InvalidaFile(c->destinazione);
   //controllo se l'operazione richiesta è l'invio di un messaggio ad un gruppo
-  if(!FindGroup(fd,msg,FILE_MESSAGE)){
-    //controllo se il destinatario del file esiste
+  int esito=FindGroup(fd,msg,FILE_MESSAGE);
+  if(esito==0){
+    //controllo se il destinatario del file esiste ancora
     if(Search(msg->data.hdr.receiver)==NULL){
-      //se non esiste allora invio un messaggio di errore al client
       SendHdr_mutex(fd, &(msg->hdr), OP_NICK_UNKNOWN);
       IncrError();
-      return 1;
+      TerminaCaricamento(s);
+      return;
     }
     //altrimenti aggiungo il file alla history dell'utente
-    Add_H(msg,FILE_MESSAGE);
+    esito=(Add_H(msg,FILE_MESSAGE)<0) ? -1 : 1;
     //ottengo il descrittore dell'utente a cui inviare il file
     long fd2=GetFd(msg->data.hdr.receiver);
     //se è online allora invio il file
@@ -423,89 +481,75 @@ int PostFile(long fd, message_t *msg){
       pthread_mutex_unlock(&mutex_stat);
     }
   }
-  //creo il file e in caso di successo invio un messaggio di ok
-  if(CreaFile(fd, msg))
-    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-  else{ 
-    //altrimenti invio un messaggio di errore
-    SendHdr_mutex(fd, &(msg->hdr), OP_MSG_TOOLONG);
+  //il file è stato salvato, ma il messaggio non è stato reso persistente come richiesto dalla politica
+  if(esito<0){
+    SendHdr_mutex(fd, &(msg->hdr), OP_FAIL);
     IncrError();
   }
-  free(msg->data.buf);
-  return 1;
-}
-
-/**
- * @function ApriFile
- * @brief Apre un file in lettura
- * @param fd indica il descrittore del client che vuole leggere il contenuto di un file
- * @param msg puntatore per l'accesso ai campi della struttura message_t
- * @return 1 in caso di successo, -1 altrimenti
- */
-int ApriFile(message_t *msg){
-  //estraggo il nome del file dal messaggio ricevuto
-  char *str=basename(msg->data.buf);
-  int dim=(strlen(dirName)+strlen(str)+2);
-  char *pathname;
-  SYSCALL_D(pathname,malloc(sizeof(char)*dim),"malloc");
-  strncpy(pathname,dirName,dim);
-  strncat(pathname,str,msg->data.hdr.len);
-  //apro il file in lettura
-  int fd=open(pathname,O_RDONLY|O_TRUNC,0666);
-  free(pathname);
-  if(fd<0)
-    return -1;
-  struct stat filestat;
-  //ottengo informazioni sul file
-  SYSCALL(notused, fstat(fd,&filestat));
-  //imposto la lunghezza del messaggio
-  msg->data.hdr.len=filestat.st_size;
-  free(msg->data.buf);
-  msg->data.buf=calloc(msg->data.hdr.len,sizeof(char));
-  //leggo il contenuto del file e lo metto dentro la variabile buf della struttura message_t
-  SYSCALL(notused, readn(fd,msg->data.buf,filestat.st_size));
-  return 1;
+  else
+    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
+  TerminaCaricamento(s);
 }
 
 /**
  * @function GetFile
- * @brief Ottiene il contenuto di un file
+ * @brief Invia il contenuto di un file al client che lo ha richiesto
  * @param fd indica il descrittore del client che vuole leggere il contenuto del file
  * @param msg puntatore per l'accesso ai campi della struttura message_t
  * @return 1
  */
 int GetFile(long fd, message_t *msg){
-  //apre il file e legge il suo contenuto
-  ApriFile(msg);
-  //invia un messaggio di ok al client
-  SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-  //invia il contenuto del file al client
-  SendData_mutex(fd,&(msg->data));
+  char *pathname=Percorso(msg);
+  int file=-1;
+  size_t len=0;
+  Voce *v=NULL;
+  //cerco il file nella cache, se non c'è viene aperto ed eventualmente mappato
+  if(pathname!=NULL){
+    v=PrendiFile(pathname,&file,&len);
+    Libera(pathname);
+  }
+  if(v==NULL && file<0){
+    //se il file non esiste invio un messaggio di errore
+    SendHdr_mutex(fd, &(msg->hdr), OP_NO_SUCH_FILE);
+    IncrError();
+    return 1;
+  }
+  //imposto la lunghezza del messaggio, il contenuto verrà inviato direttamente dalla cache o dal file
+  msg->data.hdr.len=len;
+  if(v!=NULL)
+    SendMappa_mutex(fd, msg, OP_OK, v);
+  else
+    SendFile_mutex(fd, msg, OP_OK, file);
   return 1;
 }
 
+/**
+ * @function Disconnetti
+ * @brief Chiude la connessione con un client
+ * @param fd indica il descrittore del client
+ */
+void Disconnetti(long fd){
+  //elimino l'utente dalla lista online
+  DeleteOnline(fd);
+  //libero il buffer di ricezione e la coda di uscita associati al descrittore
+  ChiudiSessione(fd);
+  //chiudo il descrittore
+  SYSCALL2(notused, close(fd), "close");
+  pthread_mutex_lock(&mutex_stat);
+  if(chattyStats.nonline)
+    chattyStats.nonline--;
+  pthread_mutex_unlock(&mutex_stat);
+}
+
 /**
  * @function Gestisci
- * @brief riceve le richieste da parte dei client e richiama le funzioni opportune per la gestione
+ * @brief gestisce una richiesta da parte di un client richiamando le funzioni opportune
  * @param fd indica il descrittore del client che ha inviato la richiesta
+ * @param msg indica la richiesta estratta dal buffer di ricezione
+ * @param file indica l'header del file che segue una richiesta POSTFILE_OP
+ * @return >0 se il descrittore deve restare attivo, 0 altrimenti
  */
-void Gestisci(long fd){
-  message_t *msg=calloc(1,sizeof(message_t));
-  //leggo l'header del messaggio
-  int c=readHeader(fd, &(msg->hdr));
-  //controllo se la lettura è andata a buon fine
-  if(c<=0){
-    //in caso contrario elimino l'utente dalla lista online
-    DeleteOnline(fd);
-    //chiudo il descrittore
-    SYSCALL2(notused, close(fd), "close");
-    pthread_mutex_lock(&mutex_stat);
-    if(chattyStats.nonline)
-      chattyStats.nonline--;
-    pthread_mutex_unlock(&mutex_stat);
-    free(msg);
-    return;
-  }
+int Gestisci(long fd, message_t *msg, message_data_t *file){
   int n=0;
   switch(msg->hdr.op){
     case REGISTER_OP:{
@@ -515,99 +559,134 @@ void Gestisci(long fd){
       n=Connetti(fd,msg); 
     }break;
     case UNREGISTER_OP:{
-      if(readn(fd,&(msg->data),sizeof(message_data_hdr_t))){
-        n=DeRegistra(fd,msg); 
-        free(msg->data.buf); 
-      }
+      n=DeRegistra(fd,msg); 
     }break;
     case USRLIST_OP:{
       n=UserList(fd,msg);
-      free(msg->data.buf); 
     }break;
-    case GETPREVMSGS_OP:{
+    case GETPREVMSGS_OP:
+    case GETNEWMSGS_OP:{
       n=GetMessage(fd,msg); 
     }break;
     case POSTTXT_OP:{
-      if(readData(fd,&(msg->data))){
-        n=PostTxt(fd,msg);
-        free(msg->data.buf); 
-      }
+      n=PostTxt(fd,msg);
     }break;
     case POSTTXTALL_OP:{
-      if(readData(fd,&(msg->data))){
-        n=PostAll(fd,msg);
-        free(msg->data.buf); 
-      }
+      n=PostAll(fd,msg);
     }break;
     case POSTFILE_OP:{
-      if(readData(fd,&(msg->data))){
-        n=PostFile(fd,msg);
-      }
+      n=PostFile(fd,msg,file);
     }break;
     case GETFILE_OP: {
-      if(readData(fd, &(msg->data))){
-        n=GetFile(fd, msg);
-        free(msg->data.buf);
-      }
+      n=GetFile(fd, msg);
     }break;
     case CREATEGROUP_OP:{
-      if(readn(fd,&(msg->data),sizeof(message_data_hdr_t))){
-        n=CreaGruppo(fd,msg);
-      }
+      n=CreaGruppo(fd,msg);
     }break;
     case ADDGROUP_OP:{
-      if(readn(fd,&(msg->data),sizeof(message_data_hdr_t))){
-        n=AggiungiAlGruppo(fd,msg);
-      }
+      n=AggiungiAlGruppo(fd,msg);
     }break;
     case DELGROUP_OP:{
-      if(readn(fd,&(msg->data),sizeof(message_data_hdr_t))){
-        n=EliminaDalGruppo(fd,msg);
-      }
+      n=EliminaDalGruppo(fd,msg);
     }break;
     default:{
       //invio un messaggio di errore se l'operazione ricevuta non corrisponde con nessuna di quelle trattate
       setHeader(&(msg->hdr), OP_FAIL, "");
     }
   }
-  free(msg);
+  return n;
+}
+
+/**
+ * @function Servi
+ * @brief Gestisce le richieste già arrivate da un client, fino ad un massimo di MAX_RICHIESTE_TURNO per turno
+ * @param fd indica il descrittore del client
+ */
+void Servi(long fd){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL){
+    Disconnetti(fd);
+    return;
+  }
+  message_t msg;
+  message_data_t file;
+  int n=1, turno=0;
+  //gestisco le richieste complete presenti nel buffer, ricevendo nuovi dati con una sola recv quando il buffer non ne contiene
+  while(n>0 && turno<MAX_RICHIESTE_TURNO){
+    //durante il caricamento di un file i byte ricevuti vengono scritti su disco invece di essere interpretati come richieste
+    if(s->caricando){
+      int r=Carica(fd,s);
+      if(r>0){
+        FineCaricamento(fd,s);
+        turno++;
+        continue;
+      }
+      if(r==0) break;
+      Disconnetti(fd);
+      return;
+    }
+    int e=Estrai(s,&msg,&file);
+    if(e==2){
+      //il body della richiesta supera la lunghezza massima e viene scartato senza essere ricevuto nel buffer
+      SendHdr_mutex(fd, &(msg.hdr), OP_MSG_TOOLONG);
+      IncrError();
+      turno++;
+      continue;
+    }
+    if(e){
+      n=Gestisci(fd,&msg,&file);
+      turno++;
+      continue;
+    }
+    int r=Riempi(fd,s);
+    if(r>0) continue;
+    //non ci sono altri dati per ora, aspetto che il descrittore torni pronto
+    if(r<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+    //il client ha chiuso la connessione o c'è stato un errore
+    Disconnetti(fd);
+    return;
+  }
   if(n>0){
-    //scrivo sulla pipe il descrittore che ha fatto richiesta
-    SYSCALL2(notused, writen(pfd[1],&fd,sizeof(long)), "writen");
+    //se nel buffer restano richieste complete rimetto il descrittore nella coda di questo worker, dietro agli altri client
+    if(turno==MAX_RICHIESTE_TURNO && Completa(s))
+      Push(fd);
+    //altrimenti riarmo direttamente il descrittore nell'epoll, senza passare dal Listener
+    else
+      RilasciaSessione(fd);
   }
 }
 
 /**
  * @function Worker
  * @brief Thread che gestisce le richieste dei client
+ * @param arg indica l'indice del worker, e quindi della sua coda
  */
-static void* Worker(){
+static void* Worker(void *arg){
+  int id=(int)(long)arg;
   while(1){
-    //estrae un descrittore dalla coda
-    long ele=Pop();
+    //estrae un descrittore dalla propria coda, o da quella di un altro worker se la propria è vuota
+    long ele=Pop(id);
     //controlla che il descrittore sia > 0
     if(ele<0)break;
-    //richiama la funzione che gestisce la richiesta
-    Gestisci(ele);
+    //richiama la funzione che gestisce le richieste del client
+    Servi(ele);
   }
   return (void *)NULL;
 }
 
 /**
- * @function UpdateMax
- * @brief Aggiorna l'indice del descrittore maggiore
- * @param set indica l'insieme dei descrittori attivi
- * @param fd_num indica l'indice del descrittore maggiore
- * @return l'indice del descrittore maggiore
+ * @function Segnali
+ * @brief Riempie l'insieme dei segnali gestiti dal server
+ * @param set indica l'insieme da riempire
  */
-long UpdateMax(fd_set *set, long fd_num){
-  for(long fd = 0; fd<=fd_num;fd++){
-    //controllo se il descrittore è settato
-    if(FD_ISSET(fd, set))
-      //se il descrittore è maggiore del massimo allora aggiorno il massimo
-      if(fd>fd_num) fd_num=fd;
-  }
-  return fd_num;
+void Segnali(sigset_t *set){
+  sigemptyset(set);
+  //segnali che devono terminare il server
+  sigaddset(set,SIGINT);
+  sigaddset(set,SIGQUIT);
+  sigaddset(set,SIGTERM);
+  //segnale che richiede la stampa delle statistiche
+  sigaddset(set,SIGUSR1);
 }
 
 /**
@@ -615,13 +694,9 @@ long UpdateMax(fd_set *set, long fd_num){
  * @brief Thread dedicato alla gestione delle richieste da parte dei client
  */
 static void* Listener(){
-  int fd_pipe;
-  long fd_sk=0,fd_c=0,fd=0,fd_num=0;
-  //creo una pipe
-  SYSCALL2(fd_pipe, pipe(pfd), "pipe");
-  fd_set set, rdset;
-  //dichiaro la struttura per il timer utilizzato dalla select
-  struct timeval timer;
+  int fd_sig;
+  long fd_sk=0,fd_c=0;
+  int termina=0;
   struct sockaddr_un psa;
   //setto il percorso in cui è memorizzato il file socket
   strcpy(psa.sun_path,unixpath);
@@ -632,120 +707,86 @@ static void* Listener(){
   SYSCALL2(notused, bind(fd_sk, (struct sockaddr*)&psa,sizeof(psa)), "bind");
   //setto il numero massimo di connessioni che il server può ricevere contemporaneamente
   SYSCALL2(notused, listen(fd_sk, maxconnections), "listen");
-  //mantengo il massimo indice di descrittore attivo in fd_num
-  if (fd_sk > fd_num) fd_num = fd_sk;
-  //inizializzo la maschera
-  FD_ZERO(&set);
-  //inserisco il descrittore di lettura della pipe nella maschera dei descrittori attivi
-  FD_SET(pfd[0],&set); 
-  //inserisco il descrittore del socket nella maschera dei descrittori attivi
-  FD_SET(fd_sk,&set); 
-  while(1){
-    //do un valore ai campi della struttura timeval
-    timer.tv_sec=0;
-    timer.tv_usec=1000;
-    //inizializzo la maschera dei descrittori attesi in lettura
-    FD_ZERO(&rdset);
-    //bisogna inizializzare ogni volta rdset perchè la select lo modifica
-    rdset=set; 
-    //funzione che gestisce le richieste
-    int s=select(fd_num+1,&rdset,NULL,NULL,&timer);
-    //controllo se la select restituisce -1 o la variabile globale fine è stata settata, e in tal caso esco dal ciclo
-    if(s==-1 || fine==1)
+  //il socket di ascolto è non bloccante, così ad ogni evento accetto tutte le connessioni pendenti
+  SYSCALL2(notused, fcntl(fd_sk, F_SETFL, fcntl(fd_sk, F_GETFL)|O_NONBLOCK), "fcntl");
+  //i segnali gestiti dal server sono bloccati in tutti i thread e vengono letti tramite un signalfd
+  sigset_t set;
+  Segnali(&set);
+  SYSCALL2(fd_sig, signalfd(-1, &set, 0), "signalfd");
+  //inserisco nell'epoll il socket e il signalfd
+  struct epoll_event ev, eventi[MAX_EVENTI];
+  memset(&ev,0,sizeof(ev));
+  ev.events=EPOLLIN;
+  ev.data.fd=fd_sk;
+  SYSCALL2(notused, epoll_ctl(epfd, EPOLL_CTL_ADD, fd_sk, &ev), "epoll_ctl");
+  ev.data.fd=fd_sig;
+  SYSCALL2(notused, epoll_ctl(epfd, EPOLL_CTL_ADD, fd_sig, &ev), "epoll_ctl");
+  while(!termina){
+    //aspetto senza timeout che almeno un descrittore sia pronto
+    int n=epoll_wait(epfd, eventi, MAX_EVENTI, -1);
+    if(n==-1){
+      if(errno==EINTR) continue;
       break;
-    else if(fine==2){
-      StatFile(statfilename);
-      fine=0;
     }
-    else{
-      for (fd = 0; fd<=fd_num;fd++){
-        //se il descrittore è settato a 1 nella maschera dei descrittori
-        if (FD_ISSET(fd,&rdset)){
-              //allora vedo se il descrittore coincide con quello ritornato dalla socket
-  	      if (fd==fd_sk){
-                //in tal caso accetto la connessione
-                SYSCALL2(fd_c, accept(fd_sk,NULL,0), "accept");
-                //aggiungo il descrittore nella maschera dei descrittori settandolo ad 1
-	        FD_SET(fd_c, &set);
-                //mantengo il massimo indice di descrittore attivo in fd_num
-	        if (fd_c>fd_num) fd_num = fd_c;
-	      }
-            //altrimenti se il descrittore coincide con quello della pipe
-            else if (fd==pfd[0]){
-              long fd_c;
-              //leggo il contenuto della pipe
-              SYSCALL2(notused, readn(pfd[0],&fd_c,sizeof(long)), "readn");
-              //aggiungo il descrittore nella maschera dei descrittori settandolo ad 1
-	      FD_SET(fd_c, &set);
-              //mantengo il massimo indice di descrittore attivo in fd_num
-	      if (fd_c>fd_num) fd_num = fd_c;
-	    }
-            else{
-                //inserisco il descrittore nella coda delle richieste
-                Push(fd);
-                //metto a zero il descrittore nella maschera dei descrittori
-                FD_CLR(fd,&set);
-                //aggiorno l'indice del descrittore maggiore
-	        fd_num = UpdateMax(&set, fd_num);
-            }
-        } 
-      } 
+    //scorro solamente i descrittori pronti
+    for(int i=0;i<n;i++){
+      long fd=eventi[i].data.fd;
+      //se il descrittore coincide con quello del socket allora accetto le nuove connessioni
+      if(fd==fd_sk){
+        while((fd_c=accept(fd_sk,NULL,0))>=0){
+          //inizializzo la sessione e registro il nuovo descrittore nell'epoll, se fallisce chiudo solo questa connessione
+          if(ApriSessione(fd_c)<0){
+            perror("ApriSessione");
+            close(fd_c);
+          }
+        }
+        if(errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR){
+          perror("accept");
+          exit(-1);
+        }
+      }
+      //altrimenti se il descrittore coincide con quello dei segnali
+      else if(fd==fd_sig){
+        struct signalfd_siginfo info;
+        SYSCALL2(notused, readn(fd_sig,&info,sizeof(info)), "readn");
+        //SIGUSR1 richiede la stampa delle statistiche, gli altri segnali fanno terminare il server
+        if(info.ssi_signo==SIGUSR1)
+          StatFile(statfilename);
+        else
+          termina=1;
+      }
+      else{
+        //svuoto la coda di uscita se il descrittore è scrivibile, e se ci sono nuove richieste inserisco il descrittore nella coda
+        //delle richieste, resterà disattivato in lettura finchè il worker non lo restituisce
+        if(EventoSessione(fd, eventi[i].events))
+          Push(fd);
+      }
     }
   }
   //inserisco -1 nella coda per far terminare i vari thread
   Push(-1);
-  //chiudo il socket
+  //chiudo il socket e il signalfd
   SYSCALL2(notused, close(fd_sk), "close");
+  SYSCALL2(notused, close(fd_sig), "close");
   return (void*) NULL;
 }
 
-/**
- * @function gestore
- * @brief funzione usata per gestire i segnali che devono terminare il server
- * @param signum indica il segnale ricevuto
- */
-static void gestore(int signum){
-  //setto a 1 la variabile globale che mi indica se far terminare il server o meno
-  fine=1;
-} 
-
-/**
- * @function gestore2
- * @brief Funzione usata per la gestione dei segnali che non devono terminare il server
- * @param signum indica il segnale ricevuto
- */
-static void gestore2(int signum){
-  fine=2;
-} 
-
 /**
  * @function exec_sigaction
  * @brief Funzione usata per la gestione dei segnali
  */
 void exec_sigaction(){
   sigset_t set;
-  //maschero tutti i segnali finchè i gestori non sono stati installati
-  sigfillset(&set);
-  pthread_sigmask(SIG_SETMASK,&set,NULL);
+  //maschero i segnali gestiti dal server, verranno consegnati al Listener tramite signalfd
+  //la maschera viene ereditata da tutti i thread creati successivamente
+  Segnali(&set);
+  pthread_sigmask(SIG_BLOCK,&set,NULL);
   struct sigaction s;
   //resetto la struttura
   memset(&s,0,sizeof(s));
-  //imposto il gestore per i segnali che devono terminare il server
-  s.sa_handler=gestore;
-  //imposto i segnali da collegare al gestore
-  SYSCALL2(notused, sigaction(SIGINT,&s,NULL), "sigaction");
-  SYSCALL2(notused, sigaction(SIGQUIT,&s,NULL), "sigaction");
-  SYSCALL2(notused, sigaction(SIGTERM,&s,NULL), "sigaction");
-  //imposto il gestore per i segnali che non devono terminare il server
-  s.sa_handler=gestore2;
-  //imposto i segnali da collegare al gestore
-  SYSCALL2(notused, sigaction(SIGUSR1,&s,NULL), "sigaction");
   //ignoro SIGPIPE
   s.sa_handler=SIG_IGN;
   SYSCALL2(notused, sigaction(SIGPIPE,&s,NULL), "sigaction");
-  //tolgo la maschera
-  sigemptyset(&set);
-  pthread_sigmask(SIG_SETMASK,&set,NULL);
 }
 
 /**
@@ -755,23 +796,42 @@ void exec_sigaction(){
 int main(int argc,char **argv){
   exec_sigaction(); //richiamo la funzione per la gestione dei segnali
   Parser(argv[2]); //libero la memoria allocata per la hash degli utenti
+  CreaSlab(maxmsgsize); //inizializzo l'allocatore usato nel percorso delle richieste
+  CreaCacheFile((size_t)filecachesize*1024); //creo la cache dei file richiesti con GETFILE_OP
+  CreaEpoche(); //inizializzo le epoche, che permettono di cercare gli utenti senza prendere la mutua-esclusione
+  ApriArchivio(historydir, dirName, historysync, maxhistmsgs); //recupero le history salvate nell'archivio, se è stato configurato
   CreateHash(threadsinpool, maxhistmsgs, maxmsgsize); //creo la hash per gli utenti e i relativi messaggi
   CreateHash_G(threadsinpool); //creo la hash per i gruppi
+  chattyStats.nusers=ApriRegistro(registrydir, dirName, historysync); //recupero gli utenti e i gruppi salvati nel registro, se è stato configurato
+  //creo l'epoll prima dei thread, dato che viene usato sia dal Listener che dai Worker
+  SYSCALL2(epfd, epoll_create1(0), "epoll_create1");
+  CreaSessioni(epfd, (size_t)maxqueuesize*1024, queuepolicy, (size_t)maxmsgsize); //creo la tabella delle sessioni
+  CreaCode(threadsinpool, nsessioni); //creo una coda delle richieste per ogni worker
+  CreaOnline(nsessioni); //creo le tabelle degli utenti online, indicizzate tramite il nome e tramite il descrittore
   pthread_t master, *workers;
   SYSCALL_D(workers, malloc(sizeof(pthread_t)*threadsinpool), "malloc");
   pthread_create(&master, NULL, Listener, NULL); //mando in esecuzione il thread Listener
   for(int i=0;i<threadsinpool;i++)
-    pthread_create(&workers[i], NULL, Worker, NULL); //mando in esecuzione i thread Worker
+    pthread_create(&workers[i], NULL, Worker, (void*)(long)i); //mando in esecuzione i thread Worker
   pthread_join(master,NULL); //aspetto la terminazione del thread Listener
   for(int i=0;i<threadsinpool;i++)
     pthread_join(workers[i],NULL); //aspetto la terminazione dei thread Worker
-  free(coda); //libero la memoria allocata per la coda
+  SYSCALL2(notused, close(epfd), "close"); //chiudo l'epoll
+  DestroyCode(); //libero la memoria allocata per le code
   free(workers); //libero la memoria allocata per i workers
+  ChiudiRegistro(); //scrivo le modifiche ancora in attesa, prima di liberare gli utenti e i gruppi letti da un'istantanea in corso
   DestroyHash_G(); //libero la memoria allocata per la hash dei gruppi
   DestroyList(); //libero la memoria allocata per la lista degli utenti online
   DestroyHash(); //libero la memoria allocata per la hash degli utenti
+  DestroyEpoche(); //libero gli utenti eliminati che erano ancora in attesa di essere liberati
+  ChiudiArchivio(); //scrivo i messaggi ancora in attesa, dopo che le history recuperate che puntano all'archivio sono state liberate
+  DestroySessioni(); //libero la memoria allocata per le sessioni
+  DestroyCacheFile(); //elimino i file mappati dalla cache, dopo che le sessioni hanno rilasciato i propri riferimenti
+  DestroySlab(); //libero i blocchi conservati dall'allocatore
   free(unixpath);
   free(dirName);
   free(statfilename);
+  free(historydir);
+  free(registrydir);
   return 0;
 } 
@@ -0,0 +1,107 @@
+/**
+ * @file chiave.h
+ * @brief File per la gestione dei nomi di utenti e gruppi come chiavi di lunghezza fissa
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Un nome è lungo al più MAX_NAME_LENGTH (32) caratteri: copiato in un buffer riempito di zeri diventa una chiave di
+ * 32 byte, il cui hash e il cui confronto lavorano su parole intere invece che su un carattere alla volta e senza
+ * cercare il terminatore. Il byte finale è sempre 0, quindi la chiave resta utilizzabile come stringa.
+ */
+
+#ifndef CHIAVE_H_
+#define CHIAVE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <config.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if MAX_NAME_LENGTH != 32
+#error "le chiavi sono di 32 byte, MAX_NAME_LENGTH deve valere 32"
+#endif
+
+/**
+ * @struct Chiave
+ * @brief è la struttura che rappresenta un nome riempito di zeri fino alla lunghezza massima
+ * @var nome contiene il nome seguito da zeri
+ */
+typedef struct Chiave1{
+  char nome[MAX_NAME_LENGTH+1];
+}Chiave;
+
+/**
+ * @function FaiChiave
+ * @brief Copia un nome in una chiave, riempiendo di zeri i byte successivi
+ * @param k indica la chiave
+ * @param nome indica il nome, di cui vengono copiati al più MAX_NAME_LENGTH caratteri
+ */
+static inline void FaiChiave(Chiave *k, const char *nome){
+  //memchr cerca il terminatore più parole alla volta, a differenza di un ciclo sui caratteri
+  const char *fine=memchr(nome,'\0',MAX_NAME_LENGTH);
+  size_t n=(fine!=NULL) ? (size_t)(fine-nome) : MAX_NAME_LENGTH;
+  memcpy(k->nome,nome,n);
+  memset(k->nome+n,0,MAX_NAME_LENGTH+1-n);
+}
+
+/**
+ * @function Parola
+ * @brief Legge l'i-esima parola di 8 byte di una chiave
+ * @param k indica la chiave
+ * @param i indica l'indice della parola, da 0 a 3
+ * @return la parola
+ */
+static inline uint64_t Parola(const Chiave *k, int i){
+  uint64_t w;
+  memcpy(&w,k->nome+8*i,sizeof(w));
+  return w;
+}
+
+/**
+ * @function ImprontaChiave
+ * @brief Calcola l'impronta a 64 bit di una chiave, mescolando le quattro parole con moltiplicazioni
+ * @param k indica la chiave
+ * @return l'impronta
+ */
+static inline uint64_t ImprontaChiave(const Chiave *k){
+  uint64_t h=0x243F6A8885A308D3ULL;
+  for(int i=0;i<4;i++){
+    h^=Parola(k,i);
+    h*=0x9E3779B97F4A7C15ULL;
+    h^=h>>29;
+  }
+  h*=0xD6E8FEB86659FD93ULL;
+  return h^(h>>32);
+}
+
+/**
+ * @function UgualeChiave
+ * @brief Confronta due chiavi con un'istruzione vettoriale quando disponibile (AVX2 o SSE2)
+ * @param a indica la prima chiave
+ * @param b indica la seconda chiave
+ * @return 1 se le chiavi sono uguali, 0 altrimenti
+ */
+static inline int UgualeChiave(const Chiave *a, const Chiave *b){
+#if defined(__AVX2__)
+  __m256i x=_mm256_loadu_si256((const __m256i*)a->nome);
+  __m256i y=_mm256_loadu_si256((const __m256i*)b->nome);
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(x,y))==-1;
+#elif defined(__SSE2__)
+  __m128i x0=_mm_loadu_si128((const __m128i*)a->nome);
+  __m128i x1=_mm_loadu_si128((const __m128i*)(a->nome+16));
+  __m128i y0=_mm_loadu_si128((const __m128i*)b->nome);
+  __m128i y1=_mm_loadu_si128((const __m128i*)(b->nome+16));
+  __m128i c=_mm_and_si128(_mm_cmpeq_epi8(x0,y0),_mm_cmpeq_epi8(x1,y1));
+  return _mm_movemask_epi8(c)==0xFFFF;
+#else
+  return ((Parola(a,0)^Parola(b,0))|(Parola(a,1)^Parola(b,1))|
+          (Parola(a,2)^Parola(b,2))|(Parola(a,3)^Parola(b,3)))==0;
+#endif
+}
+
+#endif /* CHIAVE_H_ */
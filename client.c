@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <libgen.h>
 
 
 #include <connections.h>
@@ -46,13 +47,15 @@ static message_t  *MSGS = NULL;
 static const int   msgbatch = 100;
 static size_t      msgcur=0;
 static size_t      msglen=0;     
+// directory in cui salvare i file scaricati (opzione -o), NULL se non vengono salvati
+static char       *outdir = NULL;
 /* ------------------------------------------------------- */
 
 // usage function
 static void use(const char * filename) {
     fprintf(stderr, 
 	    "use:\n"
-	    " %s -l unix_socket_path -k nick -c nick -[gad] group -t milli -S msg:to -s file:to -R n -h\n"
+	    " %s -l unix_socket_path -k nick -c nick -[gad] group -n seq -t milli -o dir -S msg:to -s file:to -R n -h\n"
 	    "  -l specifica il socket dove il server e' in ascolto\n"
 	    "  -k specifica il nickname del client\n"
 	    "  -c specifica il nickname che deve essere creato\n"
@@ -62,7 +65,10 @@ static void use(const char * filename) {
 	    "  -d rimuove  'nick' dal gruppo 'group'\n"
 	    "  -L richiede la lista degli utenti online\n"
 	    "  -p richiede di recuperare la history dei messaggi\n"
+	    "  -n richiede i soli messaggi della history con numero di sequenza maggiore o uguale a 'seq',\n"
+	    "     stampa il numero di sequenza da usare nella richiesta successiva\n"
 	    "  -t specifica i millisecondi 'milli' che intercorrono tra la gestione di due comandi consecutivi\n"
+	    "  -o salva i file scaricati nella directory 'dir', con il nome con cui sono stati inviati\n"
 	    "  -S spedisce il messaggio 'msg' al destinatario 'to' che puo' essere un nickname o groupname\n"
 	    "  -s come l'opzione -S ma permette di spedire files\n"
 	    "  -R riceve un messaggio da un nickname o groupname, se viene ricevuto un identificatore di file\n"
@@ -113,6 +119,19 @@ static int downloadFile(int connfd, char *filename, char *sender) {
 	switch(msg.hdr.op) {
 	case OP_OK: {
 	    if (readData(connfd, &msg.data) <= 0) return -1;
+	    if (outdir) { // salvo il contenuto ricevuto con il nome del file, senza il percorso
+		char *copia = strdup(filename);
+		char *path  = malloc(strlen(outdir)+strlen(filename)+2);
+		if (!copia || !path) { perror("malloc"); return -1; }
+		sprintf(path, "%s/%s", outdir, basename(copia));
+		int fd = open(path, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+		int ok = fd>=0 && (msg.data.hdr.len==0 || write(fd, msg.data.buf, msg.data.hdr.len) == (ssize_t)msg.data.hdr.len);
+		if (fd>=0) close(fd);
+		if (!ok) perror(path);
+		free(copia); free(path);
+		if (!ok) return -1;
+	    }
+	    free(msg.data.buf);
 	    return 0;
 	} break;
 	case TXT_MESSAGE:
@@ -168,12 +187,17 @@ static int execute_requestreply(int connfd, operation_t *o) {
 	} else 
 	    setData(&msg.data, rname, o->msg, o->size);	    
     } 
+    // il numero di sequenza da cui partire viene inviato nel body della richiesta
+    size_t seq = (size_t)o->n;
+    if (op == GETNEWMSGS_OP) 
+	setData(&msg.data, rname, (char*)&seq, sizeof(size_t));
     
     // spedizione effettiva
     if (sendRequest(connfd, &msg) == -1) {
 	perror("request");
 	return -1;
     }
+    if (op == GETNEWMSGS_OP) msg.data.buf = NULL;
     if (mappedfile) { // devo inviare il file
 	message_data_t data;
 	setData(&data, "", mappedfile, o->size);
@@ -236,13 +260,17 @@ static int execute_requestreply(int connfd, operation_t *o) {
 	    printf(" %s\n", &msg.data.buf[p]);
 	}
     } break;
-    case GETPREVMSGS_OP: { // ... ricevere la lista dei vecchi messaggi
+    case GETPREVMSGS_OP:
+    case GETNEWMSGS_OP: { // ... ricevere la lista dei vecchi messaggi
 	if (readData(connfd, &msg.data) <= 0) {
 	    perror("reply data");
 	    return -1; 
 	}	
 	// numero di messaggi che devo ricevere
 	size_t nmsgs = *(size_t*)(msg.data.buf); 
+	// con -n il server invia anche il numero di sequenza da chiedere la volta successiva
+	if (op == GETNEWMSGS_OP && msg.data.hdr.len >= 2*sizeof(size_t))
+	    printf("[prossima sequenza: %zu]\n", ((size_t*)msg.data.buf)[1]);
 	char *FILENAMES[nmsgs]; // NOTA: si suppone che nmsgs non sia molto grande
 	size_t nfiles=0;
 	for(size_t i=0;i<nmsgs;++i) {
@@ -343,7 +371,7 @@ static int execute_receive(int connfd, operation_t *o) {
 }
 
 int main(int argc, char *argv[]) {
-    const char optstring[] = "l:k:c:C:g:a:d:t:S:s:R:pLh";
+    const char optstring[] = "l:k:c:C:g:a:d:t:S:s:R:n:o:pLh";
     int optc;
     char *spath = NULL, *nick = NULL;
     operation_t *ops = NULL;
@@ -366,6 +394,7 @@ int main(int argc, char *argv[]) {
  	switch (optc) {
         case 'l': spath=optarg;                   break;
 	case 't': msleep= strtol(optarg,NULL,10); break;
+	case 'o': outdir= optarg;                  break;
 	case 'k': {
 	    nick = strdup(optarg);
 	    if (strlen(nick)>MAX_NAME_LENGTH) {
@@ -442,6 +471,16 @@ int main(int argc, char *argv[]) {
 	    ops[k].size  = 0;
 	    ++k;
 	} break;
+	case 'n': {
+	    nickneeded = 1;
+	    ops[k].sname = nick;
+	    ops[k].rname = NULL;
+	    ops[k].op    = GETNEWMSGS_OP;
+	    ops[k].msg   = NULL;
+	    ops[k].size  = 0;
+	    ops[k].n     = strtol(optarg,NULL,10);
+	    ++k;
+	} break;
 	case 'S': {
 	    nickneeded = 1;
 	    char *arg = strdup(optarg);
@@ -5,93 +5,340 @@
  * Autore: Stefano Torneo 545261
  *
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Ogni worker ha la propria coda, un buffer circolare di dimensione fissa, senza lock, con più produttori e più
+ * consumatori: ogni cella ha un numero di sequenza che indica se è libera o piena per il giro corrente, e le posizioni
+ * di inserimento e di estrazione vengono avanzate con una compare-and-swap.
+ * Un descrittore viene inserito nella coda del worker che lo ha servito l'ultima volta, in modo che lo stato del
+ * client resti nella cache dello stesso core; un worker che non ha richieste ruba dalle code degli altri, e il
+ * descrittore rubato passa al nuovo worker. I worker che non trovano richieste si addormentano tramite un eventcount
+ * dedicato, la mutex e la variabile di condizione vengono usate solo quando il worker è effettivamente in attesa.
+ * Prima di cercare una richiesta il worker esegue i lavori affidati tramite AffidaLavoro, che risveglia un worker
+ * addormentato allo stesso modo di un inserimento.
  */
 
+#ifndef CODA_H_
+#define CODA_H_
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <pthread.h>
 
+#include <lavori.h>
+
+//dimensione di una linea di cache, usata per separare i campi modificati da thread diversi
+#define LINEA_CACHE 64
+
+/**
+ * @struct Cella
+ * @brief è la struttura che rappresenta una cella del buffer circolare
+ * @var seq indica il numero di sequenza della cella
+ * @var fd indica il descrittore
+ */
+typedef struct Cella1{
+  size_t seq;
+  long fd;
+}Cella;
+
 /**
  * @struct Coda
- * @brief è la struttura usata per la gestione delle richieste al server
- * @fd indica il descrittore
- * @var next è un puntatore all'elemento successivo
+ * @brief è la struttura che rappresenta la coda delle richieste di un worker
+ * @var celle è il buffer circolare
+ * @var maschera è la dimensione del buffer meno uno, la dimensione è una potenza di due
+ * @var testa indica la prossima posizione da cui estrarre
+ * @var fondo indica la prossima posizione in cui inserire
+ * @var epoca viene incrementata ad ogni risveglio del worker
+ * @var dorme vale 1 se il worker si sta per addormentare o dorme
+ * @var mutex variabile per la gestione della mutua-esclusione, usata solo per addormentarsi
+ * @var cond variabile di condizione
  */
 typedef struct Coda1{
-  long fd;
-  struct Coda1 *next;
+  Cella *celle;
+  size_t maschera;
+  char pad0[LINEA_CACHE-sizeof(Cella*)-sizeof(size_t)];
+  size_t testa;
+  char pad1[LINEA_CACHE-sizeof(size_t)];
+  size_t fondo;
+  char pad2[LINEA_CACHE-sizeof(size_t)];
+  unsigned epoca;
+  int dorme;
+  char pad3[LINEA_CACHE-sizeof(unsigned)-sizeof(int)];
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  char pad4[LINEA_CACHE-(sizeof(pthread_mutex_t)+sizeof(pthread_cond_t))%LINEA_CACHE];
 }Coda;
 
 /**
- * @var coda è il puntatore al primo elemento della lista
+ * @var code è l'array delle code, una per ogni worker
+ * @var ncode indica il numero di code
+ * @var memoria_code è il blocco allocato per le code, di cui code è la parte allineata alla linea di cache
  */
-Coda *coda=NULL;
+Coda *code=NULL;
+int ncode=0;
+void *memoria_code=NULL;
 
 /**
- * @var coda è il puntatore all'ultimo elemento della lista
+ * @var affinita indica per ogni descrittore il worker nella cui coda viene inserito
+ * @var naffinita indica la dimensione dell'array affinita
  */
-Coda *ultimo=NULL;
+int *affinita=NULL;
+size_t naffinita=0;
 
 /**
- * @var mutex variabile per la gestione della mutua-esclusione
+ * @var terminata vale 1 quando i worker devono terminare
+ * @var dormienti indica il numero di worker che si stanno per addormentare o che dormono
  */
-pthread_mutex_t mutex=PTHREAD_MUTEX_INITIALIZER;
+int terminata=0;
+int dormienti=0;
+
+static void SvegliaLavoro();
 
 /**
- * @var cond variabile di condizione
+ * @function CreaCode
+ * @brief Crea le code delle richieste, una per ogni worker
+ * @param n indica il numero di worker
+ * @param dim indica il numero di descrittori gestiti, ogni coda può contenerli tutti dato che un descrittore è in coda al più una volta
+ */
+void CreaCode(int n, size_t dim){
+  size_t cap=2;
+  while(cap<dim)
+    cap<<=1;
+  //allineo le code alla linea di cache, in modo che testa e fondo non la condividano con altri dati
+  if((memoria_code=malloc(sizeof(Coda)*n+LINEA_CACHE))==NULL){
+    perror("malloc");
+    exit(-1);
+  }
+  code=(Coda*)(((size_t)memoria_code+LINEA_CACHE-1)&~(size_t)(LINEA_CACHE-1));
+  ncode=n;
+  for(int i=0;i<n;i++){
+    Coda *c=&code[i];
+    if((c->celle=malloc(sizeof(Cella)*cap))==NULL){
+      perror("malloc");
+      exit(-1);
+    }
+    //ogni cella è inizialmente libera per il giro che parte dalla sua posizione
+    for(size_t j=0;j<cap;j++)
+      c->celle[j].seq=j;
+    c->maschera=cap-1;
+    c->testa=c->fondo=0;
+    c->epoca=0;
+    c->dorme=0;
+    pthread_mutex_init(&(c->mutex),NULL);
+    pthread_cond_init(&(c->cond),NULL);
+  }
+  //inizialmente i descrittori vengono distribuiti tra i worker in base al loro valore
+  if((affinita=malloc(sizeof(int)*dim))==NULL){
+    perror("malloc");
+    exit(-1);
+  }
+  naffinita=dim;
+  for(size_t j=0;j<dim;j++)
+    affinita[j]=j%n;
+  terminata=0;
+  dormienti=0;
+  ImpostaSveglia(SvegliaLavoro);
+}
+
+/**
+ * @function DestroyCode
+ * @brief Elimina le code delle richieste
  */
-pthread_cond_t cond=PTHREAD_COND_INITIALIZER;
+void DestroyCode(){
+  if(code==NULL) return;
+  for(int i=0;i<ncode;i++){
+    pthread_mutex_destroy(&(code[i].mutex));
+    pthread_cond_destroy(&(code[i].cond));
+    free(code[i].celle);
+  }
+  free(memoria_code);
+  free(affinita);
+  code=NULL;
+  memoria_code=NULL;
+  affinita=NULL;
+  ncode=0;
+  naffinita=0;
+}
+
+/**
+ * @function Inserisci
+ * @brief Prova ad inserire un descrittore in una coda senza bloccarsi
+ * @param c indica la coda
+ * @param fd indica il descrittore da inserire
+ * @return 1 se il descrittore è stato inserito, 0 se la coda è piena
+ */
+static int Inserisci(Coda *c, long fd){
+  size_t pos=__atomic_load_n(&(c->fondo),__ATOMIC_RELAXED);
+  while(1){
+    Cella *cella=&(c->celle[pos&c->maschera]);
+    size_t seq=__atomic_load_n(&(cella->seq),__ATOMIC_ACQUIRE);
+    long diff=(long)(seq-pos);
+    //la cella è libera, provo a prenotare la posizione
+    if(diff==0){
+      if(__atomic_compare_exchange_n(&(c->fondo),&pos,pos+1,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)){
+        cella->fd=fd;
+        //rendo visibile il descrittore ai consumatori
+        __atomic_store_n(&(cella->seq),pos+1,__ATOMIC_RELEASE);
+        return 1;
+      }
+    }
+    //la cella contiene ancora un descrittore del giro precedente, la coda è piena
+    else if(diff<0)
+      return 0;
+    //un altro produttore ha già preso la posizione
+    else
+      pos=__atomic_load_n(&(c->fondo),__ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * @function Estrai_C
+ * @brief Prova ad estrarre un descrittore da una coda senza bloccarsi
+ * @param c indica la coda
+ * @param fd indica dove memorizzare il descrittore estratto
+ * @return 1 se è stato estratto un descrittore, 0 se la coda è vuota
+ */
+static int Estrai_C(Coda *c, long *fd){
+  size_t pos=__atomic_load_n(&(c->testa),__ATOMIC_RELAXED);
+  while(1){
+    Cella *cella=&(c->celle[pos&c->maschera]);
+    size_t seq=__atomic_load_n(&(cella->seq),__ATOMIC_ACQUIRE);
+    long diff=(long)(seq-(pos+1));
+    //la cella è piena, provo a prenotare la posizione
+    if(diff==0){
+      if(__atomic_compare_exchange_n(&(c->testa),&pos,pos+1,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)){
+        *fd=cella->fd;
+        //libero la cella per il giro successivo
+        __atomic_store_n(&(cella->seq),pos+c->maschera+1,__ATOMIC_RELEASE);
+        return 1;
+      }
+    }
+    //la cella non è ancora stata riempita, la coda è vuota
+    else if(diff<0)
+      return 0;
+    //un altro consumatore ha già preso la posizione
+    else
+      pos=__atomic_load_n(&(c->testa),__ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * @function Sveglia
+ * @brief Risveglia il worker proprietario di una coda, se si sta per addormentare o dorme
+ * @param c indica la coda del worker
+ * @return 1 se il worker è stato risvegliato, 0 se era già sveglio
+ */
+static int Sveglia(Coda *c){
+  //l'inserimento deve essere visibile prima di controllare se il worker dorme
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(!__atomic_load_n(&(c->dorme),__ATOMIC_RELAXED))
+    return 0;
+  pthread_mutex_lock(&(c->mutex));
+  __atomic_fetch_add(&(c->epoca),1,__ATOMIC_RELEASE);
+  pthread_cond_signal(&(c->cond));
+  pthread_mutex_unlock(&(c->mutex));
+  return 1;
+}
+
+/**
+ * @function SvegliaLavoro
+ * @brief Risveglia un worker che dorme, chiamata quando viene affidato un lavoro
+ */
+static void SvegliaLavoro(){
+  if(__atomic_load_n(&dormienti,__ATOMIC_SEQ_CST)==0)
+    return;
+  for(int i=0;i<ncode;i++)
+    if(Sveglia(&code[i]))
+      break;
+}
 
 /**
  * @function Push
- * @brief Inserisce un descrittore nella coda
+ * @brief Inserisce un descrittore nella coda del worker a cui è affidato, -1 fa terminare tutti i worker
  * @param fd indica il descrittore da inserire
  */
 void Push(long fd){
-  //prendo la mutua-esclusione 
-  pthread_mutex_lock(&mutex);
-  Coda *new=malloc(sizeof(Coda));
-  if(new!=NULL){
-    new->fd=fd;
-    new->next=NULL;
-    if(coda==NULL){
-      ultimo=new;
-      coda=new;
+  if(fd==-1){
+    //segnalo la terminazione e risveglio tutti i worker
+    __atomic_store_n(&terminata,1,__ATOMIC_SEQ_CST);
+    for(int i=0;i<ncode;i++){
+      pthread_mutex_lock(&(code[i].mutex));
+      __atomic_fetch_add(&(code[i].epoca),1,__ATOMIC_RELEASE);
+      pthread_cond_broadcast(&(code[i].cond));
+      pthread_mutex_unlock(&(code[i].mutex));
     }
-    else{
-      ultimo->next=new;
-      ultimo=new;
+    return;
+  }
+  int w=(fd>=0 && (size_t)fd<naffinita) ? __atomic_load_n(&affinita[fd],__ATOMIC_RELAXED) : fd%ncode;
+  Coda *c=&code[w];
+  //ogni descrittore è in coda al più una volta, quindi la coda si riempie solo in casi eccezionali
+  while(!Inserisci(c,fd))
+    sched_yield();
+  if(Sveglia(c))
+    return;
+  //il proprietario è occupato e potrebbe restarlo a lungo (una diffusione, un fsync, una history grande): se il
+  //descrittore non è ancora stato estratto risveglio un worker che dorme, che potrà rubarlo invece di aspettare
+  size_t arretrate=__atomic_load_n(&(c->fondo),__ATOMIC_RELAXED)-__atomic_load_n(&(c->testa),__ATOMIC_RELAXED);
+  if(arretrate>=1 && __atomic_load_n(&dormienti,__ATOMIC_RELAXED)>0)
+    for(int i=1;i<ncode;i++)
+      if(Sveglia(&code[(w+i)%ncode]))
+        break;
+}
+
+/**
+ * @function Cerca
+ * @brief Cerca un descrittore prima nella coda del worker e poi in quelle degli altri
+ * @param id indica l'indice del worker
+ * @param fd indica dove memorizzare il descrittore trovato
+ * @return 1 se è stato trovato un descrittore, 0 se tutte le code sono vuote
+ */
+static int Cerca(int id, long *fd){
+  if(Estrai_C(&code[id],fd))
+    return 1;
+  for(int i=1;i<ncode;i++){
+    if(Estrai_C(&code[(id+i)%ncode],fd)){
+      //il descrittore rubato d'ora in poi viene affidato a questo worker
+      if(*fd>=0 && (size_t)*fd<naffinita)
+        __atomic_store_n(&affinita[*fd],id,__ATOMIC_RELAXED);
+      return 1;
     }
-    //se il descrittore è != da -1 risveglio un solo thread in attesa
-    if(fd!=-1)
-      pthread_cond_signal(&cond);
-    //altrimenti li risveglio tutti
-    else 
-      pthread_cond_broadcast(&cond);
   }
-  //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex);
+  return 0;
 }
 
 /**
  * @function Pop
- * @brief Elimina un descrittore dalla coda
- * @return il valore del descrittore
+ * @brief Estrae il prossimo descrittore da servire, eseguendo nel frattempo i lavori affidati e aspettando se non ci sono né lavori né descrittori
+ * @param id indica l'indice del worker
+ * @return il valore del descrittore, -1 se il worker deve terminare
  */
-long Pop(){
-  //prendo la mutua-esclusione
-  pthread_mutex_lock(&mutex);
-  //se la coda è vuota mi metto in attesa sulla variabile di condizione
-  while(coda==NULL)
-    pthread_cond_wait(&cond,&mutex);
-  long ele=coda->fd;
-  //se il descrittore è != -1 allora lo elimino dalla coda
-  if(ele!=-1){
-    Coda *com=coda;
-    coda=coda->next;
-    free(com);
+long Pop(int id){
+  Coda *c=&code[id];
+  long ele;
+  while(!__atomic_load_n(&terminata,__ATOMIC_ACQUIRE)){
+    //i lavori affidati hanno la precedenza sulle richieste
+    if(EseguiLavoro())
+      continue;
+    if(Cerca(id,&ele))
+      return ele;
+    //mi dichiaro in attesa e ricontrollo le code, così un inserimento avvenuto nel frattempo non viene perso
+    unsigned epoca=__atomic_load_n(&(c->epoca),__ATOMIC_ACQUIRE);
+    __atomic_store_n(&(c->dorme),1,__ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&dormienti,1,__ATOMIC_SEQ_CST);
+    int trovato=Cerca(id,&ele);
+    if(!trovato && LavoriInAttesa()==0 && !__atomic_load_n(&terminata,__ATOMIC_ACQUIRE)){
+      //mi addormento finchè qualcuno non cambia l'epoca della mia coda
+      pthread_mutex_lock(&(c->mutex));
+      while(__atomic_load_n(&(c->epoca),__ATOMIC_ACQUIRE)==epoca)
+        pthread_cond_wait(&(c->cond),&(c->mutex));
+      pthread_mutex_unlock(&(c->mutex));
+    }
+    __atomic_fetch_sub(&dormienti,1,__ATOMIC_RELAXED);
+    __atomic_store_n(&(c->dorme),0,__ATOMIC_RELAXED);
+    if(trovato)
+      return ele;
   }
-  //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex);
-  return ele;
-}
\ No newline at end of file
+  return -1;
+}
+
+#endif /* CODA_H_ */
@@ -17,6 +17,90 @@
 
 /* aggiungere altre define qui */
 
+// numero massimo di eventi restituiti da una singola epoll_wait
+#define MAX_EVENTI                       64
+
+// numero massimo di richieste di uno stesso client gestite da un worker prima di passare ad altri client
+#define MAX_RICHIESTE_TURNO              32
+
+// dimensione iniziale del buffer di ricezione di ogni connessione
+#define DIM_SESSIONE                     16384
+
+// numero massimo di descrittori gestiti dalla tabella delle sessioni
+#define MAX_SESSIONI                     65536
+
+// dimensione della classe più piccola dell'allocatore
+#define SLAB_MIN                         64
+
+// dimensione minima della classe più grande dell'allocatore
+#define SLAB_MAX                         16384
+
+// numero massimo di blocchi liberi per classe nella cache di un thread
+#define SLAB_CACHE                       64
+
+// numero di blocchi spostati insieme tra la cache di un thread e il deposito comune
+#define SLAB_LOTTO                       32
+
+// numero massimo di blocchi liberi per classe nel deposito comune
+#define SLAB_DEPOSITO                    1024
+
+// numero di liste di trabocco della tabella della cache dei file
+#define CACHE_FILE_BUCKET                1024
+
+// numero di zone, ognuna con la propria mutua-esclusione, della tabella degli utenti online
+#define ONLINE_ZONE                      64
+
+// numero di liste di trabocco in ogni zona della tabella degli utenti online
+#define ONLINE_LISTE                     64
+
+// numero di elementi ritirati da un thread dopo cui si prova a far avanzare l'epoca e a liberarli
+#define EPOCA_SOGLIA                     64
+
+// numero iniziale di posti della tabella degli utenti registrati, una potenza di due
+#define TAVOLA_MIN                       1024
+
+// la tabella degli utenti raddoppia quando i posti occupati superano (TAVOLA_CARICO-1)/TAVOLA_CARICO del totale
+#define TAVOLA_CARICO                    8
+
+// numero di posti spostati nella nuova tabella ad ogni inserimento o eliminazione durante un ridimensionamento
+#define TAVOLA_PASSO                     64
+
+// numero di messaggi per cui viene allocata la history di un utente al primo messaggio, raddoppia fino a MaxHistMsgs
+#define HISTORY_MIN                      4
+
+// numero di posti della tabella degli utenti registrati gestiti da ogni parte di un invio a tutti
+#define DIFFUSIONE_PARTE                 4096
+
+// numero di scansioni di un invio a tutti dopo cui l'ultima blocca inserimenti ed eliminazioni di utenti
+#define DIFFUSIONE_TENTATIVI             3
+
+// numero iniziale di posti dell'insieme degli utenti di un gruppo, una potenza di due
+#define GRUPPO_MIN                       8
+
+// numero di parti dell'archivio delle history, ognuna con i propri file di segmento; non va cambiato se l'archivio contiene già dei dati
+#define ARCHIVIO_PARTI                   16
+
+// dimensione massima in byte di un file di segmento dell'archivio
+#define ARCHIVIO_SEGMENTO                (64*1024*1024)
+
+// byte in attesa di essere scritti in una parte dell'archivio oltre i quali la scrittura di gruppo viene anticipata
+#define ARCHIVIO_LOTTO                   (256*1024)
+
+// intervallo in millisecondi tra due scritture di gruppo dell'archivio
+#define ARCHIVIO_INTERVALLO              10
+
+// un segmento dell'archivio viene compattato quando meno di 1/ARCHIVIO_RIUSO dei suoi record sono ancora recuperabili
+#define ARCHIVIO_RIUSO                   4
+
+// numero di file in cui vengono divisi gli utenti di un'istantanea del registro, letti in parallelo all'avvio
+#define REGISTRO_PARTI                   8
+
+// byte di modifiche al registro oltre i quali viene presa una nuova istantanea, se superano anche la dimensione della precedente
+#define REGISTRO_SOGLIA                  (4*1024*1024)
+
+// intervallo in millisecondi tra due scritture delle modifiche al registro
+#define REGISTRO_INTERVALLO              10
+
 
 
 // to avoid warnings like "ISO C forbids an empty translation unit"
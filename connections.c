@@ -149,8 +149,9 @@ int readMsg(long fd, message_t *msg){
  * @return -1 se c'è stato un errore, 1 altrimenti
  */
 int sendData(long fd, message_data_t *msg){
-  SYSCALL(notused, writen(fd,&(msg->hdr),sizeof(message_data_hdr_t)));
-  SYSCALL(notused, writen(fd,msg->buf,msg->hdr.len));
+  //invio l'header del body e il body con una sola scrittura
+  struct iovec iov[2]={ {&(msg->hdr),sizeof(message_data_hdr_t)}, {msg->buf,msg->hdr.len} };
+  SYSCALL(notused, writevn(fd,iov,2));
   return 1;
 }
 
@@ -164,7 +165,8 @@ int sendData(long fd, message_data_t *msg){
  * @return -1 se c'è stato un errore, 1 altrimenti
  */
 int sendHeader(long fd, message_hdr_t *msg){
-  SYSCALL(notused, writen(fd,msg,sizeof(message_hdr_t)));
+  struct iovec iov[1]={ {msg,sizeof(message_hdr_t)} };
+  SYSCALL(notused, writevn(fd,iov,1));
   return 1;
 }
 
@@ -178,12 +180,11 @@ int sendHeader(long fd, message_hdr_t *msg){
  * @return -1 se c'è stato un errore, 1 altrimenti
  */
 int sendMsg(long fd, message_t *msg){ 
-  //invio l'header
-  SYSCALL(notused, writen(fd,&(msg->hdr),sizeof(message_hdr_t)));
-  //invio l'header del body
-  SYSCALL(notused, writen(fd,&(msg->data.hdr),sizeof(message_data_hdr_t)));
-  //invio il messaggio
-  SYSCALL(notused, writen(fd,msg->data.buf,msg->data.hdr.len));
+  //invio l'header, l'header del body e il messaggio con una sola scrittura
+  struct iovec iov[3]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)},
+                        {msg->data.buf,msg->data.hdr.len} };
+  SYSCALL(notused, writevn(fd,iov,3));
   return 1;
 }
 
@@ -197,26 +198,30 @@ int sendMsg(long fd, message_t *msg){
  * @return -1 se c'è stato un errore, 1 altrimenti
  */
 int sendRequest(long fd, message_t *msg){
-  //invio l'header del messaggio
-  writen(fd,&(msg->hdr),sizeof(message_hdr_t));
-  //controllo il tipo dell'operazione e faccio l'operazione opportuna
+  //la richiesta viene inviata con una sola scrittura, il numero di parti dipende dal tipo dell'operazione
+  struct iovec iov[3]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)},
+                        {msg->data.buf,msg->data.hdr.len} };
+  int cnt=1;
   switch(msg->hdr.op){
     case UNREGISTER_OP:
     case POSTTXT_OP: 
     case POSTTXTALL_OP:
     case POSTFILE_OP: 
-    case GETFILE_OP:{
-      //invio il body del messaggio
-      sendData(fd,&(msg->data));
+    case GETFILE_OP:
+    case GETNEWMSGS_OP:{
+      //header, header del body e body del messaggio
+      cnt=3;
     }break;
     case CREATEGROUP_OP:
     case ADDGROUP_OP:
     case DELGROUP_OP:{
-      //invio l'header del body del messaggio
-      SYSCALL(notused, writen(fd,&(msg->data.hdr),sizeof(message_data_hdr_t)));
+      //header e header del body del messaggio
+      cnt=2;
     }break;
     default:{}
   }
+  SYSCALL(notused, writevn(fd,iov,cnt));
   return 1;
 }
 
@@ -0,0 +1,249 @@
+/**
+ * @file epoca.c
+ * @brief File per la gestione della memoria condivisa letta senza mutua-esclusione, liberata solo quando nessun thread può più leggerla
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * C'è un'epoca globale che avanza di uno solo quando tutti i thread dentro una sezione di lettura l'hanno osservata.
+ * Un elemento tolto da una struttura condivisa viene ritirato con l'epoca corrente e liberato quando l'epoca globale
+ * è avanzata di due: a quel punto ogni thread che poteva averlo raggiunto è uscito dalla propria sezione di lettura.
+ * Ogni thread tiene i propri elementi ritirati, e prova a far avanzare l'epoca ogni EPOCA_SOGLIA elementi.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <config.h>
+#include <epoca.h>
+
+//macro per allocazioni dinamiche
+#define SYSCALL_D(r,c,e) \
+    if((r=c)==NULL) { perror(e); exit(-1); }
+
+/**
+ * @struct Rifiuto
+ * @brief è la struttura che rappresenta un elemento ritirato in attesa di essere liberato
+ * @var p indica l'elemento
+ * @var libera indica la funzione che libera l'elemento
+ * @var epoca indica l'epoca in cui l'elemento è stato ritirato
+ * @var next puntatore all'elemento ritirato successivo
+ */
+typedef struct Rifiuto1{
+  void *p;
+  void (*libera)(void*);
+  unsigned long epoca;
+  struct Rifiuto1 *next;
+}Rifiuto;
+
+/**
+ * @struct Partecipante
+ * @brief è la struttura che rappresenta lo stato di un thread
+ * @var stato contiene l'epoca osservata dal thread moltiplicata per due, più uno se il thread è in una sezione di lettura
+ * @var annidamento indica quante sezioni di lettura annidate sono aperte
+ * @var limbo è la lista degli elementi ritirati dal thread
+ * @var nlimbo indica il numero di elementi ritirati dal thread e non ancora liberati
+ * @var next puntatore al thread successivo
+ */
+typedef struct Partecipante1{
+  unsigned long stato;
+  int annidamento;
+  Rifiuto *limbo;
+  int nlimbo;
+  struct Partecipante1 *next;
+}Partecipante;
+
+/**
+ * @var globale indica l'epoca globale
+ */
+static unsigned long globale=0;
+
+/**
+ * @var partecipanti è l'elenco dei thread che hanno usato le epoche
+ * @var orfani è la lista degli elementi ritirati dai thread già terminati
+ */
+static Partecipante *partecipanti=NULL;
+static Rifiuto *orfani=NULL;
+
+/**
+ * @var chiave_e è la chiave con cui ogni thread ritrova il proprio stato
+ */
+static pthread_key_t chiave_e;
+
+/**
+ * @var mutex_epoca è la variabile di mutua-esclusione sull'elenco dei thread e sugli elementi orfani
+ */
+static pthread_mutex_t mutex_epoca=PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @function Esci
+ * @brief Toglie dall'elenco lo stato di un thread che termina, i suoi elementi ritirati vengono liberati in seguito
+ * @param arg indica lo stato del thread
+ */
+static void Esci(void *arg){
+  Partecipante *p=arg;
+  pthread_mutex_lock(&mutex_epoca);
+  while(p->limbo!=NULL){
+    Rifiuto *r=p->limbo;
+    p->limbo=r->next;
+    r->next=orfani;
+    orfani=r;
+  }
+  Partecipante **q=&partecipanti;
+  while(*q!=NULL && *q!=p)
+    q=&((*q)->next);
+  if(*q!=NULL)
+    *q=p->next;
+  pthread_mutex_unlock(&mutex_epoca);
+  free(p);
+}
+
+/**
+ * @function Mio
+ * @brief Restituisce lo stato del thread chiamante, creandolo al primo utilizzo
+ * @return un puntatore allo stato
+ */
+static Partecipante * Mio(){
+  Partecipante *p=pthread_getspecific(chiave_e);
+  if(p!=NULL)
+    return p;
+  SYSCALL_D(p, calloc(1,sizeof(Partecipante)), "calloc");
+  pthread_mutex_lock(&mutex_epoca);
+  p->next=partecipanti;
+  partecipanti=p;
+  pthread_mutex_unlock(&mutex_epoca);
+  pthread_setspecific(chiave_e,p);
+  return p;
+}
+
+/**
+ * @function Avanza
+ * @brief Fa avanzare l'epoca globale se tutti i thread in una sezione di lettura l'hanno osservata
+ */
+static void Avanza(){
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  unsigned long e=__atomic_load_n(&globale,__ATOMIC_RELAXED);
+  pthread_mutex_lock(&mutex_epoca);
+  for(Partecipante *p=partecipanti;p!=NULL;p=p->next){
+    unsigned long s=__atomic_load_n(&(p->stato),__ATOMIC_RELAXED);
+    //un thread sta ancora leggendo con un'epoca precedente
+    if((s&1) && (s>>1)!=e){
+      pthread_mutex_unlock(&mutex_epoca);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&mutex_epoca);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  __atomic_compare_exchange_n(&globale,&e,e+1,0,__ATOMIC_RELEASE,__ATOMIC_RELAXED);
+}
+
+/**
+ * @function Recupera
+ * @brief Libera gli elementi di una lista ritirati almeno due epoche fa
+ * @param lista indica la lista
+ * @return il numero di elementi liberati
+ */
+static int Recupera(Rifiuto **lista){
+  unsigned long e=__atomic_load_n(&globale,__ATOMIC_ACQUIRE);
+  int n=0;
+  Rifiuto **q=lista;
+  while(*q!=NULL){
+    Rifiuto *r=*q;
+    if(r->epoca+2<=e){
+      *q=r->next;
+      r->libera(r->p);
+      free(r);
+      n++;
+    }
+    else
+      q=&(r->next);
+  }
+  return n;
+}
+
+/**
+ * @function CreaEpoche
+ * @brief Inizializza la gestione delle epoche
+ */
+void CreaEpoche(){
+  if(pthread_key_create(&chiave_e,Esci)!=0){
+    perror("pthread_key_create");
+    exit(-1);
+  }
+}
+
+/**
+ * @function EntraEpoca
+ * @brief Inizia una sezione di lettura: gli elementi raggiunti al suo interno non vengono liberati prima che finisca
+ *
+ * Le sezioni possono essere annidate, gli elementi restano validi fino alla EsciEpoca più esterna.
+ */
+void EntraEpoca(){
+  Partecipante *p=Mio();
+  if(p->annidamento++>0)
+    return;
+  unsigned long e=__atomic_load_n(&globale,__ATOMIC_RELAXED);
+  __atomic_store_n(&(p->stato),(e<<1)|1,__ATOMIC_RELAXED);
+  //l'annuncio deve essere visibile prima di qualsiasi lettura della struttura condivisa
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * @function EsciEpoca
+ * @brief Termina una sezione di lettura iniziata con EntraEpoca
+ */
+void EsciEpoca(){
+  Partecipante *p=Mio();
+  if(--p->annidamento>0)
+    return;
+  __atomic_store_n(&(p->stato),p->stato&~1UL,__ATOMIC_RELEASE);
+}
+
+/**
+ * @function Ritira
+ * @brief Libera un elemento già tolto dalle strutture condivise, appena nessun thread può più averlo raggiunto
+ * @param p indica l'elemento
+ * @param libera indica la funzione che libera l'elemento
+ */
+void Ritira(void *p, void (*libera)(void*)){
+  Partecipante *t=Mio();
+  Rifiuto *r;
+  SYSCALL_D(r, malloc(sizeof(Rifiuto)), "malloc");
+  r->p=p;
+  r->libera=libera;
+  r->epoca=__atomic_load_n(&globale,__ATOMIC_SEQ_CST);
+  r->next=t->limbo;
+  t->limbo=r;
+  if(++t->nlimbo<EPOCA_SOGLIA)
+    return;
+  //il thread ha accumulato abbastanza elementi, provo a far avanzare l'epoca e libero quelli ormai irraggiungibili
+  Avanza();
+  t->nlimbo-=Recupera(&(t->limbo));
+  if(__atomic_load_n(&orfani,__ATOMIC_RELAXED)!=NULL){
+    pthread_mutex_lock(&mutex_epoca);
+    Recupera(&orfani);
+    pthread_mutex_unlock(&mutex_epoca);
+  }
+}
+
+/**
+ * @function DestroyEpoche
+ * @brief Libera tutti gli elementi ritirati, da chiamare dopo la terminazione degli altri thread
+ */
+void DestroyEpoche(){
+  Partecipante *p=pthread_getspecific(chiave_e);
+  if(p!=NULL){
+    pthread_setspecific(chiave_e,NULL);
+    Esci(p);
+  }
+  //nessun thread è più in una sezione di lettura, gli elementi possono essere liberati tutti
+  while(orfani!=NULL){
+    Rifiuto *r=orfani;
+    orfani=r->next;
+    r->libera(r->p);
+    free(r);
+  }
+  pthread_key_delete(chiave_e);
+}
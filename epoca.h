@@ -0,0 +1,47 @@
+/**
+ * @file epoca.h
+ * @brief File per la gestione della memoria condivisa letta senza mutua-esclusione, liberata solo quando nessun thread può più leggerla
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef EPOCA_H_
+#define EPOCA_H_
+
+/**
+ * @function CreaEpoche
+ * @brief Inizializza la gestione delle epoche
+ */
+void CreaEpoche();
+
+/**
+ * @function EntraEpoca
+ * @brief Inizia una sezione di lettura: gli elementi raggiunti al suo interno non vengono liberati prima che finisca
+ *
+ * Le sezioni possono essere annidate, gli elementi restano validi fino alla EsciEpoca più esterna.
+ */
+void EntraEpoca();
+
+/**
+ * @function EsciEpoca
+ * @brief Termina una sezione di lettura iniziata con EntraEpoca
+ */
+void EsciEpoca();
+
+/**
+ * @function Ritira
+ * @brief Libera un elemento già tolto dalle strutture condivise, appena nessun thread può più averlo raggiunto
+ * @param p indica l'elemento
+ * @param libera indica la funzione che libera l'elemento
+ */
+void Ritira(void *p, void (*libera)(void*));
+
+/**
+ * @function DestroyEpoche
+ * @brief Libera tutti gli elementi ritirati, da chiamare dopo la terminazione degli altri thread
+ */
+void DestroyEpoche();
+
+#endif /* EPOCA_H_ */
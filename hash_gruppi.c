@@ -7,25 +7,19 @@
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
  */
 
-#include<limits.h>
-#define BITS_IN_int     ( sizeof(int) * CHAR_BIT )
-#define THREE_QUARTERS  ((int) ((BITS_IN_int * 3) / 4))
-#define ONE_EIGHTH      ((int) (BITS_IN_int / 8))
-#define HIGH_BITS       ( ~((unsigned int)(~0) >> ONE_EIGHTH ))
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <connections.h>
 #include <online.h>
 #include <hash_history.h>
+#include <chiave.h>
+#include <archivio.h>
+#include <registro.h>
 
 //dimensione della hash
 #define DIM_HASH 1024
 
-//massimo numero di utenti in ogni gruppo
-#define max_users_group 32
-
 //macro per allocazioni dinamiche
 #define SYSCALL_D(r,c,e) \
     if((r=c)==NULL) { perror(e); exit(-1); }
@@ -34,13 +28,17 @@
  * @struct node_g
  * @brief è la struttura che rappresenta la hash
  * @var nome indica il nome del gruppo
- * @var utente indica la lista degli utenti che fanno parte di un gruppo
+ * @var creatore indica il nome dell'utente che ha creato il gruppo
+ * @var utente è l'insieme degli utenti del gruppo, una tabella ad indirizzamento aperto indicizzata tramite il nome, in cui un posto è vuoto se il nome è vuoto
+ * @var cap indica il numero di posti della tabella, una potenza di due
  * @var n_utenti è il numero di utenti di un gruppo
  * @var next puntatore all'elemento successivo
  */
 typedef struct node_g{
-  char *nome;
-  char **utente;
+  Chiave nome;
+  Chiave creatore;
+  Membro *utente;
+  int cap;
   int n_utenti;
   struct node_g *next;
 }Hash_g;
@@ -50,11 +48,6 @@ typedef struct node_g{
  */
 Hash_g **G;
 
-/**
- * @var last rappresenta il puntatore alla fine della struttura hash
- */
-Hash_g *last=NULL;
-
 /**
  * @var zone_g indica il numero di zone che dividono l'hash
  */
@@ -66,21 +59,13 @@ int zone_g=0;
 pthread_mutex_t *mutex5;
 
 /**
- * @function hash_pjw2
- * @brief Calcola la funzione hash
- * @param key indica la chiave su cui calcolare la funzione hash
- * @return ritorna un intero che rappresenta il valore della funzione hash calcolata
+ * @function Lista
+ * @brief Calcola la lista di trabocco di un gruppo
+ * @param k indica il nome del gruppo
+ * @return ritorna l'indice della lista di trabocco
  */
-unsigned int hash_pjw2(void* key){
-  char *datum = (char *)key;
-  unsigned int hash_value, i;
-  if(!datum) return 0;
-  for(hash_value = 0; *datum; ++datum) {
-    hash_value = (hash_value << ONE_EIGHTH) + *datum;
-    if ((i = hash_value & HIGH_BITS) != 0)
-      hash_value = (hash_value ^ (i >> THREE_QUARTERS)) & ~HIGH_BITS;
-    }
-  return (hash_value)%DIM_HASH;
+static int Lista(Chiave *k){
+  return (int)(ImprontaChiave(k)%DIM_HASH);
 }
 
 /**
@@ -101,6 +86,21 @@ void CreateHash_G(int nzone){
     pthread_mutex_init(&(mutex5[i]),NULL);
 }
 
+/**
+ * @function Trova_G
+ * @brief Cerca il gruppo nella sua lista di trabocco, da chiamare in mutua-esclusione sulla zona della lista
+ * @param k indica il nome del gruppo
+ * @param key indica l'indice della lista di trabocco
+ * @return ritorna un puntatore di tipo Hash se trova il gruppo, altrimenti NULL
+ */
+static Hash_g * Trova_G(Chiave *k, int key){
+  //scorro la lista e confronto il nome di ogni gruppo con quello da cercare
+  for(Hash_g *l=G[key];l!=NULL;l=l->next)
+    if(UgualeChiave(&(l->nome),k))
+      return l;
+  return NULL;
+}
+
 /**
  * @function Search_G
  * @brief Cerca il gruppo all'interno della hash
@@ -109,24 +109,129 @@ void CreateHash_G(int nzone){
  */
 Hash_g * Search_G(char *nome){
   //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome del gruppo
-  int key=hash_pjw2(nome);
+  Chiave k;
+  FaiChiave(&k,nome);
+  int key=Lista(&k);
   //prendo la mutua-esclusione
   pthread_mutex_lock(&mutex5[key%zone_g]);
-  //prendo il puntatore alla lista di trabocco corretta
-  Hash_g *l=G[key];
-  //scorro la lista e confronto il nome di ogni gruppo con quello da cercare
-  while(l!=NULL){
-    //se lo trovo
-    if(!strcmp(l->nome,nome)){
-      //rilascio la mutua-esclusione
-      pthread_mutex_unlock(&mutex5[key%zone_g]); 
-      return l;
-    }
-    l=l->next;
-  }
+  Hash_g *l=Trova_G(&k,key);
   //rilascio la mutua-esclusione
   pthread_mutex_unlock(&mutex5[key%zone_g]);
-  return NULL;
+  return l;
+}
+
+/**
+ * @function Vuoto
+ * @brief Controlla se un posto dell'insieme degli utenti di un gruppo è vuoto
+ * @param m indica il posto
+ * @return 1 se il posto è vuoto, 0 altrimenti
+ */
+static int Vuoto(Membro *m){
+  return m->nome.nome[0]=='\0';
+}
+
+/**
+ * @function Casa
+ * @brief Calcola il posto in cui un utente dovrebbe stare nell'insieme degli utenti di un gruppo
+ * @param k indica il nome dell'utente
+ * @param cap indica il numero di posti dell'insieme
+ * @return l'indice del posto
+ */
+static int Casa(Chiave *k, int cap){
+  return (int)(ImprontaChiave(k)&(uint64_t)(cap-1));
+}
+
+/**
+ * @function PostoUtente
+ * @brief Cerca un utente nell'insieme degli utenti di un gruppo, da chiamare in mutua-esclusione sul gruppo
+ * @param l indica il gruppo
+ * @param k indica il nome dell'utente
+ * @return l'indice del posto dell'utente, -1 se non fa parte del gruppo
+ */
+static int PostoUtente(Hash_g *l, Chiave *k){
+  int m=l->cap-1;
+  for(int i=Casa(k,l->cap);!Vuoto(&(l->utente[i]));i=(i+1)&m)
+    if(UgualeChiave(&(l->utente[i].nome),k))
+      return i;
+  return -1;
+}
+
+/**
+ * @function Metti_G
+ * @brief Mette un utente nel primo posto libero a partire dal posto in cui dovrebbe stare
+ * @param v indica i posti dell'insieme
+ * @param cap indica il numero di posti
+ * @param u indica l'utente
+ */
+static void Metti_G(Membro *v, int cap, Membro *u){
+  int i=Casa(&(u->nome),cap);
+  while(!Vuoto(&v[i]))
+    i=(i+1)&(cap-1);
+  v[i]=*u;
+}
+
+/**
+ * @function Ridimensiona
+ * @brief Sposta gli utenti di un gruppo in un insieme con un altro numero di posti
+ * @param l indica il gruppo
+ * @param cap indica il nuovo numero di posti, una potenza di due
+ */
+static void Ridimensiona(Hash_g *l, int cap){
+  Membro *v;
+  SYSCALL_D(v, calloc(cap,sizeof(Membro)), "calloc");
+  for(int i=0;i<l->cap;i++)
+    if(!Vuoto(&(l->utente[i])))
+      Metti_G(v,cap,&(l->utente[i]));
+  free(l->utente);
+  l->utente=v;
+  l->cap=cap;
+}
+
+/**
+ * @function Aggiungi
+ * @brief Aggiunge un utente che non fa già parte di un gruppo, da chiamare in mutua-esclusione sul gruppo
+ * @param l indica il gruppo
+ * @param k indica il nome dell'utente
+ *
+ * L'insieme raddoppia quando è pieno per tre quarti, quindi la ricerca di un utente esamina pochi posti.
+ */
+static void Aggiungi(Hash_g *l, Chiave *k){
+  if((l->n_utenti+1)*4>l->cap*3)
+    Ridimensiona(l,l->cap*2);
+  Membro u;
+  u.nome=*k;
+  //il riferimento ai dati dell'utente evita di cercarlo per nome ad ogni messaggio inviato al gruppo
+  u.utente=PrendiUtente(k->nome);
+  Metti_G(l->utente,l->cap,&u);
+  l->n_utenti++;
+}
+
+/**
+ * @function Togli_U
+ * @brief Toglie un utente da un gruppo, da chiamare in mutua-esclusione sul gruppo
+ * @param l indica il gruppo
+ * @param i indica il posto dell'utente
+ *
+ * Gli utenti successivi che non sono nel proprio posto vengono spostati indietro, così nessuna ricerca si ferma
+ * prima di trovarli e non servono posti segnati come eliminati.
+ */
+static void Togli_U(Hash_g *l, int i){
+  int m=l->cap-1;
+  if(l->utente[i].utente!=NULL)
+    RilasciaUtente(l->utente[i].utente);
+  for(int j=(i+1)&m;!Vuoto(&(l->utente[j]));j=(j+1)&m){
+    int c=Casa(&(l->utente[j].nome),l->cap);
+    //l'utente in j può prendere il posto i solo se i si trova tra il suo posto c e j
+    if(((j-c)&m)>=((j-i)&m)){
+      l->utente[i]=l->utente[j];
+      i=j;
+    }
+  }
+  memset(&(l->utente[i]),0,sizeof(Membro));
+  l->n_utenti--;
+  //la memoria segue il numero degli utenti anche quando diminuisce
+  if(l->cap>GRUPPO_MIN && l->n_utenti*8<l->cap)
+    Ridimensiona(l,l->cap/2);
 }
 
 /**
@@ -137,30 +242,27 @@ Hash_g * Search_G(char *nome){
  */
 void Insert_G(char *nome, char *user){
   //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome del gruppo
-  int key=hash_pjw2(nome);
-  //prendo la mutua-esclusione
-  pthread_mutex_lock(&mutex5[key%zone_g]);
+  Chiave k;
+  FaiChiave(&k,nome);
+  int key=Lista(&k);
   Hash_g *new;
   //inizializzo i campi della struttura hash
   SYSCALL_D(new, malloc(sizeof(Hash_g)), "malloc");
-  new->next=NULL;
-  SYSCALL_D(new->nome, malloc(sizeof(char)*(MAX_NAME_LENGTH+1)), "malloc");
-  strncpy(new->nome,nome, (MAX_NAME_LENGTH+1));
-  SYSCALL_D(new->utente, calloc(max_users_group,sizeof(char*)), "calloc");
-  for(int i=0;i<max_users_group;i++)
-    SYSCALL_D(new->utente[i], calloc((MAX_NAME_LENGTH+1),sizeof(char)), "calloc");
-  strncpy(new->utente[0],user, (MAX_NAME_LENGTH+1));
-  new->n_utenti=1;
-  if(G[key]==NULL){
-    G[key]=new;
-    last=new;
-  } 
-  else{
-    last->next=new;
-    last=new;
-  }
+  new->nome=k;
+  FaiChiave(&(new->creatore),user);
+  SYSCALL_D(new->utente, calloc(GRUPPO_MIN,sizeof(Membro)), "calloc");
+  new->cap=GRUPPO_MIN;
+  new->n_utenti=0;
+  Aggiungi(new,&(new->creatore));
+  //prendo la mutua-esclusione
+  pthread_mutex_lock(&mutex5[key%zone_g]);
+  //inserisco il gruppo in testa alla sua lista di trabocco
+  new->next=G[key];
+  G[key]=new;
+  Annota(REGISTRO_GRUPPO,new->nome.nome,new->creatore.nome);
   //rilascio la mutua-esclusione
   pthread_mutex_unlock(&mutex5[key%zone_g]);
+  AttendiRegistro();
 }
 
 /**
@@ -169,13 +271,30 @@ void Insert_G(char *nome, char *user){
  * @param curr indica il puntatore alle variabili da deallocare
  */
 void FreeAll_G(Hash_g *curr){
-  for(int i=0;i<max_users_group;i++)
-    free(curr->utente[i]);
+  //rilascio i riferimenti agli utenti del gruppo
+  for(int i=0;i<curr->cap;i++)
+    if(!Vuoto(&(curr->utente[i])) && curr->utente[i].utente!=NULL)
+      RilasciaUtente(curr->utente[i].utente);
   free(curr->utente);
-  free(curr->nome);
   free(curr);
 }
 
+/**
+ * @function Stacca
+ * @brief Toglie un gruppo dalla sua lista di trabocco e lo dealloca, da chiamare in mutua-esclusione sulla zona della lista
+ * @param l indica il gruppo
+ * @param key indica l'indice della lista di trabocco
+ */
+static void Stacca(Hash_g *l, int key){
+  for(Hash_g **p=&G[key];*p!=NULL;p=&((*p)->next)){
+    if(*p==l){
+      *p=l->next;
+      FreeAll_G(l);
+      return;
+    }
+  }
+}
+
 /**
  * @function Delete_G
  * @brief Elimina il gruppo dall'hash
@@ -183,33 +302,21 @@ void FreeAll_G(Hash_g *curr){
  */
 void Delete_G(char *nome){
   //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome del gruppo
-  int key=hash_pjw2(nome);
+  Chiave k;
+  FaiChiave(&k,nome);
+  int key=Lista(&k);
   //prendo la mutua-esclusione
   pthread_mutex_lock(&mutex5[key%zone_g]);
-  //prendo il puntatore alla lista di trabocco corretta
-  Hash_g *curr=G[key],*prec=NULL,*tmp=NULL;
-  //scorro la lista e se trovo il gruppo allora lo elimino
-  while(curr!=NULL){
-    if(!strcmp(curr->nome,nome)){
-      if(prec==NULL){
-        G[key]=curr->next;
-        FreeAll_G(curr);
-        pthread_mutex_unlock(&mutex5[key%zone_g]);
-        return;
-      }
-      else{
-        tmp=curr;
-        prec->next=curr->next;
-        FreeAll_G(tmp);
-        curr=prec->next;    
-        pthread_mutex_unlock(&mutex5[key%zone_g]);
-        return;
-      }
-    }
-    else{prec=curr;curr=curr->next;}
+  //se trovo il gruppo allora lo elimino
+  Hash_g *l=Trova_G(&k,key);
+  if(l!=NULL){
+    Annota(REGISTRO_CANCELLA,k.nome,NULL);
+    Stacca(l,key);
   }
   //rilascio la mutua-esclusione
   pthread_mutex_unlock(&mutex5[key%zone_g]);
+  if(l!=NULL)
+    AttendiRegistro();
 }
 
 /**
@@ -231,6 +338,21 @@ void DestroyHash_G(){
   if(G!=NULL) free(G);
 }
 
+/**
+ * @function ScorriGruppi
+ * @brief Esegue una funzione su tutti i gruppi, ognuno in mutua-esclusione sulla propria lista di trabocco
+ * @param visita indica la funzione, a cui vengono passati il gruppo e arg
+ * @param arg indica l'argomento passato alla funzione
+ */
+void ScorriGruppi(void (*visita)(Hash_g*,void*), void *arg){
+  for(int i=0;i<DIM_HASH;i++){
+    pthread_mutex_lock(&mutex5[i%zone_g]);
+    for(Hash_g *l=G[i];l!=NULL;l=l->next)
+      visita(l,arg);
+    pthread_mutex_unlock(&mutex5[i%zone_g]);
+  }
+}
+
 /**
  * @function SearchUser
  * @brief Cerca l'utente all'interno del gruppo
@@ -241,21 +363,16 @@ void DestroyHash_G(){
 int SearchUser(char *user, Hash_g *l){
   if(l==NULL)return 0;
   //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome del gruppo
-  int key=hash_pjw2(l->nome);
+  int key=Lista(&(l->nome));
+  Chiave k;
+  FaiChiave(&k,user);
   //prendo la mutua-esclusione
   pthread_mutex_lock(&mutex5[key%zone_g]);
-  //cerco l'utente nel gruppo
-  for(int i=0;i<l->n_utenti;i++){
-    //se lo trovo
-    if(!strcmp(user,l->utente[i])){
-      //rilascio la mutua-esclusione
-      pthread_mutex_unlock(&mutex5[key%zone_g]);
-      return 1;
-    }
-  }
+  //cerco l'utente nell'insieme degli utenti del gruppo
+  int trovato=(PostoUtente(l,&k)>=0);
   //rilascio la mutua-esclusione
   pthread_mutex_unlock(&mutex5[key%zone_g]);
-  return 0;
+  return trovato;
 }
 
 /**
@@ -263,29 +380,29 @@ int SearchUser(char *user, Hash_g *l){
  * @brief Inserisce l'utente all'interno del gruppo
  * @var nome indica il nome del gruppo
  * @var user indica il nome dell'utente da inserire
- * @return 1 se l'utente è stato inserito, -1 se si è raggiunto il massimo numero di iscritti o 0 altrimenti
+ * @return 1 se l'utente è stato inserito, 0 se era già iscritto, -1 se il gruppo non esiste
  */
 int NewUser(char *nome, char *user){
-   //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome del gruppo
-  int key=hash_pjw2(nome);
-  //cerco il gruppo tramite il nome e mi faccio restituire il puntatore alla lista
-  Hash_g *l=Search_G(nome);
-  //controllo se si è raggiunto il massimo numero di iscritti
-  if(l->n_utenti==max_users_group)
-    return -1;
-  //cerco l'utente all'interno del gruppo e se non lo trovo allora lo aggiungo alla lista degli utenti
-  if(!SearchUser(user,l)){
-    //prendo la mutua-esclusione
-    pthread_mutex_lock(&mutex5[key%zone_g]);
-    //copio l'utente nell'array degli utenti di quel gruppo
-    strncpy(l->utente[l->n_utenti],user,(MAX_NAME_LENGTH+1));
-    //incremento il numero degli utenti
-    l->n_utenti++;
-    //rilascio la mutua-esclusione
-    pthread_mutex_unlock(&mutex5[key%zone_g]);
-    return 1;
+  Chiave g, k;
+  FaiChiave(&g,nome);
+  FaiChiave(&k,user);
+  int key=Lista(&g), res=-1;
+  //prendo la mutua-esclusione
+  pthread_mutex_lock(&mutex5[key%zone_g]);
+  //cerco il gruppo e, se l'utente non ne fa già parte, lo aggiungo
+  Hash_g *l=Trova_G(&g,key);
+  if(l!=NULL){
+    res=(PostoUtente(l,&k)<0);
+    if(res){
+      Aggiungi(l,&k);
+      Annota(REGISTRO_ENTRA,g.nome,k.nome);
+    }
   }
-  return 0;
+  //rilascio la mutua-esclusione
+  pthread_mutex_unlock(&mutex5[key%zone_g]);
+  if(res>0)
+    AttendiRegistro();
+  return res;
 }
 
 /**
@@ -296,34 +413,26 @@ int NewUser(char *nome, char *user){
  * @return 1 se l'utente viene rimosso, 0 altrimenti
  */
 int DeleteUser(char *nome, char *user){
-  //cerco il gruppo tramite il nome e mi faccio restituire il puntatore alla lista
-  Hash_g *l=Search_G(nome);
-  //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome del gruppo
-  int key=hash_pjw2(l->nome);
+  Chiave g, k;
+  FaiChiave(&g,nome);
+  FaiChiave(&k,user);
+  int key=Lista(&g), trovato=0;
   //prendo la mutua-esclusione
   pthread_mutex_lock(&mutex5[key%zone_g]);
-  int i=0, trovato=0;
-  //cerco l'utente all'interno della lista del gruppo
-  while(!trovato){
-    if(!strcmp(user,l->utente[i])){
-      trovato=1;
-      //elimino l'utente shiftando le posizioni dell'array
-      for(;i<l->n_utenti-1;i++)
-        strcpy(l->utente[i],l->utente[i+1]);
-      strcpy(l->utente[l->n_utenti-1],"");
-      //decremento il numero di utenti del gruppo
-      l->n_utenti--;
-    }
-    else i++;
-  }
-  //se non ci sono più utenti in quel gruppo allora cancello il gruppo
-  if(!l->n_utenti){
-    pthread_mutex_unlock(&mutex5[key%zone_g]);
-    Delete_G(nome);
+  Hash_g *l=Trova_G(&g,key);
+  int i=(l!=NULL) ? PostoUtente(l,&k) : -1;
+  if(i>=0){
+    trovato=1;
+    Togli_U(l,i);
+    Annota(REGISTRO_ESCE,g.nome,k.nome);
+    //se non ci sono più utenti in quel gruppo allora cancello il gruppo
+    if(!l->n_utenti)
+      Stacca(l,key);
   }
-  else
-    //rilascio la mutua-esclusione
-    pthread_mutex_unlock(&mutex5[key%zone_g]);
+  //rilascio la mutua-esclusione
+  pthread_mutex_unlock(&mutex5[key%zone_g]);
+  if(trovato)
+    AttendiRegistro();
   return trovato;
 }
 
@@ -338,12 +447,14 @@ int DeleteGroup(long fd, message_t *msg){
   //cerco se esiste il gruppo
   Hash_g *l=Search_G(msg->data.hdr.receiver);
   if(l!=NULL){
+    Chiave k;
+    FaiChiave(&k,msg->hdr.sender);
     //se esiste allora vedo se chi ha fatto richiesta di deregistrazione corrisponde con chi ha creato il gruppo
-    if(!strcmp(msg->hdr.sender,l->utente[0])){
-      //se corrisponde allora invio un messaggio di ok al client
+    if(UgualeChiave(&k,&(l->creatore))){
+      //se corrisponde allora elimino il gruppo
+      Delete_G(l->nome.nome);
+      //e invio un messaggio di ok al client, dopo che l'eliminazione è stata salvata
       SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-      //elimino il gruppo
-      Delete_G(l->nome);
     }
     else{
       //se chi ha fatto richiesta di cancellazione del gruppo non è il creatore allora invio un messaggio di errore
@@ -360,25 +471,29 @@ int DeleteGroup(long fd, message_t *msg){
  * @param fd indica il descrittore del client che ha fatto la richiesta di inviare un messaggio di tipo op ad un gruppo
  * @param msg puntatore per l'accesso ai campi della struttura message_t
  * @param op indica il tipo di messaggio
- * @return 1 se il gruppo esiste e il messaggio è stato inviato, 0 altrimenti
+ * @return 1 se il gruppo esiste e il messaggio è stato inviato, -1 se è stato inviato ma la politica richiede che sia
+ *         persistente e la scrittura è fallita, 0 se il gruppo non esiste
  */
 int FindGroup(long fd, message_t *msg, op_t op){
-  //cerco il gruppo
-  Hash_g *l=Search_G(msg->data.hdr.receiver);
+  Chiave g, k;
+  FaiChiave(&g,msg->data.hdr.receiver);
+  FaiChiave(&k,msg->hdr.sender);
+  int key=Lista(&g), trovato=0;
+  uint64_t inizio[ARCHIVIO_PARTI];
+  SegnaArchivio(inizio);
+  //il gruppo e i riferimenti ai suoi utenti restano validi finchè tengo la mutua-esclusione
+  pthread_mutex_lock(&mutex5[key%zone_g]);
+  Hash_g *l=Trova_G(&g,key);
   //cerco l'utente nel gruppo
-  if(SearchUser(msg->hdr.sender,l)){
-    //aggiungo il file alla history di tutti gli utenti del gruppo
-    AddtoAll_G(l->utente,l->n_utenti,msg,op);
-    //invio il messaggio agli utenti online appartenenti al gruppo
-    for(int i=0;i<l->n_utenti;++i){
-      //ottengo il descrittore dell'utente
-      long fd2=GetFd(l->utente[i]);
-      //invio il messaggio
-      SendMsg_mutex(fd2,msg,op);
-    }
-    return 1;
-  }
-  return 0;
+  trovato=(l!=NULL && PostoUtente(l,&k)>=0);
+  if(trovato)
+    //aggiungo il messaggio alla history di tutti gli utenti del gruppo e lo invio a quelli online
+    AddtoAll_G(l->utente,l->cap,msg,op);
+  pthread_mutex_unlock(&mutex5[key%zone_g]);
+  //aspetto che il messaggio sia persistente fuori dalla mutua-esclusione sul gruppo
+  if(trovato && AttendiArchivio(inizio)<0)
+    return -1;
+  return trovato;
 }
 
 /**
@@ -395,10 +510,10 @@ int CreaGruppo(long fd, message_t *msg){
     SendHdr_mutex(fd, &(msg->hdr), OP_NICK_ALREADY);
   }
   else{
-    //altrimenti invia un messaggio di ok
-    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
-    //inserisce il gruppo nella hash dei gruppi
+    //altrimenti inserisce il gruppo nella hash dei gruppi
     Insert_G(msg->data.hdr.receiver, msg->hdr.sender);
+    //e invia un messaggio di ok, dopo che la creazione è stata salvata
+    SendHdr_mutex(fd, &(msg->hdr), OP_OK);
   }
   return 1;
 }
@@ -422,7 +537,7 @@ int AggiungiAlGruppo(long fd, message_t *msg){
       //se è già presente allora invia un messaggio di errore
       SendHdr_mutex(fd, &(msg->hdr), OP_NICK_ALREADY);
     else if(res<0)
-      //se si è raggiunto il numero massimo di iscritti allora invia un messaggio di errore
+      //se il gruppo è stato cancellato nel frattempo allora invia un messaggio di errore
       SendHdr_mutex(fd, &(msg->hdr), OP_FAIL);
     else
       //altrimenti invia un messaggio di ok
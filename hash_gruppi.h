@@ -8,18 +8,24 @@
  */
 
 #include <message.h>
+#include <chiave.h>
+#include <hash_history.h>
 
 /**
  * @struct node_g
  * @brief è la struttura che rappresenta la hash
  * @var nome indica il nome del gruppo
- * @var utente indica la lista degli utenti che fanno parte di un gruppo
+ * @var creatore indica il nome dell'utente che ha creato il gruppo
+ * @var utente è l'insieme degli utenti del gruppo, una tabella ad indirizzamento aperto indicizzata tramite il nome, in cui un posto è vuoto se il nome è vuoto
+ * @var cap indica il numero di posti della tabella, una potenza di due
  * @var n_utenti è il numero di utenti di un gruppo
  * @var next puntatore all'elemento successivo
  */
 typedef struct node_g{
-  char *nome;
-  char **utente;
+  Chiave nome;
+  Chiave creatore;
+  Membro *utente;
+  int cap;
   int n_utenti;
   struct node_g *next;
 }Hash_g;
@@ -29,14 +35,6 @@ typedef struct node_g{
  */
 Hash_g **G;
 
-/**
- * @function hash_pjw2
- * @brief Calcola la funzione hash
- * @param key indica la chiave su cui calcolare la funzione hash
- * @return ritorna un intero che rappresenta il valore della funzione hash calcolata
- */
-unsigned int hash_pjw2(void* key);
-
 /**
  * @function CreateHash_G
  * @brief Crea la struttura hash
@@ -80,6 +78,14 @@ void Delete_G(char *nome);
  */
 void DestroyHash_G();
 
+/**
+ * @function ScorriGruppi
+ * @brief Esegue una funzione su tutti i gruppi, ognuno in mutua-esclusione sulla propria lista di trabocco
+ * @param visita indica la funzione, a cui vengono passati il gruppo e arg
+ * @param arg indica l'argomento passato alla funzione
+ */
+void ScorriGruppi(void (*visita)(Hash_g*,void*), void *arg);
+
 /**
  * @function SearchUser
  * @brief Cerca l'utente all'interno del gruppo
@@ -94,7 +100,7 @@ int SearchUser(char *user, Hash_g *l);
  * @brief Inserisce l'utente all'interno del gruppo
  * @var nome indica il nome del gruppo
  * @var user indica il nome dell'utente da inserire
- * @return 1 se l'utente è stato inserito, 0 altrimenti
+ * @return 1 se l'utente è stato inserito, 0 se era già iscritto, -1 se il gruppo non esiste
  */
 int NewUser(char *nome, char *user);
 
@@ -103,7 +109,7 @@ int NewUser(char *nome, char *user);
  * @brief Elimina l'utente dal gruppo e cancella il gruppo se non rimangono più utenti iscritti
  * @var nome indica il nome del gruppo
  * @var user indica il nome dell'utente da eliminare
- * @return 1 se l'utente è stato inserito, -1 se si è raggiunto il massimo numero di iscritti o 0 altrimenti
+ * @return 1 se l'utente viene rimosso, 0 altrimenti
  */
 int DeleteUser(char *nome, char *user);
 
@@ -122,7 +128,8 @@ int DeleteGroup(long fd, message_t *msg);
  * @param fd indica il descrittore del client che ha fatto la richiesta di inviare un messaggio di tipo op ad un gruppo
  * @param msg puntatore per l'accesso ai campi della struttura message_t
  * @param op indica il tipo di messaggio
- * @return 1 se il gruppo esiste e il messaggio è stato inviato, 0 altrimenti
+ * @return 1 se il gruppo esiste e il messaggio è stato inviato, -1 se è stato inviato ma la politica richiede che sia
+ *         persistente e la scrittura è fallita, 0 se il gruppo non esiste
  */
 int FindGroup(long fd, message_t *msg, op_t op);
 
@@ -7,63 +7,143 @@
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
  */
 
-#include<limits.h>
-#define BITS_IN_int     ( sizeof(int) * CHAR_BIT )
-#define THREE_QUARTERS  ((int) ((BITS_IN_int * 3) / 4))
-#define ONE_EIGHTH      ((int) (BITS_IN_int / 8))
-#define HIGH_BITS       ( ~((unsigned int)(~0) >> ONE_EIGHTH ))
-
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include <connections.h>
 #include <online.h>
 #include <message.h>
+#include <slab.h>
+#include <epoca.h>
+#include <chiave.h>
+#include <lavori.h>
+#include <archivio.h>
+#include <registro.h>
 
 //macro per allocazioni dinamiche
 #define SYSCALL_D(r,c,e) \
     if((r=c)==NULL) { perror(e); exit(-1);}
 
-#define DIM_HASH 1024
+/**
+ * @struct Messaggio
+ * @brief è un messaggio memorizzato nelle history, allocato in un solo blocco insieme al body e mai modificato
+ * @var rif indica il numero di history che contengono il messaggio
+ * @var archivio indica la posizione del body nell'archivio, ARCHIVIO_NESSUNA se non è ancora stato archiviato
+ * @var dati contiene il tipo, il mittente e il body del messaggio
+ */
+typedef struct Messaggio1{
+  int rif;
+  uint64_t archivio;
+  message_t dati;
+}Messaggio;
 
 /**
  * @struct History
  * @brief è la struttura che rappresenta la history
- * @var msg è un puntatore alla struttura message_t
- * @var consegnato indica se un messaggio è stato consegnato o meno
+ * @var msg è un puntatore al messaggio, condiviso con le history degli altri destinatari
  */
 typedef struct History{
-  message_t *msg;
-  int consegnato;
+  Messaggio *msg;
 }Hist;
 
+//valore della connessione di un utente che non è online
+#define NON_CONNESSO UINT64_MAX
+
 /**
  * @struct node
  * @brief è la struttura che rappresenta l'hash
- * @var H è un puntatore alla stuttura History
+ * @var H è l'array circolare dei messaggi della history, allocato alla ricezione del primo messaggio
  * @var nickname indica il nome dell'utente
+ * @var cap indica la dimensione dell'array, che raddoppia fino a maxhistmsgs man mano che arrivano messaggi
  * @var cont indica il numero dei messaggi presenti nella history di un utente
- * @var start è una variabile che indica l'inizio della history di un utente
- * @var end è una variabile che indica la fine della history di un utente
- * @var controllo è una variabile usata per la gestione della history
- * @var next è il puntatore all'elemento successivo
+ * @var start indica la posizione del messaggio più vecchio
+ * @var seq indica il numero di sequenza che avrà il prossimo messaggio, i messaggi presenti hanno i numeri da seq-cont a seq-1
+ * @var consegnati indica che i messaggi con numero di sequenza minore sono già stati consegnati tramite la history
+ * @var connessione indica il descrittore su cui l'utente è connesso nei 32 bit bassi e la generazione della sua sessione
+ *      in quelli alti, NON_CONNESSO se non è online; i due valori vengono letti insieme con una sola lettura atomica
+ * @var rif indica il numero dei riferimenti all'utente, quello della tabella e quelli dei gruppi di cui fa parte
+ * @var cancellato vale 1 se l'utente è stato eliminato dalla tabella
+ * @var diffusione indica l'ultimo invio a tutti memorizzato nella history, da leggere in mutua-esclusione sulla zona dell'utente
  */
 typedef struct node{
   Hist *H; 
-  char *nickname;
+  char nickname[MAX_NAME_LENGTH+1];
+  int cap;
   int cont;
   int start;
-  int end;
-  int controllo;
-  struct node *next;
+  size_t seq;
+  size_t consegnati;
+  uint64_t connessione;
+  int rif;
+  int cancellato;
+  unsigned long diffusione;
 }Hash;
 
+/**
+ * @struct Membro
+ * @brief è un utente appartenente ad un gruppo
+ * @var nome indica il nome dell'utente
+ * @var utente è un riferimento all'utente, NULL se non è registrato
+ */
+typedef struct Membro1{
+  Chiave nome;
+  Hash *utente;
+}Membro;
+
+/**
+ * @struct Posto
+ * @brief è un elemento della tabella degli utenti, che contiene il nome dell'utente senza doverlo raggiungere tramite puntatore
+ * @var tag contiene i 32 bit alti dell'impronta del nome, 0 se il posto è vuoto
+ * @var dist indica la distanza del posto da quello in cui l'utente dovrebbe stare
+ * @var chiave indica il nome dell'utente
+ * @var utente è il puntatore ai dati dell'utente
+ */
+typedef struct Posto1{
+  uint32_t tag;
+  uint32_t dist;
+  Chiave chiave;
+  Hash *utente;
+}Posto;
+
+/**
+ * @struct Tavola
+ * @brief è la tabella degli utenti, ad indirizzamento aperto con il metodo Robin Hood
+ * @var cap indica il numero di posti, una potenza di due
+ * @var n indica il numero di posti occupati
+ * @var cursore indica il prossimo posto da spostare nella nuova tabella, se la tabella è in fase di ridimensionamento
+ * @var posti è l'array dei posti
+ */
+typedef struct Tavola1{
+  size_t cap;
+  size_t n;
+  size_t cursore;
+  Posto posti[];
+}Tavola;
+
+
+/**
+ * @var attuale è la tabella in cui vengono inseriti gli utenti
+ * @var vecchia è la tabella precedente, i cui utenti vengono spostati in attuale un po' alla volta, NULL se non c'è un ridimensionamento in corso
+ */
+static Tavola *attuale=NULL, *vecchia=NULL;
+
+/**
+ * @var versione è il contatore con cui le ricerche si accorgono di una modifica concorrente della tabella, è dispari durante una modifica
+ */
+static unsigned long versione=0;
+
+/**
+ * @var diffusioni indica il numero degli invii a tutti iniziati, usato per numerarli
+ */
+static unsigned long diffusioni=0;
 
 /**
- * @var T è il puntatore dell'hash
+ * @var mutex_tab è la variabile di mutua-esclusione tra gli inserimenti e le eliminazioni di utenti
  */
-Hash **T;
+static pthread_mutex_t mutex_tab=PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @var zone indica il numero di zone che dividono l'hash
@@ -81,6 +161,176 @@ pthread_mutex_t *mutex3;
  */
 int maxhistmsgs, maxmsgsize;
 
+/**
+ * @function NuovaTavola
+ * @brief Crea una tabella vuota
+ * @param cap indica il numero di posti, una potenza di due
+ * @return la tabella
+ */
+static Tavola * NuovaTavola(size_t cap){
+  Tavola *t;
+  SYSCALL_D(t, calloc(1,sizeof(Tavola)+cap*sizeof(Posto)), "calloc");
+  t->cap=cap;
+  return t;
+}
+
+/**
+ * @function Tag
+ * @brief Restituisce il tag di un'impronta, mai uguale a 0
+ * @param h indica l'impronta
+ * @return il tag
+ */
+static uint32_t Tag(uint64_t h){
+  return (uint32_t)(h>>32)|1;
+}
+
+/**
+ * @function Posizione
+ * @brief Cerca il posto di un utente in una tabella
+ * @param t indica la tabella
+ * @param k indica il nome dell'utente
+ * @param h indica l'impronta del nome
+ * @return l'indice del posto, -1 se l'utente non è nella tabella
+ *
+ * La ricerca si ferma al primo posto vuoto o al primo utente più vicino di noi alla propria posizione, che con il
+ * metodo Robin Hood garantisce che l'utente cercato non si trova più avanti.
+ */
+static long Posizione(Tavola *t, Chiave *k, uint64_t h){
+  size_t m=t->cap-1, i=h&m;
+  uint32_t tag=Tag(h);
+  for(uint32_t d=0;d<=m;d++,i=(i+1)&m){
+    Posto *p=&(t->posti[i]);
+    if(p->tag==0 || p->dist<d)
+      return -1;
+    //il nome viene confrontato solo se il tag coincide
+    if(p->tag==tag && UgualeChiave(&(p->chiave),k))
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * @function Metti
+ * @brief Inserisce un utente in una tabella, scambiandolo con gli utenti più vicini di lui alla propria posizione
+ * @param t indica la tabella
+ * @param k indica il nome dell'utente
+ * @param h indica l'impronta del nome
+ * @param u indica i dati dell'utente
+ */
+static void Metti(Tavola *t, Chiave *k, uint64_t h, Hash *u){
+  size_t m=t->cap-1, i=h&m;
+  Posto cur;
+  memset(&cur,0,sizeof(Posto));
+  cur.tag=Tag(h);
+  cur.chiave=*k;
+  cur.utente=u;
+  while(1){
+    Posto *p=&(t->posti[i]);
+    if(p->tag==0){
+      *p=cur;
+      break;
+    }
+    if(p->dist<cur.dist){
+      Posto tmp=*p;
+      *p=cur;
+      cur=tmp;
+    }
+    i=(i+1)&m;
+    cur.dist++;
+  }
+  t->n++;
+}
+
+/**
+ * @function Togli
+ * @brief Toglie l'utente in un posto di una tabella, spostando indietro di un posto gli utenti successivi che non sono nella propria posizione
+ * @param t indica la tabella
+ * @param i indica l'indice del posto
+ */
+static void Togli(Tavola *t, size_t i){
+  size_t m=t->cap-1;
+  while(1){
+    size_t j=(i+1)&m;
+    Posto *q=&(t->posti[j]);
+    if(q->tag==0 || q->dist==0){
+      memset(&(t->posti[i]),0,sizeof(Posto));
+      break;
+    }
+    t->posti[i]=*q;
+    t->posti[i].dist--;
+    i=j;
+  }
+  t->n--;
+}
+
+/**
+ * @function IniziaModifica
+ * @brief Segnala alle ricerche che la tabella sta per essere modificata, da chiamare in mutua-esclusione su mutex_tab
+ */
+static void IniziaModifica(){
+  __atomic_store_n(&versione,versione+1,__ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @function FineModifica
+ * @brief Segnala alle ricerche che la modifica della tabella è terminata
+ */
+static void FineModifica(){
+  __atomic_store_n(&versione,versione+1,__ATOMIC_RELEASE);
+}
+
+/**
+ * @function Migra
+ * @brief Sposta al più passi posti della vecchia tabella nella nuova, da chiamare durante una modifica
+ * @param passi indica il numero massimo di posti da esaminare
+ *
+ * Il ridimensionamento avviene un po' alla volta ad ogni inserimento o eliminazione, senza fermare gli altri thread.
+ */
+static void Migra(size_t passi){
+  Tavola *v=vecchia;
+  while(v!=NULL && passi-->0){
+    if(v->n>0){
+      Posto *p=&(v->posti[v->cursore]);
+      if(p->tag==0){
+        v->cursore=(v->cursore+1)&(v->cap-1);
+        continue;
+      }
+      Metti(attuale,&(p->chiave),ImprontaChiave(&(p->chiave)),p->utente);
+      //togliendo l'utente, quelli successivi possono tornare indietro nel posto appena esaminato
+      Togli(v,v->cursore);
+    }
+    if(v->n==0){
+      //la vecchia tabella è vuota, la libero quando nessuna ricerca può più leggerla
+      __atomic_store_n(&vecchia,NULL,__ATOMIC_RELEASE);
+      Ritira(v,free);
+      v=NULL;
+    }
+  }
+}
+
+/**
+ * @function Pieno
+ * @brief Controlla se l'inserimento di un utente supererebbe il carico massimo della tabella, da chiamare in mutua-esclusione su mutex_tab
+ * @return 1 se la tabella va raddoppiata, 0 altrimenti
+ */
+static int Pieno(){
+  return (attuale->n+1)*TAVOLA_CARICO>attuale->cap*(TAVOLA_CARICO-1);
+}
+
+/**
+ * @function Cresci
+ * @brief Sostituisce la tabella con una tabella grande il doppio, in cui gli utenti vengono spostati un po' alla volta, da chiamare durante una modifica
+ * @param nuova indica la nuova tabella, allocata prima di iniziare la modifica per non far aspettare le ricerche
+ */
+static void Cresci(Tavola *nuova){
+  //un ridimensionamento precedente non è ancora finito, lo completo
+  if(vecchia!=NULL)
+    Migra(SIZE_MAX);
+  __atomic_store_n(&vecchia,attuale,__ATOMIC_RELEASE);
+  __atomic_store_n(&attuale,nuova,__ATOMIC_RELEASE);
+}
+
 /**
  * @function CreateHash
  * @brief Crea la struttura hash
@@ -91,10 +341,9 @@ int maxhistmsgs, maxmsgsize;
 void CreateHash(int nzone, int maxhist, int maxmsg){
   maxhistmsgs=maxhist;
   maxmsgsize=maxmsg;
-  SYSCALL_D(T,malloc(sizeof(Hash*)*(DIM_HASH)), "malloc");
-  //inizializzo la variabile T che rappresenta la struttura hash
-  for(int i=0;i<DIM_HASH;i++)
-    T[i]=NULL;
+  //creo la tabella degli utenti, che cresce man mano che gli utenti si registrano
+  attuale=NuovaTavola(TAVOLA_MIN);
+  vecchia=NULL;
   zone=nzone;
   //alloco la variabile di mutex
   SYSCALL_D(mutex3, malloc(sizeof(pthread_mutex_t)*zone) , "malloc");
@@ -104,47 +353,169 @@ void CreateHash(int nzone, int maxhist, int maxmsg){
 }
 
 /**
- * @function hash_pjw
- * @brief Calcola la funzione hash
- * @param key indica la chiave su cui calcolare la funzione hash
- * @return ritorna un intero che rappresenta il valore della funzione hash calcolata
+ * @function Zona
+ * @brief Restituisce la zona della history di un utente
+ * @param h indica l'impronta del nome dell'utente
+ * @return l'indice della mutua-esclusione della zona
+ */
+static int Zona(uint64_t h){
+  return (int)(h%zone);
+}
+
+/**
+ * @function Trova
+ * @brief Cerca l'utente nella tabella senza prendere la mutua-esclusione, da chiamare dentro una sezione EntraEpoca/EsciEpoca
+ * @param k indica il nome dell'utente da cercare
+ * @param h indica l'impronta del nome
+ * @return un puntatore di tipo Hash se trova l'utente, altrimenti NULL
+ *
+ * Se un inserimento o un'eliminazione modifica la tabella durante la ricerca, la versione cambia e la ricerca viene
+ * ripetuta; un utente eliminato nel frattempo resta valido fino alla fine della sezione.
  */
-unsigned int hash_pjw(void* key){
-  char *datum = (char *)key;
-  unsigned int hash_value, i;
-  if(!datum) return 0;
-  for(hash_value = 0; *datum; ++datum) {
-    hash_value = (hash_value << ONE_EIGHTH) + *datum;
-    if ((i = hash_value & HIGH_BITS) != 0)
-      hash_value = (hash_value ^ (i >> THREE_QUARTERS)) & ~HIGH_BITS;
+static Hash * Trova(Chiave *k, uint64_t h){
+  while(1){
+    unsigned long ver=__atomic_load_n(&versione,__ATOMIC_ACQUIRE);
+    if(ver&1) continue;
+    Hash *l=NULL;
+    Tavola *t=__atomic_load_n(&attuale,__ATOMIC_ACQUIRE);
+    long i=Posizione(t,k,h);
+    if(i>=0)
+      l=t->posti[i].utente;
+    else{
+      //durante un ridimensionamento l'utente può trovarsi ancora nella vecchia tabella
+      Tavola *v=__atomic_load_n(&vecchia,__ATOMIC_ACQUIRE);
+      if(v!=NULL && (i=Posizione(v,k,h))>=0)
+        l=v->posti[i].utente;
     }
-  return (hash_value)%DIM_HASH;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&versione,__ATOMIC_RELAXED)==ver)
+      return l;
+  }
 }
 
 /**
  * @function Search
- * @brief Cerca l'utente all'interno della hash
+ * @brief Cerca l'utente all'interno della hash, senza prendere la mutua-esclusione
  * @param utente indica il nome dell'utente da cercare
  * @return ritorna un puntatore di tipo Hash se trova l'utente, altrimenti NULL
+ *
+ * Il puntatore può essere usato solo se il chiamante è dentro una sezione EntraEpoca/EsciEpoca, altrimenti serve solo a sapere se l'utente esiste.
  */
 Hash * Search(char *utente){
-  //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome dell'utente
-  int key=hash_pjw(utente);
-  //prendo la lock per eseguire il codice in mutua-esclusione
-  pthread_mutex_lock(&mutex3[key%zone]);
-  Hash *l=T[key];
-  //scorro la lista di trabocco individuata tramite la chiave (key) calcolata
-  while(l!=NULL){
-    //controllo se un utente di quella lista corrisponde all'utente che si sta cercando, se sì allora ritorno il puntatore e rilascio la mutua-esclusione
-    if(!strcmp(l->nickname,utente)){
-      pthread_mutex_unlock(&mutex3[key%zone]); 
-      return l;
+  Chiave k;
+  FaiChiave(&k,utente);
+  EntraEpoca();
+  Hash *l=Trova(&k,ImprontaChiave(&k));
+  EsciEpoca();
+  return l;
+}
+
+/**
+ * @function NuovoMessaggio
+ * @brief Copia un messaggio in un blocco grande quanto il body fino al terminatore, e non quanto MaxMsgSize
+ * @param msg indica il messaggio, di cui vengono copiati il mittente e il body
+ * @param op indica il tipo del messaggio
+ * @return il messaggio, con un riferimento del chiamante da rilasciare con RilasciaMessaggio
+ *
+ * Un messaggio inviato a più utenti viene copiato una sola volta e ogni history ne tiene un riferimento.
+ */
+static Messaggio * NuovoMessaggio(message_t *msg, op_t op){
+  size_t max=(msg->data.hdr.len<(unsigned int)maxmsgsize) ? msg->data.hdr.len : (size_t)maxmsgsize;
+  char *fine=(msg->data.buf!=NULL) ? memchr(msg->data.buf,'\0',max) : NULL;
+  size_t len=(fine!=NULL) ? (size_t)(fine-msg->data.buf) : max;
+  Messaggio *m=Alloca(sizeof(Messaggio)+len+1);
+  memset(m,0,sizeof(Messaggio));
+  m->rif=1;
+  m->archivio=ARCHIVIO_NESSUNA;
+  m->dati.hdr.op=op;
+  strncpy(m->dati.hdr.sender,msg->hdr.sender,MAX_NAME_LENGTH);
+  m->dati.data.buf=(char*)(m+1);
+  if(len>0)
+    memcpy(m->dati.data.buf,msg->data.buf,len);
+  m->dati.data.buf[len]='\0';
+  m->dati.data.hdr.len=len+1;
+  return m;
+}
+
+/**
+ * @function RilasciaMessaggio
+ * @brief Rilascia un riferimento ad un messaggio, liberandolo quando nessuna history lo contiene più
+ * @param m indica il messaggio
+ */
+static void RilasciaMessaggio(Messaggio *m){
+  if(__atomic_sub_fetch(&(m->rif),1,__ATOMIC_ACQ_REL)==0)
+    Libera(m);
+}
+
+/**
+ * @function FreeAll_H
+ * @brief Dealloca delle variabili della struttura history e hash
+ * @param curr è un puntatore alle variabili da deallocare
+ */
+void FreeAll_H(Hash *curr){
+  for(int i=0;i<curr->cont;i++)
+    RilasciaMessaggio(curr->H[(curr->start+i)%curr->cap].msg);
+  Libera(curr->H);
+  free(curr);
+}
+
+/**
+ * @function Adotta
+ * @brief Assegna ad un nuovo utente la history salvata nell'archivio, se ne ha una
+ * @param l indica l'utente, non ancora visibile nella tabella
+ *
+ * I messaggi recuperati non vengono copiati: il loro body punta alla mappatura dell'archivio.
+ */
+static void Adotta(Hash *l){
+  int n;
+  size_t seq;
+  message_t *rec=Recupera(l->nickname,&n,&seq);
+  if(rec==NULL) return;
+  if(n>0){
+    int cap=HISTORY_MIN;
+    while(cap<n) cap*=2;
+    if(cap>maxhistmsgs) cap=maxhistmsgs;
+    l->H=Alloca(sizeof(Hist)*cap);
+    l->cap=cap;
+    for(int i=0;i<n;i++){
+      Messaggio *m=Alloca(sizeof(Messaggio));
+      m->rif=1;
+      m->archivio=ARCHIVIO_NESSUNA;
+      m->dati=rec[i];
+      l->H[i].msg=m;
     }
-    l=l->next;
+    l->cont=n;
   }
-  //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex3[key%zone]);
-  return NULL;
+  //la numerazione continua da quella salvata, i messaggi recuperati sono già stati contati nelle statistiche
+  l->seq=seq;
+  l->consegnati=seq;
+  free(rec);
+}
+
+/**
+ * @function NuovoUtente
+ * @brief Crea un utente senza history
+ * @param utente indica il nome dell'utente
+ * @return l'utente
+ *
+ * La history viene allocata solo quando l'utente riceve il primo messaggio.
+ */
+static Hash * NuovoUtente(const char *utente){
+  Hash *new;
+  SYSCALL_D(new,malloc(sizeof(Hash)), "malloc");
+  strncpy(new->nickname,utente,MAX_NAME_LENGTH);
+  new->nickname[MAX_NAME_LENGTH]='\0';
+  new->H=NULL;
+  new->cap=0;
+  new->cont=0;
+  new->start=0;
+  new->seq=0;
+  new->consegnati=0;
+  new->connessione=NON_CONNESSO;
+  new->rif=1;
+  new->cancellato=0;
+  new->diffusione=0;
+  return new;
 }
 
 /**
@@ -153,47 +524,94 @@ Hash * Search(char *utente){
  * @param utente indica il nome dell'utente da inserire
  */
 void Insert(char *utente){
-  //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome dell'utente
-  int key=hash_pjw(utente);
-  //prendo la lock per eseguire il codice in mutua-esclusione
-  pthread_mutex_lock(&mutex3[key%zone]);
-  Hash *new=malloc(sizeof(Hash));
-  new->next=NULL;
-  SYSCALL_D(new->H,malloc(sizeof(Hist)*maxhistmsgs), "malloc");
-  SYSCALL_D(new->nickname,malloc(sizeof(char)*(MAX_NAME_LENGTH+1)), "malloc");
-  strncpy(new->nickname,utente,(MAX_NAME_LENGTH+1));
-  new->start=0;
-  new->end=0;
-  new->controllo=0;
-  new->cont=0;
-  for(int i=0;i<maxhistmsgs;i++){
-    SYSCALL_D(new->H[i].msg,calloc(1,sizeof(message_t)), "calloc");
-    SYSCALL_D(new->H[i].msg->data.buf,malloc(sizeof(char)*maxmsgsize), "malloc");
-    new->H[i].consegnato=0;
-  }
-  if(T[key]==NULL)
-    T[key]=new; 
-  else{
-    new->next=T[key];
-    T[key]=new;
+  Hash *new=NuovoUtente(utente);
+  Chiave k;
+  FaiChiave(&k,utente);
+  uint64_t h=ImprontaChiave(&k);
+  //prendo la lock per eseguire il codice in mutua-esclusione con gli altri inserimenti ed eliminazioni
+  pthread_mutex_lock(&mutex_tab);
+  //l'utente potrebbe essere stato registrato nel frattempo da un'altra connessione
+  if(Posizione(attuale,&k,h)>=0 || (vecchia!=NULL && Posizione(vecchia,&k,h)>=0)){
+    pthread_mutex_unlock(&mutex_tab);
+    FreeAll_H(new);
+    return;
   }
+  //recupero la history salvata solo quando l'inserimento è sicuro
+  Adotta(new);
+  Tavola *nuova=Pieno() ? NuovaTavola(attuale->cap*2) : NULL;
+  IniziaModifica();
+  Migra(TAVOLA_PASSO);
+  if(nuova!=NULL)
+    Cresci(nuova);
+  //l'utente è già inizializzato quando diventa visibile alle ricerche
+  Metti(attuale,&k,h,new);
+  FineModifica();
+  //la registrazione viene salvata nello stesso ordine delle altre registrazioni ed eliminazioni
+  Annota(REGISTRO_UTENTE,new->nickname,NULL);
   //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex3[key%zone]);
+  pthread_mutex_unlock(&mutex_tab);
+  AttendiRegistro();
 }
 
 /**
- * @function FreeAll_H
- * @brief Dealloca delle variabili della struttura history e hash
- * @param curr è un puntatore alle variabili da deallocare
+ * @function LiberaUtente
+ * @brief Dealloca un utente ritirato, quando nessun thread può più leggerlo
+ * @param p indica l'utente
  */
-void FreeAll_H(Hash *curr){
-  for(int i=0;i<maxhistmsgs;i++){
-    free(curr->H[i].msg->data.buf);
-    free(curr->H[i].msg);
+static void LiberaUtente(void *p){
+  FreeAll_H(p);
+}
+
+/**
+ * @function RilasciaUtente
+ * @brief Rilascia un riferimento ad un utente, che viene liberato quando non è più nella tabella né in alcun gruppo
+ * @param l indica l'utente
+ */
+void RilasciaUtente(Hash *l){
+  //chi lo ha trovato senza prendere un riferimento può ancora leggerlo, verrà liberato quando nessuno potrà più farlo
+  if(__atomic_sub_fetch(&(l->rif),1,__ATOMIC_ACQ_REL)==0)
+    Ritira(l,LiberaUtente);
+}
+
+/**
+ * @function PrendiUtente
+ * @brief Cerca un utente e prende un riferimento, con cui può essere usato anche fuori da una sezione EntraEpoca/EsciEpoca
+ * @param utente indica il nome dell'utente
+ * @return l'utente, da rilasciare con RilasciaUtente, NULL se non è registrato
+ */
+Hash * PrendiUtente(char *utente){
+  Chiave k;
+  FaiChiave(&k,utente);
+  EntraEpoca();
+  Hash *l=Trova(&k,ImprontaChiave(&k));
+  if(l!=NULL){
+    //un utente il cui ultimo riferimento è già stato rilasciato sta per essere liberato, non può essere ripreso
+    int rif=__atomic_load_n(&(l->rif),__ATOMIC_RELAXED);
+    do{
+      if(rif==0){
+        l=NULL;
+        break;
+      }
+    }while(!__atomic_compare_exchange_n(&(l->rif),&rif,rif+1,1,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED));
   }
-  free(curr->H);
-  free(curr->nickname);
-  free(curr);
+  EsciEpoca();
+  return l;
+}
+
+/**
+ * @function Collega
+ * @brief Aggiorna il descrittore su cui è connesso un utente, chiamata quando l'utente si connette o si disconnette
+ * @param k indica il nome dell'utente
+ * @param fd indica il descrittore, -1 se l'utente si è disconnesso
+ * @param generazione indica la generazione della sessione del descrittore
+ */
+void Collega(Chiave *k, long fd, unsigned generazione){
+  uint64_t c=(fd<0) ? NON_CONNESSO : ((uint64_t)generazione<<32)|(uint32_t)fd;
+  EntraEpoca();
+  Hash *l=Trova(k,ImprontaChiave(k));
+  if(l!=NULL)
+    __atomic_store_n(&(l->connessione),c,__ATOMIC_RELEASE);
+  EsciEpoca();
 }
 
 /**
@@ -202,33 +620,114 @@ void FreeAll_H(Hash *curr){
  * @param utente indica il nome dell'utente da eliminare
  */
 void Delete(char *utente){
-  //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome dell'utente
-  int key=hash_pjw(utente);
-  //prendo la lock per eseguire il codice in mutua-esclusione
-  pthread_mutex_lock(&mutex3[key%zone]);
-  Hash *curr=T[key],*prec=NULL,*tmp=NULL;
-  //cerco l'utente nella struttura Hash, se lo trovo allora lo elimino
-  while(curr!=NULL){
-    if(!strcmp(curr->nickname,utente)){
-      if(prec==NULL){
-        T[key]=curr->next;
-        FreeAll_H(curr);
-        pthread_mutex_unlock(&mutex3[key%zone]);
-        return;
-      }
-      else{
-        tmp=curr;
-        prec->next=curr->next;
-        FreeAll_H(tmp);
-        curr=prec->next;    
-        pthread_mutex_unlock(&mutex3[key%zone]);
-        return;
+  Chiave k;
+  FaiChiave(&k,utente);
+  uint64_t h=ImprontaChiave(&k);
+  Hash *curr=NULL;
+  //prendo la lock per eseguire il codice in mutua-esclusione con gli altri inserimenti ed eliminazioni
+  pthread_mutex_lock(&mutex_tab);
+  IniziaModifica();
+  Migra(TAVOLA_PASSO);
+  //cerco l'utente nella tabella, o nella vecchia tabella se non è ancora stato spostato
+  Tavola *t=attuale;
+  long i=Posizione(t,&k,h);
+  if(i<0 && (t=vecchia)!=NULL)
+    i=Posizione(t,&k,h);
+  if(i>=0){
+    curr=t->posti[i].utente;
+    Togli(t,i);
+  }
+  FineModifica();
+  if(curr!=NULL){
+    Annota(REGISTRO_ELIMINAZIONE,curr->nickname,NULL);
+    //i gruppi che hanno ancora un riferimento all'utente vedono che è stato eliminato
+    __atomic_store_n(&(curr->cancellato),1,__ATOMIC_RELEASE);
+    //l'eliminazione viene archiviata dopo l'ultimo messaggio memorizzato nella history dell'utente e prima di rilasciare
+    //mutex_tab, così precede i messaggi di un utente con lo stesso nome registrato subito dopo
+    int key=Zona(h);
+    pthread_mutex_lock(&mutex3[key]);
+    ArchiviaEliminazione(curr->nickname);
+    pthread_mutex_unlock(&mutex3[key]);
+  }
+  //rilascio la mutua-esclusione
+  pthread_mutex_unlock(&mutex_tab);
+  if(curr!=NULL){
+    RilasciaUtente(curr);
+    AttendiRegistro();
+  }
+}
+
+/**
+ * @function InsertAll
+ * @brief Inserisce nella tabella, con una sola modifica, gli utenti recuperati all'avvio
+ * @param nomi indica i nomi degli utenti, tutti diversi e non ancora registrati
+ * @param n indica il numero degli utenti
+ *
+ * La tabella viene allargata una sola volta per tutti gli utenti e gli utenti vengono messi direttamente nei loro
+ * posti, senza cercare duplicati, annotare le registrazioni e spostare gli utenti un po' alla volta. Le ricerche
+ * aspettano la fine dell'intero caricamento, quindi va chiamata prima che il server accetti connessioni.
+ */
+void InsertAll(Chiave *nomi, size_t n){
+  if(n==0) return;
+  //creo gli utenti e recupero le loro history prima di modificare la tabella
+  Hash **nuovi;
+  SYSCALL_D(nuovi, malloc(sizeof(Hash*)*n), "malloc");
+  for(size_t i=0;i<n;i++){
+    nuovi[i]=NuovoUtente(nomi[i].nome);
+    Adotta(nuovi[i]);
+  }
+  pthread_mutex_lock(&mutex_tab);
+  size_t tot=attuale->n+((vecchia!=NULL) ? vecchia->n : 0)+n, cap=attuale->cap;
+  while((tot+1)*TAVOLA_CARICO>cap*(TAVOLA_CARICO-1))
+    cap*=2;
+  IniziaModifica();
+  if(cap>attuale->cap || vecchia!=NULL){
+    //sposto subito gli utenti già presenti nella tabella della dimensione finale
+    Tavola *tab[2]={attuale,vecchia}, *nuova=NuovaTavola(cap);
+    for(int t=0;t<2;t++){
+      if(tab[t]==NULL) continue;
+      for(size_t i=0;i<tab[t]->cap;i++){
+        Posto *p=&(tab[t]->posti[i]);
+        if(p->tag!=0)
+          Metti(nuova,&(p->chiave),ImprontaChiave(&(p->chiave)),p->utente);
       }
     }
-    else{prec=curr;curr=curr->next;}
+    __atomic_store_n(&vecchia,NULL,__ATOMIC_RELEASE);
+    __atomic_store_n(&attuale,nuova,__ATOMIC_RELEASE);
+    for(int t=0;t<2;t++)
+      if(tab[t]!=NULL)
+        Ritira(tab[t],free);
   }
-  //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex3[key%zone]);
+  for(size_t i=0;i<n;i++)
+    Metti(attuale,&(nomi[i]),ImprontaChiave(&(nomi[i])),nuovi[i]);
+  FineModifica();
+  pthread_mutex_unlock(&mutex_tab);
+  free(nuovi);
+}
+
+/**
+ * @function ElencoUtenti
+ * @brief Copia i nomi degli utenti registrati
+ * @param n conterrà il numero degli utenti
+ * @return l'array dei nomi, da liberare con free
+ *
+ * Blocca gli inserimenti e le eliminazioni solo per il tempo della copia, le ricerche proseguono.
+ */
+Chiave * ElencoUtenti(size_t *n){
+  pthread_mutex_lock(&mutex_tab);
+  Tavola *tab[2]={attuale,vecchia};
+  size_t tot=attuale->n+((vecchia!=NULL) ? vecchia->n : 0), j=0;
+  Chiave *nomi;
+  SYSCALL_D(nomi, malloc(sizeof(Chiave)*((tot>0) ? tot : 1)), "malloc");
+  for(int k=0;k<2;k++){
+    if(tab[k]==NULL) continue;
+    for(size_t i=0;i<tab[k]->cap;i++)
+      if(tab[k]->posti[i].tag!=0)
+        nomi[j++]=tab[k]->posti[i].chiave;
+  }
+  pthread_mutex_unlock(&mutex_tab);
+  *n=j;
+  return nomi;
 }
 
 /**
@@ -236,181 +735,469 @@ void Delete(char *utente){
  * @brief Elimina la struttura hash
  */
 void DestroyHash(){
-  if(T==NULL) return;
-  Hash *curr,*tmp;
-  for(int i=0; i<DIM_HASH; i++){
-    curr = T[i]; tmp=NULL;
-    while(curr!=NULL){
-      tmp=curr;
-      curr=curr->next;
-      FreeAll_H(tmp);
-    } 
+  if(attuale==NULL) return;
+  Tavola *tab[2]={attuale,vecchia};
+  for(int k=0;k<2;k++){
+    if(tab[k]==NULL) continue;
+    for(size_t i=0;i<tab[k]->cap;i++)
+      if(tab[k]->posti[i].tag!=0)
+        RilasciaUtente(tab[k]->posti[i].utente);
+    free(tab[k]);
   }
+  attuale=vecchia=NULL;
   free(mutex3);
-  if(T!=NULL) free(T);
+}
+
+/**
+ * @function Allarga
+ * @brief Raddoppia l'array della history di un utente, senza superare maxhistmsgs, da chiamare in mutua-esclusione sulla zona dell'utente
+ * @param l indica l'utente
+ */
+static void Allarga(Hash *l){
+  int cap=(l->cap==0) ? HISTORY_MIN : 2*l->cap;
+  if(cap>maxhistmsgs) cap=maxhistmsgs;
+  Hist *H=Alloca(sizeof(Hist)*cap);
+  //copio i messaggi in ordine, dal più vecchio
+  for(int i=0;i<l->cont;i++)
+    H[i]=l->H[(l->start+i)%l->cap];
+  Libera(l->H);
+  l->H=H;
+  l->cap=cap;
+  l->start=0;
+}
+
+/**
+ * @function Memorizza
+ * @brief Aggiunge un messaggio alla history di un utente, eliminando il più vecchio se la history è piena, da chiamare in mutua-esclusione sulla zona dell'utente
+ * @param l indica l'utente
+ * @param m indica il messaggio, di cui la history prende un riferimento
+ */
+static void Memorizza(Hash *l, Messaggio *m){
+  if(l->cont==l->cap){
+    if(l->cap<maxhistmsgs)
+      Allarga(l);
+    else{
+      //la history è piena, il messaggio più vecchio lascia il posto al nuovo
+      RilasciaMessaggio(l->H[l->start].msg);
+      l->start=(l->start+1)%l->cap;
+      l->cont--;
+    }
+  }
+  __atomic_add_fetch(&(m->rif),1,__ATOMIC_RELAXED);
+  //un utente già eliminato non viene archiviato, la sua eliminazione è già nell'archivio
+  if(!__atomic_load_n(&(l->cancellato),__ATOMIC_ACQUIRE))
+    Archivia(l->nickname,l->seq,&(m->dati),&(m->archivio));
+  Hist *h2=&(l->H[(l->start+l->cont)%l->cap]);
+  h2->msg=m;
+  l->cont++;
+  l->seq++;
 }
 
 /**
  * @function Add_H
  * @brief Aggiunge un messaggio all'interno della history
  * @param msg è un puntatore di tipo message_t
+ * @return 0 se il messaggio è stato aggiunto, -1 se la politica richiede che sia persistente e la scrittura è fallita
  */
-void Add_H(message_t *msg, op_t op){
-  //cerco il puntatore alla history dell'utente passato come parametro
-  Hash *l=Search(msg->data.hdr.receiver);
-  //mi faccio restituire la chiave calcolata dalla funzione dandogli come parametro il nome dell'utente
-  int key=hash_pjw(msg->data.hdr.receiver);
+int Add_H(message_t *msg, op_t op){
+  uint64_t inizio[ARCHIVIO_PARTI];
+  SegnaArchivio(inizio);
+  //mi faccio restituire la chiave del nome dell'utente e la sua impronta
+  Chiave k;
+  FaiChiave(&k,msg->data.hdr.receiver);
+  uint64_t h=ImprontaChiave(&k);
+  int key=Zona(h);
+  //cerco il puntatore alla history dell'utente, che resta valido fino a EsciEpoca anche se l'utente viene eliminato
+  EntraEpoca();
+  Hash *l=Trova(&k,h);
+  if(l==NULL){
+    EsciEpoca();
+    return 0;
+  }
+  //il messaggio viene copiato fuori dalla mutua-esclusione
+  Messaggio *m=NuovoMessaggio(msg,op);
   //prendo la lock per eseguire il codice in mutua-esclusione
-  pthread_mutex_lock(&mutex3[key%zone]);
-  Hist h2 = l->H[l->end];
-  //controllo se i "puntatori" start ed end siano uguali e che la variabile controllo sia non 0, in tal caso incremento il contatore start
-  //la variabile controllo mi serve a non far avanzare start la prima volta che start ed end puntano alla stessa posizione
-  if((l->start==l->end)&&(l->controllo))l->start=(l->start+1)%maxhistmsgs;
-  strncpy(h2.msg->hdr.sender,msg->hdr.sender,(MAX_NAME_LENGTH+1));
-  strncpy(h2.msg->data.buf,msg->data.buf, maxmsgsize);
-  h2.msg->hdr.op=op;
-  if(l->cont<maxhistmsgs)
-    l->cont++;
-  l->end=(l->end+1)%maxhistmsgs;
-  if(!l->end)l->controllo=1;
+  pthread_mutex_lock(&mutex3[key]);
+  Memorizza(l,m);
   //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex3[key%zone]);
-} 
+  pthread_mutex_unlock(&mutex3[key]);
+  EsciEpoca();
+  RilasciaMessaggio(m);
+  //con la politica che lo richiede, il mittente riceve la risposta solo quando il messaggio è persistente
+  return AttendiArchivio(inizio);
+}
 
 /**
- * @function AddtoAll_H
- * @brief Aggiunge un messaggio alla history di tutti gli utenti, eccetto di chi l'ha inviato
- * @param msg è un puntatore di tipo message_t
- * @param lista è un array di stringhe da riempire con i nomi degli utenti a cui inviare il messaggio
- * @return il numero degli utenti a cui è stato inviato il messaggio
- */
-int AddtoAll_H(message_t *msg, char **lista){
-  int cont=0;
-  //scorro tutta la hash
-  for(int i=0;i<DIM_HASH;i++){
-    Hash *l=T[i];
-    //prendo la mutua-esclusione
-    pthread_mutex_lock(&mutex3[i%zone]);
-    while(l!=NULL){
-      Hist h2 = l->H[l->end];
-      if(strcmp(l->nickname,msg->hdr.sender)){
-        if((l->start==l->end)&&(l->controllo))l->start=(l->start+1)%maxhistmsgs;
-        strncpy(h2.msg->hdr.sender,msg->hdr.sender, (MAX_NAME_LENGTH+1));
-  	strncpy(h2.msg->data.buf,msg->data.buf, maxmsgsize);	
-        strncpy(lista[cont],l->nickname, (MAX_NAME_LENGTH+1));
-	cont++;
-        h2.msg->hdr.op=TXT_MESSAGE;
-        if(l->cont<maxhistmsgs)
-          l->cont++;
-        l->end=(l->end+1)%maxhistmsgs;
-        if(!l->end)l->controllo=1;
+ * @struct Parte
+ * @brief è una parte di un invio a tutti, che riguarda DIFFUSIONE_PARTE posti della tabella degli utenti
+ * @var d indica l'invio di cui fa parte
+ * @var fd contiene i descrittori dei destinatari online, a cui il messaggio viene consegnato
+ * @var nfd indica il numero dei descrittori
+ * @var offline indica il numero dei destinatari a cui il messaggio non è stato consegnato
+ */
+typedef struct Parte1{
+  struct Diffusione1 *d;
+  long *fd;
+  int nfd;
+  int offline;
+}Parte;
+
+/**
+ * @struct Diffusione
+ * @brief è un invio a tutti, diviso in parti eseguite dai worker
+ * @var m indica il messaggio
+ * @var mittente indica il nome di chi ha inviato il messaggio
+ * @var id indica il numero dell'invio, con cui un utente incontrato due volte durante la scansione viene riconosciuto
+ * @var tab sono la tabella degli utenti e l'eventuale vecchia tabella lette all'inizio della scansione, che restano
+ *      allocate perchè chi ha iniziato l'invio resta in una sezione EntraEpoca/EsciEpoca
+ * @var posti indica il numero totale dei posti delle due tabelle
+ * @var parti indica il numero delle parti
+ * @var prossima indica la prossima parte da eseguire
+ * @var mancanti indica il numero di parti di cui non è ancora stata aggiornata la history
+ * @var rif indica il numero dei riferimenti all'invio, che viene liberato quando arriva a 0
+ * @var esito indica la funzione a cui comunicare quanti messaggi sono stati consegnati e quanti no
+ * @var mutex variabile per la gestione della mutua-esclusione su mancanti
+ * @var cond variabile di condizione su cui si attende che mancanti arrivi a 0
+ * @var parte è l'array delle parti
+ */
+typedef struct Diffusione1{
+  Messaggio *m;
+  Chiave mittente;
+  unsigned long id;
+  Tavola *tab[2];
+  size_t posti;
+  int parti;
+  int prossima;
+  int mancanti;
+  int rif;
+  void (*esito)(int,int);
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  Parte parte[];
+}Diffusione;
+
+/**
+ * @function RilasciaDiffusione
+ * @brief Rilascia un riferimento ad un invio a tutti, liberandolo insieme al messaggio quando non ne restano
+ * @param d indica l'invio
+ */
+static void RilasciaDiffusione(Diffusione *d){
+  if(__atomic_sub_fetch(&(d->rif),1,__ATOMIC_ACQ_REL)>0)
+    return;
+  RilasciaMessaggio(d->m);
+  pthread_mutex_destroy(&(d->mutex));
+  pthread_cond_destroy(&(d->cond));
+  free(d);
+}
+
+/**
+ * @function MemorizzaParte
+ * @brief Aggiunge il messaggio alla history degli utenti di una parte e raccoglie i descrittori di quelli online
+ * @param d indica l'invio
+ * @param i indica l'indice della parte
+ *
+ * I posti della parte vengono copiati senza prendere mutua-esclusioni e la copia viene ripetuta se un inserimento o
+ * un'eliminazione modifica la tabella nel frattempo, come fa Trova. Un utente spostato da una parte all'altra durante
+ * la scansione può essere incontrato due volte: la seconda viene riconosciuta tramite il numero dell'invio.
+ */
+static void MemorizzaParte(Diffusione *d, int i){
+  Parte *p=&(d->parte[i]);
+  size_t inizio=(size_t)i*DIFFUSIONE_PARTE;
+  size_t fine=(inizio+DIFFUSIONE_PARTE<d->posti) ? inizio+DIFFUSIONE_PARTE : d->posti;
+  p->d=d;
+  p->fd=Alloca(sizeof(long)*(fine-inizio));
+  p->nfd=0;
+  p->offline=0;
+  Hash **utenti=Alloca(sizeof(Hash*)*(fine-inizio));
+  int *zona=Alloca(sizeof(int)*(fine-inizio));
+  size_t n;
+  while(1){
+    unsigned long ver=__atomic_load_n(&versione,__ATOMIC_ACQUIRE);
+    if(ver&1) continue;
+    n=0;
+    for(size_t g=inizio;g<fine;g++){
+      //i posti della vecchia tabella seguono quelli della tabella attuale
+      Tavola *t=d->tab[0];
+      size_t j=g;
+      if(j>=t->cap){
+        j-=t->cap;
+        t=d->tab[1];
       }
-      l=l->next;
+      Posto *q=&(t->posti[j]);
+      if(q->tag==0 || UgualeChiave(&(q->chiave),&(d->mittente))) continue;
+      utenti[n]=q->utente;
+      zona[n++]=Zona(ImprontaChiave(&(q->chiave)));
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&versione,__ATOMIC_RELAXED)==ver)
+      break;
+  }
+  for(size_t g=0;g<n;g++){
+    Hash *l=utenti[g];
+    //prendo la mutua-esclusione sulla history dell'utente
+    pthread_mutex_lock(&mutex3[zona[g]]);
+    int nuovo=(l->diffusione!=d->id);
+    if(nuovo){
+      l->diffusione=d->id;
+      Memorizza(l,d->m);
     }
-    //rilascio la mutua-esclusione
-    pthread_mutex_unlock(&mutex3[i%zone]);
+    pthread_mutex_unlock(&mutex3[zona[g]]);
+    if(!nuovo) continue;
+    long fd=GetFd(l->nickname);
+    if(fd<0)
+      p->offline++;
+    else
+      p->fd[p->nfd++]=fd;
+  }
+  Libera(utenti);
+  Libera(zona);
+  //dopo aver segnalato la fine della parte non leggo più la tabella
+  pthread_mutex_lock(&(d->mutex));
+  if(--d->mancanti==0)
+    pthread_cond_signal(&(d->cond));
+  pthread_mutex_unlock(&(d->mutex));
+}
+
+/**
+ * @function ConsegnaParte
+ * @brief Consegna il messaggio ai destinatari online di una parte e comunica l'esito, rilasciando poi un riferimento all'invio
+ * @param arg indica la parte
+ */
+static void ConsegnaParte(void *arg){
+  Parte *p=arg;
+  Diffusione *d=p->d;
+  //ogni parte invia una propria copia degli header, il messaggio memorizzato non viene mai modificato
+  message_t invio=d->m->dati;
+  int consegnati=0;
+  for(int i=0;i<p->nfd;i++){
+    if(SendMsg_mutex(p->fd[i],&invio,TXT_MESSAGE))
+      consegnati++;
+    else
+      p->offline++;
+  }
+  if(d->esito!=NULL)
+    d->esito(consegnati,p->offline);
+  Libera(p->fd);
+  RilasciaDiffusione(d);
+}
+
+/**
+ * @function EseguiParte
+ * @brief Esegue per intero la prossima parte di un invio a tutti non ancora iniziata, se c'è, eseguita dai worker come lavoro
+ * @param arg indica l'invio
+ */
+static void EseguiParte(void *arg){
+  Diffusione *d=arg;
+  int i=__atomic_fetch_add(&(d->prossima),1,__ATOMIC_RELAXED);
+  if(i>=d->parti){
+    //le parti sono già state prese da altri
+    RilasciaDiffusione(d);
+    return;
   }
-  return cont;
+  MemorizzaParte(d,i);
+  ConsegnaParte(&(d->parte[i]));
+}
+
+/**
+ * @function Scansiona
+ * @brief Esegue una scansione completa delle tabelle degli utenti per un invio a tutti
+ * @param m indica il messaggio, di cui l'invio prende un riferimento
+ * @param mittente indica il nome di chi ha inviato il messaggio
+ * @param id indica il numero dell'invio
+ * @param esito indica la funzione a cui ogni parte comunica quanti messaggi ha consegnato e quanti no
+ * @return 1 se la tabella è stata modificata durante la scansione, 0 altrimenti
+ *
+ * Va chiamata dentro una sezione EntraEpoca/EsciEpoca, che tiene allocate le tabelle e gli utenti letti dalle parti.
+ */
+static int Scansiona(Messaggio *m, Chiave *mittente, unsigned long id, void (*esito)(int,int)){
+  unsigned long ver;
+  while((ver=__atomic_load_n(&versione,__ATOMIC_ACQUIRE))&1);
+  Tavola *t0=__atomic_load_n(&attuale,__ATOMIC_ACQUIRE), *t1=__atomic_load_n(&vecchia,__ATOMIC_ACQUIRE);
+  size_t posti=t0->cap+((t1!=NULL) ? t1->cap : 0);
+  int parti=(int)((posti+DIFFUSIONE_PARTE-1)/DIFFUSIONE_PARTE);
+  Diffusione *d;
+  SYSCALL_D(d, malloc(sizeof(Diffusione)+sizeof(Parte)*parti), "malloc");
+  __atomic_add_fetch(&(m->rif),1,__ATOMIC_RELAXED);
+  d->m=m;
+  d->mittente=*mittente;
+  d->id=id;
+  d->tab[0]=t0;
+  d->tab[1]=t1;
+  d->posti=posti;
+  d->parti=parti;
+  d->prossima=0;
+  d->mancanti=parti;
+  //un riferimento per il chiamante e uno per ogni lavoro affidato
+  d->rif=parti;
+  d->esito=esito;
+  pthread_mutex_init(&(d->mutex),NULL);
+  pthread_cond_init(&(d->cond),NULL);
+  for(int i=1;i<parti;i++)
+    AffidaLavoro(EseguiParte,d);
+  int i;
+  while((i=__atomic_fetch_add(&(d->prossima),1,__ATOMIC_RELAXED))<parti){
+    MemorizzaParte(d,i);
+    __atomic_add_fetch(&(d->rif),1,__ATOMIC_RELAXED);
+    AffidaLavoro(ConsegnaParte,&(d->parte[i]));
+  }
+  //le parti rimaste sono già in esecuzione su altri worker
+  pthread_mutex_lock(&(d->mutex));
+  while(d->mancanti>0)
+    pthread_cond_wait(&(d->cond),&(d->mutex));
+  pthread_mutex_unlock(&(d->mutex));
+  RilasciaDiffusione(d);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&versione,__ATOMIC_RELAXED)!=ver;
+}
+
+/**
+ * @function AddtoAll_H
+ * @brief Aggiunge un messaggio alla history di tutti gli utenti, eccetto di chi l'ha inviato, e lo consegna a quelli online
+ * @param msg è un puntatore di tipo message_t
+ * @param esito indica la funzione a cui ogni parte comunica quanti messaggi ha consegnato e quanti no
+ * @return 0 se il messaggio è stato aggiunto, -1 se la politica richiede che sia persistente e la scrittura è fallita
+ *
+ * La tabella degli utenti viene divisa in parti di DIFFUSIONE_PARTE posti, affidate ai worker. Anche il chiamante
+ * esegue le parti non ancora prese, e ritorna appena tutte le history sono aggiornate: la consegna delle sue parti
+ * viene affidata ai worker, quindi il mittente non aspetta le scritture sui socket dei destinatari.
+ * La scansione non blocca gli inserimenti e le eliminazioni: se la tabella cambia nel frattempo un utente spostato
+ * potrebbe essere stato saltato, quindi la scansione viene ripetuta, saltando gli utenti che hanno già il messaggio.
+ * Dopo DIFFUSIONE_TENTATIVI scansioni l'ultima viene eseguita in mutua-esclusione sulla tabella. Un utente registrato
+ * durante l'invio può riceverlo o meno, come se si fosse registrato subito prima o subito dopo.
+ */
+int AddtoAll_H(message_t *msg, void (*esito)(int,int)){
+  uint64_t inizio[ARCHIVIO_PARTI];
+  SegnaArchivio(inizio);
+  //il messaggio viene copiato una sola volta, ogni history ne prende un riferimento
+  Messaggio *m=NuovoMessaggio(msg,TXT_MESSAGE);
+  Chiave mittente;
+  FaiChiave(&mittente,msg->hdr.sender);
+  unsigned long id=__atomic_add_fetch(&diffusioni,1,__ATOMIC_RELAXED);
+  //le tabelle e gli utenti letti durante la scansione non vengono liberati finchè non esco dall'epoca
+  EntraEpoca();
+  int t;
+  for(t=1;t<DIFFUSIONE_TENTATIVI;t++)
+    if(!Scansiona(m,&mittente,id,esito))
+      break;
+  if(t==DIFFUSIONE_TENTATIVI){
+    //la tabella cambia troppo spesso, l'ultima scansione blocca inserimenti ed eliminazioni
+    pthread_mutex_lock(&mutex_tab);
+    Scansiona(m,&mittente,id,esito);
+    pthread_mutex_unlock(&mutex_tab);
+  }
+  EsciEpoca();
+  RilasciaMessaggio(m);
+  return AttendiArchivio(inizio);
 }
 
 /**
  * @function AddtoAll_G
- * @brief Aggiunge un messaggio alla history di tutti gli utenti appartenenti al gruppo
- * @param lista contiene l'elenco degli utenti appartenenti al gruppo
- * @param nutenti indica il numero di utenti appartenenti al gruppo
+ * @brief Aggiunge un messaggio alla history di tutti gli utenti appartenenti al gruppo e lo invia a quelli online
+ * @param membri sono i posti dell'insieme degli utenti appartenenti al gruppo, in cui un posto vuoto ha il nome vuoto, da chiamare in mutua-esclusione sul gruppo
+ * @param nposti indica il numero dei posti
  * @param msg è un puntatore di tipo message_t
+ * @param op indica il tipo di messaggio
+ *
+ * Ogni membro tiene un riferimento all'utente, quindi né la history né il descrittore vengono cercati tramite il nome;
+ * solo se l'utente è stato eliminato il riferimento viene sostituito con quello dell'utente registrato con lo stesso nome.
  */
-void AddtoAll_G(char **lista, int nutenti, message_t *msg, op_t op){
-  for(int i=0;i<nutenti;i++){
-    //mi faccio restituire la chiave
-    int key=hash_pjw(lista[i]);
-    //prendo la mutua-esclusione
-    pthread_mutex_lock(&mutex3[key%zone]);
-    Hash *l=T[key];
-    //scorro la lista che punta alla history dell'utente del gruppo
-    while(l!=NULL){
-      Hist h2 = l->H[l->end];
-      //se trovo l'utente nella lista allora copio nelle variabili della history le informazioni prese dalle variabili della struttura message_t
-      if(!strcmp(l->nickname,lista[i])){
-        if((l->start==l->end)&&(l->controllo))l->start=(l->start+1)%maxhistmsgs;
-        strncpy(h2.msg->hdr.sender,msg->hdr.sender,(MAX_NAME_LENGTH+1));
-        strncpy(h2.msg->data.buf,msg->data.buf, maxmsgsize);	
-        h2.msg->hdr.op=op;
-        if(l->cont<maxhistmsgs)
-          l->cont++;
-        l->end=(l->end+1)%maxhistmsgs;
-        if(!l->end)l->controllo=1;
-      }
-      l=l->next;
+void AddtoAll_G(Membro *membri, int nposti, message_t *msg, op_t op){
+  //il messaggio viene copiato una sola volta, ogni history ne prende un riferimento
+  Messaggio *m=NuovoMessaggio(msg,op);
+  for(int i=0;i<nposti;i++){
+    Membro *u=&membri[i];
+    if(u->nome.nome[0]=='\0') continue;
+    if(u->utente==NULL || __atomic_load_n(&(u->utente->cancellato),__ATOMIC_ACQUIRE)){
+      Hash *l=PrendiUtente(u->nome.nome);
+      if(u->utente!=NULL)
+        RilasciaUtente(u->utente);
+      u->utente=l;
+      if(l==NULL) continue;
     }
-    //rilascio la mutua-esclusione
-    pthread_mutex_unlock(&mutex3[key%zone]);
+    Hash *l=u->utente;
+    int key=Zona(ImprontaChiave(&(u->nome)));
+    //prendo la mutua-esclusione sulla history dell'utente
+    pthread_mutex_lock(&mutex3[key]);
+    Memorizza(l,m);
+    pthread_mutex_unlock(&mutex3[key]);
+    //invio il messaggio se l'utente è online, solo alla connessione su cui si era collegato
+    uint64_t c=__atomic_load_n(&(l->connessione),__ATOMIC_ACQUIRE);
+    if(c!=NON_CONNESSO)
+      SendMsgSessione_mutex((long)(uint32_t)c,(unsigned)(c>>32),msg,op);
   }
+  RilasciaMessaggio(m);
 }
 
 /**
  * @function GetHistory
- * @brief Invia la lista dei messaggi ricevuti da un utente
+ * @brief Invia un messaggio di ok seguito dalla lista dei messaggi ricevuti da un utente, con una sola scrittura
  * @param fd indica il descrittore
  * @param msg è un puntatore di tipo message_t per accedere ai vari campi della struttura
  * @param file_inviati è una variabile che conterrà il numero di file consegnati, conteggiati all'interno della funzione
+ * @param dopo se è NULL viene inviata tutta la history, altrimenti solo i messaggi con numero di sequenza maggiore o uguale a *dopo
  * @return ritorna il numero dei messaggi consegnati
+ *
+ * Con dopo diverso da NULL il body della risposta contiene, oltre al numero dei messaggi, il numero di sequenza da
+ * chiedere la volta successiva. Un numero di sequenza più grande di quello dell'utente, ad esempio perchè l'utente è
+ * stato registrato di nuovo, fa inviare tutta la history.
+ * La risposta viene copiata in un unico buffer mentre si tiene la mutua-esclusione sulla history, che viene rilasciata
+ * prima dell'invio: un client lento non blocca chi scrive nella stessa zona.
  */
-int GetHistory(long fd, message_t *msg, int *file_consegnati){
-  //cerco l'utente
-  Hash *l=Search(msg->hdr.sender);
-  //mi faccio restituire la chiave
-  int key=hash_pjw(msg->hdr.sender);
+int GetHistory(long fd, message_t *msg, int *file_consegnati, size_t *dopo){
+  //mi faccio restituire la chiave del nome e la sua impronta
+  Chiave k;
+  FaiChiave(&k,msg->hdr.sender);
+  uint64_t h=ImprontaChiave(&k);
+  int key=Zona(h);
+  //cerco l'utente, che resta valido fino a EsciEpoca anche se viene eliminato
+  EntraEpoca();
+  Hash *l=Trova(&k,h);
   //prendo la mutua-esclusione
-  pthread_mutex_lock(&mutex3[key%zone]);
-  int cont;
-  if(l==NULL){
-    cont=0;
-    msg->data.hdr.len=cont;
-  }
-  else{
-    cont=l->cont;
-    msg->data.hdr.len=sizeof(size_t);
-  }
-  msg->data.buf=calloc(msg->data.hdr.len,sizeof(char));
-  if(msg->data.buf==NULL)
-    return 0;
-  snprintf(msg->data.buf,msg->data.hdr.len,"%s",(char*)&cont);
-  //invio i dati
-  SendData_mutex(fd,&(msg->data));
-  free(msg->data.buf);
-  int mex_consegnati=0, i=l->start;
-  Hist *h2 = l->H;
-  //itero mentre j è minore del numero di messaggi presenti nella history dell'utente
-  for(int j=0;j<cont;++j){
-      //copio le variabili della struttura history nelle variabili delle struttura message_t
-      msg->data.hdr.len=maxmsgsize;
-      msg->data.buf=malloc(msg->data.hdr.len*sizeof(char));
-      if(msg->data.buf==NULL)
-        return -1;
-      strncpy(msg->hdr.sender,h2[i].msg->hdr.sender, (MAX_NAME_LENGTH+1));
-      strncpy(msg->data.buf,h2[i].msg->data.buf,msg->data.hdr.len);
-      //controlllo se il messaggio è di tipo file
-      if(h2[i].msg->hdr.op==FILE_MESSAGE){
-        //controllo se il messaggio non è stato inviato, in tal caso setto la variabile = 1 e aumento il contatore dei file inviati
-        if(!h2[i].consegnato){
-          h2[i].consegnato=1;
-          (*file_consegnati)++;
-        }
-      }
-      else{
-      //se il messaggio è di tipo testuale allora controllo se il messaggio non è stato inviato, in tal caso setto la variabile = 1 e aumento il contatore dei messaggi testuali inviati
-        if(!h2[i].consegnato){
-          h2[i].consegnato=1;
-          mex_consegnati++;
-        }
-      }
-      //invio il messaggio
-      SendMsg_mutex(fd,msg,h2[i].msg->hdr.op);
-      free(msg->data.buf);
-      i=(i+1)%maxhistmsgs;
+  pthread_mutex_lock(&mutex3[key]);
+  size_t tot=(l==NULL) ? 0 : l->cont, seq=(l==NULL) ? 0 : l->seq;
+  //il primo messaggio presente ha numero di sequenza seq-tot, salto quelli che il client ha già ricevuto
+  size_t salta=0;
+  if(dopo!=NULL && *dopo<=seq && *dopo>seq-tot)
+    salta=*dopo-(seq-tot);
+  size_t risposta[2]={tot-salta,seq};
+  msg->hdr.op=OP_OK;
+  msg->data.hdr.len=(dopo!=NULL) ? sizeof(risposta) : sizeof(size_t);
+  //calcolo la dimensione della risposta: header di ok, numero dei messaggi e, per ogni messaggio, header, header del body e body
+  size_t dim=sizeof(message_hdr_t)+sizeof(message_data_hdr_t)+msg->data.hdr.len;
+  for(size_t j=salta;j<tot;++j)
+    dim+=sizeof(message_hdr_t)+sizeof(message_data_hdr_t)+l->H[(l->start+j)%l->cap].msg->dati.data.hdr.len;
+  char *buf=Alloca(dim), *p=buf;
+  memcpy(p,&(msg->hdr),sizeof(message_hdr_t));
+  p+=sizeof(message_hdr_t);
+  memcpy(p,&(msg->data.hdr),sizeof(message_data_hdr_t));
+  p+=sizeof(message_data_hdr_t);
+  memcpy(p,risposta,msg->data.hdr.len);
+  p+=msg->data.hdr.len;
+  int mex_consegnati=0;
+  for(size_t j=salta;j<tot;++j){
+    message_t *m=&(l->H[(l->start+j)%l->cap].msg->dati);
+    //i messaggi con numero di sequenza minore del cursore sono già stati contati come consegnati
+    if(seq-tot+j>=l->consegnati){
+      if(m->hdr.op==FILE_MESSAGE)
+        (*file_consegnati)++;
+      else
+        mex_consegnati++;
+    }
+    memcpy(p,&(m->hdr),sizeof(message_hdr_t));
+    p+=sizeof(message_hdr_t);
+    memcpy(p,&(m->data.hdr),sizeof(message_data_hdr_t));
+    p+=sizeof(message_data_hdr_t);
+    memcpy(p,m->data.buf,m->data.hdr.len);
+    p+=m->data.hdr.len;
   }
-  //rilascio la mutua-esclusione
-  pthread_mutex_unlock(&mutex3[key%zone]);
+  if(l!=NULL && seq>l->consegnati)
+    l->consegnati=seq;
+  //rilascio la mutua-esclusione, il buffer non dipende più dalla history
+  pthread_mutex_unlock(&mutex3[key]);
+  EsciEpoca();
+  //invio la risposta e tutti i messaggi con una sola scrittura
+  struct iovec iov={buf,dim};
+  SendV_mutex(fd,&iov,1);
+  Libera(buf);
   return mex_consegnati;
-}
\ No newline at end of file
+}
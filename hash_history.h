@@ -7,40 +7,79 @@
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
  */
 
+#ifndef HASH_HISTORY_H_
+#define HASH_HISTORY_H_
+
+#include <stdint.h>
 #include <message.h>
+#include <chiave.h>
+
+//valore della connessione di un utente che non è online
+#define NON_CONNESSO UINT64_MAX
+
+/**
+ * @struct Messaggio
+ * @brief è un messaggio memorizzato nelle history, allocato in un solo blocco insieme al body e mai modificato
+ * @var rif indica il numero di history che contengono il messaggio
+ * @var archivio indica la posizione del body nell'archivio, ARCHIVIO_NESSUNA se non è ancora stato archiviato
+ * @var dati contiene il tipo, il mittente e il body del messaggio
+ */
+typedef struct Messaggio1{
+  int rif;
+  uint64_t archivio;
+  message_t dati;
+}Messaggio;
 
 /**
  * @struct History
  * @brief è la struttura che rappresenta la history
- * @var msg è un puntatore alla struttura message_t
- * @var consegnato indica se un messaggio è stato consegnato o meno
+ * @var msg è un puntatore al messaggio, condiviso con le history degli altri destinatari
  */
 typedef struct History{
-  message_t *msg;
-  int consegnato;
+  Messaggio *msg;
 }Hist;
 
 /**
  * @struct node
  * @brief è la struttura che rappresenta l'hash
- * @var H è un puntatore ai campi della stuttura History
+ * @var H è l'array circolare dei messaggi della history, allocato alla ricezione del primo messaggio
  * @var nickname indica il nome dell'utente
+ * @var cap indica la dimensione dell'array, che raddoppia fino a maxhistmsgs man mano che arrivano messaggi
  * @var cont indica il numero dei messaggi presenti nella history di un utente
- * @var start è una variabile che punta all'inizio della history di un utente
- * @var end è una variabile che punta alla fine della history di un utente
- * @var controllo è una variabile usata per la gestione della history
- * @var next è il puntatore all'elemento successivo
+ * @var start indica la posizione del messaggio più vecchio
+ * @var seq indica il numero di sequenza che avrà il prossimo messaggio, i messaggi presenti hanno i numeri da seq-cont a seq-1
+ * @var consegnati indica che i messaggi con numero di sequenza minore sono già stati consegnati tramite la history
+ * @var connessione indica il descrittore su cui l'utente è connesso nei 32 bit bassi e la generazione della sua sessione
+ *      in quelli alti, NON_CONNESSO se non è online; i due valori vengono letti insieme con una sola lettura atomica
+ * @var rif indica il numero dei riferimenti all'utente, quello della tabella e quelli dei gruppi di cui fa parte
+ * @var cancellato vale 1 se l'utente è stato eliminato dalla tabella
+ * @var diffusione indica l'ultimo invio a tutti memorizzato nella history, da leggere in mutua-esclusione sulla zona dell'utente
  */
 typedef struct node{
   Hist *H; 
-  char *nickname;
+  char nickname[MAX_NAME_LENGTH+1];
+  int cap;
   int cont;
   int start;
-  int end;
-  int controllo;
-  struct node *next;
+  size_t seq;
+  size_t consegnati;
+  uint64_t connessione;
+  int rif;
+  int cancellato;
+  unsigned long diffusione;
 }Hash;
 
+/**
+ * @struct Membro
+ * @brief è un utente appartenente ad un gruppo
+ * @var nome indica il nome dell'utente
+ * @var utente è un riferimento all'utente, NULL se non è registrato
+ */
+typedef struct Membro1{
+  Chiave nome;
+  Hash *utente;
+}Membro;
+
 /**
  * @function CreateHash
  * @brief Crea la struttura hash
@@ -50,19 +89,13 @@ typedef struct node{
  */
 void CreateHash(int nzone, int maxhist, int maxmsg);
 
-/**
- * @function hash_pjw
- * @brief Calcola la funzione hash
- * @param key indica la chiave su cui calcolare la funzione hash
- * @return ritorna un intero che rappresenta il valore della funzione hash calcolata
- */
-unsigned int hash_pjw(void* key);
-
 /**
  * @function Search
  * @brief Cerca l'utente all'interno della hash
  * @param utente indica il nome dell'utente da cercare
  * @return un puntatore di tipo Hash se trova l'utente, altrimenti NULL
+ *
+ * Il puntatore può essere usato solo se il chiamante è dentro una sezione EntraEpoca/EsciEpoca, altrimenti serve solo a sapere se l'utente esiste.
  */
 Hash * Search(char *utente);
 
@@ -87,6 +120,46 @@ void FreeAll_H(Hash *curr);
  */
 void Delete(char *utente);
 
+/**
+ * @function InsertAll
+ * @brief Inserisce nella tabella, con una sola modifica, gli utenti recuperati all'avvio
+ * @param nomi indica i nomi degli utenti, tutti diversi e non ancora registrati
+ * @param n indica il numero degli utenti
+ */
+void InsertAll(Chiave *nomi, size_t n);
+
+/**
+ * @function ElencoUtenti
+ * @brief Copia i nomi degli utenti registrati
+ * @param n conterrà il numero degli utenti
+ * @return l'array dei nomi, da liberare con free
+ */
+Chiave * ElencoUtenti(size_t *n);
+
+/**
+ * @function PrendiUtente
+ * @brief Cerca un utente e prende un riferimento, con cui può essere usato anche fuori da una sezione EntraEpoca/EsciEpoca
+ * @param utente indica il nome dell'utente
+ * @return l'utente, da rilasciare con RilasciaUtente, NULL se non è registrato
+ */
+Hash * PrendiUtente(char *utente);
+
+/**
+ * @function RilasciaUtente
+ * @brief Rilascia un riferimento ad un utente, che viene liberato quando non è più nella tabella né in alcun gruppo
+ * @param l indica l'utente
+ */
+void RilasciaUtente(Hash *l);
+
+/**
+ * @function Collega
+ * @brief Aggiorna il descrittore su cui è connesso un utente, chiamata quando l'utente si connette o si disconnette
+ * @param k indica il nome dell'utente
+ * @param fd indica il descrittore, -1 se l'utente si è disconnesso
+ * @param generazione indica la generazione della sessione del descrittore
+ */
+void Collega(Chiave *k, long fd, unsigned generazione);
+
 /**
  * @function DestroyHash
  * @brief Elimina la struttura hash
@@ -98,47 +171,42 @@ void DestroyHash();
  * @brief Aggiunge un messaggio all'interno della history
  * @param msg è un puntatore di tipo message_t
  * @param op indica il tipo di messaggio
+ * @return 0 se il messaggio è stato aggiunto, -1 se la politica richiede che sia persistente e la scrittura è fallita
  */
-void Add_H(message_t *msg, op_t op);
-
-/**
- * @function CreaLista
- * @brief Crea un array di stringhe
- * @return un puntatore che rappresenta l'array di stringhe
- */
-char ** CreaLista();
-
-/**
- * @function CancellaLista
- * @brief Elimina la memoria allocata per l'allocazione dell'array di stringhe
- */
-void CancellaLista(char **lista);
+int Add_H(message_t *msg, op_t op);
 
 /**
  * @function AddtoAll_H
- * @brief Aggiunge un messaggio alla history di tutti gli utenti, eccetto di chi l'ha inviato
+ * @brief Aggiunge un messaggio alla history di tutti gli utenti, eccetto di chi l'ha inviato, e lo consegna a quelli online
  * @param msg è un puntatore di tipo message_t
- * @param lista è un array di stringhe da riempire con i nomi degli utenti a cui inviare il messaggio
- * @return il numero degli utenti a cui è stato inviato il messaggio
+ * @param esito indica la funzione a cui comunicare quanti messaggi sono stati consegnati e quanti no, chiamata una volta per ogni parte
+ * @return 0 se il messaggio è stato aggiunto, -1 se la politica richiede che sia persistente e la scrittura è fallita
+ *
+ * L'invio viene diviso in parti eseguite dai worker; la funzione ritorna quando tutte le history sono aggiornate,
+ * anche se la consegna agli utenti online può essere ancora in corso. Gli inserimenti e le eliminazioni di utenti non
+ * vengono bloccati: un utente registrato durante l'invio può riceverlo o meno.
  */
-int AddtoAll_H(message_t *msg, char **lista);
+int AddtoAll_H(message_t *msg, void (*esito)(int,int));
 
 /**
- * @function AggiungiHAll_G
- * @brief Aggiunge un messaggio alla history di tutti gli utenti appartenenti al gruppo
- * @param lista contiene l'elenco degli utenti appartenenti al gruppo
- * @param nutenti indica il numero di utenti appartenenti al gruppo
+ * @function AddtoAll_G
+ * @brief Aggiunge un messaggio alla history di tutti gli utenti appartenenti al gruppo e lo invia a quelli online
+ * @param membri sono i posti dell'insieme degli utenti appartenenti al gruppo, in cui un posto vuoto ha il nome vuoto, da chiamare in mutua-esclusione sul gruppo
+ * @param nposti indica il numero dei posti
  * @param msg è un puntatore di tipo message_t
  * @param op indica il tipo di messaggio
  */
-void AddtoAll_G(char **lista, int nutenti, message_t *msg, op_t op);
+void AddtoAll_G(Membro *membri, int nposti, message_t *msg, op_t op);
 
 /**
  * @function GetHistory
- * @brief Invia la lista dei messaggi ricevuti da un utente
+ * @brief Invia un messaggio di ok seguito dalla lista dei messaggi ricevuti da un utente, con una sola scrittura
  * @param fd indica il descrittore
  * @param msg è un puntatore di tipo message_t per accedere ai vari campi della struttura
  * @param file_inviati è una variabile che conterrà il numero di file consegnati, conteggiati all'interno della funzione
+ * @param dopo se è NULL viene inviata tutta la history, altrimenti solo i messaggi con numero di sequenza maggiore o uguale a *dopo
  * @return ritorna il numero dei messaggi consegnati
  */
-int GetHistory(long fd, message_t *msg, int *file_consegnati);
\ No newline at end of file
+int GetHistory(long fd, message_t *msg, int *file_consegnati, size_t *dopo);
+
+#endif /* HASH_HISTORY_H_ */
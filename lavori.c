@@ -0,0 +1,111 @@
+/**
+ * @file lavori.c
+ * @brief File per la gestione dei lavori affidati ai worker, oltre alle richieste dei client
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Un'operazione che riguarda molti utenti, come l'invio di un messaggio a tutti, viene divisa in parti che vengono
+ * affidate ai worker: i lavori stanno in una lista con la propria mutua-esclusione, e un worker li esegue prima di
+ * cercare una nuova richiesta nelle code.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <slab.h>
+#include <lavori.h>
+
+/**
+ * @struct Lavoro
+ * @brief è la struttura che rappresenta un lavoro in attesa
+ * @var esegui indica la funzione da eseguire
+ * @var arg indica l'argomento della funzione
+ * @var next puntatore al lavoro successivo
+ */
+typedef struct Lavoro1{
+  void (*esegui)(void*);
+  void *arg;
+  struct Lavoro1 *next;
+}Lavoro;
+
+/**
+ * @var primo è il lavoro affidato da più tempo
+ * @var ultimo è il lavoro affidato più di recente
+ * @var attesa indica il numero di lavori nella lista, letto anche senza mutua-esclusione
+ * @var mutex_lavori è la variabile di mutua-esclusione sulla lista
+ * @var sveglia è la funzione che risveglia un worker addormentato
+ */
+static Lavoro *primo=NULL, *ultimo=NULL;
+static int attesa=0;
+static pthread_mutex_t mutex_lavori=PTHREAD_MUTEX_INITIALIZER;
+static void (*sveglia)()=NULL;
+
+/**
+ * @function ImpostaSveglia
+ * @brief Imposta la funzione con cui risvegliare un worker addormentato quando viene affidato un lavoro
+ * @param f indica la funzione
+ */
+void ImpostaSveglia(void (*f)()){
+  sveglia=f;
+}
+
+/**
+ * @function AffidaLavoro
+ * @brief Affida un lavoro al primo worker libero
+ * @param esegui indica la funzione da eseguire
+ * @param arg indica l'argomento della funzione
+ */
+void AffidaLavoro(void (*esegui)(void*), void *arg){
+  Lavoro *l=Alloca(sizeof(Lavoro));
+  l->esegui=esegui;
+  l->arg=arg;
+  l->next=NULL;
+  pthread_mutex_lock(&mutex_lavori);
+  if(ultimo==NULL)
+    primo=l;
+  else
+    ultimo->next=l;
+  ultimo=l;
+  //il contatore viene aggiornato prima di controllare se qualche worker dorme, come per l'inserimento in una coda
+  __atomic_add_fetch(&attesa,1,__ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&mutex_lavori);
+  if(sveglia!=NULL)
+    sveglia();
+}
+
+/**
+ * @function EseguiLavoro
+ * @brief Esegue il lavoro affidato da più tempo, se c'è
+ * @return 1 se è stato eseguito un lavoro, 0 se non ce ne sono
+ */
+int EseguiLavoro(){
+  //la lista viene bloccata solo se contiene qualche lavoro
+  if(__atomic_load_n(&attesa,__ATOMIC_ACQUIRE)==0)
+    return 0;
+  pthread_mutex_lock(&mutex_lavori);
+  Lavoro *l=primo;
+  if(l!=NULL){
+    primo=l->next;
+    if(primo==NULL)
+      ultimo=NULL;
+    __atomic_sub_fetch(&attesa,1,__ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&mutex_lavori);
+  if(l==NULL)
+    return 0;
+  l->esegui(l->arg);
+  Libera(l);
+  return 1;
+}
+
+/**
+ * @function LavoriInAttesa
+ * @brief Restituisce il numero di lavori affidati e non ancora iniziati
+ * @return il numero di lavori
+ */
+int LavoriInAttesa(){
+  return __atomic_load_n(&attesa,__ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,42 @@
+/**
+ * @file lavori.h
+ * @brief File per la gestione dei lavori affidati ai worker, oltre alle richieste dei client
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef LAVORI_H_
+#define LAVORI_H_
+
+/**
+ * @function ImpostaSveglia
+ * @brief Imposta la funzione con cui risvegliare un worker addormentato quando viene affidato un lavoro
+ * @param sveglia indica la funzione
+ */
+void ImpostaSveglia(void (*sveglia)());
+
+/**
+ * @function AffidaLavoro
+ * @brief Affida un lavoro al primo worker libero
+ * @param esegui indica la funzione da eseguire
+ * @param arg indica l'argomento della funzione
+ */
+void AffidaLavoro(void (*esegui)(void*), void *arg);
+
+/**
+ * @function EseguiLavoro
+ * @brief Esegue il lavoro affidato da più tempo, se c'è
+ * @return 1 se è stato eseguito un lavoro, 0 se non ce ne sono
+ */
+int EseguiLavoro();
+
+/**
+ * @function LavoriInAttesa
+ * @brief Restituisce il numero di lavori affidati e non ancora iniziati
+ * @return il numero di lavori
+ */
+int LavoriInAttesa();
+
+#endif /* LAVORI_H_ */
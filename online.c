@@ -9,9 +9,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <config.h>
 #include <connections.h>
 #include <rnwn.h>
+#include <sessione.h>
+#include <slab.h>
+#include <chiave.h>
+#include <hash_history.h>
+#include <sys/uio.h>
 
 //macro per allocazioni dinamiche
 #define SYSCALL_D(r,c,e) \
@@ -19,54 +26,111 @@
 
 /**
  * @struct Online
- * @brief è la struttura che rappresenta la lista degli utenti online
+ * @brief è l'elemento di una lista di trabocco della tabella degli utenti online, con il nome memorizzato nell'elemento
  * @var nick indica il nome dell'utente
  * @var fd indica il descrittore
  * @var next puntatore all'elemento successivo
- * @var mutexon è una variabile di mutex associata ad ogni utente
  */
 typedef struct Online1{
-  char *nick;
+  Chiave nick;
   long fd;
   struct Online1 *next;
-  pthread_mutex_t mutexon;
 }Online;
 
-/** 
- * @var online è un puntatore di tipo Online, che punta al primo elemento della struttura
-*/
-Online *online=NULL;
+/**
+ * @struct Zona
+ * @brief è una zona della tabella degli utenti online, con una propria mutua-esclusione
+ * @var mutex è la variabile di mutua-esclusione sulle liste della zona
+ * @var liste sono le liste di trabocco della zona
+ */
+typedef struct Zona1{
+  pthread_mutex_t mutex;
+  Online *liste[ONLINE_LISTE];
+}Zona;
+
+/**
+ * @struct Presenza
+ * @brief è l'elemento della tabella indicizzata tramite il descrittore, che indica quale utente è connesso su di esso
+ * @var nick indica il nome dell'utente
+ * @var attivo vale 1 se sul descrittore è connesso un utente
+ */
+typedef struct Presenza1{
+  Chiave nick;
+  int attivo;
+}Presenza;
 
 /** 
- * @var last_online è un puntatore di tipo Online, che punta all'ultimo elemento della struttura
+ * @var zone_o è la tabella degli utenti online, indicizzata tramite il nome e divisa in ONLINE_ZONE zone
 */
-Online *last_online=NULL;
+static Zona zone_o[ONLINE_ZONE];
 
 /** 
- * @var mutex2 è una variabile per la gestione della mutua-esclusione
+ * @var presenze è la tabella degli utenti online indicizzata tramite il descrittore
+ * @var npresenze indica la dimensione della tabella
 */
-pthread_mutex_t mutex2=PTHREAD_MUTEX_INITIALIZER;
+static Presenza *presenze=NULL;
+static long npresenze=0;
 
 /** 
  * @var nutenti indica il numero di utenti online
 */
 int nutenti=0;
 
+/**
+ * @function Posizione
+ * @brief Calcola la zona e la lista di trabocco di un nome
+ * @param nick indica il nome dell'utente
+ * @param lista indica dove restituire la lista di trabocco all'interno della zona
+ * @return la zona
+ */
+static Zona * Posizione(Chiave *nick, Online ***lista){
+  uint64_t h=ImprontaChiave(nick);
+  Zona *z=&zone_o[h%ONLINE_ZONE];
+  *lista=&(z->liste[(h/ONLINE_ZONE)%ONLINE_LISTE]);
+  return z;
+}
+
+/**
+ * @function CreaOnline
+ * @brief Crea le tabelle degli utenti online
+ * @param n indica il numero di descrittori, uguale alla dimensione della tabella delle sessioni
+ */
+void CreaOnline(long n){
+  for(int i=0;i<ONLINE_ZONE;i++){
+    pthread_mutex_init(&(zone_o[i].mutex),NULL);
+    memset(zone_o[i].liste,0,sizeof(zone_o[i].liste));
+  }
+  SYSCALL_D(presenze, calloc(n,sizeof(Presenza)), "calloc");
+  npresenze=n;
+}
+
 /**
  * @function SearchFd
- * @brief Cerca il descrittore all'interno della lista degli online
+ * @brief Controlla se sul descrittore è connesso un utente, senza prendere mutua-esclusioni
  * @param fd indica il descrittore da cercare
- * @return ritorna un puntatore di tipo Online se trova il descrittore, altrimenti NULL
+ * @return 1 se sul descrittore è connesso un utente, 0 altrimenti
  */
-Online * SearchFd(long fd){
-  Online *curr=online;
-  //cerco il descrittore e se lo trovo allora ritorno il puntatore
-  while(curr!=NULL){
-    if(fd==curr->fd)
-      return curr;
-    curr=curr->next;
-  }
-  return NULL;
+int SearchFd(long fd){
+  if(fd<0 || fd>=npresenze)
+    return 0;
+  return __atomic_load_n(&(presenze[fd].attivo),__ATOMIC_ACQUIRE);
+}
+
+/**
+ * @function InviaV
+ * @brief Invia un insieme di dati con una sola scrittura, senza bloccarsi se il client non sta leggendo
+ * @param fd indica il descrittore
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param sempre se è 0 i dati vengono inviati solo se l'utente è online, rispettando la soglia della sua coda di uscita
+ * @return 1 se i dati sono stati inviati o accodati, 0 altrimenti
+ */
+static int InviaV(long fd, struct iovec *iov, int cnt, int sempre){
+  //i dati vengono inviati solo se l'utente è online, controllando direttamente la tabella dei descrittori
+  if(!sempre && !SearchFd(fd))
+    return 0;
+  //la sessione serializza le scritture sul descrittore, la parte che non viene accettata subito resta nella sua coda di uscita
+  return Accoda(fd,iov,cnt,!sempre);
 }
 
 /**
@@ -78,27 +142,32 @@ Online * SearchFd(long fd){
  * @return 1 se l'operazione è andata a buon fine, 0 altrimenti
  */
 int SendMsg_mutex(long fd, message_t *msg, int op){
-  //prendo la mutua-esclusione sull'intera struttura online
-  pthread_mutex_lock(&mutex2);
-  //vedo se l'utente è online, in tal caso curr è !=NULL
-  Online *curr=SearchFd(fd);
-  if(curr!=NULL){
-    //prendo la mutua-esclusione sul descrittore dell'utente a cui si vuole inviare il messaggio
-    pthread_mutex_lock(&(curr->mutexon));
-    //rilascio la mutua-esclusione sull'intera struttura online
-    pthread_mutex_unlock(&mutex2);
-    msg->hdr.op=op;
-    //invio il messaggio
-    sendMsg(fd,msg);
-    //rilascio la mutua-esclusione sul descrittore
-    pthread_mutex_unlock(&(curr->mutexon));
-    return 1;
-  }
-  else{
-    //rilascio la mutua-esclusione sull'intera struttura online
-    pthread_mutex_unlock(&mutex2);
+  msg->hdr.op=op;
+  struct iovec iov[3]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)},
+                        {msg->data.buf,msg->data.hdr.len} };
+  //invio il messaggio solo se l'utente è online
+  return InviaV(fd,iov,3,0);
+}
+
+/**
+ * @function SendMsgSessione_mutex
+ * @brief Come SendMsg_mutex, ma invia il messaggio solo se il descrittore è ancora assegnato alla connessione indicata
+ * @param fd indica il descrittore
+ * @param generazione indica la generazione della sessione letta insieme al descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t
+ * @param op indica il tipo di operazione
+ * @return 1 se l'operazione è andata a buon fine, 0 altrimenti
+ */
+int SendMsgSessione_mutex(long fd, unsigned generazione, message_t *msg, int op){
+  msg->hdr.op=op;
+  struct iovec iov[3]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)},
+                        {msg->data.buf,msg->data.hdr.len} };
+  if(!SearchFd(fd))
     return 0;
-  }
+  //la generazione viene confrontata in mutua-esclusione sulla sessione, così il messaggio non arriva a chi ha ricevuto lo stesso descrittore
+  return AccodaSessione(fd,generazione,iov,3);
 }
 
 /**
@@ -108,23 +177,9 @@ int SendMsg_mutex(long fd, message_t *msg, int op){
  * @param msg variabile tramite cui accedere ai campi della struttura message_t
  */
 void SendData_mutex(long fd, message_data_t *msg){
-  //prendo la mutua-esclusione sull'intera struttura online
-  pthread_mutex_lock(&mutex2);
-  //vedo se l'utente è online, in tal caso curr è !=NULL
-  Online *curr=SearchFd(fd);
-  if(curr!=NULL){
-    //prendo la mutua-esclusione sul descrittore dell'utente a cui si vuole inviare il messaggio
-    pthread_mutex_lock(&(curr->mutexon));
-    //rilascio la mutua-esclusione sull'intera struttura online
-    pthread_mutex_unlock(&mutex2);
-    //invio il body
-    sendData(fd,msg);
-    //rilascio la mutua-esclusione sul descrittore
-    pthread_mutex_unlock(&(curr->mutexon));
-  }
-  else
-    //rilascio la mutua-esclusione sull'intera struttura online
-    pthread_mutex_unlock(&mutex2);
+  struct iovec iov[2]={ {&(msg->hdr),sizeof(message_data_hdr_t)}, {msg->buf,msg->hdr.len} };
+  //invio il body solo se l'utente è online
+  InviaV(fd,iov,2,0);
 }
 
 /**
@@ -135,22 +190,92 @@ void SendData_mutex(long fd, message_data_t *msg){
  * @param op indica il tipo di operazione
  */
 void SendHdr_mutex(long fd, message_hdr_t *msg, int op){
-  //prendo la mutua-esclusione sull'intera struttura online
-  pthread_mutex_lock(&mutex2);
-  //vedo se l'utente è online, in tal caso curr è !=NULL
-  Online *curr=SearchFd(fd);
-  if(curr!=NULL)
-    //prendo la mutua-esclusione sul descrittore dell'utente a cui si vuole inviare il messaggio
-    pthread_mutex_lock(&(curr->mutexon));
-  //rilascio la mutua-esclusione sull'intera struttura online
-  pthread_mutex_unlock(&mutex2);
   //setto il campo della struttura message_t in modo da specificare il tipo di operazione
   msg->op=op;
-  //invio l'header
-  sendHeader(fd,msg);
-  if(curr!=NULL)
-    //rilascio la mutua-esclusione sul descrittore
-    pthread_mutex_unlock(&(curr->mutexon));
+  struct iovec iov[1]={ {msg,sizeof(message_hdr_t)} };
+  //l'header viene inviato anche se l'utente non è online
+  InviaV(fd,iov,1,1);
+}
+
+/**
+ * @function SendRisposta_mutex
+ * @brief Invia in mutua-esclusione l'header di risposta seguito dal body del messaggio, con una sola scrittura
+ * @param fd indica il descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t
+ * @param op indica il tipo di operazione
+ */
+void SendRisposta_mutex(long fd, message_t *msg, int op){
+  msg->hdr.op=op;
+  struct iovec iov[3]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)},
+                        {msg->data.buf,msg->data.hdr.len} };
+  //come per l'header, la risposta viene inviata anche se l'utente non è online
+  InviaV(fd,iov,3,1);
+}
+
+/**
+ * @function SendFile_mutex
+ * @brief Invia l'header di risposta e l'header del body seguiti dal contenuto di un file, che viene letto direttamente dal file
+ * @param fd indica il descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t, data.hdr.len indica la dimensione del file
+ * @param op indica il tipo di operazione
+ * @param file indica il descrittore del file aperto in lettura, che viene chiuso dopo l'invio
+ */
+void SendFile_mutex(long fd, message_t *msg, int op, int file){
+  msg->hdr.op=op;
+  struct iovec iov[2]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)} };
+  //come per l'header, la risposta viene inviata anche se l'utente non è online
+  AccodaFile(fd,iov,2,file,msg->data.hdr.len);
+}
+
+/**
+ * @function SendMappa_mutex
+ * @brief Invia l'header di risposta e l'header del body seguiti dal contenuto di un file mappato dalla cache dei file
+ * @param fd indica il descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t, data.hdr.len indica la dimensione del file
+ * @param op indica il tipo di operazione
+ * @param v indica la voce della cache, che viene rilasciata dopo l'invio
+ */
+void SendMappa_mutex(long fd, message_t *msg, int op, Voce *v){
+  msg->hdr.op=op;
+  struct iovec iov[2]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)} };
+  AccodaMappa(fd,iov,2,v);
+}
+
+/**
+ * @function SendV_mutex
+ * @brief Invia in mutua-esclusione un insieme di messaggi già preparati dal chiamante, con una sola scrittura
+ * @param fd indica il descrittore
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ */
+void SendV_mutex(long fd, struct iovec *iov, int cnt){
+  InviaV(fd,iov,cnt,1);
+}
+
+/**
+ * @function Togli
+ * @brief Toglie dalla tabella degli utenti online l'utente connesso su un descrittore, da chiamare in mutua-esclusione sulla zona del suo nome
+ * @param fd indica il descrittore
+ * @param lista indica la lista di trabocco del nome dell'utente
+ * @return 1 se l'utente è stato tolto, 0 altrimenti
+ */
+static int Togli(long fd, Online **lista){
+  for(Online **p=lista;*p!=NULL;p=&((*p)->next)){
+    if((*p)->fd==fd){
+      Online *curr=*p;
+      *p=curr->next;
+      //l'utente non è più raggiungibile tramite il descrittore memorizzato nei gruppi
+      Collega(&(curr->nick),-1,0);
+      Libera(curr);
+      __atomic_store_n(&(presenze[fd].attivo),0,__ATOMIC_RELEASE);
+      __atomic_sub_fetch(&nutenti,1,__ATOMIC_RELAXED);
+      return 1;
+    }
+  }
+  return 0;
 }
 
 /**
@@ -159,75 +284,56 @@ void SendHdr_mutex(long fd, message_hdr_t *msg, int op){
  * @param fd indica il descrittore dell'utente da eliminare
  */
 void DeleteOnline(long fd){
-  //prendo la mutua-esclusione sull'intera struttura online
-  pthread_mutex_lock(&mutex2);
-  if(online==NULL){
-    pthread_mutex_unlock(&mutex2);
+  //il nome dell'utente connesso sul descrittore si trova direttamente nella tabella dei descrittori
+  if(!SearchFd(fd))
     return;
-  }
-  Online *curr=online;
-  //controllo se il primo fd della lista corrisponde a quello cercato, in tal caso elimino l'utente dalla lista liberando la memoria e decrementando il numero di utenti online
-  if(curr->fd==fd){
-    online=curr->next;
-    free(curr->nick);
-    free(curr);
-    nutenti--;
-  }
-  else{
-    Online *prev=online; curr=online->next;
-    int trovato=0;
-    //cerco il descrittore nella lista
-    while(curr!=NULL&&!trovato){
-      if(curr->fd==fd)
-        trovato=1;
-      else{
-        curr=curr->next;
-        prev=prev->next;
-      }
-    }
-    //se lo trovo allora elimino l'utente dalla lista liberando la memoria e decrementando il numero di utenti online
-    if(trovato){
-      prev->next=curr->next;
-      if(prev->next==NULL)last_online=prev;
-      free(curr->nick);
-      free(curr); 
-      nutenti--;
-    }
-  }
-  //rilascio la mutua-esclusione sull'intera struttura online
-  pthread_mutex_unlock(&mutex2);
+  Online **lista;
+  Zona *z=Posizione(&(presenze[fd].nick),&lista);
+  //prendo la mutua-esclusione solo sulla zona del nome
+  pthread_mutex_lock(&(z->mutex));
+  Togli(fd,lista);
+  pthread_mutex_unlock(&(z->mutex));
 }
 
 /**
  * @function ListaOnline
- * @brief Invia la lista degli utenti online
+ * @brief Invia l'header di risposta seguito dalla lista degli utenti online, con una sola scrittura
  * @param fd indica il descrittore dell'utente a cui inviare la lista
  * @param msg puntatore per accedere alla struttura message_t
+ * @param op indica il tipo di operazione da inserire nell'header
  */
-void ListaOnline(long fd, message_t *msg){
-  //prendo la mutua-esclusione sull'intera struttura online
-  pthread_mutex_lock(&mutex2);
-  Online *curr=online;
-  //setto la lunghezza del messaggio
-  msg->data.hdr.len=(MAX_NAME_LENGTH+1)*nutenti;
-  //invio il body del messaggio contenente in particolare la lunghezza del messaggio da inviare
-  writen(fd,&(msg->data.hdr),sizeof(message_data_hdr_t));
-  //cerco se l'utente è online tramite il descrittore associato
-  Online *tmp=SearchFd(fd);
-  if(tmp!=NULL){
-    //se trovo l'utente allora prendo la mutua-esclusione sul descrittore
-    pthread_mutex_lock(&(tmp->mutexon));
-    //scorro la lista degli utenti online
-    while(curr!=NULL){
-      //invio il nome dell'utente
-      writen(fd,curr->nick,(MAX_NAME_LENGTH+1));
-      curr=curr->next;
+void ListaOnline(long fd, message_t *msg, int op){
+  size_t dim=MAX_NAME_LENGTH+1;
+  int cap=__atomic_load_n(&nutenti,__ATOMIC_RELAXED)+16, n=0;
+  char *nomi=Alloca(cap*dim);
+  //copio i nomi una zona alla volta, senza bloccare le altre zone
+  for(int i=0;i<ONLINE_ZONE;i++){
+    Zona *z=&zone_o[i];
+    pthread_mutex_lock(&(z->mutex));
+    for(int j=0;j<ONLINE_LISTE;j++){
+      for(Online *curr=z->liste[j];curr!=NULL;curr=curr->next){
+        //nel frattempo si sono connessi altri utenti, ingrandisco il buffer
+        if(n==cap){
+          char *tmp=Alloca(2*cap*dim);
+          memcpy(tmp,nomi,n*dim);
+          Libera(nomi);
+          nomi=tmp;
+          cap*=2;
+        }
+        memcpy(nomi+n*dim,curr->nick.nome,dim);
+        n++;
+      }
     }
-    //rilascio la mutua-esclusione sul descrittore
-    pthread_mutex_unlock(&(tmp->mutexon));
+    pthread_mutex_unlock(&(z->mutex));
   }
-  //rilascio la mutua-esclusione sull'intera struttura online
-  pthread_mutex_unlock(&mutex2);
+  //setto il tipo di operazione e la lunghezza del messaggio
+  msg->hdr.op=op;
+  msg->data.hdr.len=dim*n;
+  struct iovec iov[3]={ {&(msg->hdr),sizeof(message_hdr_t)},
+                        {&(msg->data.hdr),sizeof(message_data_hdr_t)},
+                        {nomi,dim*n} };
+  Accoda(fd,iov,3,0);
+  Libera(nomi);
 }
 
 /**
@@ -237,21 +343,21 @@ void ListaOnline(long fd, message_t *msg){
  * @return ritorna il descrittore associato all'utente se lo trova, altrimenti -1
  */
 long GetFd(char *nick){
-  //prendo la mutua-esclusione sull'intera struttura degli utenti online
-  pthread_mutex_lock(&mutex2);
-  Online *curr=online;
-  //cerco l'utente
-  while(curr!=NULL){
-    //se lo trovo rilascio la mutua-esclusione e ritorno il descrittore associato
-    if(!strcmp(nick,curr->nick)){
-      pthread_mutex_unlock(&mutex2); 
-      return curr->fd;
+  Chiave k;
+  FaiChiave(&k,nick);
+  Online **lista;
+  Zona *z=Posizione(&k,&lista);
+  long fd=-1;
+  //prendo la mutua-esclusione solo sulla zona del nome
+  pthread_mutex_lock(&(z->mutex));
+  for(Online *curr=*lista;curr!=NULL;curr=curr->next){
+    if(UgualeChiave(&k,&(curr->nick))){
+      fd=curr->fd;
+      break;
     }
-    curr=curr->next;
   }
-  //rilascio la mutua-esclusione sull'intera struttura degli utenti online
-  pthread_mutex_unlock(&mutex2);
-  return -1;
+  pthread_mutex_unlock(&(z->mutex));
+  return fd;
 }
 
 /**
@@ -262,32 +368,35 @@ long GetFd(char *nick){
  * @return 0 se l'utente era già online, 1 altrimenti
  */
 int PushOnline(long fd, message_t *msg){
-  //controllo se l'utente è già online, se lo è allora non lo reinserisco
-  long fd2=GetFd(msg->hdr.sender);
-  if(fd2>=0)
+  if(fd<0 || fd>=npresenze)
     return 0;
-  //prendo la mutua-esclusione sull'intera struttura online
-  pthread_mutex_lock(&mutex2);
-  Online *new;
-  SYSCALL_D(new,malloc(sizeof(Online)), "malloc");
-  SYSCALL_D(new->nick,calloc((MAX_NAME_LENGTH+1),sizeof(char)), "calloc");
-  strncpy(new->nick,msg->hdr.sender,(MAX_NAME_LENGTH+1));
-  new->fd=fd;
-  new->next=NULL;
-  //inizializzo la variabile di mutua-esclusione dedicata all'utente che si sta inserendo
-  pthread_mutex_init(&(new->mutexon),NULL);
-  if(online==NULL){
-    last_online=new;
-    online=new;
-  }
-  else{
-    last_online->next=new;
-    last_online=new;
+  Chiave k;
+  FaiChiave(&k,msg->hdr.sender);
+  //se sul descrittore era connesso un altro utente lo tolgo, una connessione rappresenta un solo utente
+  if(SearchFd(fd) && !UgualeChiave(&(presenze[fd].nick),&k))
+    DeleteOnline(fd);
+  Online **lista;
+  Zona *z=Posizione(&k,&lista);
+  pthread_mutex_lock(&(z->mutex));
+  //controllo se l'utente è già online, se lo è allora non lo reinserisco
+  for(Online *curr=*lista;curr!=NULL;curr=curr->next){
+    if(UgualeChiave(&k,&(curr->nick))){
+      pthread_mutex_unlock(&(z->mutex));
+      return 0;
+    }
   }
-  //incremento il numero degli utenti online
-  nutenti++;
-  //rilascio la mutua-esclusione sull'intera struttura online
-  pthread_mutex_unlock(&mutex2);
+  Online *new=Alloca(sizeof(Online));
+  new->nick=k;
+  new->fd=fd;
+  new->next=*lista;
+  *lista=new;
+  //il nome viene scritto nella tabella dei descrittori prima di segnare il descrittore come attivo
+  presenze[fd].nick=k;
+  __atomic_store_n(&(presenze[fd].attivo),1,__ATOMIC_RELEASE);
+  __atomic_add_fetch(&nutenti,1,__ATOMIC_RELAXED);
+  //il descrittore viene memorizzato anche nell'utente, da cui lo leggono gli invii ai gruppi
+  Collega(&k,fd,GenerazioneSessione(fd));
+  pthread_mutex_unlock(&(z->mutex));
   return 1;
 }
 
@@ -296,11 +405,18 @@ int PushOnline(long fd, message_t *msg){
  * @brief Elimina la struttura degli utenti online
  */
 void DestroyList(){
-  Online *curr=NULL;
-  while(online!=NULL){
-    curr=online;
-    online=online->next;
-    free(curr->nick);
-    free(curr);
+  for(int i=0;i<ONLINE_ZONE;i++){
+    for(int j=0;j<ONLINE_LISTE;j++){
+      while(zone_o[i].liste[j]!=NULL){
+        Online *curr=zone_o[i].liste[j];
+        zone_o[i].liste[j]=curr->next;
+        Libera(curr);
+      }
+    }
+    pthread_mutex_destroy(&(zone_o[i].mutex));
   }
+  free(presenze);
+  presenze=NULL;
+  npresenze=0;
+  nutenti=0;
 }
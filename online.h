@@ -8,22 +8,16 @@
  */
 
 #include <pthread.h>
+#include <sys/uio.h>
 #include <message.h>
+#include <cachefile.h>
 
 /**
- * @struct Online
- * @brief è la struttura che rappresenta la lista degli utenti online
- * @var nick indica il nome dell'utente
- * @var fd indica il descrittore
- * @var next puntatore all'elemento successivo
- * @var mutexon è una variabile di mutex associata ad ogni utente
+ * @function CreaOnline
+ * @brief Crea le tabelle degli utenti online
+ * @param n indica il numero di descrittori, uguale alla dimensione della tabella delle sessioni
  */
-typedef struct Online1{
-  char *nick;
-  long fd;
-  struct Online1 *next;
-  pthread_mutex_t mutexon;
-}Online;
+void CreaOnline(long n);
 
 /**
  * @function DeleteOnline
@@ -34,19 +28,20 @@ void DeleteOnline(long fd);
 
 /**
  * @function SearchFd
- * @brief Cerca il descrittore all'interno della lista degli online
+ * @brief Controlla se sul descrittore è connesso un utente, senza prendere mutua-esclusioni
  * @param fd indica il descrittore da cercare
- * @return ritorna un puntatore di tipo Online se trova il descrittore, altrimenti NULL
+ * @return 1 se sul descrittore è connesso un utente, 0 altrimenti
  */
-Online * SearchFd(long fd);
+int SearchFd(long fd);
 
 /**
  * @function ListaOnline
- * @brief Invia la lista degli utenti online
+ * @brief Invia l'header di risposta seguito dalla lista degli utenti online, con una sola scrittura
  * @param fd indica il descrittore dell'utente a cui inviare la lista
  * @param msg puntatore per accedere alla struttura message_t
+ * @param op indica il tipo di operazione da inserire nell'header
  */
-void ListaOnline(long fd, message_t *msg);
+void ListaOnline(long fd, message_t *msg, int op);
 
 /**
  * @function PushOnline
@@ -81,6 +76,17 @@ long GetFd(char *nick);
  */
 int SendMsg_mutex(long fd, message_t *msg, int op);
 
+/**
+ * @function SendMsgSessione_mutex
+ * @brief Come SendMsg_mutex, ma invia il messaggio solo se il descrittore è ancora assegnato alla connessione indicata
+ * @param fd indica il descrittore
+ * @param generazione indica la generazione della sessione letta insieme al descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t
+ * @param op indica il tipo di operazione
+ * @return 1 se l'operazione è andata a buon fine, 0 altrimenti
+ */
+int SendMsgSessione_mutex(long fd, unsigned generazione, message_t *msg, int op);
+
 /**
  * @function SendData_mutex
  * @brief Invia il body del messaggio in mutua-esclusione
@@ -96,4 +102,42 @@ void SendData_mutex(long fd, message_data_t *msg);
  * @param msg variabile tramite cui accedere ai campi della struttura message_t
  * @param op indica il tipo di operazione
  */
-void SendHdr_mutex(long fd, message_hdr_t *hdr, int op);
\ No newline at end of file
+void SendHdr_mutex(long fd, message_hdr_t *hdr, int op);
+
+/**
+ * @function SendRisposta_mutex
+ * @brief Invia in mutua-esclusione l'header di risposta seguito dal body del messaggio, con una sola scrittura
+ * @param fd indica il descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t
+ * @param op indica il tipo di operazione
+ */
+void SendRisposta_mutex(long fd, message_t *msg, int op);
+
+/**
+ * @function SendFile_mutex
+ * @brief Invia l'header di risposta e l'header del body seguiti dal contenuto di un file, che viene letto direttamente dal file
+ * @param fd indica il descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t, data.hdr.len indica la dimensione del file
+ * @param op indica il tipo di operazione
+ * @param file indica il descrittore del file aperto in lettura, che viene chiuso dopo l'invio
+ */
+void SendFile_mutex(long fd, message_t *msg, int op, int file);
+
+/**
+ * @function SendMappa_mutex
+ * @brief Invia l'header di risposta e l'header del body seguiti dal contenuto di un file mappato dalla cache dei file
+ * @param fd indica il descrittore
+ * @param msg variabile tramite cui accedere ai campi della struttura message_t, data.hdr.len indica la dimensione del file
+ * @param op indica il tipo di operazione
+ * @param v indica la voce della cache, che viene rilasciata dopo l'invio
+ */
+void SendMappa_mutex(long fd, message_t *msg, int op, Voce *v);
+
+/**
+ * @function SendV_mutex
+ * @brief Invia in mutua-esclusione un insieme di messaggi già preparati dal chiamante, con una sola scrittura
+ * @param fd indica il descrittore
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ */
+void SendV_mutex(long fd, struct iovec *iov, int cnt);
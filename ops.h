@@ -43,6 +43,7 @@ typedef enum {
     /* 
      * aggiungere qui eltre operazioni che si vogliono implementare 
      */
+    GETNEWMSGS_OP    = 13,  /// richiesta dei soli messaggi della history con numero di sequenza maggiore o uguale a quello indicato
 
     /* ------------------------------------------ */
     /*    messaggi inviati dal server             */
@@ -16,6 +16,17 @@
  */
 int maxconnections,threadsinpool,maxmsgsize,maxfilesize,maxhistmsgs;
 
+/**
+ * @var maxqueuesize indica il numero massimo di kilobytes in attesa di essere inviati ad un client
+ * @var queuepolicy indica cosa fare quando un messaggio supera la soglia: 0 lo scarta (resta nella history), 1 disconnette il client
+ */
+int maxqueuesize=4096,queuepolicy=0;
+
+/**
+ * @var filecachesize indica il numero massimo di kilobytes di file mappati in memoria dalla cache dei file, 0 la disattiva
+ */
+int filecachesize=65536;
+
 /**
  * @var unixpath indica il path utilizzato per la creazione del socket AF_UNIX
  * @var dirname indica la directory dove memorizzare i files da inviare agli utenti
@@ -23,6 +34,15 @@ int maxconnections,threadsinpool,maxmsgsize,maxfilesize,maxhistmsgs;
  */
 char *unixpath,*dirName,*statfilename;
 
+/**
+ * @var historydir indica la directory dell'archivio delle history, NULL se le history restano solo in memoria
+ * @var historysync indica quando l'archivio e il registro rendono persistenti i dati: 0 mai esplicitamente, 1 dopo ogni scrittura di gruppo, 2 prima di rispondere al client
+ * @var registrydir indica la directory del registro degli utenti e dei gruppi, NULL se restano solo in memoria
+ */
+char *historydir=NULL;
+int historysync=1;
+char *registrydir=NULL;
+
 //macro per allocazioni dinamiche
 #define SYSCALL_D(r,c,e) \
     if((r=c)==NULL) { perror(e); exit(-1); }
@@ -84,6 +104,18 @@ void Parser(char *filename){
       Leggi(fp,buf);
       maxhistmsgs=atoi(buf);
     }
+    else if(!strcmp("MaxQueueSize",buf)){
+      Leggi(fp,buf);
+      maxqueuesize=atoi(buf);
+    }
+    else if(!strcmp("QueuePolicy",buf)){
+      Leggi(fp,buf);
+      queuepolicy=!strcmp("disconnect",buf);
+    }
+    else if(!strcmp("FileCacheSize",buf)){
+      Leggi(fp,buf);
+      filecachesize=atoi(buf);
+    }
     else if(!strcmp("DirName",buf)){
       Leggi(fp,buf);
       char *tmp=realloc(dirName,sizeof(char)*strlen(buf)+2);
@@ -93,6 +125,26 @@ void Parser(char *filename){
       strncpy(dirName,buf,strlen(buf)+1);
       strncat(dirName,"/",1);
     }
+    else if(!strcmp("HistoryDir",buf)){
+      Leggi(fp,buf);
+      char *tmp=realloc(historydir,sizeof(char)*strlen(buf)+1);
+      if(tmp==NULL)
+        return;
+      historydir=tmp;
+      strncpy(historydir,buf,strlen(buf)+1);
+    }
+    else if(!strcmp("RegistryDir",buf)){
+      Leggi(fp,buf);
+      char *tmp=realloc(registrydir,sizeof(char)*strlen(buf)+1);
+      if(tmp==NULL)
+        return;
+      registrydir=tmp;
+      strncpy(registrydir,buf,strlen(buf)+1);
+    }
+    else if(!strcmp("HistorySync",buf)){
+      Leggi(fp,buf);
+      historysync=!strcmp("none",buf) ? 0 : (!strcmp("always",buf) ? 2 : 1);
+    }
     else if(!strcmp("StatFileName",buf)){
       Leggi(fp,buf);
       char *tmp=realloc(statfilename,sizeof(char)*strlen(buf)+1);
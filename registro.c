@@ -0,0 +1,828 @@
+/**
+ * @file registro.c
+ * @brief File per il salvataggio su disco degli utenti registrati e dei gruppi, recuperati quando il server riparte
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Ogni registrazione, deregistrazione e modifica di un gruppo viene copiata in un buffer come annotazione di lunghezza
+ * fissa; un thread custode aggiunge il buffer al file delle modifiche (registro-<n>.wal) ogni REGISTRO_INTERVALLO
+ * millisecondi, seguito da fdatasync se la politica lo richiede. Quando le modifiche superano REGISTRO_SOGLIA byte il
+ * custode passa ad un nuovo file delle modifiche e un altro thread scrive un'istantanea degli utenti, divisi in
+ * REGISTRO_PARTI file (utenti-<n>-<parte>.snap), e dei gruppi (gruppi-<n>.snap), senza fermare il server: l'istantanea
+ * diventa quella da caricare quando il file istantanea ne contiene il numero, e i file precedenti vengono eliminati.
+ * All'avvio i file dell'istantanea vengono letti in parallelo, poi le modifiche successive vengono applicate in ordine
+ * e gli utenti vengono inseriti nella tabella, dimensionata una sola volta per il loro numero.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <config.h>
+#include <chiave.h>
+#include <hash_history.h>
+#include <hash_gruppi.h>
+#include <archivio.h>
+#include <registro.h>
+
+//macro per allocazioni dinamiche
+#define SYSCALL_D(r,c,e) \
+    if((r=c)==NULL) { perror(e); exit(-1); }
+
+/**
+ * @struct Annotazione
+ * @brief è una modifica degli utenti o dei gruppi salvata nel registro
+ * @var somma è il checksum dei byte dell'annotazione che la seguono
+ * @var tipo indica il tipo della modifica
+ * @var nome indica il nome dell'utente o del gruppo
+ * @var utente indica il creatore o l'utente aggiunto o tolto da un gruppo, vuoto se non serve
+ */
+typedef struct Annotazione1{
+  uint32_t somma;
+  uint32_t tipo;
+  Chiave nome;
+  Chiave utente;
+}Annotazione;
+
+/**
+ * @struct Elemento
+ * @brief è un utente trovato all'avvio
+ * @var nome indica il nome dell'utente, vuoto se il posto è libero
+ * @var presente vale 1 se l'utente è registrato, 0 se è stato eliminato
+ */
+typedef struct Elemento1{
+  Chiave nome;
+  int presente;
+}Elemento;
+
+/**
+ * @struct Insieme
+ * @brief è una parte degli utenti trovati all'avvio, con indirizzamento aperto
+ * @var mutex è la variabile di mutua-esclusione sulla parte
+ * @var el è l'array dei posti
+ * @var cap indica il numero di posti, una potenza di due
+ * @var n indica il numero di posti occupati
+ * @var presenti indica il numero di utenti registrati
+ */
+typedef struct Insieme1{
+  pthread_mutex_t mutex;
+  Elemento *el;
+  size_t cap;
+  size_t n;
+  size_t presenti;
+}Insieme;
+
+/**
+ * @var insieme sono le parti degli utenti trovati all'avvio
+ * @var cartella indica la directory del registro
+ * @var attivo vale 1 se il registro salva le modifiche
+ * @var politica_r indica quando le modifiche vengono rese persistenti
+ * @var istantanea indica il numero dell'ultima istantanea completa
+ * @var dim_istantanea indica la dimensione in byte dell'ultima istantanea completa
+ */
+static Insieme insieme[REGISTRO_PARTI];
+static char *cartella=NULL;
+static int attivo=0, politica_r=1;
+static uint32_t istantanea=0;
+static size_t dim_istantanea=0;
+
+/**
+ * @var buf contiene le annotazioni in attesa di essere scritte
+ * @var nbuf indica il numero di byte nel buffer
+ * @var capbuf indica la dimensione del buffer
+ * @var riserva è il secondo buffer, che il custode scambia con il primo per scriverlo senza mutua-esclusione
+ * @var capriserva indica la dimensione del secondo buffer
+ * @var accodati indica il numero di byte aggiunti al buffer dall'avvio
+ * @var scritti indica il numero di byte già scritti dal custode e resi persistenti come richiesto dalla politica
+ * @var fermo vale 1 quando il custode deve terminare
+ * @var anticipa vale 1 se il custode deve scrivere senza aspettare la fine dell'intervallo
+ * @var mutex_registro è la variabile di mutua-esclusione sul buffer e sullo stato del custode
+ * @var sveglia_r è la variabile di condizione su cui aspetta il custode
+ * @var scritto_r è la variabile di condizione su cui aspetta chi vuole che le proprie modifiche siano persistenti
+ */
+static char *buf=NULL, *riserva=NULL;
+static size_t nbuf=0, capbuf=0, capriserva=0;
+static uint64_t accodati=0, scritti=0;
+static int fermo=0, anticipa=0;
+static pthread_mutex_t mutex_registro=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sveglia_r=PTHREAD_COND_INITIALIZER, scritto_r=PTHREAD_COND_INITIALIZER;
+
+/**
+ * @var custode è il thread che scrive le modifiche e decide quando prendere un'istantanea
+ * @var fotografo è il thread che scrive un'istantanea
+ * @var fotografo_avviato vale 1 se il thread fotografo è stato creato e non ancora atteso
+ * @var in_corso vale 1 mentre il thread fotografo scrive un'istantanea
+ * @var wal indica il numero del file delle modifiche aperto dal custode
+ * @var fd_wal indica il descrittore del file delle modifiche, -1 se non è aperto
+ * @var sano indica la lunghezza del file delle modifiche fino all'ultima annotazione scritta senza errori
+ * @var dim_wal indica il numero di byte di modifiche scritti dopo l'ultima istantanea
+ */
+static pthread_t custode, fotografo;
+static int fotografo_avviato=0, in_corso=0;
+static uint32_t wal=0;
+static int fd_wal=-1;
+static size_t sano=0, dim_wal=0;
+
+/**
+ * @function Somma
+ * @brief Calcola il checksum di un'annotazione, con cui all'avvio si riconosce un'annotazione scritta solo in parte
+ * @param a indica l'annotazione
+ * @return il checksum dei byte dell'annotazione successivi al campo somma
+ */
+static uint32_t Somma(Annotazione *a){
+  const unsigned char *p=(const unsigned char*)a;
+  uint32_t h=2166136261u;
+  for(size_t i=sizeof(uint32_t);i<sizeof(Annotazione);i++)
+    h=(h^p[i])*16777619u;
+  return h;
+}
+
+/**
+ * @function Prepara
+ * @brief Compila un'annotazione
+ * @param a indica l'annotazione
+ * @param tipo indica il tipo della modifica
+ * @param nome indica il nome dell'utente o del gruppo
+ * @param utente indica il secondo nome, NULL se non serve
+ */
+static void Prepara(Annotazione *a, int tipo, const Chiave *nome, const Chiave *utente){
+  //azzero anche i byte di allineamento, che entrano nel checksum
+  memset(a,0,sizeof(Annotazione));
+  a->tipo=(uint32_t)tipo;
+  a->nome=*nome;
+  if(utente!=NULL)
+    a->utente=*utente;
+  a->somma=Somma(a);
+}
+
+/**
+ * @function Percorso
+ * @brief Costruisce il percorso di un file del registro
+ * @param nome indica il nome del file
+ * @return il percorso, da liberare con free
+ */
+static char * Percorso(const char *nome){
+  size_t dim=strlen(cartella)+strlen(nome)+2;
+  char *p;
+  SYSCALL_D(p,malloc(dim),"malloc");
+  snprintf(p,dim,"%s/%s",cartella,nome);
+  return p;
+}
+
+/**
+ * @function Segna
+ * @brief Segna un utente trovato all'avvio come registrato o eliminato
+ * @param k indica il nome dell'utente
+ * @param presente vale 1 se l'utente è registrato, 0 se è stato eliminato
+ */
+static void Segna(Chiave *k, int presente){
+  uint64_t h=ImprontaChiave(k);
+  Insieme *s=&insieme[h%REGISTRO_PARTI];
+  pthread_mutex_lock(&(s->mutex));
+  if((s->n+1)*4>s->cap*3){
+    //raddoppio la parte e reinserisco gli utenti
+    size_t cap=(s->cap==0) ? 1024 : 2*s->cap;
+    Elemento *el;
+    SYSCALL_D(el,calloc(cap,sizeof(Elemento)),"calloc");
+    for(size_t i=0;i<s->cap;i++){
+      if(s->el[i].nome.nome[0]=='\0') continue;
+      size_t j=(ImprontaChiave(&(s->el[i].nome))/REGISTRO_PARTI)&(cap-1);
+      while(el[j].nome.nome[0]!='\0')
+        j=(j+1)&(cap-1);
+      el[j]=s->el[i];
+    }
+    free(s->el);
+    s->el=el;
+    s->cap=cap;
+  }
+  size_t i=(h/REGISTRO_PARTI)&(s->cap-1);
+  while(s->el[i].nome.nome[0]!='\0' && !UgualeChiave(&(s->el[i].nome),k))
+    i=(i+1)&(s->cap-1);
+  if(s->el[i].nome.nome[0]=='\0'){
+    s->el[i].nome=*k;
+    s->n++;
+  }
+  s->presenti+=presente-s->el[i].presente;
+  s->el[i].presente=presente;
+  pthread_mutex_unlock(&(s->mutex));
+}
+
+/**
+ * @function Applica
+ * @brief Applica un'annotazione letta all'avvio
+ * @param a indica l'annotazione
+ *
+ * Le annotazioni vengono applicate più volte se l'istantanea contiene già le modifiche successive al passaggio ad un
+ * nuovo file delle modifiche: ogni modifica lascia lo stesso stato anche se applicata di nuovo, e la creazione di un
+ * gruppo sostituisce quello con lo stesso nome.
+ */
+static void Applica(Annotazione *a){
+  switch(a->tipo){
+    case REGISTRO_UTENTE: Segna(&(a->nome),1); break;
+    case REGISTRO_ELIMINAZIONE: Segna(&(a->nome),0); break;
+    case REGISTRO_GRUPPO:
+      Delete_G(a->nome.nome);
+      Insert_G(a->nome.nome,a->utente.nome);
+      break;
+    case REGISTRO_ENTRA: NewUser(a->nome.nome,a->utente.nome); break;
+    case REGISTRO_ESCE: DeleteUser(a->nome.nome,a->utente.nome); break;
+    case REGISTRO_CANCELLA: Delete_G(a->nome.nome); break;
+  }
+}
+
+/**
+ * @function Rileggi
+ * @brief Applica le annotazioni di un file, fermandosi alla prima scritta solo in parte
+ * @param nome indica il nome del file
+ * @return il numero di byte delle annotazioni applicate
+ */
+static size_t Rileggi(const char *nome){
+  char *p=Percorso(nome);
+  FILE *f=fopen(p,"r");
+  free(p);
+  if(f==NULL) return 0;
+  Annotazione a;
+  size_t letti=0;
+  while(fread(&a,sizeof(a),1,f)==1 && a.somma==Somma(&a)){
+    Applica(&a);
+    letti+=sizeof(a);
+  }
+  fclose(f);
+  return letti;
+}
+
+/**
+ * @function CaricaUtenti
+ * @brief Funzione eseguita dai thread che leggono gli utenti dell'istantanea all'avvio, uno per file
+ * @param arg indica la parte dell'istantanea
+ * @return il numero di byte letti
+ */
+static void * CaricaUtenti(void *arg){
+  char nome[64];
+  snprintf(nome,sizeof(nome),"utenti-%u-%d.snap",istantanea,(int)(long)arg);
+  return (void*)Rileggi(nome);
+}
+
+/**
+ * @function CaricaGruppi
+ * @brief Funzione eseguita dal thread che ricrea i gruppi dell'istantanea all'avvio
+ * @param arg non utilizzato
+ * @return il numero di byte letti
+ */
+static void * CaricaGruppi(void *arg){
+  char nome[64];
+  snprintf(nome,sizeof(nome),"gruppi-%u.snap",istantanea);
+  return (void*)Rileggi(nome);
+}
+
+/**
+ * @function Confronta
+ * @brief Confronta due numeri di file delle modifiche, per ordinarli con qsort
+ * @param a indica il primo numero
+ * @param b indica il secondo numero
+ * @return un valore negativo, nullo o positivo se il primo numero precede, è uguale o segue il secondo
+ */
+static int Confronta(const void *a, const void *b){
+  uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b;
+  return (x>y)-(x<y);
+}
+
+/**
+ * @function Pulisci
+ * @brief Elimina i file che non servono per ricostruire lo stato a partire da un'istantanea
+ * @param s indica il numero dell'istantanea
+ *
+ * Vengono eliminati i file delle modifiche contenute nell'istantanea, quelli delle altre istantanee e quelli temporanei
+ * di un'istantanea interrotta.
+ */
+static void Pulisci(uint32_t s){
+  DIR *d=opendir(cartella);
+  if(d==NULL){
+    perror(cartella);
+    return;
+  }
+  struct dirent *e;
+  while((e=readdir(d))!=NULL){
+    unsigned int n;
+    int parte, fine=0, inutile=0;
+    if(sscanf(e->d_name,"registro-%u.wal%n",&n,&fine)==1 && fine>0 && e->d_name[fine]=='\0')
+      inutile=(n<s);
+    else if(sscanf(e->d_name,"utenti-%u-%d.snap%n",&n,&parte,&fine)==2 && fine>0 && e->d_name[fine]=='\0')
+      inutile=(n!=s);
+    else if(sscanf(e->d_name,"gruppi-%u.snap%n",&n,&fine)==1 && fine>0 && e->d_name[fine]=='\0')
+      inutile=(n!=s);
+    else{
+      size_t len=strlen(e->d_name);
+      inutile=(len>4 && strcmp(e->d_name+len-4,".tmp")==0);
+    }
+    if(inutile){
+      char *p=Percorso(e->d_name);
+      if(unlink(p)<0)
+        perror(p);
+      free(p);
+    }
+  }
+  closedir(d);
+}
+
+/**
+ * @function SincronizzaCartella
+ * @brief Rende persistenti le creazioni e i cambi di nome dei file del registro
+ */
+static void SincronizzaCartella(){
+  int fd=open(cartella,O_RDONLY);
+  if(fd<0) return;
+  if(fsync(fd)<0 && errno!=EINVAL)
+    perror("fsync");
+  close(fd);
+}
+
+/**
+ * @function ApriWal
+ * @brief Apre il file delle modifiche su cui scrive il custode
+ */
+static void ApriWal(){
+  char nome[64];
+  snprintf(nome,sizeof(nome),"registro-%u.wal",wal);
+  char *p=Percorso(nome);
+  fd_wal=open(p,O_WRONLY|O_CREAT|O_APPEND,0600);
+  if(fd_wal<0)
+    perror(p);
+  free(p);
+  off_t fine;
+  if(fd_wal>=0 && (fine=lseek(fd_wal,0,SEEK_END))>=0)
+    sano=(size_t)fine;
+}
+
+/**
+ * @function Scrivi
+ * @brief Aggiunge delle annotazioni al file delle modifiche
+ * @param dati indica le annotazioni
+ * @param n indica il numero di byte
+ * @return 0 se le annotazioni sono state scritte, -1 altrimenti
+ */
+static int Scrivi(char *dati, size_t n){
+  if(fd_wal<0) return -1;
+  while(n>0){
+    ssize_t r=write(fd_wal,dati,n);
+    if(r<0){
+      if(errno==EINTR) continue;
+      perror("write");
+      return -1;
+    }
+    dati+=r;
+    n-=(size_t)r;
+  }
+  return 0;
+}
+
+/**
+ * @function Rimetti
+ * @brief Rimette le annotazioni di una scrittura fallita davanti a quelle aggiunte nel frattempo, eseguita dal custode
+ * @param dati indica le annotazioni
+ * @param n indica il numero di byte
+ * @param cap indica la dimensione del buffer che le contiene
+ */
+static void Rimetti(char *dati, size_t n, size_t cap){
+  pthread_mutex_lock(&mutex_registro);
+  if(n+nbuf>cap){
+    char *tmp;
+    SYSCALL_D(tmp,realloc(dati,n+nbuf),"realloc");
+    dati=tmp;
+    cap=n+nbuf;
+  }
+  memcpy(dati+n,buf,nbuf);
+  riserva=buf;
+  capriserva=capbuf;
+  buf=dati;
+  capbuf=cap;
+  nbuf+=n;
+  pthread_mutex_unlock(&mutex_registro);
+}
+
+/**
+ * @function Svuota
+ * @brief Scrive le annotazioni in attesa, eseguita dal custode
+ *
+ * Se la scrittura o fdatasync falliscono il file delle modifiche viene riportato all'ultima annotazione scritta senza
+ * errori e le annotazioni restano in attesa, nello stesso ordine, per la scrittura successiva: chi le aspetta non
+ * riceve la risposta finché non sono persistenti.
+ */
+static void Svuota(){
+  //scambio i buffer, così le annotazioni possono essere aggiunte mentre scrivo quelle già presenti
+  pthread_mutex_lock(&mutex_registro);
+  char *dati=buf;
+  size_t n=nbuf, cap=capbuf;
+  buf=riserva;
+  capbuf=capriserva;
+  nbuf=0;
+  uint64_t fino=accodati;
+  pthread_mutex_unlock(&mutex_registro);
+  if(n==0){
+    riserva=dati;
+    capriserva=cap;
+    return;
+  }
+  //il file delle modifiche viene riaperto se l'apertura precedente è fallita
+  if(fd_wal<0)
+    ApriWal();
+  int esito=Scrivi(dati,n);
+  if(esito==0 && politica_r>0 && fdatasync(fd_wal)<0){
+    perror("fdatasync");
+    esito=-1;
+  }
+  if(esito<0){
+    if(fd_wal>=0 && ftruncate(fd_wal,(off_t)sano)<0)
+      perror("ftruncate");
+    Rimetti(dati,n,cap);
+    return;
+  }
+  sano+=n;
+  dim_wal+=n;
+  riserva=dati;
+  capriserva=cap;
+  pthread_mutex_lock(&mutex_registro);
+  scritti=fino;
+  pthread_cond_broadcast(&scritto_r);
+  pthread_mutex_unlock(&mutex_registro);
+}
+
+/**
+ * @function Fotografa
+ * @brief Scrive le annotazioni che ricreano un gruppo, chiamata in mutua-esclusione sul gruppo
+ * @param l indica il gruppo
+ * @param arg indica il file dei gruppi dell'istantanea
+ */
+static void Fotografa(Hash_g *l, void *arg){
+  FILE *f=arg;
+  Annotazione a;
+  Prepara(&a,REGISTRO_GRUPPO,&(l->nome),&(l->creatore));
+  fwrite(&a,sizeof(a),1,f);
+  int creatore=0;
+  for(int i=0;i<l->cap;i++){
+    Membro *m=&(l->utente[i]);
+    if(m->nome.nome[0]=='\0') continue;
+    if(UgualeChiave(&(m->nome),&(l->creatore))){
+      creatore=1;
+      continue;
+    }
+    Prepara(&a,REGISTRO_ENTRA,&(l->nome),&(m->nome));
+    fwrite(&a,sizeof(a),1,f);
+  }
+  //il creatore è uscito dal gruppo, che resta suo
+  if(!creatore){
+    Prepara(&a,REGISTRO_ESCE,&(l->nome),&(l->creatore));
+    fwrite(&a,sizeof(a),1,f);
+  }
+}
+
+/**
+ * @function Chiudi
+ * @brief Rende persistente e chiude un file dell'istantanea, dandogli il nome definitivo
+ * @param f indica il file
+ * @param tmp indica il nome temporaneo del file
+ * @param nome indica il nome definitivo del file
+ * @return la dimensione del file, -1 in caso di errore
+ */
+static long Chiudi(FILE *f, const char *tmp, const char *nome){
+  long dim=-1;
+  if(fflush(f)==0 && fsync(fileno(f))==0)
+    dim=ftell(f);
+  if(fclose(f)!=0)
+    dim=-1;
+  char *p=Percorso(tmp), *q=Percorso(nome);
+  if(dim<0)
+    perror(p);
+  else if(rename(p,q)<0){
+    perror(q);
+    dim=-1;
+  }
+  free(p);
+  free(q);
+  return dim;
+}
+
+/**
+ * @function Istantanea
+ * @brief Funzione eseguita dal thread che scrive un'istantanea degli utenti e dei gruppi
+ * @param arg indica il numero dell'istantanea, uguale a quello del file delle modifiche successive
+ *
+ * Gli utenti e i gruppi vengono letti senza fermare il server, quindi l'istantanea può contenere anche una parte delle
+ * modifiche successive, che all'avvio vengono applicate di nuovo.
+ */
+static void * Istantanea(void *arg){
+  uint32_t n=(uint32_t)(long)arg;
+  char tmp[64], nome[64];
+  FILE *f[REGISTRO_PARTI+1];
+  int ok=1;
+  for(int p=0;p<=REGISTRO_PARTI;p++){
+    if(p<REGISTRO_PARTI)
+      snprintf(tmp,sizeof(tmp),"utenti-%u-%d.tmp",n,p);
+    else
+      snprintf(tmp,sizeof(tmp),"gruppi-%u.tmp",n);
+    char *q=Percorso(tmp);
+    if((f[p]=fopen(q,"w"))==NULL){
+      perror(q);
+      ok=0;
+    }
+    free(q);
+  }
+  if(ok){
+    //gli utenti vanno nel file della parte indicata dall'impronta del nome
+    size_t tot;
+    Chiave *nomi=ElencoUtenti(&tot);
+    Annotazione a;
+    for(size_t i=0;i<tot;i++){
+      Prepara(&a,REGISTRO_UTENTE,&nomi[i],NULL);
+      fwrite(&a,sizeof(a),1,f[ImprontaChiave(&nomi[i])%REGISTRO_PARTI]);
+    }
+    free(nomi);
+    ScorriGruppi(Fotografa,f[REGISTRO_PARTI]);
+  }
+  size_t dim=0;
+  for(int p=0;p<=REGISTRO_PARTI;p++){
+    if(f[p]==NULL) continue;
+    if(p<REGISTRO_PARTI){
+      snprintf(tmp,sizeof(tmp),"utenti-%u-%d.tmp",n,p);
+      snprintf(nome,sizeof(nome),"utenti-%u-%d.snap",n,p);
+    }
+    else{
+      snprintf(tmp,sizeof(tmp),"gruppi-%u.tmp",n);
+      snprintf(nome,sizeof(nome),"gruppi-%u.snap",n);
+    }
+    long d=Chiudi(f[p],tmp,nome);
+    if(d<0) ok=0;
+    else dim+=(size_t)d;
+  }
+  //l'istantanea diventa quella da caricare solo quando tutti i suoi file sono completi
+  if(ok){
+    FILE *m;
+    char *p=Percorso("istantanea.tmp");
+    if((m=fopen(p,"w"))==NULL){
+      perror(p);
+      ok=0;
+    }
+    else{
+      fprintf(m,"%u\n",n);
+      ok=(Chiudi(m,"istantanea.tmp","istantanea")>=0);
+    }
+    free(p);
+  }
+  if(ok){
+    SincronizzaCartella();
+    istantanea=n;
+    __atomic_store_n(&dim_istantanea,dim,__ATOMIC_RELAXED);
+    Pulisci(n);
+  }
+  __atomic_store_n(&in_corso,0,__ATOMIC_RELEASE);
+  return NULL;
+}
+
+/**
+ * @function Ruota
+ * @brief Passa ad un nuovo file delle modifiche e avvia la scrittura di un'istantanea, eseguita dal custode
+ */
+static void Ruota(){
+  if(fotografo_avviato)
+    pthread_join(fotografo,NULL);
+  //le modifiche già annotate vanno nel file attuale, che viene chiuso, quelle successive nel nuovo
+  Svuota();
+  if(fd_wal>=0){
+    if(fsync(fd_wal)<0)
+      perror("fsync");
+    close(fd_wal);
+  }
+  wal++;
+  ApriWal();
+  SincronizzaCartella();
+  dim_wal=0;
+  __atomic_store_n(&in_corso,1,__ATOMIC_RELAXED);
+  pthread_create(&fotografo,NULL,Istantanea,(void*)(long)wal);
+  fotografo_avviato=1;
+}
+
+/**
+ * @function Custode
+ * @brief Funzione eseguita dal thread che scrive le modifiche, una scrittura di gruppo alla volta
+ * @param arg non utilizzato
+ */
+static void * Custode(void *arg){
+  while(1){
+    pthread_mutex_lock(&mutex_registro);
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME,&t);
+    t.tv_nsec+=REGISTRO_INTERVALLO*1000000L;
+    t.tv_sec+=t.tv_nsec/1000000000L;
+    t.tv_nsec%=1000000000L;
+    while(!fermo && !anticipa)
+      if(pthread_cond_timedwait(&sveglia_r,&mutex_registro,&t)==ETIMEDOUT) break;
+    int ultimo=fermo;
+    anticipa=0;
+    pthread_mutex_unlock(&mutex_registro);
+    Svuota();
+    if(ultimo) break;
+    //un'istantanea non più grande delle modifiche accumulate rende l'avvio più veloce
+    if(dim_wal>REGISTRO_SOGLIA && dim_wal>__atomic_load_n(&dim_istantanea,__ATOMIC_RELAXED) &&
+       !__atomic_load_n(&in_corso,__ATOMIC_ACQUIRE))
+      Ruota();
+  }
+  return NULL;
+}
+
+/**
+ * @function ApriRegistro
+ * @brief Recupera gli utenti e i gruppi salvati e inizia a salvare le modifiche, da chiamare dopo CreateHash, CreateHash_G e ApriArchivio
+ * @param dir indica la directory del registro, NULL lo disattiva
+ * @param file indica la directory dei file inviati dai client, che non può contenere il registro
+ * @param politica indica quando le modifiche vengono rese persistenti, come per l'archivio delle history
+ * @return il numero degli utenti recuperati
+ */
+size_t ApriRegistro(char *dir, char *file, int politica){
+  if(dir==NULL) return 0;
+  politica_r=politica;
+  SYSCALL_D(cartella,strdup(dir),"strdup");
+  if(mkdir(cartella,0700)<0 && errno!=EEXIST){
+    perror(cartella);
+    exit(-1);
+  }
+  //i client potrebbero leggere e sovrascrivere le istantanee con GETFILE_OP e POSTFILE_OP
+  if(Contenuta(cartella,file)){
+    fprintf(stderr,"RegistryDir %s non può trovarsi dentro DirName %s\n",cartella,file);
+    exit(-1);
+  }
+  //leggo il numero dell'ultima istantanea completa, 0 se non ce n'è una
+  char *p=Percorso("istantanea");
+  FILE *f=fopen(p,"r");
+  free(p);
+  if(f!=NULL){
+    if(fscanf(f,"%u",&istantanea)!=1)
+      istantanea=0;
+    fclose(f);
+  }
+  Pulisci(istantanea);
+  //leggo l'istantanea in parallelo: un thread per ogni file degli utenti e uno per i gruppi
+  pthread_t th[REGISTRO_PARTI+1];
+  for(int i=0;i<REGISTRO_PARTI;i++){
+    memset(&insieme[i],0,sizeof(Insieme));
+    pthread_mutex_init(&(insieme[i].mutex),NULL);
+  }
+  for(int i=0;i<REGISTRO_PARTI;i++)
+    pthread_create(&th[i],NULL,CaricaUtenti,(void*)(long)i);
+  pthread_create(&th[REGISTRO_PARTI],NULL,CaricaGruppi,NULL);
+  for(int i=0;i<=REGISTRO_PARTI;i++){
+    void *letti;
+    pthread_join(th[i],&letti);
+    dim_istantanea+=(size_t)letti;
+  }
+  //cerco i file delle modifiche successive all'istantanea
+  uint32_t *num=NULL;
+  size_t nwal=0, capwal=0;
+  DIR *d;
+  SYSCALL_D(d,opendir(cartella),cartella);
+  struct dirent *e;
+  while((e=readdir(d))!=NULL){
+    unsigned int n;
+    int fine=0;
+    if(sscanf(e->d_name,"registro-%u.wal%n",&n,&fine)<1 || fine==0 || e->d_name[fine]!='\0' || n<istantanea)
+      continue;
+    if(nwal==capwal){
+      capwal=(capwal==0) ? 8 : 2*capwal;
+      uint32_t *tmp;
+      SYSCALL_D(tmp,realloc(num,sizeof(uint32_t)*capwal),"realloc");
+      num=tmp;
+    }
+    num[nwal++]=n;
+  }
+  closedir(d);
+  //le modifiche vengono applicate nell'ordine in cui sono state fatte
+  wal=istantanea;
+  if(nwal>0)
+    qsort(num,nwal,sizeof(uint32_t),Confronta);
+  size_t letti=0;
+  for(size_t i=0;i<nwal;i++){
+    char nome[64];
+    snprintf(nome,sizeof(nome),"registro-%u.wal",num[i]);
+    letti=Rileggi(nome);
+    dim_wal+=letti;
+    wal=num[i];
+  }
+  free(num);
+  //le nuove modifiche vengono aggiunte dopo l'ultima annotazione integra
+  ApriWal();
+  if(fd_wal>=0 && ftruncate(fd_wal,(off_t)letti)<0)
+    perror("ftruncate");
+  sano=letti;
+  //inserisco gli utenti nella tabella tutti insieme, sono già distinti e non vanno annotati di nuovo
+  size_t tot=0;
+  for(int i=0;i<REGISTRO_PARTI;i++)
+    tot+=insieme[i].presenti;
+  Chiave *nomi;
+  SYSCALL_D(nomi,malloc(sizeof(Chiave)*((tot>0) ? tot : 1)),"malloc");
+  tot=0;
+  for(int i=0;i<REGISTRO_PARTI;i++){
+    for(size_t j=0;j<insieme[i].cap;j++)
+      if(insieme[i].el[j].presente)
+        nomi[tot++]=insieme[i].el[j].nome;
+    free(insieme[i].el);
+    pthread_mutex_destroy(&(insieme[i].mutex));
+  }
+  InsertAll(nomi,tot);
+  free(nomi);
+  //le modifiche vengono salvate solo dopo il recupero, che non deve essere annotato di nuovo
+  attivo=1;
+  pthread_create(&custode,NULL,Custode,NULL);
+  return tot;
+}
+
+/**
+ * @function Annota
+ * @brief Salva una modifica degli utenti o dei gruppi, da chiamare in mutua-esclusione sull'utente o sul gruppo modificato
+ * @param tipo indica il tipo della modifica
+ * @param nome indica il nome dell'utente o del gruppo
+ * @param utente indica il creatore o l'utente aggiunto o tolto da un gruppo, NULL se non serve
+ */
+void Annota(int tipo, const char *nome, const char *utente){
+  if(!attivo) return;
+  Chiave k, u;
+  FaiChiave(&k,nome);
+  if(utente!=NULL)
+    FaiChiave(&u,utente);
+  Annotazione a;
+  Prepara(&a,tipo,&k,(utente!=NULL) ? &u : NULL);
+  pthread_mutex_lock(&mutex_registro);
+  if(nbuf+sizeof(a)>capbuf){
+    size_t cap=(capbuf==0) ? 64*sizeof(a) : 2*capbuf;
+    char *tmp;
+    SYSCALL_D(tmp,realloc(buf,cap),"realloc");
+    buf=tmp;
+    capbuf=cap;
+  }
+  memcpy(buf+nbuf,&a,sizeof(a));
+  nbuf+=sizeof(a);
+  accodati+=sizeof(a);
+  pthread_mutex_unlock(&mutex_registro);
+}
+
+/**
+ * @function AttendiRegistro
+ * @brief Aspetta che le modifiche salvate finora siano persistenti, se la politica lo richiede
+ *
+ * Come per l'archivio, chi aspetta si aggiunge alla prossima scrittura di gruppo del custode.
+ */
+void AttendiRegistro(){
+  if(!attivo || politica_r<2) return;
+  pthread_mutex_lock(&mutex_registro);
+  uint64_t fino=accodati;
+  anticipa=1;
+  pthread_cond_signal(&sveglia_r);
+  while(scritti<fino)
+    pthread_cond_wait(&scritto_r,&mutex_registro);
+  pthread_mutex_unlock(&mutex_registro);
+}
+
+/**
+ * @function ChiudiRegistro
+ * @brief Scrive le modifiche ancora in attesa e chiude il registro
+ */
+void ChiudiRegistro(){
+  if(!attivo) return;
+  //il custode esegue un'ultima scrittura prima di terminare
+  pthread_mutex_lock(&mutex_registro);
+  fermo=1;
+  pthread_cond_signal(&sveglia_r);
+  pthread_mutex_unlock(&mutex_registro);
+  pthread_join(custode,NULL);
+  if(fotografo_avviato)
+    pthread_join(fotografo,NULL);
+  if(fd_wal>=0){
+    if(fsync(fd_wal)<0)
+      perror("fsync");
+    close(fd_wal);
+    fd_wal=-1;
+  }
+  free(buf);
+  free(riserva);
+  buf=riserva=NULL;
+  nbuf=capbuf=capriserva=0;
+  free(cartella);
+  cartella=NULL;
+  //il registro può essere riaperto, anche in un'altra directory
+  istantanea=0;
+  dim_istantanea=0;
+  accodati=scritti=0;
+  wal=0;
+  sano=dim_wal=0;
+  attivo=0;
+  fermo=0;
+  fotografo_avviato=0;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file registro.h
+ * @brief File per il salvataggio su disco degli utenti registrati e dei gruppi, recuperati quando il server riparte
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef REGISTRO_H_
+#define REGISTRO_H_
+
+#include <stddef.h>
+
+/**
+ * @var REGISTRO_UTENTE indica la registrazione di un utente
+ * @var REGISTRO_ELIMINAZIONE indica la deregistrazione di un utente
+ * @var REGISTRO_GRUPPO indica la creazione di un gruppo, con il creatore come unico utente
+ * @var REGISTRO_ENTRA indica l'aggiunta di un utente ad un gruppo
+ * @var REGISTRO_ESCE indica l'uscita di un utente da un gruppo, che viene eliminato se resta vuoto
+ * @var REGISTRO_CANCELLA indica l'eliminazione di un gruppo
+ */
+#define REGISTRO_UTENTE        1
+#define REGISTRO_ELIMINAZIONE  2
+#define REGISTRO_GRUPPO        3
+#define REGISTRO_ENTRA         4
+#define REGISTRO_ESCE          5
+#define REGISTRO_CANCELLA      6
+
+/**
+ * @function ApriRegistro
+ * @brief Recupera gli utenti e i gruppi salvati e inizia a salvare le modifiche, da chiamare dopo CreateHash, CreateHash_G e ApriArchivio
+ * @param dir indica la directory del registro, NULL lo disattiva
+ * @param file indica la directory dei file inviati dai client, che non può contenere il registro
+ * @param politica indica quando le modifiche vengono rese persistenti, come per l'archivio delle history
+ * @return il numero degli utenti recuperati
+ */
+size_t ApriRegistro(char *dir, char *file, int politica);
+
+/**
+ * @function Annota
+ * @brief Salva una modifica degli utenti o dei gruppi, da chiamare in mutua-esclusione sull'utente o sul gruppo modificato
+ * @param tipo indica il tipo della modifica
+ * @param nome indica il nome dell'utente o del gruppo
+ * @param utente indica il creatore o l'utente aggiunto o tolto da un gruppo, NULL se non serve
+ */
+void Annota(int tipo, const char *nome, const char *utente);
+
+/**
+ * @function AttendiRegistro
+ * @brief Aspetta che le modifiche salvate finora siano persistenti, se la politica lo richiede
+ */
+void AttendiRegistro();
+
+/**
+ * @function ChiudiRegistro
+ * @brief Scrive le modifiche ancora in attesa e chiude il registro
+ */
+void ChiudiRegistro();
+
+#endif /* REGISTRO_H_ */
@@ -7,12 +7,20 @@
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
  */
 
+#ifndef RNWN_H_
+#define RNWN_H_
+
 #include <sys/types.h> 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 
+//numero massimo di vettori passati ad una singola sendmsg
+#define MAX_IOV 1024
+
 /**
  * @function readn
  * @brief Legge un dato di qualsiasi tipo
@@ -60,3 +68,40 @@ static inline int writen(long fd, void *buf, size_t size) {
     }
     return 1;
 }
+
+/**
+ * @function writevn
+ * @brief Scrive con una sola sendmsg (MSG_NOSIGNAL) un insieme di dati non contigui, ripetendo la chiamata solo in caso di scritture parziali
+ * @param fd indica il descrittore
+ * @param iov indica l'array dei dati da scrivere, viene modificato durante la scrittura
+ * @param cnt indica il numero di elementi dell'array
+ * @return 1 se l'operazione è andata a buon fine, <=0 altrimenti
+ */
+static inline int writevn(long fd, struct iovec *iov, int cnt) {
+    struct msghdr mh;
+    ssize_t r;
+    while(cnt>0) {
+	memset(&mh,0,sizeof(mh));
+	mh.msg_iov    = iov;
+	mh.msg_iovlen = cnt>MAX_IOV ? MAX_IOV : cnt;
+	if ((r=sendmsg((int)fd,&mh,MSG_NOSIGNAL)) == -1) {
+	    if (errno == EINTR) continue;
+	    //il descrittore non è un socket, uso la writev
+	    if (errno != ENOTSOCK || (r=writev((int)fd,iov,mh.msg_iovlen)) == -1) return -1;
+	}
+	if (r == 0 && iov->iov_len>0) return 0;
+	//salto i vettori scritti per intero e aggiorno quello scritto in parte
+	while(cnt>0 && (size_t)r>=iov->iov_len) {
+	    r -= iov->iov_len;
+	    iov++;
+	    cnt--;
+	}
+	if (cnt>0) {
+	    iov->iov_base = (char *)iov->iov_base + r;
+	    iov->iov_len -= r;
+	}
+    }
+    return 1;
+}
+
+#endif /* RNWN_H_ */
@@ -0,0 +1,900 @@
+/**
+ * @file sessione.c
+ * @brief File per la gestione dello stato associato ad ogni connessione (buffer di ricezione, parser delle richieste e coda di uscita)
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <message.h>
+#include <rnwn.h>
+#include <slab.h>
+#include <sessione.h>
+
+//macro per allocazioni dinamiche
+#define SYSCALL_D(r,c,e) \
+    if((r=c)==NULL) { perror(e); exit(-1); }
+
+/**
+ * @var sessioni è la tabella delle sessioni, indicizzata tramite il descrittore
+ */
+Sessione *sessioni=NULL;
+
+/**
+ * @var nsessioni indica la dimensione della tabella delle sessioni
+ */
+long nsessioni=0;
+
+/**
+ * @var epoll_s indica il descrittore dell'epoll in cui sono registrate le connessioni
+ * @var soglia_s indica il numero massimo di byte nella coda di uscita di una connessione
+ * @var disconnetti_s indica se un client che supera la soglia deve essere disconnesso
+ * @var massimo_s indica la lunghezza massima del body di una richiesta
+ */
+static int epoll_s=-1;
+static size_t soglia_s=0;
+static int disconnetti_s=0;
+static size_t massimo_s=0;
+
+/**
+ * @function CreaSessioni
+ * @brief Crea la tabella delle sessioni, indicizzata tramite il descrittore della connessione
+ * @param ep indica il descrittore dell'epoll in cui sono registrate le connessioni
+ * @param soglia indica il numero massimo di byte nella coda di uscita di una connessione
+ * @param disconnetti se vale 1 un client che supera la soglia viene disconnesso, altrimenti i messaggi in eccesso vengono scartati
+ * @param maxmsg indica la lunghezza massima del body di una richiesta, oltre la quale il body non viene ricevuto nel buffer
+ */
+void CreaSessioni(int ep, size_t soglia, int disconnetti, size_t maxmsg){
+  epoll_s=ep;
+  soglia_s=soglia;
+  disconnetti_s=disconnetti;
+  massimo_s=maxmsg;
+  struct rlimit rl;
+  //la tabella ha un elemento per ogni descrittore che il processo può aprire
+  if(getrlimit(RLIMIT_NOFILE,&rl)==-1 || rl.rlim_cur==RLIM_INFINITY)
+    nsessioni=MAX_SESSIONI;
+  else
+    nsessioni=rl.rlim_cur;
+  if(nsessioni>MAX_SESSIONI)
+    nsessioni=MAX_SESSIONI;
+  SYSCALL_D(sessioni, calloc(nsessioni,sizeof(Sessione)), "calloc");
+  for(long i=0;i<nsessioni;i++)
+    pthread_mutex_init(&(sessioni[i].mtx),NULL);
+}
+
+/**
+ * @function GetSessione
+ * @brief Restituisce la sessione associata ad un descrittore
+ * @param fd indica il descrittore della connessione
+ * @return un puntatore alla sessione, NULL se il descrittore non è valido
+ */
+Sessione * GetSessione(long fd){
+  if(fd<0 || fd>=nsessioni)
+    return NULL;
+  return &sessioni[fd];
+}
+
+/**
+ * @function Memoria
+ * @brief Restituisce l'indirizzo del primo byte non ancora inviato di un blocco che non si trova in un file
+ * @param u indica il blocco
+ * @return l'indirizzo del byte
+ */
+static char * Memoria(Uscita *u){
+  if(u->voce!=NULL)
+    return u->voce->mappa+u->offset+u->inviati;
+  return u->dati+u->inviati;
+}
+
+/**
+ * @function Elimina
+ * @brief Elimina un blocco della coda di uscita, chiudendo il file o rilasciando la voce della cache da cui legge
+ * @param u indica il blocco
+ */
+static void Elimina(Uscita *u){
+  if(u->file>=0)
+    close(u->file);
+  RilasciaFile(u->voce);
+  Libera(u);
+}
+
+/**
+ * @function SvuotaCoda
+ * @brief Elimina tutti i blocchi della coda di uscita, da chiamare in mutua-esclusione sulla sessione
+ * @param s indica la sessione
+ */
+static void SvuotaCoda(Sessione *s){
+  while(s->testa!=NULL){
+    Uscita *tmp=s->testa;
+    s->testa=tmp->next;
+    Elimina(tmp);
+  }
+  s->ultimo=NULL;
+  s->inuscita=0;
+}
+
+/**
+ * @function Arma
+ * @brief Riarma il descrittore nell'epoll in base allo stato della sessione, da chiamare in mutua-esclusione sulla sessione
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione
+ */
+static void Arma(long fd, Sessione *s){
+  if(s->chiusa) return;
+  uint32_t ev=0;
+  //aspetto nuove richieste solo se nessun worker le sta già servendo e il client sta leggendo le risposte
+  if(!s->lettura && s->inuscita<=soglia_s)
+    ev|=EPOLLIN;
+  //aspetto che il descrittore sia scrivibile solo se ci sono dati in coda
+  if(s->testa!=NULL)
+    ev|=EPOLLOUT;
+  if(ev==0) return;
+  struct epoll_event e;
+  memset(&e,0,sizeof(e));
+  e.events=ev|EPOLLONESHOT;
+  e.data.fd=fd;
+  if(epoll_ctl(epoll_s,EPOLL_CTL_MOD,fd,&e)==-1){
+    perror("epoll_ctl");
+    exit(-1);
+  }
+}
+
+/**
+ * @function Interrompi
+ * @brief Interrompe la connessione scartando i dati in coda, il worker se ne accorgerà alla prossima lettura
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione
+ */
+static void Interrompi(long fd, Sessione *s){
+  SvuotaCoda(s);
+  s->interrotta=1;
+  shutdown(fd,SHUT_RDWR);
+}
+
+/**
+ * @function Scrivi
+ * @brief Scrive senza bloccarsi quanti più dati possibile, con una sendmsg per ogni gruppo di MAX_IOV elementi
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @return il numero di byte scritti, -1 se la connessione non è più valida
+ */
+static ssize_t Scrivi(long fd, struct iovec *iov, int cnt){
+  ssize_t tot=0;
+  while(cnt>0){
+    struct msghdr m;
+    memset(&m,0,sizeof(m));
+    m.msg_iov=iov;
+    m.msg_iovlen=cnt>MAX_IOV ? MAX_IOV : cnt;
+    size_t chiesti=0;
+    for(size_t i=0;i<m.msg_iovlen;i++)
+      chiesti+=iov[i].iov_len;
+    ssize_t r=sendmsg(fd,&m,MSG_DONTWAIT|MSG_NOSIGNAL);
+    if(r==-1){
+      if(errno==EINTR) continue;
+      if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+      return -1;
+    }
+    tot+=r;
+    //il descrittore non ha accettato tutto il gruppo, il resto andrà in coda
+    if((size_t)r<chiesti) break;
+    iov+=m.msg_iovlen;
+    cnt-=m.msg_iovlen;
+  }
+  return tot;
+}
+
+/**
+ * @function Consuma
+ * @brief Elimina dalla testa della coda di uscita i byte inviati, da chiamare in mutua-esclusione sulla sessione
+ * @param s indica la sessione
+ * @param r indica il numero di byte inviati
+ * @return 1 se il primo blocco rimasto è stato inviato solo in parte, 0 altrimenti
+ */
+static int Consuma(Sessione *s, size_t r){
+  while(r>0){
+    Uscita *u=s->testa;
+    size_t resto=u->len-u->inviati;
+    size_t n=r<resto ? r : resto;
+    //i blocchi di un file non occupano memoria della sessione, quindi non contano per la soglia
+    if(u->file<0 && u->voce==NULL)
+      s->inuscita-=n;
+    r-=n;
+    if(n<resto){
+      u->inviati+=n;
+      return 1;
+    }
+    s->testa=u->next;
+    Elimina(u);
+  }
+  if(s->testa==NULL)
+    s->ultimo=NULL;
+  return 0;
+}
+
+/**
+ * @function Svuota
+ * @brief Invia quanti più blocchi possibile della coda di uscita, da chiamare in mutua-esclusione sulla sessione
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione
+ *
+ * I blocchi in memoria consecutivi, compresi quelli dei file della cache, vengono inviati con una sola sendmsg, quelli
+ * che descrivono una parte di un file vengono inviati con sendfile, senza copiare il contenuto del file.
+ */
+static void Svuota(long fd, Sessione *s){
+  while(s->testa!=NULL){
+    ssize_t r;
+    if(s->testa->file>=0){
+      Uscita *u=s->testa;
+      off_t pos=u->offset+u->inviati;
+      if((r=sendfile(fd,u->file,&pos,u->len-u->inviati))==-1){
+        if(errno==EINTR) continue;
+        if(errno==EAGAIN || errno==EWOULDBLOCK) return;
+      }
+      //se il file è stato accorciato nel frattempo il client non riceverebbe i byte che aspetta
+      if(r<=0){
+        Interrompi(fd,s);
+        return;
+      }
+    }
+    else{
+      struct iovec iov[MAX_IOV];
+      int cnt=0;
+      //invio insieme i primi blocchi in memoria della coda
+      for(Uscita *u=s->testa;u!=NULL && u->file<0 && cnt<MAX_IOV;u=u->next,cnt++){
+        iov[cnt].iov_base=Memoria(u);
+        iov[cnt].iov_len=u->len-u->inviati;
+      }
+      if((r=Scrivi(fd,iov,cnt))<0){
+        Interrompi(fd,s);
+        return;
+      }
+      if(r==0) return;
+    }
+    //il descrittore non ha accettato altri dati, aspetto che torni scrivibile
+    if(Consuma(s,r))
+      return;
+  }
+}
+
+/**
+ * @function Appendi
+ * @brief Aggiunge un blocco in fondo alla coda di uscita, da chiamare in mutua-esclusione sulla sessione
+ * @param s indica la sessione
+ * @param u indica il blocco da aggiungere
+ */
+static void Appendi(Sessione *s, Uscita *u){
+  u->next=NULL;
+  if(s->ultimo==NULL)
+    s->testa=u;
+  else
+    s->ultimo->next=u;
+  s->ultimo=u;
+  if(u->file<0 && u->voce==NULL)
+    s->inuscita+=u->len;
+}
+
+/**
+ * @function Copia
+ * @brief Copia in un nuovo blocco della coda di uscita i byte non ancora inviati, da chiamare in mutua-esclusione sulla sessione
+ * @param s indica la sessione
+ * @param iov indica l'array dei dati
+ * @param cnt indica il numero di elementi dell'array
+ * @param tot indica il numero totale di byte dell'array
+ * @param inviati indica quanti byte dell'array sono già stati inviati
+ */
+static void Copia(Sessione *s, struct iovec *iov, int cnt, size_t tot, size_t inviati){
+  if(inviati>=tot) return;
+  Uscita *u=Alloca(sizeof(Uscita)+tot-inviati);
+  u->len=tot-inviati;
+  u->inviati=0;
+  u->file=-1;
+  u->offset=0;
+  u->voce=NULL;
+  size_t pos=0;
+  for(int i=0;i<cnt;i++){
+    char *base=iov[i].iov_base;
+    size_t len=iov[i].iov_len;
+    if(inviati>=len){
+      inviati-=len;
+      continue;
+    }
+    memcpy(u->dati+pos,base+inviati,len-inviati);
+    pos+=len-inviati;
+    inviati=0;
+  }
+  Appendi(s,u);
+}
+
+/**
+ * @function ApriSessione
+ * @brief Inizializza la sessione di una nuova connessione e registra il descrittore nell'epoll
+ * @param fd indica il descrittore della connessione
+ * @return 0 in caso di successo, -1 altrimenti
+ */
+int ApriSessione(long fd){
+  //il descrittore è non bloccante, così anche sendfile ritorna quando il client non legge
+  if(fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK)==-1)
+    return -1;
+  Sessione *s=GetSessione(fd);
+  if(s!=NULL){
+    pthread_mutex_lock(&(s->mtx));
+    SvuotaCoda(s);
+    s->lettura=s->interrotta=s->chiusa=0;
+    s->generazione++;
+    pthread_mutex_unlock(&(s->mtx));
+  }
+  struct epoll_event e;
+  memset(&e,0,sizeof(e));
+  //il descrittore viene disattivato dopo il primo evento, finchè non viene riarmato
+  e.events=EPOLLIN|EPOLLONESHOT;
+  e.data.fd=fd;
+  return epoll_ctl(epoll_s,EPOLL_CTL_ADD,fd,&e);
+}
+
+/**
+ * @function EventoSessione
+ * @brief Gestisce un evento dell'epoll su una connessione, svuotando la coda di uscita se il descrittore è scrivibile
+ * @param fd indica il descrittore della connessione
+ * @param eventi indica gli eventi restituiti dall'epoll
+ * @return 1 se le richieste della connessione devono essere servite da un worker, 0 altrimenti
+ */
+int EventoSessione(long fd, uint32_t eventi){
+  Sessione *s=GetSessione(fd);
+  //il descrittore non ha una sessione, sarà il worker a chiudere la connessione
+  if(s==NULL) return 1;
+  int servi=0;
+  pthread_mutex_lock(&(s->mtx));
+  if(!s->chiusa){
+    if(eventi&(EPOLLOUT|EPOLLERR|EPOLLHUP))
+      Svuota(fd,s);
+    //la connessione viene affidata ad un solo worker alla volta
+    if((eventi&(EPOLLIN|EPOLLERR|EPOLLHUP)) && !s->lettura){
+      s->lettura=1;
+      servi=1;
+    }
+    Arma(fd,s);
+  }
+  pthread_mutex_unlock(&(s->mtx));
+  return servi;
+}
+
+/**
+ * @function RilasciaSessione
+ * @brief Segnala che il worker ha finito di servire la connessione e riarma il descrittore nell'epoll
+ * @param fd indica il descrittore della connessione
+ */
+void RilasciaSessione(long fd){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL) return;
+  pthread_mutex_lock(&(s->mtx));
+  s->lettura=0;
+  Arma(fd,s);
+  pthread_mutex_unlock(&(s->mtx));
+}
+
+/**
+ * @function AccodaDa
+ * @brief Invia dei dati senza bloccarsi, accodando quelli che il descrittore non riesce ad accettare subito
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param consegna vale 1 se si tratta di un messaggio per un altro utente, a cui si applica la politica scelta quando la coda è piena
+ * @param generazione se non è NULL i dati vengono scartati quando la sessione ha una generazione diversa
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+static int AccodaDa(long fd, struct iovec *iov, int cnt, int consegna, const unsigned *generazione){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL) return 0;
+  size_t tot=0;
+  for(int i=0;i<cnt;i++)
+    tot+=iov[i].iov_len;
+  pthread_mutex_lock(&(s->mtx));
+  //il descrittore potrebbe essere stato chiuso e assegnato ad un altro client dopo che il mittente lo ha letto
+  if(s->chiusa || s->interrotta || (generazione!=NULL && s->generazione!=*generazione)){
+    pthread_mutex_unlock(&(s->mtx));
+    return 0;
+  }
+  //il client non sta leggendo i messaggi, applico la politica scelta
+  if(consegna && s->testa!=NULL && s->inuscita+tot>soglia_s){
+    if(disconnetti_s)
+      Interrompi(fd,s);
+    pthread_mutex_unlock(&(s->mtx));
+    return 0;
+  }
+  ssize_t inviati=0;
+  //se la coda è vuota provo ad inviare subito, altrimenti i dati devono andare dietro a quelli già in coda
+  if(s->testa==NULL && (inviati=Scrivi(fd,iov,cnt))<0){
+    Interrompi(fd,s);
+    pthread_mutex_unlock(&(s->mtx));
+    return 0;
+  }
+  if((size_t)inviati<tot){
+    Copia(s,iov,cnt,tot,inviati);
+    Arma(fd,s);
+  }
+  pthread_mutex_unlock(&(s->mtx));
+  return 1;
+}
+
+/**
+ * @function Accoda
+ * @brief Invia dei dati senza bloccarsi, accodando quelli che il descrittore non riesce ad accettare subito
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param consegna vale 1 se si tratta di un messaggio per un altro utente, a cui si applica la politica scelta quando la coda è piena
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+int Accoda(long fd, struct iovec *iov, int cnt, int consegna){
+  return AccodaDa(fd,iov,cnt,consegna,NULL);
+}
+
+/**
+ * @function AccodaSessione
+ * @brief Come Accoda per un messaggio destinato ad un altro utente, ma solo se il descrittore è ancora assegnato alla stessa connessione
+ * @param fd indica il descrittore della connessione
+ * @param generazione indica la generazione della sessione restituita da GenerazioneSessione quando l'utente si è connesso
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati o se il descrittore è stato riassegnato
+ */
+int AccodaSessione(long fd, unsigned generazione, struct iovec *iov, int cnt){
+  return AccodaDa(fd,iov,cnt,1,&generazione);
+}
+
+/**
+ * @function GenerazioneSessione
+ * @brief Restituisce la generazione della connessione a cui è assegnato un descrittore
+ * @param fd indica il descrittore della connessione
+ * @return la generazione, 0 se il descrittore non ha una sessione
+ */
+unsigned GenerazioneSessione(long fd){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL) return 0;
+  pthread_mutex_lock(&(s->mtx));
+  unsigned g=s->generazione;
+  pthread_mutex_unlock(&(s->mtx));
+  return g;
+}
+
+/**
+ * @function AccodaFile
+ * @brief Invia degli header seguiti dal contenuto di un file, senza bloccarsi e senza copiare il file in memoria
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array degli header da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param file indica il descrittore del file aperto in lettura, che viene chiuso dalla sessione
+ * @param len indica il numero di byte del file da inviare
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+int AccodaFile(long fd, struct iovec *iov, int cnt, int file, size_t len){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL){
+    close(file);
+    return 0;
+  }
+  size_t tot=0;
+  for(int i=0;i<cnt;i++)
+    tot+=iov[i].iov_len;
+  pthread_mutex_lock(&(s->mtx));
+  if(s->chiusa || s->interrotta){
+    pthread_mutex_unlock(&(s->mtx));
+    close(file);
+    return 0;
+  }
+  int vuota=(s->testa==NULL);
+  ssize_t inviati=0;
+  off_t pos=0;
+  if(vuota && (inviati=Scrivi(fd,iov,cnt))<0){
+    Interrompi(fd,s);
+    pthread_mutex_unlock(&(s->mtx));
+    close(file);
+    return 0;
+  }
+  Copia(s,iov,cnt,tot,inviati);
+  //se gli header sono stati inviati per intero provo ad inviare subito anche il file
+  while(vuota && (size_t)inviati==tot && (size_t)pos<len){
+    ssize_t r=sendfile(fd,file,&pos,len-pos);
+    if(r==-1 && errno==EINTR) continue;
+    if(r==-1 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+    if(r<=0){
+      Interrompi(fd,s);
+      pthread_mutex_unlock(&(s->mtx));
+      close(file);
+      return 0;
+    }
+  }
+  if((size_t)pos<len){
+    //accodo la parte del file non ancora inviata, verrà inviata dal Listener quando il descrittore torna scrivibile
+    Uscita *u=Alloca(sizeof(Uscita));
+    u->len=len-pos;
+    u->inviati=0;
+    u->file=file;
+    u->offset=pos;
+    u->voce=NULL;
+    Appendi(s,u);
+  }
+  else
+    close(file);
+  if(s->testa!=NULL)
+    Arma(fd,s);
+  pthread_mutex_unlock(&(s->mtx));
+  return 1;
+}
+
+/**
+ * @function AccodaMappa
+ * @brief Invia degli header seguiti dal contenuto di un file della cache, senza bloccarsi e senza copiarlo
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array degli header da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param v indica la voce della cache, il cui riferimento viene rilasciato dalla sessione
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+int AccodaMappa(long fd, struct iovec *iov, int cnt, Voce *v){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL || cnt>=MAX_IOV){
+    RilasciaFile(v);
+    return 0;
+  }
+  //il contenuto del file viene inviato insieme agli header, direttamente dalla mappatura
+  struct iovec tutti[MAX_IOV];
+  size_t tot=0;
+  for(int i=0;i<cnt;i++){
+    tutti[i]=iov[i];
+    tot+=iov[i].iov_len;
+  }
+  tutti[cnt].iov_base=v->mappa;
+  tutti[cnt].iov_len=v->len;
+  pthread_mutex_lock(&(s->mtx));
+  if(s->chiusa || s->interrotta){
+    pthread_mutex_unlock(&(s->mtx));
+    RilasciaFile(v);
+    return 0;
+  }
+  ssize_t inviati=0;
+  if(s->testa==NULL && (inviati=Scrivi(fd,tutti,cnt+1))<0){
+    Interrompi(fd,s);
+    pthread_mutex_unlock(&(s->mtx));
+    RilasciaFile(v);
+    return 0;
+  }
+  Copia(s,iov,cnt,tot,inviati);
+  size_t pos=(size_t)inviati>tot ? inviati-tot : 0;
+  if(pos<v->len){
+    //accodo la parte del file non ancora inviata, la voce resta mappata finchè il blocco non viene eliminato
+    Uscita *u=Alloca(sizeof(Uscita));
+    u->len=v->len-pos;
+    u->inviati=0;
+    u->file=-1;
+    u->offset=pos;
+    u->voce=v;
+    Appendi(s,u);
+  }
+  else
+    RilasciaFile(v);
+  if(s->testa!=NULL)
+    Arma(fd,s);
+  pthread_mutex_unlock(&(s->mtx));
+  return 1;
+}
+
+/**
+ * @function ChiudiSessione
+ * @brief Libera il buffer e la coda di uscita della sessione associata ad un descrittore, che può essere riusato da una nuova connessione
+ * @param fd indica il descrittore della connessione
+ */
+void ChiudiSessione(long fd){
+  Sessione *s=GetSessione(fd);
+  if(s==NULL) return;
+  //se il client si disconnette durante un caricamento il file incompleto viene cancellato
+  TerminaCaricamento(s);
+  free(s->buf);
+  s->buf=NULL;
+  s->cap=s->inizio=s->fine=0;
+  pthread_mutex_lock(&(s->mtx));
+  SvuotaCoda(s);
+  s->lettura=0;
+  s->chiusa=1;
+  pthread_mutex_unlock(&(s->mtx));
+}
+
+/**
+ * @function DestroySessioni
+ * @brief Elimina la tabella delle sessioni
+ */
+void DestroySessioni(){
+  if(sessioni==NULL) return;
+  for(long i=0;i<nsessioni;i++){
+    //un caricamento interrotto dalla terminazione del server non lascia file temporanei nella directory
+    TerminaCaricamento(&sessioni[i]);
+    free(sessioni[i].buf);
+    SvuotaCoda(&sessioni[i]);
+    pthread_mutex_destroy(&(sessioni[i].mtx));
+  }
+  free(sessioni);
+  sessioni=NULL;
+}
+
+/**
+ * @function Spazio
+ * @brief Si assicura che il buffer possa contenere almeno dim byte a partire dal primo byte non consumato
+ * @param s indica la sessione
+ * @param dim indica il numero di byte da poter contenere
+ * @return 0 in caso di successo, -1 se non c'è memoria per ingrandire il buffer
+ */
+static int Spazio(Sessione *s, size_t dim){
+  //compatto il buffer spostando all'inizio i byte non ancora consumati
+  if(s->inizio>0){
+    memmove(s->buf,s->buf+s->inizio,s->fine-s->inizio);
+    s->fine-=s->inizio;
+    s->inizio=0;
+  }
+  if(dim<=s->cap)
+    return 0;
+  //la richiesta non entra nel buffer, lo ingrandisco quanto basta; se non c'è memoria fallisce solo questa connessione
+  char *tmp=realloc(s->buf,dim);
+  if(tmp==NULL){
+    errno=ENOMEM;
+    return -1;
+  }
+  s->buf=tmp;
+  s->cap=dim;
+  return 0;
+}
+
+/**
+ * @function Riempi
+ * @brief Riceve con una sola recv non bloccante tutti i byte disponibili sulla connessione, fino a riempire il buffer
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione associata al descrittore
+ * @return il numero di byte ricevuti, 0 se il client ha chiuso la connessione, -1 in caso di errore (EAGAIN se non ci sono dati)
+ */
+int Riempi(long fd, Sessione *s){
+  //il buffer viene allocato alla prima ricezione
+  if(s->buf==NULL){
+    if((s->buf=malloc(DIM_SESSIONE))==NULL){
+      errno=ENOMEM;
+      return -1;
+    }
+    s->cap=DIM_SESSIONE;
+    s->inizio=s->fine=0;
+  }
+  //se il buffer è pieno faccio spazio, raddoppiandolo se non ci sono byte da compattare
+  if(s->fine==s->cap && Spazio(s, s->inizio>0 ? s->cap : s->cap*2)<0)
+    return -1;
+  int r;
+  while((r=recv(fd,s->buf+s->fine,s->cap-s->fine,MSG_DONTWAIT))==-1 && errno==EINTR);
+  if(r>0)
+    s->fine+=r;
+  return r;
+}
+
+/**
+ * @function HaBody
+ * @brief Controlla se una richiesta contiene un buffer dati dopo l'header della parte dati
+ * @param op indica il tipo della richiesta
+ * @return 1 se la richiesta contiene un buffer dati, 0 altrimenti
+ */
+static int HaBody(op_t op){
+  return op==POSTTXT_OP || op==POSTTXTALL_OP || op==GETFILE_OP || op==GETNEWMSGS_OP || op==POSTFILE_OP;
+}
+
+/**
+ * @function Lunghezza
+ * @brief Calcola quanti byte occupa la richiesta che inizia nel buffer, per quanto è possibile saperlo con i byte già ricevuti
+ * @param p indica l'inizio della richiesta
+ * @param disp indica il numero di byte ricevuti a partire da p
+ * @return il numero di byte necessari, che può crescere man mano che arrivano gli header successivi
+ */
+static size_t Lunghezza(char *p, size_t disp){
+  size_t h=sizeof(message_hdr_t), d=sizeof(message_data_hdr_t);
+  message_hdr_t hdr;
+  message_data_hdr_t dhdr;
+  if(disp<h) return h;
+  memcpy(&hdr,p,h);
+  switch(hdr.op){
+    case UNREGISTER_OP:
+    case CREATEGROUP_OP:
+    case ADDGROUP_OP:
+    case DELGROUP_OP:
+      //header e header della parte dati
+      return h+d;
+    case POSTTXT_OP:
+    case POSTTXTALL_OP:
+    case GETFILE_OP:
+    case GETNEWMSGS_OP:
+    case POSTFILE_OP:{
+      //header, header della parte dati e buffer dati
+      if(disp<h+d) return h+d;
+      memcpy(&dhdr,p+h,d);
+      //un body troppo lungo non viene ricevuto nel buffer, la richiesta è completa appena arrivano gli header
+      if(dhdr.len>massimo_s) return h+d;
+      size_t n=h+d+dhdr.len;
+      if(hdr.op!=POSTFILE_OP) return n;
+      //una POSTFILE_OP è seguita dall'header del file, il contenuto non fa parte della richiesta e viene ricevuto da Carica
+      return n+d;
+    }
+    default:
+      //le altre richieste sono formate dal solo header
+      return h;
+  }
+}
+
+/**
+ * @function Completa
+ * @brief Controlla se nel buffer c'è almeno una richiesta completa
+ * @param s indica la sessione da controllare
+ * @return 1 se c'è una richiesta completa, 0 altrimenti
+ */
+int Completa(Sessione *s){
+  size_t disp=s->fine-s->inizio;
+  if(disp==0) return 0;
+  //durante un caricamento i byte nel buffer appartengono al file e possono essere consumati subito
+  if(s->caricando) return 1;
+  return disp>=Lunghezza(s->buf+s->inizio,disp);
+}
+
+/**
+ * @function Estrai
+ * @brief Estrae dal buffer la prossima richiesta completa, senza copiare il body
+ * @param s indica la sessione da cui estrarre la richiesta
+ * @param msg indica la richiesta estratta, il campo data.buf punta direttamente nel buffer della sessione
+ * @param file indica l'header del file che segue una richiesta POSTFILE_OP, il contenuto va consumato con IniziaCaricamento
+ * @return 1 se è stata estratta una richiesta, 0 se la richiesta non è ancora arrivata per intero
+ */
+int Estrai(Sessione *s, message_t *msg, message_data_t *file){
+  size_t h=sizeof(message_hdr_t), d=sizeof(message_data_hdr_t);
+  size_t disp=s->fine-s->inizio;
+  if(disp==0){
+    s->inizio=s->fine=0;
+    //se il buffer era stato ingrandito per una richiesta grande lo libero, verrà riallocato alla prossima ricezione
+    if(s->cap>DIM_SESSIONE){
+      free(s->buf);
+      s->buf=NULL;
+      s->cap=0;
+    }
+    return 0;
+  }
+  char *p=s->buf+s->inizio;
+  size_t n=Lunghezza(p,disp);
+  if(disp<n){
+    //la richiesta non è completa, mi assicuro che il buffer possa contenerla per intero; se non c'è memoria
+    //Riempi fallirà quando il buffer sarà pieno e la connessione verrà chiusa
+    Spazio(s,n);
+    return 0;
+  }
+  memset(msg,0,sizeof(message_t));
+  memset(file,0,sizeof(message_data_t));
+  memcpy(&(msg->hdr),p,h);
+  if(n==h+d){
+    memcpy(&(msg->data.hdr),p+h,d);
+    if(msg->data.hdr.len>massimo_s && HaBody(msg->hdr.op)){
+      //il body supera la lunghezza massima: consumo gli header e scarto il body, e per una POSTFILE_OP anche il file
+      s->inizio+=n;
+      IniziaCaricamento(s,-1,NULL,NULL,msg->data.hdr.len,msg);
+      s->car.intestazione=(msg->hdr.op==POSTFILE_OP);
+      return 2;
+    }
+  }
+  if(n>h){
+    memcpy(&(msg->data.hdr),p+h,d);
+    if(n>h+d && msg->data.hdr.len>0)
+      msg->data.buf=p+h+d;
+    if(msg->hdr.op==POSTFILE_OP)
+      memcpy(&(file->hdr),p+h+d+msg->data.hdr.len,d);
+  }
+  //consumo la richiesta, i byte restano nel buffer finchè non vengono ricevuti nuovi dati
+  s->inizio+=n;
+  return 1;
+}
+
+/**
+ * @function IniziaCaricamento
+ * @brief Fa sì che i prossimi byte ricevuti sulla connessione vengano scritti in un file, o scartati, invece di essere interpretati come richieste
+ * @param s indica la sessione
+ * @param file indica il descrittore del file aperto in scrittura, -1 se i byte devono essere scartati
+ * @param percorso indica il percorso del file temporaneo, che viene cancellato se il caricamento non termina, NULL se i byte vengono scartati
+ * @param destinazione indica il percorso che il file prende quando è stato ricevuto per intero, NULL se i byte vengono scartati
+ * @param len indica il numero di byte del file
+ * @param msg indica la richiesta POSTFILE_OP, che viene copiata insieme al nome del file
+ */
+void IniziaCaricamento(Sessione *s, int file, char *percorso, char *destinazione, size_t len, message_t *msg){
+  Caricamento *c=&(s->car);
+  c->file=file;
+  c->percorso=percorso;
+  c->destinazione=destinazione;
+  c->resto=len;
+  c->errore=0;
+  c->intestazione=0;
+  memset(&(c->msg),0,sizeof(message_t));
+  c->msg.hdr=msg->hdr;
+  c->msg.data.hdr=msg->data.hdr;
+  //il nome del file è nel buffer della sessione, che verrà riusato per ricevere il contenuto
+  if(file>=0 && msg->data.hdr.len>0){
+    c->msg.data.buf=Alloca(msg->data.hdr.len);
+    memcpy(c->msg.data.buf,msg->data.buf,msg->data.hdr.len);
+  }
+  s->caricando=1;
+}
+
+/**
+ * @function Carica
+ * @brief Scrive nel file i byte del caricamento in corso, a blocchi grandi al più quanto il buffer della sessione
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione
+ * @return 1 se il file è stato ricevuto per intero, 0 se bisogna aspettare altri dati, -1 se il client ha chiuso la connessione o c'è stato un errore
+ */
+int Carica(long fd, Sessione *s){
+  Caricamento *c=&(s->car);
+  size_t d=sizeof(message_data_hdr_t);
+  while(c->resto>0 || c->intestazione){
+    size_t disp=s->fine-s->inizio;
+    if(c->resto>0 && disp>0){
+      size_t n=disp<c->resto ? disp : c->resto;
+      //se la scrittura fallisce continuo a consumare i byte, così le richieste successive restano allineate
+      if(c->file>=0 && !c->errore && writen(c->file,s->buf+s->inizio,n)<=0)
+        c->errore=1;
+      s->inizio+=n;
+      c->resto-=n;
+      continue;
+    }
+    if(c->resto==0 && disp>=d){
+      //dopo il nome di un file troppo lungo arriva l'header del file, di cui scarto anche il contenuto
+      message_data_hdr_t dhdr;
+      memcpy(&dhdr,s->buf+s->inizio,d);
+      s->inizio+=d;
+      c->resto=dhdr.len;
+      c->intestazione=0;
+      continue;
+    }
+    //il buffer non contiene altri byte utili, ricevo il prossimo blocco riusando sempre lo stesso spazio
+    if(disp==0)
+      s->inizio=s->fine=0;
+    int r=Riempi(fd,s);
+    if(r>0) continue;
+    if(r<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 0;
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * @function TerminaCaricamento
+ * @brief Chiude il caricamento in corso, cancellando il file temporaneo se non è stato ricevuto per intero o se la scrittura è fallita
+ * @param s indica la sessione
+ */
+void TerminaCaricamento(Sessione *s){
+  Caricamento *c=&(s->car);
+  if(!s->caricando) return;
+  if(c->file>=0)
+    close(c->file);
+  //la versione precedente del file non viene toccata, al più cancello il file temporaneo
+  if(c->percorso!=NULL){
+    if(c->resto>0 || c->errore)
+      unlink(c->percorso);
+    Libera(c->percorso);
+    Libera(c->destinazione);
+  }
+  Libera(c->msg.data.buf);
+  c->msg.data.buf=NULL;
+  c->percorso=NULL;
+  c->destinazione=NULL;
+  c->file=-1;
+  s->caricando=0;
+}
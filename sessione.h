@@ -0,0 +1,271 @@
+/**
+ * @file sessione.h
+ * @brief File per la gestione dello stato associato ad ogni connessione (buffer di ricezione, parser delle richieste e coda di uscita)
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef SESSIONE_H_
+#define SESSIONE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <message.h>
+#include <cachefile.h>
+
+/**
+ * @struct Uscita
+ * @brief è la struttura che rappresenta un blocco di byte in attesa di essere inviato al client
+ * @var len indica il numero di byte del blocco
+ * @var inviati indica quanti byte del blocco sono già stati inviati
+ * @var file indica il descrittore del file da cui leggere i byte, -1 se i byte sono in dati
+ * @var offset indica la posizione nel file, o nella mappatura, del primo byte del blocco
+ * @var voce indica il file della cache da cui leggere i byte, NULL se i byte sono in dati o in un file
+ * @var next puntatore al blocco successivo
+ * @var dati contiene i byte da inviare
+ */
+typedef struct Uscita1{
+  size_t len;
+  size_t inviati;
+  int file;
+  off_t offset;
+  Voce *voce;
+  struct Uscita1 *next;
+  char dati[];
+}Uscita;
+
+/**
+ * @struct Caricamento
+ * @brief è la struttura che rappresenta il caricamento di un file in corso su una connessione
+ * @var file indica il descrittore del file in cui scrivere, -1 se i byte ricevuti vengono scartati
+ * @var percorso indica il percorso del file temporaneo in cui viene scritto il contenuto, NULL se i byte ricevuti vengono scartati
+ * @var destinazione indica il percorso che il file prende quando è stato ricevuto per intero, NULL se i byte ricevuti vengono scartati
+ * @var resto indica il numero di byte del file ancora da ricevere
+ * @var errore vale 1 se la scrittura sul file è fallita
+ * @var intestazione vale 1 se i byte scartati sono il nome di un file troppo lungo, seguito dall'header e dal contenuto del file da scartare
+ * @var msg è una copia della richiesta POSTFILE_OP, compreso il nome del file
+ */
+typedef struct Caricamento1{
+  int file;
+  char *percorso;
+  char *destinazione;
+  size_t resto;
+  int errore;
+  int intestazione;
+  message_t msg;
+}Caricamento;
+
+/**
+ * @struct Sessione
+ * @brief è la struttura che rappresenta lo stato di una connessione
+ * @var buf è il buffer in cui vengono ricevuti i byte inviati dal client
+ * @var cap indica la dimensione del buffer
+ * @var inizio indica la posizione del primo byte non ancora consumato
+ * @var fine indica la posizione successiva all'ultimo byte ricevuto
+ * @var mtx è la variabile di mutua-esclusione sulla coda di uscita e sullo stato dell'epoll
+ * @var testa puntatore al primo blocco della coda di uscita
+ * @var ultimo puntatore all'ultimo blocco della coda di uscita
+ * @var inuscita indica il numero di byte presenti nella coda di uscita
+ * @var lettura vale 1 se un worker sta servendo le richieste della connessione
+ * @var interrotta vale 1 se la connessione è stata interrotta dal server e non accetta altri dati
+ * @var chiusa vale 1 se il descrittore è stato chiuso
+ * @var generazione viene incrementata ogni volta che il descrittore viene assegnato ad una nuova connessione
+ * @var caricando vale 1 se i byte in arrivo appartengono al contenuto di un file
+ * @var car indica il caricamento in corso
+ */
+typedef struct Sessione1{
+  char *buf;
+  size_t cap;
+  size_t inizio;
+  size_t fine;
+  pthread_mutex_t mtx;
+  Uscita *testa;
+  Uscita *ultimo;
+  size_t inuscita;
+  int lettura;
+  int interrotta;
+  int chiusa;
+  unsigned generazione;
+  int caricando;
+  Caricamento car;
+}Sessione;
+
+/**
+ * @var nsessioni indica la dimensione della tabella delle sessioni
+ */
+extern long nsessioni;
+
+/**
+ * @function CreaSessioni
+ * @brief Crea la tabella delle sessioni, indicizzata tramite il descrittore della connessione
+ * @param ep indica il descrittore dell'epoll in cui sono registrate le connessioni
+ * @param soglia indica il numero massimo di byte nella coda di uscita di una connessione
+ * @param disconnetti se vale 1 un client che supera la soglia viene disconnesso, altrimenti i messaggi in eccesso vengono scartati
+ * @param maxmsg indica la lunghezza massima del body di una richiesta, oltre la quale il body non viene ricevuto nel buffer
+ */
+void CreaSessioni(int ep, size_t soglia, int disconnetti, size_t maxmsg);
+
+/**
+ * @function ApriSessione
+ * @brief Inizializza la sessione di una nuova connessione e registra il descrittore nell'epoll
+ * @param fd indica il descrittore della connessione
+ * @return 0 in caso di successo, -1 altrimenti
+ */
+int ApriSessione(long fd);
+
+/**
+ * @function EventoSessione
+ * @brief Gestisce un evento dell'epoll su una connessione, svuotando la coda di uscita se il descrittore è scrivibile
+ * @param fd indica il descrittore della connessione
+ * @param eventi indica gli eventi restituiti dall'epoll
+ * @return 1 se le richieste della connessione devono essere servite da un worker, 0 altrimenti
+ */
+int EventoSessione(long fd, uint32_t eventi);
+
+/**
+ * @function RilasciaSessione
+ * @brief Segnala che il worker ha finito di servire la connessione e riarma il descrittore nell'epoll
+ * @param fd indica il descrittore della connessione
+ *
+ * Se la coda di uscita supera la soglia il descrittore viene riarmato solo in scrittura, finchè il client non legge le risposte.
+ */
+void RilasciaSessione(long fd);
+
+/**
+ * @function Accoda
+ * @brief Invia dei dati senza bloccarsi, accodando quelli che il descrittore non riesce ad accettare subito
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param consegna vale 1 se si tratta di un messaggio per un altro utente, a cui si applica la politica scelta quando la coda è piena
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+int Accoda(long fd, struct iovec *iov, int cnt, int consegna);
+
+/**
+ * @function AccodaSessione
+ * @brief Come Accoda per un messaggio destinato ad un altro utente, ma solo se il descrittore è ancora assegnato alla stessa connessione
+ * @param fd indica il descrittore della connessione
+ * @param generazione indica la generazione della sessione restituita da GenerazioneSessione quando l'utente si è connesso
+ * @param iov indica l'array dei dati da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati o se il descrittore è stato riassegnato
+ */
+int AccodaSessione(long fd, unsigned generazione, struct iovec *iov, int cnt);
+
+/**
+ * @function GenerazioneSessione
+ * @brief Restituisce la generazione della connessione a cui è assegnato un descrittore
+ * @param fd indica il descrittore della connessione
+ * @return la generazione, 0 se il descrittore non ha una sessione
+ */
+unsigned GenerazioneSessione(long fd);
+
+/**
+ * @function AccodaFile
+ * @brief Invia degli header seguiti dal contenuto di un file, senza bloccarsi e senza copiare il file in memoria
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array degli header da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param file indica il descrittore del file aperto in lettura, che viene chiuso dalla sessione
+ * @param len indica il numero di byte del file da inviare
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+int AccodaFile(long fd, struct iovec *iov, int cnt, int file, size_t len);
+
+/**
+ * @function AccodaMappa
+ * @brief Invia degli header seguiti dal contenuto di un file della cache, senza bloccarsi e senza copiarlo
+ * @param fd indica il descrittore della connessione
+ * @param iov indica l'array degli header da inviare
+ * @param cnt indica il numero di elementi dell'array
+ * @param v indica la voce della cache, il cui riferimento viene rilasciato dalla sessione
+ * @return 1 se i dati sono stati inviati o accodati, 0 se sono stati scartati
+ */
+int AccodaMappa(long fd, struct iovec *iov, int cnt, Voce *v);
+
+/**
+ * @function GetSessione
+ * @brief Restituisce la sessione associata ad un descrittore
+ * @param fd indica il descrittore della connessione
+ * @return un puntatore alla sessione, NULL se il descrittore non è valido
+ */
+Sessione * GetSessione(long fd);
+
+/**
+ * @function ChiudiSessione
+ * @brief Libera il buffer e la coda di uscita della sessione associata ad un descrittore, che può essere riusato da una nuova connessione
+ * @param fd indica il descrittore della connessione
+ */
+void ChiudiSessione(long fd);
+
+/**
+ * @function DestroySessioni
+ * @brief Elimina la tabella delle sessioni
+ */
+void DestroySessioni();
+
+/**
+ * @function Riempi
+ * @brief Riceve con una sola recv non bloccante tutti i byte disponibili sulla connessione, fino a riempire il buffer
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione associata al descrittore
+ * @return il numero di byte ricevuti, 0 se il client ha chiuso la connessione, -1 in caso di errore (EAGAIN se non ci sono dati)
+ */
+int Riempi(long fd, Sessione *s);
+
+/**
+ * @function Completa
+ * @brief Controlla se nel buffer c'è almeno una richiesta completa
+ * @param s indica la sessione da controllare
+ * @return 1 se c'è una richiesta completa, 0 altrimenti
+ */
+int Completa(Sessione *s);
+
+/**
+ * @function Estrai
+ * @brief Estrae dal buffer la prossima richiesta completa, senza copiare il body
+ * @param s indica la sessione da cui estrarre la richiesta
+ * @param msg indica la richiesta estratta, il campo data.buf punta direttamente nel buffer della sessione
+ * @param file indica l'header del file che segue una richiesta POSTFILE_OP, il contenuto va consumato con IniziaCaricamento
+ * @return 1 se è stata estratta una richiesta, 0 se la richiesta non è ancora arrivata per intero, 2 se il body della
+ *         richiesta supera la lunghezza massima: viene estratto solo l'header e il body viene scartato man mano che arriva
+ *
+ * I puntatori restituiti restano validi fino alla successiva chiamata di Riempi o Estrai sulla stessa sessione.
+ */
+int Estrai(Sessione *s, message_t *msg, message_data_t *file);
+
+/**
+ * @function IniziaCaricamento
+ * @brief Fa sì che i prossimi byte ricevuti sulla connessione vengano scritti in un file, o scartati, invece di essere interpretati come richieste
+ * @param s indica la sessione
+ * @param file indica il descrittore del file aperto in scrittura, -1 se i byte devono essere scartati
+ * @param percorso indica il percorso del file temporaneo, che viene cancellato se il caricamento non termina, NULL se i byte vengono scartati
+ * @param destinazione indica il percorso che il file prende quando è stato ricevuto per intero, NULL se i byte vengono scartati
+ * @param len indica il numero di byte del file
+ * @param msg indica la richiesta POSTFILE_OP, che viene copiata insieme al nome del file
+ */
+void IniziaCaricamento(Sessione *s, int file, char *percorso, char *destinazione, size_t len, message_t *msg);
+
+/**
+ * @function Carica
+ * @brief Scrive nel file i byte del caricamento in corso, a blocchi grandi al più quanto il buffer della sessione
+ * @param fd indica il descrittore della connessione
+ * @param s indica la sessione
+ * @return 1 se il file è stato ricevuto per intero, 0 se bisogna aspettare altri dati, -1 se il client ha chiuso la connessione o c'è stato un errore
+ */
+int Carica(long fd, Sessione *s);
+
+/**
+ * @function TerminaCaricamento
+ * @brief Chiude il caricamento in corso, cancellando il file temporaneo se non è stato ricevuto per intero o se la scrittura è fallita
+ * @param s indica la sessione
+ */
+void TerminaCaricamento(Sessione *s);
+
+#endif /* SESSIONE_H_ */
@@ -0,0 +1,311 @@
+/**
+ * @file slab.c
+ * @brief File per la gestione dell'allocatore a classi di dimensione usato nel percorso delle richieste
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ * Ogni thread ha una cache con una lista di blocchi liberi per ogni classe di dimensione (potenze di due). Un blocco
+ * liberato torna nella cache del thread che lo libera; quando una cache supera SLAB_CACHE blocchi in una classe ne
+ * sposta SLAB_LOTTO in un deposito comune, da cui le cache vuote si riforniscono prima di ricorrere a malloc. In
+ * questo modo anche i blocchi allocati da un thread e liberati da un altro vengono riusati.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <config.h>
+#include <message.h>
+#include <slab.h>
+
+//macro per allocazioni dinamiche
+#define SYSCALL_D(r,c,e) \
+    if((r=c)==NULL) { perror(e); exit(-1); }
+
+//numero massimo di classi di dimensione
+#define MAX_CLASSI 24
+
+//classe assegnata ai blocchi troppo grandi, allocati e liberati direttamente con malloc e free
+#define FUORI_CLASSE ((size_t)-1)
+
+/**
+ * @struct Blocco
+ * @brief è l'intestazione che precede ogni blocco restituito da Alloca
+ * @var next puntatore al blocco successivo nella lista dei liberi
+ * @var classe indica la classe di dimensione del blocco
+ */
+typedef struct Blocco1{
+  struct Blocco1 *next;
+  size_t classe;
+}Blocco;
+
+/**
+ * @struct Cache
+ * @brief è la struttura che rappresenta la cache di un thread
+ * @var libero è la lista dei blocchi liberi per ogni classe
+ * @var nliberi indica il numero di blocchi liberi per ogni classe
+ * @var hit indica il numero di allocazioni servite senza malloc
+ * @var miss indica il numero di allocazioni passate a malloc
+ * @var next puntatore alla cache successiva nell'elenco delle cache attive
+ */
+typedef struct Cache1{
+  Blocco *libero[MAX_CLASSI];
+  int nliberi[MAX_CLASSI];
+  unsigned long hit;
+  unsigned long miss;
+  struct Cache1 *next;
+}Cache;
+
+/**
+ * @var nclassi indica il numero di classi di dimensione
+ */
+static int nclassi=0;
+
+/**
+ * @var chiave è la chiave con cui ogni thread ritrova la propria cache
+ */
+static pthread_key_t chiave;
+
+/**
+ * @var deposito è la lista dei blocchi liberi in comune tra i thread, per ogni classe
+ * @var ndeposito indica il numero di blocchi nel deposito per ogni classe
+ */
+static Blocco *deposito[MAX_CLASSI];
+static int ndeposito[MAX_CLASSI];
+
+/**
+ * @var cache è l'elenco delle cache attive, usato per stampare i contatori
+ * @var hit_chiuse indica le allocazioni servite senza malloc dai thread già terminati
+ * @var miss_chiuse indica le allocazioni passate a malloc dai thread già terminati
+ */
+static Cache *cache=NULL;
+static unsigned long hit_chiuse=0, miss_chiuse=0;
+
+/**
+ * @var mutex_slab è la variabile di mutua-esclusione sul deposito e sull'elenco delle cache
+ */
+static pthread_mutex_t mutex_slab=PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @function Dimensione
+ * @brief Restituisce il numero di byte utilizzabili di un blocco di una classe
+ * @param c indica la classe
+ * @return il numero di byte
+ */
+static size_t Dimensione(int c){
+  return (size_t)SLAB_MIN<<c;
+}
+
+/**
+ * @function Classe
+ * @brief Restituisce la classe più piccola che può contenere dim byte
+ * @param dim indica il numero di byte richiesti
+ * @return la classe, -1 se dim è più grande della classe più grande
+ */
+static int Classe(size_t dim){
+  int c=0;
+  while(c<nclassi && Dimensione(c)<dim)
+    c++;
+  return c<nclassi ? c : -1;
+}
+
+/**
+ * @function Conta
+ * @brief Incrementa un contatore della cache, che solo il thread proprietario modifica ma che può essere letto da StampaSlab
+ * @param cont indica il contatore
+ */
+static void Conta(unsigned long *cont){
+  __atomic_store_n(cont,__atomic_load_n(cont,__ATOMIC_RELAXED)+1,__ATOMIC_RELAXED);
+}
+
+/**
+ * @function Sposta
+ * @brief Sposta al più n blocchi di una classe da una lista ad un'altra
+ * @param da indica la lista di partenza
+ * @param nda indica il numero di blocchi della lista di partenza
+ * @param a indica la lista di arrivo
+ * @param na indica il numero di blocchi della lista di arrivo
+ * @param n indica il numero di blocchi da spostare
+ */
+static void Sposta(Blocco **da, int *nda, Blocco **a, int *na, int n){
+  while(n-- > 0 && *da!=NULL){
+    Blocco *b=*da;
+    *da=b->next;
+    b->next=*a;
+    *a=b;
+    (*nda)--;
+    (*na)++;
+  }
+}
+
+/**
+ * @function ChiudiCache
+ * @brief Sposta nel deposito i blocchi della cache di un thread che termina e la elimina
+ * @param arg indica la cache del thread
+ */
+static void ChiudiCache(void *arg){
+  Cache *t=arg;
+  pthread_mutex_lock(&mutex_slab);
+  for(int c=0;c<nclassi;c++)
+    Sposta(&(t->libero[c]),&(t->nliberi[c]),&deposito[c],&ndeposito[c],t->nliberi[c]);
+  hit_chiuse+=t->hit;
+  miss_chiuse+=t->miss;
+  //tolgo la cache dall'elenco di quelle attive
+  Cache **p=&cache;
+  while(*p!=NULL && *p!=t)
+    p=&((*p)->next);
+  if(*p!=NULL)
+    *p=t->next;
+  pthread_mutex_unlock(&mutex_slab);
+  free(t);
+}
+
+/**
+ * @function MiaCache
+ * @brief Restituisce la cache del thread chiamante, creandola al primo utilizzo
+ * @return un puntatore alla cache
+ */
+static Cache * MiaCache(){
+  Cache *t=pthread_getspecific(chiave);
+  if(t!=NULL)
+    return t;
+  SYSCALL_D(t, calloc(1,sizeof(Cache)), "calloc");
+  pthread_mutex_lock(&mutex_slab);
+  t->next=cache;
+  cache=t;
+  pthread_mutex_unlock(&mutex_slab);
+  pthread_setspecific(chiave,t);
+  return t;
+}
+
+/**
+ * @function CreaSlab
+ * @brief Inizializza l'allocatore, le classi vanno da SLAB_MIN byte fino alla dimensione di un messaggio testuale completo
+ * @param maxmsg indica la dimensione massima di un messaggio testuale
+ */
+void CreaSlab(size_t maxmsg){
+  //la classe più grande deve contenere un messaggio testuale con i suoi header, e almeno SLAB_MAX byte
+  size_t max=maxmsg+sizeof(message_hdr_t)+sizeof(message_data_hdr_t);
+  if(max<SLAB_MAX)
+    max=SLAB_MAX;
+  nclassi=1;
+  while(nclassi<MAX_CLASSI && Dimensione(nclassi-1)<max)
+    nclassi++;
+  for(int c=0;c<MAX_CLASSI;c++){
+    deposito[c]=NULL;
+    ndeposito[c]=0;
+  }
+  if(pthread_key_create(&chiave,ChiudiCache)!=0){
+    perror("pthread_key_create");
+    exit(-1);
+  }
+}
+
+/**
+ * @function Alloca
+ * @brief Alloca un blocco prendendolo dalla cache del thread, senza chiamare malloc se la cache ne contiene uno libero
+ * @param dim indica il numero di byte richiesti
+ * @return un puntatore al blocco allocato
+ */
+void * Alloca(size_t dim){
+  Cache *t=MiaCache();
+  Blocco *b;
+  int c=Classe(dim);
+  //i blocchi più grandi della classe più grande vengono allocati direttamente
+  if(c<0){
+    Conta(&(t->miss));
+    SYSCALL_D(b, malloc(sizeof(Blocco)+dim), "malloc");
+    b->classe=FUORI_CLASSE;
+    return b+1;
+  }
+  //se la cache è vuota provo a rifornirla dal deposito
+  if(t->libero[c]==NULL && __atomic_load_n(&ndeposito[c],__ATOMIC_RELAXED)>0){
+    pthread_mutex_lock(&mutex_slab);
+    Sposta(&deposito[c],&ndeposito[c],&(t->libero[c]),&(t->nliberi[c]),SLAB_LOTTO);
+    pthread_mutex_unlock(&mutex_slab);
+  }
+  if(t->libero[c]!=NULL){
+    Conta(&(t->hit));
+    b=t->libero[c];
+    t->libero[c]=b->next;
+    t->nliberi[c]--;
+    return b+1;
+  }
+  Conta(&(t->miss));
+  SYSCALL_D(b, malloc(sizeof(Blocco)+Dimensione(c)), "malloc");
+  b->classe=c;
+  return b+1;
+}
+
+/**
+ * @function Libera
+ * @brief Restituisce un blocco alla cache del thread che lo libera
+ * @param p indica il blocco da liberare, può essere NULL
+ */
+void Libera(void *p){
+  if(p==NULL) return;
+  Blocco *b=(Blocco*)p-1;
+  if(b->classe==FUORI_CLASSE){
+    free(b);
+    return;
+  }
+  Cache *t=MiaCache();
+  int c=b->classe;
+  b->next=t->libero[c];
+  t->libero[c]=b;
+  t->nliberi[c]++;
+  //la cache ha troppi blocchi di questa classe, ne sposto una parte nel deposito per gli altri thread
+  if(t->nliberi[c]>SLAB_CACHE){
+    pthread_mutex_lock(&mutex_slab);
+    Sposta(&(t->libero[c]),&(t->nliberi[c]),&deposito[c],&ndeposito[c],SLAB_LOTTO);
+    //il deposito non trattiene più di SLAB_DEPOSITO blocchi per classe, gli altri tornano al sistema
+    while(ndeposito[c]>SLAB_DEPOSITO){
+      Blocco *tmp=deposito[c];
+      deposito[c]=tmp->next;
+      ndeposito[c]--;
+      free(tmp);
+    }
+    pthread_mutex_unlock(&mutex_slab);
+  }
+}
+
+/**
+ * @function StampaSlab
+ * @brief Stampa su file i contatori dell'allocatore (richieste servite dalle cache e richieste passate a malloc)
+ * @param fp indica il file su cui stampare
+ */
+void StampaSlab(FILE *fp){
+  pthread_mutex_lock(&mutex_slab);
+  unsigned long hit=hit_chiuse, miss=miss_chiuse;
+  for(Cache *t=cache;t!=NULL;t=t->next){
+    hit+=__atomic_load_n(&(t->hit),__ATOMIC_RELAXED);
+    miss+=__atomic_load_n(&(t->miss),__ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&mutex_slab);
+  unsigned long tot=hit+miss;
+  fprintf(fp,"# slab %lu %lu %.1f%%\n",hit,miss,tot ? 100.0*hit/tot : 0.0);
+}
+
+/**
+ * @function DestroySlab
+ * @brief Libera tutti i blocchi conservati dall'allocatore, da chiamare dopo la terminazione degli altri thread
+ */
+void DestroySlab(){
+  //la cache del thread chiamante non viene chiusa automaticamente, dato che il thread non è ancora terminato
+  Cache *t=pthread_getspecific(chiave);
+  if(t!=NULL){
+    pthread_setspecific(chiave,NULL);
+    ChiudiCache(t);
+  }
+  for(int c=0;c<nclassi;c++){
+    while(deposito[c]!=NULL){
+      Blocco *b=deposito[c];
+      deposito[c]=b->next;
+      free(b);
+    }
+    ndeposito[c]=0;
+  }
+  pthread_key_delete(chiave);
+}
@@ -0,0 +1,51 @@
+/**
+ * @file slab.h
+ * @brief File per la gestione dell'allocatore a classi di dimensione usato nel percorso delle richieste
+ *
+ * Autore: Stefano Torneo 545261
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * @function CreaSlab
+ * @brief Inizializza l'allocatore, le classi vanno da SLAB_MIN byte fino alla dimensione di un messaggio testuale completo
+ * @param maxmsg indica la dimensione massima di un messaggio testuale
+ */
+void CreaSlab(size_t maxmsg);
+
+/**
+ * @function Alloca
+ * @brief Alloca un blocco prendendolo dalla cache del thread, senza chiamare malloc se la cache ne contiene uno libero
+ * @param dim indica il numero di byte richiesti
+ * @return un puntatore al blocco allocato
+ */
+void * Alloca(size_t dim);
+
+/**
+ * @function Libera
+ * @brief Restituisce un blocco alla cache del thread che lo libera
+ * @param p indica il blocco da liberare, può essere NULL
+ */
+void Libera(void *p);
+
+/**
+ * @function StampaSlab
+ * @brief Stampa su file i contatori dell'allocatore (richieste servite dalle cache e richieste passate a malloc)
+ * @param fp indica il file su cui stampare
+ */
+void StampaSlab(FILE *fp);
+
+/**
+ * @function DestroySlab
+ * @brief Libera tutti i blocchi conservati dall'allocatore, da chiamare dopo la terminazione degli altri thread
+ */
+void DestroySlab();
+
+#endif /* SLAB_H_ */
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <slab.h>
+#include <cachefile.h>
 
 
 /**
@@ -86,6 +88,9 @@ void StatFile(char *statfilename){
     perror(statfilename);
     return;
   }
+  //i contatori dell'allocatore e della cache dei file vengono stampati prima, l'ultima riga resta quella delle statistiche
+  StampaSlab(fp);
+  StampaCacheFile(fp);
   pthread_mutex_lock(&mutex_stat); //prendo la mutua-esclusione sulle statistiche
   printStats(fp);
   pthread_mutex_unlock(&mutex_stat); //rilascio la mutua-esclusione sulle statistiche
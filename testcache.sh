@@ -0,0 +1,50 @@
+#!/bin/bash
+
+if [[ $# != 1 ]]; then
+    echo "usa $0 unix_path"
+    exit 1
+fi
+
+# due versioni diverse di un file con lo stesso nome, e le directory in cui salvare i file scaricati
+tmp=/tmp/chatty_testcache
+rm -rf $tmp
+mkdir -p $tmp/vecchio $tmp/nuovo $tmp/scaricati1 $tmp/scaricati2
+cp ./client $tmp/vecchio/dato
+cp ./chatty $tmp/nuovo/dato
+
+# registro un po' di nickname
+./client -l $1 -c pippo &
+./client -l $1 -c pluto &
+wait
+
+# pippo manda la prima versione a pluto, che la scarica due volte: la seconda viene servita dalla cache
+./client -l $1 -k pippo -s $tmp/vecchio/dato:pluto
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -k pluto -p -o $tmp/scaricati1 -p -o $tmp/scaricati1
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+if [[ $(md5sum < $tmp/scaricati1/dato) != $(md5sum < $tmp/vecchio/dato) ]]; then
+    echo "la prima versione scaricata e' diversa da quella inviata"
+    exit 1
+fi
+
+# pippo sovrascrive il file con la seconda versione, che deve prendere il posto di quella nella cache
+./client -l $1 -k pippo -s $tmp/nuovo/dato:pluto
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -k pluto -p -o $tmp/scaricati2
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+if [[ $(md5sum < $tmp/scaricati2/dato) != $(md5sum < $tmp/nuovo/dato) ]]; then
+    echo "dopo la sovrascrittura e' stata scaricata la versione vecchia del file"
+    exit 1
+fi
+
+rm -rf $tmp
+echo "Test OK!"
+exit 0
@@ -0,0 +1,67 @@
+#!/bin/bash
+
+if [[ $# != 1 ]]; then
+    echo "usa $0 unix_path"
+    exit 1
+fi
+
+# controlla l'output di una richiesta -n: numero di messaggi ricevuti, ultimo messaggio e prossima sequenza attesi
+function controlla {
+    out=$(./client -l $1 -k pluto -n $2)
+    if [[ $? != 0 ]]; then
+        echo "Errore nella richiesta -n $2"
+        exit 1
+    fi
+    n=$(echo "$out" | grep -c "^\[pippo:\]")
+    if [[ $n != $3 ]]; then
+        echo "-n $2: ricevuti $n messaggi invece di $3"
+        exit 1
+    fi
+    if [[ $3 != 0 && $(echo "$out" | grep "^\[pippo:\]" | tail -1) != "[pippo:] $4" ]]; then
+        echo "-n $2: l'ultimo messaggio non e' '$4'"
+        exit 1
+    fi
+    if [[ $(echo "$out" | grep -c "^\[prossima sequenza: $5\]$") != 1 ]]; then
+        echo "-n $2: la prossima sequenza non e' $5"
+        exit 1
+    fi
+}
+
+# registro un po' di nickname
+./client -l $1 -c pippo &
+./client -l $1 -c pluto &
+wait
+
+# pippo manda tre messaggi a pluto, che hanno numeri di sequenza 0, 1 e 2
+./client -l $1 -k pippo -S "uno":pluto -S "due":pluto -S "tre":pluto
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+
+# da 0 ricevo tutta la history
+controlla $1 0 3 "tre" 3
+# da 1 ricevo solo i messaggi successivi al primo
+controlla $1 1 2 "tre" 3
+
+# altri due messaggi, con numeri di sequenza 3 e 4
+./client -l $1 -k pippo -S "quattro":pluto -S "cinque":pluto
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+
+# dalla sequenza restituita prima ricevo solo i messaggi nuovi
+controlla $1 3 2 "cinque" 5
+# con la sequenza attuale non ci sono messaggi nuovi
+controlla $1 5 0 "" 5
+# una sequenza maggiore di quella dell'utente (ad esempio di una registrazione precedente) restituisce tutta la history
+controlla $1 100 5 "cinque" 5
+
+# -p continua a restituire tutta la history
+n=$(./client -l $1 -k pluto -p | grep -c "^\[pippo:\]")
+if [[ $n != 5 ]]; then
+    echo "-p: ricevuti $n messaggi invece di 5"
+    exit 1
+fi
+
+echo "Test OK!"
+exit 0
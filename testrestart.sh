@@ -0,0 +1,80 @@
+#!/bin/bash
+
+if [[ $# != 2 ]]; then
+    echo "usa $0 unix_path prima|dopo"
+    exit 1
+fi
+
+OP_NICK_ALREADY=26
+OP_NICK_UNKNOWN=27
+
+# controlla che un comando del client fallisca con l'errore atteso
+function fallisce {
+    atteso=$1
+    shift
+    ./client -l $SOCK "$@"
+    e=$?
+    if [[ $((256-e)) != $atteso ]]; then
+        echo "$*: errore $e invece di $atteso"
+        exit 1
+    fi
+}
+
+# controlla l'output di una richiesta -p: numero di messaggi di un mittente e ultimo messaggio attesi
+function controlla {
+    out=$(./client -l $SOCK -k $1 -p)
+    if [[ $? != 0 ]]; then
+        echo "Errore nella richiesta -p di $1"
+        exit 1
+    fi
+    n=$(echo "$out" | grep -c "^\[$2:\]")
+    if [[ $n != $3 ]]; then
+        echo "-p di $1: ricevuti $n messaggi di $2 invece di $3"
+        exit 1
+    fi
+    if [[ $(echo "$out" | grep "^\[[a-z]*:\]" | tail -1) != "$4" ]]; then
+        echo "-p di $1: l'ultimo messaggio non e' '$4'"
+        exit 1
+    fi
+}
+
+SOCK=$1
+
+if [[ $2 == prima ]]; then
+    # registro gli utenti e creo un gruppo, che vengono salvati nel registro
+    ./client -l $SOCK -c pippo &
+    ./client -l $SOCK -c pluto &
+    ./client -l $SOCK -c minni &
+    wait
+    ./client -l $SOCK -k pippo -g gruppo1
+    if [[ $? != 0 ]]; then
+        exit 1
+    fi
+    ./client -l $SOCK -k pluto -a gruppo1
+    if [[ $? != 0 ]]; then
+        exit 1
+    fi
+    # i messaggi vengono salvati nell'archivio delle history
+    ./client -l $SOCK -k pippo -S "uno":pluto -S "due":pluto -S "al gruppo":gruppo1 -R 1
+    if [[ $? != 0 ]]; then
+        exit 1
+    fi
+    controlla pluto pippo 3 "[pippo:] al gruppo"
+else
+    # gli utenti e il gruppo sono stati ripristinati, non possono essere registrati di nuovo
+    fallisce $OP_NICK_ALREADY -c pippo
+    fallisce $OP_NICK_ALREADY -c pluto
+    fallisce $OP_NICK_ALREADY -k minni -g gruppo1
+    # la history salvata prima del riavvio viene recuperata
+    controlla pluto pippo 3 "[pippo:] al gruppo"
+    # il gruppo mantiene i suoi iscritti
+    fallisce $OP_NICK_UNKNOWN -k minni -S "non iscritta":gruppo1
+    ./client -l $SOCK -k pluto -S "dopo il riavvio":gruppo1
+    if [[ $? != 0 ]]; then
+        exit 1
+    fi
+    controlla pippo pluto 1 "[pluto:] dopo il riavvio"
+fi
+
+echo "Test OK!"
+exit 0